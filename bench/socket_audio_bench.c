@@ -0,0 +1,464 @@
+/*
+ * socket_audio_bench.c -- Load driver for mod_socket_audio
+ *
+ * Starts N loopback calls through ESL, each running socket_audio against the
+ * synthetic sidecar on the A leg and the echo application on the B leg, holds
+ * them for a measurement window and hangs them up. Reports, for the window:
+ *
+ * - CPU per call: FreeSWITCH user+system time over the window / calls
+ * - RSS per call: FreeSWITCH RSS growth from before the first call / calls
+ * - Playout pacing: the module's pace_error histogram (socket_audio_stats
+ *   delta), frames written, underruns
+ *
+ * End-to-end latency and mic arrival jitter are measured by the sidecar
+ * (socket_audio_sidecar) and printed when it exits.
+ *
+ * FreeSWITCH must run on this host (CPU and RSS come from /proc).
+ *
+ * Usage: socket_audio_bench [-H esl_host] [-P esl_port] [-w password]
+ *                           [-n calls] [-r calls_per_s] [-d seconds]
+ *                           [-t "socket_audio args"] [-e dialstring] [-v var=value]...
+ *                           [-p freeswitch_pid]
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_VARS            32
+#define BENCH_SETTLE_S            2        /* After the last call starts, before measuring */
+#define BENCH_PACE_BUCKETS        6
+
+static const char *bench_pace_names[BENCH_PACE_BUCKETS] = {
+    "lt_1ms", "lt_2ms", "lt_5ms", "lt_10ms", "lt_20ms", "ge_20ms"
+};
+
+typedef struct {
+    double pace[BENCH_PACE_BUCKETS];
+    double pace_error_us_total;
+    double pace_error_us_max;
+    double speaker_frames;
+    double mic_frames;
+    double underruns;
+    double concealed_frames;
+    double mic_drops;
+    double active_pipes;
+} bench_stats_t;
+
+typedef struct {
+    int fd;
+    char buf[65536];
+    size_t len;
+} esl_t;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Read one ESL message. Headers go to hdr, the body (Content-Length) to
+ * *body (malloc'd, NUL terminated; NULL if none). Returns 0 on EOF/error.
+ */
+static int esl_read(esl_t *esl, char *hdr, size_t hdr_size, char **body)
+{
+    char *end;
+    size_t hdr_len, body_len = 0;
+    const char *cl;
+
+    *body = NULL;
+    while (!(end = memmem(esl->buf, esl->len, "\n\n", 2))) {
+        ssize_t n;
+
+        if (esl->len == sizeof(esl->buf)) {
+            return 0;
+        }
+        if ((n = recv(esl->fd, esl->buf + esl->len, sizeof(esl->buf) - esl->len, 0)) <= 0) {
+            return 0;
+        }
+        esl->len += (size_t)n;
+    }
+
+    hdr_len = (size_t)(end - esl->buf) + 2;
+    if (hdr_len >= hdr_size) {
+        return 0;
+    }
+    memcpy(hdr, esl->buf, hdr_len);
+    hdr[hdr_len] = '\0';
+    memmove(esl->buf, esl->buf + hdr_len, esl->len - hdr_len);
+    esl->len -= hdr_len;
+
+    if ((cl = strstr(hdr, "Content-Length: "))) {
+        body_len = (size_t)strtoul(cl + 16, NULL, 10);
+    }
+    if (body_len) {
+        size_t have = 0;
+
+        if (!(*body = malloc(body_len + 1))) {
+            return 0;
+        }
+        while (have < body_len) {
+            size_t take = esl->len < body_len - have ? esl->len : body_len - have;
+            ssize_t n;
+
+            memcpy(*body + have, esl->buf, take);
+            memmove(esl->buf, esl->buf + take, esl->len - take);
+            esl->len -= take;
+            have += take;
+            if (have == body_len) {
+                break;
+            }
+            if ((n = recv(esl->fd, esl->buf, sizeof(esl->buf), 0)) <= 0) {
+                free(*body);
+                *body = NULL;
+                return 0;
+            }
+            esl->len = (size_t)n;
+        }
+        (*body)[body_len] = '\0';
+    }
+
+    return 1;
+}
+
+/*
+ * Send a command and return the body of its reply (api) or the Reply-Text
+ * header (everything else), malloc'd. NULL on connection error.
+ */
+static char *esl_command(esl_t *esl, const char *cmd)
+{
+    char hdr[4096], out[4096], *body, *reply;
+    int len = snprintf(out, sizeof(out), "%s\n\n", cmd), off = 0;
+
+    if (len < 0 || (size_t)len >= sizeof(out)) {
+        return NULL;
+    }
+    while (off < len) {
+        ssize_t n = send(esl->fd, out + off, (size_t)(len - off), MSG_NOSIGNAL);
+
+        if (n <= 0) {
+            return NULL;
+        }
+        off += (int)n;
+    }
+
+    for (;;) {
+        if (!esl_read(esl, hdr, sizeof(hdr), &body)) {
+            return NULL;
+        }
+        if (strstr(hdr, "Content-Type: api/response")) {
+            return body ? body : strdup("");
+        }
+        if (strstr(hdr, "Content-Type: command/reply")) {
+            const char *rt = strstr(hdr, "Reply-Text: ");
+
+            free(body);
+            if (!rt) {
+                return strdup("");
+            }
+            rt += 12;
+            reply = strndup(rt, strcspn(rt, "\n"));
+            return reply;
+        }
+        free(body);                   /* Events or logs we did not ask for */
+    }
+}
+
+static int esl_connect(esl_t *esl, const char *host, const char *port, const char *password)
+{
+    struct addrinfo hints, *res, *ai;
+    char hdr[4096], cmd[512], *body, *reply;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        return 0;
+    }
+    esl->fd = -1;
+    esl->len = 0;
+    for (ai = res; ai && esl->fd < 0; ai = ai->ai_next) {
+        if ((esl->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+            continue;
+        }
+        if (connect(esl->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(esl->fd);
+            esl->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (esl->fd < 0) {
+        return 0;
+    }
+
+    if (!esl_read(esl, hdr, sizeof(hdr), &body) || !strstr(hdr, "auth/request")) {
+        free(body);
+        return 0;
+    }
+    free(body);
+
+    snprintf(cmd, sizeof(cmd), "auth %s", password);
+    if (!(reply = esl_command(esl, cmd)) || strncmp(reply, "+OK", 3)) {
+        fprintf(stderr, "ESL auth failed: %s\n", reply ? reply : "connection closed");
+        free(reply);
+        return 0;
+    }
+    free(reply);
+
+    return 1;
+}
+
+/* "name":number anywhere in a flat or nested JSON text */
+static double json_number(const char *json, const char *name)
+{
+    char key[64];
+    const char *p;
+
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    if (!json || !(p = strstr(json, key))) {
+        return 0;
+    }
+
+    return strtod(p + strlen(key), NULL);
+}
+
+static int bench_stats(esl_t *esl, bench_stats_t *stats)
+{
+    char *json = esl_command(esl, "api socket_audio_stats");
+    int i;
+
+    if (!json || *json != '{') {
+        fprintf(stderr, "socket_audio_stats failed: %s\n", json ? json : "connection closed");
+        free(json);
+        return 0;
+    }
+    for (i = 0; i < BENCH_PACE_BUCKETS; i++) {
+        stats->pace[i] = json_number(json, bench_pace_names[i]);
+    }
+    stats->pace_error_us_total = json_number(json, "pace_error_us_total");
+    stats->pace_error_us_max = json_number(json, "pace_error_us_max");
+    stats->speaker_frames = json_number(json, "speaker_frames");
+    stats->mic_frames = json_number(json, "mic_frames");
+    stats->underruns = json_number(json, "underruns");
+    stats->concealed_frames = json_number(json, "concealed_frames");
+    stats->mic_drops = json_number(json, "mic_drops");
+    stats->active_pipes = json_number(json, "active_pipes");
+    free(json);
+
+    return 1;
+}
+
+static pid_t find_freeswitch(void)
+{
+    DIR *dir = opendir("/proc");
+    struct dirent *de;
+    pid_t pid = 0;
+
+    if (!dir) {
+        return 0;
+    }
+    while (!pid && (de = readdir(dir))) {
+        char path[300], comm[64];
+        FILE *f;
+
+        if (!isdigit((unsigned char)de->d_name[0])) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/comm", de->d_name);
+        if ((f = fopen(path, "r"))) {
+            if (fgets(comm, sizeof(comm), f) && !strcmp(comm, "freeswitch\n")) {
+                pid = (pid_t)atoi(de->d_name);
+            }
+            fclose(f);
+        }
+    }
+    closedir(dir);
+
+    return pid;
+}
+
+/* utime + stime of pid, in seconds */
+static double proc_cpu(pid_t pid)
+{
+    char path[64], line[1024], *p;
+    unsigned long long utime, stime;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if (!(f = fopen(path, "r"))) {
+        return 0;
+    }
+    p = fgets(line, sizeof(line), f);
+    fclose(f);
+    /* comm may contain spaces; fields resume after the last ')' */
+    if (!p || !(p = strrchr(line, ')')) ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        return 0;
+    }
+
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+/* VmRSS of pid, in kB */
+static double proc_rss_kb(pid_t pid)
+{
+    char path[64], line[256];
+    double kb = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    if (!(f = fopen(path, "r"))) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "VmRSS:", 6)) {
+            kb = strtod(line + 6, NULL);
+            break;
+        }
+    }
+    fclose(f);
+
+    return kb;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-H esl_host] [-P esl_port] [-w password] [-n calls] [-r calls_per_s]\n"
+            "          [-d seconds] [-t \"socket_audio args\"] [-e dialstring] [-v var=value]... [-p pid]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1", *port = "8021", *password = "ClueCon";
+    const char *target = "127.0.0.1 9000", *dialstring = "loopback/echo/default/inline";
+    const char *vars[BENCH_MAX_VARS];
+    uint32_t var_count = 0, calls = 10, rate = 10, duration = 30, i;
+    bench_stats_t before, after;
+    double cpu0, cpu1, rss0, rss1, window_s, frames, pace_total = 0;
+    char cmd[2048], chanvars[1024], *reply;
+    uint64_t started, t0, t1;
+    pid_t pid = 0;
+    esl_t esl;
+    int opt, b;
+
+    while ((opt = getopt(argc, argv, "H:P:w:n:r:d:t:e:v:p:h")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'P': port = optarg; break;
+        case 'w': password = optarg; break;
+        case 'n': calls = (uint32_t)atoi(optarg); break;
+        case 'r': rate = (uint32_t)atoi(optarg); break;
+        case 'd': duration = (uint32_t)atoi(optarg); break;
+        case 't': target = optarg; break;
+        case 'e': dialstring = optarg; break;
+        case 'v':
+            if (var_count < BENCH_MAX_VARS) {
+                vars[var_count++] = optarg;
+            }
+            break;
+        case 'p': pid = (pid_t)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!calls || !rate || !duration) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!pid && !(pid = find_freeswitch())) {
+        fprintf(stderr, "FreeSWITCH process not found (use -p)\n");
+        return 1;
+    }
+    if (!esl_connect(&esl, host, port, password)) {
+        fprintf(stderr, "Cannot connect to ESL at %s:%s\n", host, port);
+        return 1;
+    }
+
+    snprintf(chanvars, sizeof(chanvars), "socket_audio_bench=true,ignore_early_media=true");
+    for (i = 0; i < var_count; i++) {
+        size_t used = strlen(chanvars);
+
+        snprintf(chanvars + used, sizeof(chanvars) - used, ",%s", vars[i]);
+    }
+
+    rss0 = proc_rss_kb(pid);
+    if (!bench_stats(&esl, &before)) {
+        return 1;
+    }
+    if (before.active_pipes) {
+        fprintf(stderr, "Warning: %.0f pipes already active; per-call figures include them\n", before.active_pipes);
+    }
+
+    /* Ramp at the requested rate; bgapi so a slow originate never blocks the next */
+    printf("Starting %u calls at %u/s: %s -> socket_audio(%s)\n", calls, rate, dialstring, target);
+    fflush(stdout);
+    started = now_ms();
+    for (i = 0; i < calls; i++) {
+        uint64_t due = started + (uint64_t)i * 1000 / rate, now = now_ms();
+
+        if (due > now) {
+            usleep((useconds_t)(due - now) * 1000);
+        }
+        snprintf(cmd, sizeof(cmd), "bgapi originate {%s}%s &socket_audio(%s)", chanvars, dialstring, target);
+        if (!(reply = esl_command(&esl, cmd))) {
+            fprintf(stderr, "ESL connection lost while originating\n");
+            return 1;
+        }
+        free(reply);
+    }
+    sleep(BENCH_SETTLE_S);
+
+    /* Measurement window */
+    if (!bench_stats(&esl, &before)) {
+        return 1;
+    }
+    cpu0 = proc_cpu(pid);
+    t0 = now_ms();
+    sleep(duration);
+    t1 = now_ms();
+    cpu1 = proc_cpu(pid);
+    rss1 = proc_rss_kb(pid);
+    if (!bench_stats(&esl, &after)) {
+        return 1;
+    }
+
+    reply = esl_command(&esl, "api hupall NORMAL_CLEARING socket_audio_bench true");
+    free(reply);
+
+    window_s = (double)(t1 - t0) / 1000.0;
+    frames = after.speaker_frames - before.speaker_frames;
+    for (b = 0; b < BENCH_PACE_BUCKETS; b++) {
+        pace_total += after.pace[b] - before.pace[b];
+    }
+
+    printf("calls=%u active_pipes=%.0f window=%.1fs\n", calls, after.active_pipes, window_s);
+    printf("cpu_per_call=%.3f%% (freeswitch total %.1f%%)\n",
+           (cpu1 - cpu0) / window_s * 100.0 / calls, (cpu1 - cpu0) / window_s * 100.0);
+    printf("rss_per_call=%.0fkB (freeswitch %.0fkB -> %.0fkB)\n", (rss1 - rss0) / calls, rss0, rss1);
+    printf("speaker_frames=%.0f mic_frames=%.0f underruns=%.0f concealed_frames=%.0f mic_drops=%.0f\n",
+           frames, after.mic_frames - before.mic_frames, after.underruns - before.underruns,
+           after.concealed_frames - before.concealed_frames, after.mic_drops - before.mic_drops);
+    printf("pace_error:");
+    for (b = 0; b < BENCH_PACE_BUCKETS; b++) {
+        printf(" %s=%.2f%%", bench_pace_names[b],
+               pace_total ? (after.pace[b] - before.pace[b]) * 100.0 / pace_total : 0.0);
+    }
+    printf("\npace_error_us_avg=%.0f pace_error_us_max=%.0f (max is since load)\n",
+           pace_total ? (after.pace_error_us_total - before.pace_error_us_total) / pace_total : 0.0,
+           after.pace_error_us_max);
+
+    close(esl.fd);
+
+    return 0;
+}
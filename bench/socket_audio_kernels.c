@@ -0,0 +1,560 @@
+/*
+ * socket_audio_kernels.c -- Offline micro-benchmark of the mod_socket_audio media path
+ *
+ * Runs the per-frame kernels of socket_audio_core.c over 8k/16k/48k audio and
+ * reports ns per 20ms frame and frames per second per core:
+ *
+ * - resample_mic:     session rate -> 16k (mic path)
+ * - resample_mic_lite: the same with the cheaper filter used under load
+ * - resample_speaker: 24k -> session rate (speaker path)
+ * - g711_encode, g711_decode (mu-law)
+ * - vad_measure, peak
+ * - aec:              echo canceller, default 128ms tail, against a later frame
+ * - aec_lite:         the same suppression only, as under load
+ * - queue:            write one frame + peek/consume it (SPSC playback queue)
+ * - queue_toss:       write into a full queue (overflow) + read a frame
+ * - tap:              write one stereo frame into the recording tap + drain it
+ * - frame_header:     write + parse one framed protocol header
+ *
+ * Corpora are raw L16 mono files (-f path:rate, repeatable); without any, a
+ * synthetic speech-like signal (voiced harmonics, syllable envelope, pauses,
+ * low noise) is generated at each rate. Results can be saved (-o) and
+ * compared against a saved baseline (-b); with -t, a kernel more than that
+ * percentage slower than the baseline fails the run.
+ *
+ * Usage: socket_audio_kernels [-f file.raw:rate]... [-s seconds] [-m min_ms]
+ *                             [-o results] [-b baseline] [-t percent]
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "socket_audio_core.h"
+
+#define KERNELS_FRAME_MS          20
+#define KERNELS_MAX_CORPORA       8
+#define KERNELS_MAX_RESULTS       128
+#define KERNELS_MIC_RATE          16000
+#define KERNELS_SPEAKER_RATE      24000
+
+typedef struct {
+    char name[256];
+    uint32_t rate;
+    int16_t *pcm;
+    uint32_t samples;
+} kernels_corpus_t;
+
+typedef struct {
+    char kernel[32];
+    uint32_t rate;
+    double ns_per_frame;
+} kernels_result_t;
+
+typedef struct {
+    const kernels_corpus_t *corpus;
+    uint32_t frame_samples;
+    uint32_t frames;
+    int16_t *aux;                     /* Kernel-specific input (speaker-rate audio) */
+    uint32_t aux_frame_samples;
+    socket_audio_resampler_t *resampler;
+    socket_audio_queue_t *queue;
+    socket_audio_tap_t *tap;
+    socket_audio_aec_t *aec;
+    uint8_t *scratch;
+} kernels_ctx_t;
+
+typedef void (*kernels_func_t)(kernels_ctx_t *k, uint32_t frame);
+
+static volatile uint64_t kernels_sink;  /* Keeps results observable */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Speech-like test signal: a voiced source with a wandering pitch and three
+ * harmonics shaped by a ~4Hz syllable envelope, ~30% pauses, and noise at
+ * about -60 dBFS so the VAD and G.711 see realistic low-level content.
+ */
+static void corpus_synthesize(kernels_corpus_t *c, uint32_t rate, uint32_t seconds)
+{
+    uint32_t i, seed = 12345;
+    double phase = 0;
+
+    c->rate = rate;
+    c->samples = rate * seconds;
+    c->pcm = malloc(sizeof(int16_t) * c->samples);
+    snprintf(c->name, sizeof(c->name), "synthetic/%u", rate);
+
+    for (i = 0; i < c->samples; i++) {
+        double t = (double)i / rate;
+        double f0 = 140 + 40 * sin(2 * M_PI * 0.7 * t);
+        double env = sin(2 * M_PI * 2.0 * t);
+        double v, noise;
+
+        phase += 2 * M_PI * f0 / rate;
+        env = env > 0.3 ? env : 0;    /* Pauses between syllables */
+        v = env * (0.5 * sin(phase) + 0.3 * sin(2 * phase) + 0.15 * sin(3 * phase + 0.5));
+        seed = seed * 1664525 + 1013904223;
+        noise = ((int32_t)(seed >> 16) % 64 - 32) / 32768.0;
+        c->pcm[i] = (int16_t)lrint((v * 0.6 + noise) * 32767);
+    }
+}
+
+static int corpus_load(kernels_corpus_t *c, const char *spec)
+{
+    const char *colon = strrchr(spec, ':');
+    size_t path_len = colon ? (size_t)(colon - spec) : 0;
+    long size;
+    FILE *f;
+
+    if (!colon || path_len >= sizeof(c->name) || !(c->rate = (uint32_t)atoi(colon + 1))) {
+        fprintf(stderr, "Corpus must be path:rate, got %s\n", spec);
+        return 0;
+    }
+    memcpy(c->name, spec, path_len);
+    c->name[path_len] = '\0';
+
+    if (!(f = fopen(c->name, "rb"))) {
+        perror(c->name);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    c->samples = (uint32_t)(size / 2);
+    c->pcm = malloc(sizeof(int16_t) * (c->samples ? c->samples : 1));
+    if (fread(c->pcm, sizeof(int16_t), c->samples, f) != c->samples) {
+        fclose(f);
+        fprintf(stderr, "Short read on %s\n", c->name);
+        return 0;
+    }
+    fclose(f);
+
+    return 1;
+}
+
+static socket_audio_resampler_t *resampler_new(uint32_t from, uint32_t to, uint32_t max_in)
+{
+    socket_audio_resampler_t *r = malloc(sizeof(*r));
+
+    if (!socket_audio_resampler_plan(r, from, to, max_in)) {
+        free(r);
+        return NULL;
+    }
+    r->coefs = malloc(sizeof(int16_t) * r->up * r->taps);
+    if (r->taps_lite) {
+        r->coefs_lite = malloc(sizeof(int16_t) * r->up * r->taps_lite);
+    }
+    r->buf = malloc(sizeof(int16_t) * (r->taps - 1 + max_in));
+    r->out = malloc(sizeof(int16_t) * r->out_cap);
+    socket_audio_resampler_design(r);
+
+    return r;
+}
+
+static void resampler_free(socket_audio_resampler_t *r)
+{
+    if (r) {
+        free(r->coefs);
+        free(r->coefs_lite);
+        free(r->buf);
+        free(r->out);
+        free(r);
+    }
+}
+
+/* Whole-corpus conversion, to feed the speaker-path kernel */
+static int16_t *corpus_resample(const kernels_corpus_t *c, uint32_t to, uint32_t *out_samples)
+{
+    uint32_t block = c->rate * KERNELS_FRAME_MS / 1000, cap = (uint32_t)((uint64_t)c->samples * to / c->rate) + 64;
+    socket_audio_resampler_t *r;
+    int16_t *out = malloc(sizeof(int16_t) * cap);
+    uint32_t i, len = 0;
+
+    if (c->rate == to) {
+        memcpy(out, c->pcm, sizeof(int16_t) * c->samples);
+        *out_samples = c->samples;
+        return out;
+    }
+    if (!(r = resampler_new(c->rate, to, block))) {
+        free(out);
+        return NULL;
+    }
+    for (i = 0; i + block <= c->samples; i += block) {
+        uint32_t got;
+
+        socket_audio_resample_begin(r, c->pcm + i, block);
+        while ((got = socket_audio_resample_emit(r, out + len, cap - len))) {
+            len += got;
+        }
+    }
+    resampler_free(r);
+    *out_samples = len;
+
+    return out;
+}
+
+/*
+ * Kernels: one frame each
+ */
+static void kernel_resample_mic(kernels_ctx_t *k, uint32_t frame)
+{
+    socket_audio_resampler_t *r = k->resampler;
+    uint32_t got;
+
+    socket_audio_resample_begin(r, k->corpus->pcm + frame * k->frame_samples, k->frame_samples);
+    while ((got = socket_audio_resample_emit(r, r->out, r->out_cap))) {
+        kernels_sink += (uint64_t)r->out[got - 1];
+    }
+}
+
+static void kernel_resample_speaker(kernels_ctx_t *k, uint32_t frame)
+{
+    socket_audio_resampler_t *r = k->resampler;
+    uint32_t got;
+
+    socket_audio_resample_begin(r, k->aux + frame * k->aux_frame_samples, k->aux_frame_samples);
+    while ((got = socket_audio_resample_emit(r, r->out, r->out_cap))) {
+        kernels_sink += (uint64_t)r->out[got - 1];
+    }
+}
+
+static void kernel_g711_encode(kernels_ctx_t *k, uint32_t frame)
+{
+    socket_audio_g711_encode(SOCKET_AUDIO_ENC_PCMU, k->corpus->pcm + frame * k->frame_samples, k->scratch, k->frame_samples);
+    kernels_sink += k->scratch[0];
+}
+
+static void kernel_g711_decode(kernels_ctx_t *k, uint32_t frame)
+{
+    int16_t *out = (int16_t *)(k->scratch + k->frame_samples);
+
+    socket_audio_g711_decode(SOCKET_AUDIO_ENC_PCMU, (const uint8_t *)(k->corpus->pcm + frame * k->frame_samples),
+                             out, k->frame_samples);
+    kernels_sink += (uint64_t)out[0];
+}
+
+static void kernel_vad_measure(kernels_ctx_t *k, uint32_t frame)
+{
+    uint32_t crossings;
+
+    kernels_sink += socket_audio_vad_measure(k->corpus->pcm + frame * k->frame_samples, k->frame_samples, &crossings);
+    kernels_sink += crossings;
+}
+
+static void kernel_peak(kernels_ctx_t *k, uint32_t frame)
+{
+    kernels_sink += (uint64_t)socket_audio_peak(k->corpus->pcm + frame * k->frame_samples, k->frame_samples);
+}
+
+static void kernel_aec(kernels_ctx_t *k, uint32_t frame)
+{
+    const int16_t *ref = k->corpus->pcm + ((frame + 1) % k->frames) * k->frame_samples;
+
+    kernels_sink += (uint64_t)socket_audio_aec_process(k->aec, k->corpus->pcm + frame * k->frame_samples, ref,
+                                                       k->frame_samples)[0];
+}
+
+static void kernel_queue(kernels_ctx_t *k, uint32_t frame)
+{
+    size_t bytes = k->frame_samples * sizeof(int16_t), tossed;
+    uint8_t *p;
+
+    socket_audio_queue_write(k->queue, k->corpus->pcm + frame * k->frame_samples, bytes, &tossed);
+    if ((p = socket_audio_queue_peek(k->queue, bytes))) {
+        kernels_sink += p[0];
+        socket_audio_queue_consume(k->queue, bytes);
+    } else {
+        kernels_sink += socket_audio_queue_read(k->queue, k->scratch, bytes);
+    }
+}
+
+static void kernel_queue_toss(kernels_ctx_t *k, uint32_t frame)
+{
+    size_t bytes = k->frame_samples * sizeof(int16_t), tossed;
+
+    /* Two frames in, one out: the queue stays at its limit and every write tosses */
+    socket_audio_queue_write(k->queue, k->corpus->pcm + frame * k->frame_samples, bytes, &tossed);
+    socket_audio_queue_write(k->queue, k->corpus->pcm + frame * k->frame_samples, bytes, &tossed);
+    kernels_sink += tossed + socket_audio_queue_read(k->queue, k->scratch, bytes);
+}
+
+static void kernel_tap(kernels_ctx_t *k, uint32_t frame)
+{
+    const int16_t *pcm = k->corpus->pcm + frame * k->frame_samples;
+    const int16_t *played = k->corpus->pcm + ((frame + 1) % k->frames) * k->frame_samples;
+    const uint8_t *p;
+    size_t len;
+
+    kernels_sink += socket_audio_tap_write_stereo(k->tap, pcm, played, k->frame_samples);
+    while ((len = socket_audio_tap_peek(k->tap, &p))) {
+        kernels_sink += p[len - 1];
+        socket_audio_tap_consume(k->tap, len);
+    }
+}
+
+static void kernel_frame_header(kernels_ctx_t *k, uint32_t frame)
+{
+    uint8_t type, flags;
+    uint32_t len, seq;
+
+    socket_audio_frame_header(k->scratch, SOCKET_AUDIO_MSG_AUDIO, (uint16_t)(k->frame_samples * 2), frame);
+    socket_audio_frame_parse(k->scratch, &type, &flags, &len, &seq);
+    kernels_sink += type + len + seq;
+}
+
+/*
+ * Run func over every frame of the corpus until at least min_ms has passed;
+ * returns ns per frame.
+ */
+static double kernels_time(kernels_func_t func, kernels_ctx_t *k, uint32_t min_ms)
+{
+    uint64_t frames = 0, start = now_ns(), elapsed;
+    uint32_t i;
+
+    /* Warm caches and branch predictors on one pass first */
+    for (i = 0; i < k->frames; i++) {
+        func(k, i);
+    }
+
+    start = now_ns();
+    do {
+        for (i = 0; i < k->frames; i++) {
+            func(k, i);
+        }
+        frames += k->frames;
+        elapsed = now_ns() - start;
+    } while (elapsed < (uint64_t)min_ms * 1000000);
+
+    return (double)elapsed / (double)frames;
+}
+
+static void kernels_report(kernels_result_t *results, uint32_t *count, const char *kernel, uint32_t rate, double ns)
+{
+    printf("%-18s %6u %12.1f %14.0f\n", kernel, rate, ns, 1e9 / ns);
+    if (*count < KERNELS_MAX_RESULTS) {
+        snprintf(results[*count].kernel, sizeof(results[*count].kernel), "%s", kernel);
+        results[*count].rate = rate;
+        results[*count].ns_per_frame = ns;
+        (*count)++;
+    }
+}
+
+static void run_corpus(const kernels_corpus_t *c, uint32_t min_ms, kernels_result_t *results, uint32_t *count)
+{
+    kernels_ctx_t k;
+    socket_audio_queue_t queue;
+    socket_audio_tap_t tap;
+    socket_audio_aec_t aec;
+    size_t frame_bytes;
+
+    memset(&k, 0, sizeof(k));
+    k.corpus = c;
+    k.frame_samples = c->rate * KERNELS_FRAME_MS / 1000;
+    k.frames = c->samples / k.frame_samples;
+    frame_bytes = k.frame_samples * sizeof(int16_t);
+    k.scratch = malloc(frame_bytes * 3 + SOCKET_AUDIO_FRAME_HEADER_LEN);
+    if (!k.frames) {
+        fprintf(stderr, "%s: shorter than one frame, skipped\n", c->name);
+        free(k.scratch);
+        return;
+    }
+
+    if (c->rate != KERNELS_MIC_RATE && (k.resampler = resampler_new(c->rate, KERNELS_MIC_RATE, k.frame_samples))) {
+        kernels_report(results, count, "resample_mic", c->rate, kernels_time(kernel_resample_mic, &k, min_ms));
+        if (k.resampler->taps_lite) {
+            k.resampler->lite = 1;
+            kernels_report(results, count, "resample_mic_lite", c->rate, kernels_time(kernel_resample_mic, &k, min_ms));
+        }
+        resampler_free(k.resampler);
+    }
+
+    if (c->rate != KERNELS_SPEAKER_RATE) {
+        uint32_t aux_samples;
+
+        k.aux_frame_samples = KERNELS_SPEAKER_RATE * KERNELS_FRAME_MS / 1000;
+        if ((k.aux = corpus_resample(c, KERNELS_SPEAKER_RATE, &aux_samples)) &&
+            (k.resampler = resampler_new(KERNELS_SPEAKER_RATE, c->rate, k.aux_frame_samples))) {
+            uint32_t frames = k.frames;
+
+            if (aux_samples / k.aux_frame_samples < k.frames) {
+                k.frames = aux_samples / k.aux_frame_samples;
+            }
+            kernels_report(results, count, "resample_speaker", c->rate, kernels_time(kernel_resample_speaker, &k, min_ms));
+            k.frames = frames;
+            resampler_free(k.resampler);
+        }
+        free(k.aux);
+        k.aux = NULL;
+    }
+
+    kernels_report(results, count, "g711_encode", c->rate, kernels_time(kernel_g711_encode, &k, min_ms));
+    kernels_report(results, count, "g711_decode", c->rate, kernels_time(kernel_g711_decode, &k, min_ms));
+    kernels_report(results, count, "vad_measure", c->rate, kernels_time(kernel_vad_measure, &k, min_ms));
+    kernels_report(results, count, "peak", c->rate, kernels_time(kernel_peak, &k, min_ms));
+
+    /* The module's default tail and suppression */
+    socket_audio_aec_plan(&aec, c->rate, 128, k.frame_samples);
+    aec.w = malloc(aec.taps * sizeof(float));
+    aec.buf = malloc((aec.taps + aec.max_in) * sizeof(float));
+    aec.out = malloc(aec.max_in * sizeof(int16_t));
+    socket_audio_aec_reset(&aec, 18.0);
+    k.aec = &aec;
+    kernels_report(results, count, "aec", c->rate, kernels_time(kernel_aec, &k, min_ms));
+    aec.lite = 1;
+    kernels_report(results, count, "aec_lite", c->rate, kernels_time(kernel_aec, &k, min_ms));
+    free(aec.w);
+    free(aec.buf);
+    free(aec.out);
+
+    /* Segments of 25 frames and a 90s limit, as the module sizes them */
+    socket_audio_queue_init(&queue, frame_bytes * 25, frame_bytes * 50 * 90, frame_bytes * 50);
+    k.queue = &queue;
+    kernels_report(results, count, "queue", c->rate, kernels_time(kernel_queue, &k, min_ms));
+    socket_audio_queue_destroy(&queue);
+
+    socket_audio_queue_init(&queue, frame_bytes * 25, frame_bytes * 10, frame_bytes * 50);
+    kernels_report(results, count, "queue_toss", c->rate, kernels_time(kernel_queue_toss, &k, min_ms));
+    socket_audio_queue_destroy(&queue);
+
+    /* A 4s ring, as the module sizes it by default */
+    if (!socket_audio_tap_init(&tap, frame_bytes * 2 * 50 * 4)) {
+        k.tap = &tap;
+        kernels_report(results, count, "tap", c->rate, kernels_time(kernel_tap, &k, min_ms));
+        socket_audio_tap_destroy(&tap);
+    }
+
+    kernels_report(results, count, "frame_header", c->rate, kernels_time(kernel_frame_header, &k, min_ms));
+
+    free(k.scratch);
+}
+
+static int results_save(const char *path, const kernels_result_t *results, uint32_t count)
+{
+    FILE *f = fopen(path, "w");
+    uint32_t i;
+
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        fprintf(f, "%s %u %.3f\n", results[i].kernel, results[i].rate, results[i].ns_per_frame);
+    }
+    fclose(f);
+
+    return 1;
+}
+
+/*
+ * Compare against a saved baseline. Returns the number of kernels slower by
+ * more than threshold percent (threshold < 0: report only).
+ */
+static int results_compare(const char *path, const kernels_result_t *results, uint32_t count, double threshold)
+{
+    char kernel[32];
+    unsigned rate;
+    double ns;
+    int regressions = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    printf("\n%-18s %6s %12s %12s %8s\n", "vs baseline", "rate", "base ns", "now ns", "change");
+    while (fscanf(f, "%31s %u %lf", kernel, &rate, &ns) == 3) {
+        uint32_t i;
+
+        for (i = 0; i < count; i++) {
+            if (!strcmp(results[i].kernel, kernel) && results[i].rate == rate) {
+                double change = (results[i].ns_per_frame - ns) * 100.0 / ns;
+                int bad = threshold >= 0 && change > threshold;
+
+                printf("%-18s %6u %12.1f %12.1f %+7.1f%%%s\n", kernel, rate, ns, results[i].ns_per_frame, change,
+                       bad ? "  REGRESSION" : "");
+                regressions += bad;
+                break;
+            }
+        }
+    }
+    fclose(f);
+
+    return regressions;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-f file.raw:rate]... [-s seconds] [-m min_ms] [-o results] [-b baseline] [-t percent]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t synthetic_rates[] = { 8000, 16000, 48000 };
+    kernels_corpus_t corpora[KERNELS_MAX_CORPORA];
+    kernels_result_t results[KERNELS_MAX_RESULTS];
+    uint32_t corpus_count = 0, result_count = 0, seconds = 10, min_ms = 300, i;
+    const char *save = NULL, *baseline = NULL;
+    double threshold = -1;
+    int opt, regressions = 0;
+
+    memset(corpora, 0, sizeof(corpora));
+    while ((opt = getopt(argc, argv, "f:s:m:o:b:t:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            if (corpus_count < KERNELS_MAX_CORPORA && !corpus_load(&corpora[corpus_count++], optarg)) {
+                return 1;
+            }
+            break;
+        case 's': seconds = (uint32_t)atoi(optarg); break;
+        case 'm': min_ms = (uint32_t)atoi(optarg); break;
+        case 'o': save = optarg; break;
+        case 'b': baseline = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!corpus_count) {
+        for (i = 0; i < sizeof(synthetic_rates) / sizeof(synthetic_rates[0]); i++) {
+            corpus_synthesize(&corpora[corpus_count++], synthetic_rates[i], seconds ? seconds : 1);
+        }
+    }
+
+    printf("Dot product kernel: %s\n", socket_audio_resample_init());
+    printf("Echo canceller kernel: %s\n", socket_audio_aec_init());
+    socket_audio_g711_init();
+
+    for (i = 0; i < corpus_count; i++) {
+        printf("\n%s (%u Hz, %.1fs, %ums frames)\n", corpora[i].name, corpora[i].rate,
+               (double)corpora[i].samples / corpora[i].rate, KERNELS_FRAME_MS);
+        printf("%-18s %6s %12s %14s\n", "kernel", "rate", "ns/frame", "frames/s/core");
+        run_corpus(&corpora[i], min_ms, results, &result_count);
+        free(corpora[i].pcm);
+    }
+
+    if (save && !results_save(save, results, result_count)) {
+        return 1;
+    }
+    if (baseline && (regressions = results_compare(baseline, results, result_count, threshold)) < 0) {
+        return 1;
+    }
+    if (regressions) {
+        printf("\n%d kernel(s) regressed by more than %.1f%%\n", regressions, threshold);
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,657 @@
+/*
+ * socket_audio_sidecar.c -- Synthetic sidecar for mod_socket_audio load tests
+ *
+ * Accepts any number of socket_audio connections on one epoll loop and plays
+ * a paced speaker stream into each: silence with a short full-scale marker
+ * burst every interval. With the call looped back through the FreeSWITCH
+ * echo application (see socket_audio_bench), each marker returns on the same
+ * connection's mic stream, and the time between sending its first sample and
+ * receiving it is the end-to-end latency: sidecar -> playback queue ->
+ * playout -> call -> media bug -> sidecar.
+ *
+ * Also measures mic frame inter-arrival error (framed mode, where each
+ * message is one frame) and prints a report every few seconds and on exit
+ * (SIGINT/SIGTERM).
+ *
+ * Usage: socket_audio_sidecar [-l host:port | -u path] [-m raw|framed]
+ *                             [-a marker|echo] [-i interval_ms]
+ *                             [-r mic_rate] [-s speaker_rate] [-R report_s]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIDECAR_CHUNK_MS          20       /* Speaker audio is sent in chunks this long */
+#define SIDECAR_MARKER_MS         10       /* Marker burst length */
+#define SIDECAR_MARKER_AMPLITUDE  24000
+#define SIDECAR_MARKER_HZ         1000
+#define SIDECAR_DETECT_LEVEL      6000     /* Mic sample magnitude that counts as a marker */
+#define SIDECAR_MAX_EVENTS        256
+#define SIDECAR_RX_BUF            65536
+#define SIDECAR_HIST_MS           2000     /* Latency histogram: 1ms bins up to this */
+#define SIDECAR_JITTER_US         20000    /* Jitter histogram: 100us bins up to this */
+#define SIDECAR_JITTER_BIN_US     100
+
+#define MSG_HEADER_LEN            8
+#define MSG_AUDIO                 0x01
+
+typedef enum {
+    SIDECAR_MARKER,
+    SIDECAR_ECHO
+} sidecar_action_t;
+
+typedef struct sidecar_conn_s {
+    int fd;
+    uint8_t hdr[MSG_HEADER_LEN];      /* Framed: partial header */
+    uint32_t hdr_len;
+    uint32_t body_left;               /* Framed: payload bytes still to come */
+    uint8_t body_audio;               /* Framed: current payload is mic audio */
+    uint8_t odd;                      /* Raw: a sample straddles two reads */
+    uint8_t odd_byte;
+
+    uint64_t speaker_samples;         /* Sent so far, drives the marker schedule */
+    uint64_t marker_sent_ns;          /* First marker sample handed to the kernel, 0 = none in flight */
+    uint64_t quiet_samples;           /* Mic samples since the last loud one */
+    uint64_t last_frame_ns;           /* Framed: arrival of the previous mic frame */
+    uint64_t last_frame_us;           /* Its duration */
+    struct sidecar_conn_s *prev;
+    struct sidecar_conn_s *next;      /* Live list, or the dead list once closed */
+} sidecar_conn_t;
+
+static struct {
+    int framed;
+    sidecar_action_t action;
+    uint32_t interval_ms;
+    uint32_t mic_rate;
+    uint32_t speaker_rate;
+    uint32_t report_s;
+
+    sidecar_conn_t *conns;
+    sidecar_conn_t *dead;             /* Closed this epoll batch; freed after it */
+    uint32_t conn_count;
+    uint32_t conn_peak;
+    uint64_t accepted;
+
+    uint64_t mic_bytes;
+    uint64_t mic_frames;
+    uint64_t speaker_bytes;
+    uint64_t speaker_drops;           /* Chunks not sent: socket buffer full */
+    uint64_t markers_sent;
+    uint64_t markers_seen;
+    uint64_t latency_hist[SIDECAR_HIST_MS + 1];
+    uint64_t jitter_hist[SIDECAR_JITTER_US / SIDECAR_JITTER_BIN_US + 1];
+    uint64_t jitter_total_us;
+
+    volatile sig_atomic_t stop;
+} g;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+    g.stop = 1;
+}
+
+/*
+ * Value at percentile pct of a histogram with bins of width bin.
+ */
+static uint64_t hist_percentile(const uint64_t *hist, uint32_t bins, uint64_t total, double pct, uint64_t bin)
+{
+    uint64_t want = (uint64_t)ceil((double)total * pct / 100.0), seen = 0;
+    uint32_t i;
+
+    for (i = 0; i < bins; i++) {
+        seen += hist[i];
+        if (seen >= want && seen) {
+            return (uint64_t)i * bin;
+        }
+    }
+
+    return (uint64_t)(bins - 1) * bin;
+}
+
+static void report(const char *tag)
+{
+    uint32_t jitter_bins = SIDECAR_JITTER_US / SIDECAR_JITTER_BIN_US + 1;
+    uint64_t jitter_count = 0;
+    uint32_t i;
+
+    for (i = 0; i < jitter_bins; i++) {
+        jitter_count += g.jitter_hist[i];
+    }
+
+    printf("[%s] conns=%u peak=%u accepted=%llu mic_frames=%llu mic_bytes=%llu speaker_bytes=%llu speaker_drops=%llu\n",
+           tag, g.conn_count, g.conn_peak, (unsigned long long)g.accepted,
+           (unsigned long long)g.mic_frames, (unsigned long long)g.mic_bytes,
+           (unsigned long long)g.speaker_bytes, (unsigned long long)g.speaker_drops);
+
+    if (g.markers_seen) {
+        printf("[%s] latency_ms markers=%llu/%llu p50=%llu p90=%llu p99=%llu max=%llu\n", tag,
+               (unsigned long long)g.markers_seen, (unsigned long long)g.markers_sent,
+               (unsigned long long)hist_percentile(g.latency_hist, SIDECAR_HIST_MS + 1, g.markers_seen, 50, 1),
+               (unsigned long long)hist_percentile(g.latency_hist, SIDECAR_HIST_MS + 1, g.markers_seen, 90, 1),
+               (unsigned long long)hist_percentile(g.latency_hist, SIDECAR_HIST_MS + 1, g.markers_seen, 99, 1),
+               (unsigned long long)hist_percentile(g.latency_hist, SIDECAR_HIST_MS + 1, g.markers_seen, 100, 1));
+    } else if (g.action == SIDECAR_MARKER) {
+        printf("[%s] latency_ms markers=0/%llu (none returned yet)\n", tag, (unsigned long long)g.markers_sent);
+    }
+
+    if (jitter_count) {
+        printf("[%s] mic_jitter_us frames=%llu avg=%llu p50=%llu p99=%llu max=%llu\n", tag,
+               (unsigned long long)jitter_count, (unsigned long long)(g.jitter_total_us / jitter_count),
+               (unsigned long long)hist_percentile(g.jitter_hist, jitter_bins, jitter_count, 50, SIDECAR_JITTER_BIN_US),
+               (unsigned long long)hist_percentile(g.jitter_hist, jitter_bins, jitter_count, 99, SIDECAR_JITTER_BIN_US),
+               (unsigned long long)hist_percentile(g.jitter_hist, jitter_bins, jitter_count, 100, SIDECAR_JITTER_BIN_US));
+    }
+
+    fflush(stdout);
+}
+
+/*
+ * Close now, free after the current epoll batch (later events in it may
+ * still point at the connection).
+ */
+static void conn_close(int ep, sidecar_conn_t *conn)
+{
+    epoll_ctl(ep, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        g.conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    g.conn_count--;
+    conn->next = g.dead;
+    g.dead = conn;
+}
+
+static void conn_reap(void)
+{
+    while (g.dead) {
+        sidecar_conn_t *conn = g.dead;
+
+        g.dead = conn->next;
+        free(conn);
+    }
+}
+
+/*
+ * Send all of buf or nothing: a sidecar that cannot keep up drops whole
+ * chunks rather than splitting samples. Returns 0 if the peer is gone.
+ */
+static int conn_send(sidecar_conn_t *conn, const uint8_t *buf, size_t len)
+{
+    ssize_t n = send(conn->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            g.speaker_drops++;
+            return 1;
+        }
+        return 0;
+    }
+    if ((size_t)n < len) {
+        /* Keep sample alignment: finish the chunk blocking (rare, small) */
+        size_t off = (size_t)n;
+
+        while (off < len) {
+            n = send(conn->fd, buf + off, len - off, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return 0;
+            }
+            off += (size_t)n;
+        }
+    }
+    g.speaker_bytes += len;
+
+    return 1;
+}
+
+static void frame_header(uint8_t *p, uint8_t type, uint16_t len, uint32_t seq)
+{
+    p[0] = type;
+    p[1] = 0;
+    p[2] = (uint8_t)(len >> 8);
+    p[3] = (uint8_t)len;
+    p[4] = (uint8_t)(seq >> 24);
+    p[5] = (uint8_t)(seq >> 16);
+    p[6] = (uint8_t)(seq >> 8);
+    p[7] = (uint8_t)seq;
+}
+
+/*
+ * One chunk of marker-mode speaker audio: silence, with a marker burst at the
+ * start of every interval.
+ */
+static int conn_speak(sidecar_conn_t *conn, uint64_t now)
+{
+    uint32_t samples = g.speaker_rate * SIDECAR_CHUNK_MS / 1000;
+    uint32_t marker = g.speaker_rate * SIDECAR_MARKER_MS / 1000;
+    uint64_t period = (uint64_t)g.speaker_rate * g.interval_ms / 1000;
+    uint8_t buf[MSG_HEADER_LEN + 48000 * SIDECAR_CHUNK_MS / 1000 * 2];
+    int16_t *pcm = (int16_t *)(buf + MSG_HEADER_LEN);
+    uint64_t start = conn->speaker_samples;
+    int has_marker = 0;
+    uint32_t i;
+
+    for (i = 0; i < samples; i++) {
+        uint64_t pos = (start + i) % period;
+
+        if (pos < marker) {
+            /* 1kHz survives resampling to and from any session rate >= 8k */
+            pcm[i] = (int16_t)(SIDECAR_MARKER_AMPLITUDE * sin(2 * M_PI * SIDECAR_MARKER_HZ * (double)pos / g.speaker_rate));
+            if (pos == 0) {
+                has_marker = 1;
+            }
+        } else {
+            pcm[i] = 0;
+        }
+    }
+
+    if (g.framed) {
+        frame_header(buf, MSG_AUDIO, (uint16_t)(samples * 2), 0);
+    }
+    if (!conn_send(conn, g.framed ? buf : buf + MSG_HEADER_LEN, (g.framed ? MSG_HEADER_LEN : 0) + samples * 2)) {
+        return 0;
+    }
+
+    conn->speaker_samples += samples;
+    if (has_marker) {
+        /* One marker in flight at a time: an unanswered one is written off */
+        conn->marker_sent_ns = now;
+        g.markers_sent++;
+    }
+
+    return 1;
+}
+
+/*
+ * Scan mic samples for a marker onset: a loud sample after at least half an
+ * interval of quiet. The onset time is the arrival time backed off by the
+ * samples that followed it in this read.
+ */
+static void conn_listen(sidecar_conn_t *conn, const int16_t *pcm, uint32_t samples, uint64_t now)
+{
+    uint64_t quiet = (uint64_t)g.mic_rate * g.interval_ms / 2000;
+    uint32_t i;
+
+    for (i = 0; i < samples; i++) {
+        if (pcm[i] > SIDECAR_DETECT_LEVEL || pcm[i] < -SIDECAR_DETECT_LEVEL) {
+            if (conn->quiet_samples >= quiet && conn->marker_sent_ns) {
+                uint64_t onset = now - (uint64_t)(samples - i) * 1000000000ULL / g.mic_rate;
+                uint64_t ms = onset > conn->marker_sent_ns ? (onset - conn->marker_sent_ns) / 1000000 : 0;
+
+                g.latency_hist[ms < SIDECAR_HIST_MS ? ms : SIDECAR_HIST_MS]++;
+                g.markers_seen++;
+                conn->marker_sent_ns = 0;
+            }
+            conn->quiet_samples = 0;
+        } else {
+            conn->quiet_samples++;
+        }
+    }
+}
+
+static void conn_mic(sidecar_conn_t *conn, const uint8_t *data, size_t len, uint64_t now)
+{
+    int16_t pcm[SIDECAR_RX_BUF / 2 + 1];
+    uint32_t n = 0;
+
+    g.mic_bytes += len;
+
+    if (g.action == SIDECAR_ECHO) {
+        if (g.framed) {
+            static uint8_t msg[MSG_HEADER_LEN + 65535];
+
+            /* Each payload piece goes back as its own AUDIO message, header
+             * and body in one send so a drop never splits them */
+            frame_header(msg, MSG_AUDIO, (uint16_t)len, 0);
+            memcpy(msg + MSG_HEADER_LEN, data, len);
+            conn_send(conn, msg, MSG_HEADER_LEN + len);
+        } else {
+            conn_send(conn, data, len);
+        }
+        return;
+    }
+
+    /* Reassemble samples (raw reads may split one) */
+    if (conn->odd && len) {
+        uint8_t pair[2] = { conn->odd_byte, data[0] };
+
+        memcpy(&pcm[n++], pair, 2);
+        data++;
+        len--;
+        conn->odd = 0;
+    }
+    memcpy(&pcm[n], data, len & ~(size_t)1);
+    n += (uint32_t)(len / 2);
+    if (len & 1) {
+        conn->odd = 1;
+        conn->odd_byte = data[len - 1];
+    }
+
+    conn_listen(conn, pcm, n, now);
+}
+
+/*
+ * Framed mode: one mic frame arrived whole; record how far its arrival was
+ * from one frame duration after the previous one.
+ */
+static void conn_frame_done(sidecar_conn_t *conn, uint32_t bytes, uint64_t now)
+{
+    uint64_t frame_us = (uint64_t)bytes / 2 * 1000000 / g.mic_rate;
+
+    g.mic_frames++;
+    if (conn->last_frame_ns) {
+        int64_t gap_us = (int64_t)((now - conn->last_frame_ns) / 1000);
+        int64_t err = gap_us - (int64_t)conn->last_frame_us;
+        uint64_t abs_err = (uint64_t)(err < 0 ? -err : err);
+        uint64_t bin = abs_err / SIDECAR_JITTER_BIN_US;
+
+        g.jitter_hist[bin < SIDECAR_JITTER_US / SIDECAR_JITTER_BIN_US ? bin : SIDECAR_JITTER_US / SIDECAR_JITTER_BIN_US]++;
+        g.jitter_total_us += abs_err;
+    }
+    conn->last_frame_ns = now;
+    conn->last_frame_us = frame_us;
+}
+
+/*
+ * Feed received bytes through the framed parser (or straight to the mic
+ * handler in raw mode).
+ */
+static void conn_input(sidecar_conn_t *conn, const uint8_t *data, size_t len, uint64_t now)
+{
+    if (!g.framed) {
+        conn_mic(conn, data, len, now);
+        return;
+    }
+
+    while (len) {
+        if (conn->body_left) {
+            size_t take = len < conn->body_left ? len : conn->body_left;
+
+            if (conn->body_audio) {
+                conn_mic(conn, data, take, now);
+            }
+            conn->body_left -= (uint32_t)take;
+            data += take;
+            len -= take;
+            if (!conn->body_left && conn->body_audio) {
+                conn_frame_done(conn, ((uint32_t)conn->hdr[2] << 8) | conn->hdr[3], now);
+            }
+            continue;
+        }
+
+        while (conn->hdr_len < MSG_HEADER_LEN && len) {
+            conn->hdr[conn->hdr_len++] = *data++;
+            len--;
+        }
+        if (conn->hdr_len < MSG_HEADER_LEN) {
+            break;
+        }
+        conn->hdr_len = 0;
+        conn->body_left = ((uint32_t)conn->hdr[2] << 8) | conn->hdr[3];
+        conn->body_audio = conn->hdr[0] == MSG_AUDIO;
+        if (!conn->body_left && conn->body_audio) {
+            conn_frame_done(conn, 0, now);
+        }
+    }
+}
+
+static int listen_on(const char *addr, const char *unix_path)
+{
+    int fd, one = 1;
+
+    if (unix_path) {
+        struct sockaddr_un sun;
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            return -1;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", unix_path);
+        unlink(unix_path);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in sin;
+        char host[256];
+        const char *colon = strrchr(addr, ':');
+
+        if (!colon || (size_t)(colon - addr) >= sizeof(host)) {
+            fprintf(stderr, "Bad listen address %s (want host:port)\n", addr);
+            return -1;
+        }
+        memcpy(host, addr, (size_t)(colon - addr));
+        host[colon - addr] = '\0';
+
+        if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons((uint16_t)atoi(colon + 1));
+        if (inet_pton(AF_INET, host, &sin.sin_addr) != 1 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 4096) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void accept_all(int ep, int lfd, int is_unix)
+{
+    for (;;) {
+        struct epoll_event ev;
+        sidecar_conn_t *conn;
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC), one = 1;
+
+        if (fd < 0) {
+            return;
+        }
+        if (!is_unix) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (!(conn = calloc(1, sizeof(*conn)))) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = g.conns;
+        if (g.conns) {
+            g.conns->prev = conn;
+        }
+        g.conns = conn;
+        g.accepted++;
+        if (++g.conn_count > g.conn_peak) {
+            g.conn_peak = g.conn_count;
+        }
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-l host:port | -u path] [-m raw|framed] [-a marker|echo] [-i interval_ms]\n"
+            "          [-r mic_rate] [-s speaker_rate] [-R report_s]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *addr = "127.0.0.1:9000", *unix_path = NULL;
+    static uint8_t rx[SIDECAR_RX_BUF];
+    struct epoll_event events[SIDECAR_MAX_EVENTS], ev;
+    struct itimerspec its;
+    uint64_t next_report;
+    int ep, lfd, tfd, opt;
+
+    g.framed = 0;
+    g.action = SIDECAR_MARKER;
+    g.interval_ms = 1000;
+    g.mic_rate = 16000;
+    g.speaker_rate = 24000;
+    g.report_s = 5;
+
+    while ((opt = getopt(argc, argv, "l:u:m:a:i:r:s:R:h")) != -1) {
+        switch (opt) {
+        case 'l': addr = optarg; break;
+        case 'u': unix_path = optarg; break;
+        case 'm': g.framed = !strcmp(optarg, "framed"); break;
+        case 'a': g.action = !strcmp(optarg, "echo") ? SIDECAR_ECHO : SIDECAR_MARKER; break;
+        case 'i': g.interval_ms = (uint32_t)atoi(optarg); break;
+        case 'r': g.mic_rate = (uint32_t)atoi(optarg); break;
+        case 's': g.speaker_rate = (uint32_t)atoi(optarg); break;
+        case 'R': g.report_s = (uint32_t)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (g.interval_ms < 4 * SIDECAR_CHUNK_MS || !g.mic_rate || g.speaker_rate < 8000 || g.speaker_rate > 48000) {
+        fprintf(stderr, "interval must be >= %dms, rates 8000..48000\n", 4 * SIDECAR_CHUNK_MS);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((lfd = listen_on(addr, unix_path)) < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", unix_path ? unix_path : addr, strerror(errno));
+        return 1;
+    }
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ep < 0 || tfd < 0) {
+        perror("epoll/timerfd");
+        return 1;
+    }
+
+    /* Listener and timer are told apart from connections by a NULL/self ptr */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+    ev.data.ptr = &tfd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev);
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = SIDECAR_CHUNK_MS * 1000000L;
+    its.it_interval.tv_nsec = SIDECAR_CHUNK_MS * 1000000L;
+    if (g.action == SIDECAR_MARKER) {
+        timerfd_settime(tfd, 0, &its, NULL);
+    }
+
+    printf("Listening on %s (%s, %s)\n", unix_path ? unix_path : addr, g.framed ? "framed" : "raw",
+           g.action == SIDECAR_ECHO ? "echo" : "marker");
+    fflush(stdout);
+
+    next_report = now_ns() + (uint64_t)g.report_s * 1000000000ULL;
+    while (!g.stop) {
+        int n = epoll_wait(ep, events, SIDECAR_MAX_EVENTS, 100), i;
+        uint64_t now = now_ns();
+
+        for (i = 0; i < n; i++) {
+            sidecar_conn_t *conn = events[i].data.ptr;
+
+            if (!conn) {
+                accept_all(ep, lfd, unix_path != NULL);
+            } else if (events[i].data.ptr == &tfd) {
+                uint64_t ticks, missed;
+                sidecar_conn_t *next;
+
+                if (read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+                    continue;
+                }
+                /* Catch up missed ticks so each stream stays real time */
+                for (missed = 0; missed < ticks; missed++) {
+                    for (conn = g.conns; conn; conn = next) {
+                        next = conn->next;
+                        if (!conn_speak(conn, now)) {
+                            conn_close(ep, conn);
+                        }
+                    }
+                }
+            } else if (conn->fd >= 0) {
+                int reads;
+
+                for (reads = 0; reads < 8; reads++) {
+                    ssize_t got = recv(conn->fd, rx, sizeof(rx), 0);
+
+                    if (got > 0) {
+                        conn_input(conn, rx, (size_t)got, now);
+                        if ((size_t)got < sizeof(rx)) {
+                            break;
+                        }
+                    } else {
+                        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                            conn_close(ep, conn);
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        conn_reap();
+
+        if (g.report_s && now >= next_report) {
+            report("sidecar");
+            next_report = now + (uint64_t)g.report_s * 1000000000ULL;
+        }
+    }
+
+    report("final");
+
+    while (g.conns) {
+        conn_close(ep, g.conns);
+    }
+    conn_reap();
+    close(tfd);
+    close(lfd);
+    close(ep);
+    if (unix_path) {
+        unlink(unix_path);
+    }
+
+    return 0;
+}
@@ -11,267 +11,5962 @@
  * - Minimal latency: no buffering delays, immediate playback
  * - Simple: audio only, all call control via ESL
  * - Fast: pure raw PCM on socket, no parsing overhead
+ * - Optional framed mode: length-prefixed messages carrying audio plus in-band
+ *   flush/mark/clear commands, for sidecars that want single-hop barge-in
  *
+ * Threading:
+ * - Sidecar sockets are multiplexed by a small, fixed set of reactor threads
+ *   (epoll), so thread count scales with cores instead of with calls.
+ * - Playback is paced by clock threads running a timer wheel on the core
+ *   soft timer (the same media clock that paces RTP), one per reactor.
+ * - Mic audio is sent from the media bug callback on the session's media thread.
+ *
+ * Transports: TCP, a unix domain socket (unix:/path) for co-located sidecars,
+ * or shared-memory rings set up over the unix socket (shm mode).
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                 /* memfd_create */
+#endif
+#include <switch.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <math.h>
+
+#include "socket_audio_core.h"
+
+#define SOCKET_AUDIO_INPUT_RATE   16000   /* Default input sample rate (to sidecar) */
+#define SOCKET_AUDIO_OUTPUT_RATE  24000   /* Default output sample rate (from sidecar) */
+#define SOCKET_AUDIO_BUG_NAME     "socket_audio"
+#define SOCKET_AUDIO_CONFIG       "socket_audio.conf"
+
+/* Default audio queue limit in seconds of audio at the session rate
+ * (queue-seconds / socket_audio_queue_seconds). Sidecar may generate audio
+ * faster than real-time, so queue must hold entire turn. Memory is only
+ * allocated for audio actually queued, in segments returned as they drain. */
+#define SOCKET_AUDIO_QUEUE_SECONDS   90
+
+/* Queue segment size in frames (500ms at 20ms ptime) */
+#define SOCKET_AUDIO_SEGMENT_FRAMES  25
+
+/* Extra queue space beyond the limit, in seconds. Overflow drops the oldest
+ * audio, but only the consumer may advance the read position, so the producer
+ * needs room to keep writing until the toss is applied. */
+#define SOCKET_AUDIO_QUEUE_SLACK_SECONDS  1
+
+/* Duration to discard incoming audio after flush (microseconds)
+ * This allows in-flight packets to clear before resuming playback */
+#define SOCKET_AUDIO_DISCARD_DURATION_US  50000  /* 50ms */
+
+/* Reactor tuning */
+#define SOCKET_AUDIO_REACTOR_MAX_EVENTS   64     /* epoll events handled per wakeup */
+#define SOCKET_AUDIO_REACTOR_RECV_BUF     8192   /* Shared receive buffer per reactor */
+#define SOCKET_AUDIO_REACTOR_MAX_READS    8      /* recv() calls per readable socket per wakeup (fairness) */
+
+#define SOCKET_AUDIO_REGISTRY_BUCKETS     4096   /* Pipes by call UUID for the uuid_* APIs, power of two */
+#define SOCKET_AUDIO_CONTEXT_POOL         64     /* Idle pipe contexts kept for reuse (context-pool) */
+
+#define SOCKET_AUDIO_MARK_NAME_MAX        64     /* Longer control payloads are truncated */
+#define SOCKET_AUDIO_MSG_SLOTS            64     /* Pending control messages per direction, power of two */
+#define SOCKET_AUDIO_OUTBOX_BYTES         (SOCKET_AUDIO_MSG_SLOTS * (SOCKET_AUDIO_FRAME_HEADER_LEN + SOCKET_AUDIO_MARK_NAME_MAX))
+
+/* Mic frames coalesced per send (mic-batch-frames / socket_audio_mic_batch_frames).
+ * The staging buffer holds two batches: one the kernel has not taken yet and
+ * the one being filled. */
+#define SOCKET_AUDIO_MIC_BATCH_FRAMES     1
+#define SOCKET_AUDIO_MIC_BATCH_MAX        10
+
+/* socket_audio_debug: frames logged in detail, then level logged every N frames */
+#define SOCKET_AUDIO_DEBUG_DETAIL_FRAMES  5
+#define SOCKET_AUDIO_DEBUG_INTERVAL       250    /* 5s at 20ms ptime */
+
+/* Sidecar connections (connect-timeout-ms / connection-pool) */
+#define SOCKET_AUDIO_CONNECT_TIMEOUT_MS   2000
+#define SOCKET_AUDIO_POOL_SIZE            4      /* Default idle connections per pool */
+#define SOCKET_AUDIO_POOL_SIZE_MAX        256
+#define SOCKET_AUDIO_POOL_RETRY_US        1000000  /* Back off after a failed pre-connect */
+
+/* Reconnect policy (reconnect-* / socket_audio_reconnect_*); off by default */
+#define SOCKET_AUDIO_RECONNECT_ATTEMPTS   0
+#define SOCKET_AUDIO_RECONNECT_BACKOFF_MS 250    /* Doubles per failed attempt */
+#define SOCKET_AUDIO_RECONNECT_BACKOFF_MAX_MS 5000
+#define SOCKET_AUDIO_RECONNECT_BUFFER_MS  2000   /* Mic audio kept for replay while down */
+#define SOCKET_AUDIO_RECONNECT_HOSTS      5      /* Primary plus alternates */
+#define SOCKET_AUDIO_HOST_MAX             256
+
+/* Unix domain socket and shared-memory transport */
+#define SOCKET_AUDIO_UNIX_PREFIX          "unix:"
+#define SOCKET_AUDIO_SHM_MAGIC            0x53414d52  /* "SAMR" */
+#define SOCKET_AUDIO_SHM_VERSION          1
+#define SOCKET_AUDIO_SHM_RING_MS          1000   /* Audio each ring holds, rounded up to a power of two */
+
+/* Adaptive prebuffer and underrun concealment (jitter-buffer / socket_audio_jitter_buffer*) */
+#define SOCKET_AUDIO_JB_MAX_MS            200    /* Deepest the prebuffer may grow */
+#define SOCKET_AUDIO_JB_DECAY             50     /* Prebuffer shrinks by 1/50 of the time elapsed (20ms per second) */
+#define SOCKET_AUDIO_PLC_MAX_MS           60     /* Longest underrun filled before playback stops */
+#define SOCKET_AUDIO_PLC_NOISE_AMPLITUDE  16     /* Comfort noise peak, about -66 dBFS */
+
+/* Voice activity detection on the mic path (vad / socket_audio_vad*) */
+#define SOCKET_AUDIO_VAD_THRESHOLD_DB     -45.0  /* Frame energy (dBFS) below which it is never speech */
+#define SOCKET_AUDIO_VAD_NOISE_MARGIN_DB  9.0    /* Speech must also clear the tracked noise floor by this */
+#define SOCKET_AUDIO_VAD_LOUD_DB          10.0   /* Above the threshold by this, a high zero-crossing rate still counts */
+#define SOCKET_AUDIO_VAD_MAX_ZCR          0.35   /* Crossings per sample above which a quieter frame is noise */
+#define SOCKET_AUDIO_VAD_HANGOVER_MS      300    /* Speech continues this long after the last active frame */
+#define SOCKET_AUDIO_VAD_ONSET_FRAMES     2      /* Consecutive active frames before speech_start */
+#define SOCKET_AUDIO_BARGE_IN_MS          40     /* Sustained speech during playback that interrupts it */
+#define SOCKET_AUDIO_BARGE_IN_HANGOVER_MS 200    /* Audio still arriving after a barge-in is discarded this long */
+
+/* Joined legs (legs / socket_audio_legs*): other sessions sharing one pipe */
+#define SOCKET_AUDIO_LEGS_MAX             4      /* Default slots per pipe (legs-max / socket_audio_legs_max) */
+#define SOCKET_AUDIO_LEGS_LIMIT           8
+#define SOCKET_AUDIO_LEG_QUEUE_FRAMES     5      /* Leg mic audio held for the mix; older audio is tossed */
+#define SOCKET_AUDIO_LEG_LAG_FRAMES       2      /* Backlog beyond this is dropped (media clock drift) */
+#define SOCKET_AUDIO_LEG_BUG_NAME         "socket_audio_leg"
+
+/* Playback reference for the mic path (stereo / socket_audio_stereo) */
+#define SOCKET_AUDIO_REF_QUEUE_FRAMES     5      /* Played frames held for the mic path */
+#define SOCKET_AUDIO_REF_LAG_FRAMES       2      /* Backlog beyond this is dropped, keeping the channels aligned */
+
+/* Echo canceller on the caller's audio (aec / socket_audio_aec) */
+#define SOCKET_AUDIO_AEC_TAIL_MS          128    /* Echo path covered, from playout to the mic */
+#define SOCKET_AUDIO_AEC_SUPPRESS_DB      18.0   /* Residual attenuation while only the module's audio plays */
+#define SOCKET_AUDIO_AEC_MAX_TAPS         2048   /* Filter length cap: the default tail at 16kHz, about 43ms at 48kHz */
+
+/* Prompt cache (cache-max-mb, socket_audio_cache, framed CACHE_PUT / PLAY) */
+#define SOCKET_AUDIO_CACHE_BUCKETS        256    /* Power of two */
+#define SOCKET_AUDIO_CACHE_MAX_MB         64     /* Clip audio held, all rates */
+#define SOCKET_AUDIO_CACHE_PUT_CHUNK      65536  /* CACHE_PUT receive buffer growth */
+#define SOCKET_AUDIO_CACHE_RATES          "8000,16000,48000"  /* Copies made as soon as a clip is stored */
+#define SOCKET_AUDIO_CACHE_RATES_MAX      8
+
+/* Load shedding under CPU pressure (load-shedding / socket_audio_load_shedding) */
+#define SOCKET_AUDIO_LOAD_INTERVAL_MS     1000   /* Monitor sampling period */
+#define SOCKET_AUDIO_LOAD_MEDIA_US        2000   /* Mean mic callback time per frame that counts as pressure */
+#define SOCKET_AUDIO_LOAD_PACE_MS         10     /* p99 playout pacing error that counts as pressure */
+#define SOCKET_AUDIO_LOAD_RECOVER_S       10     /* Calm needed before stepping back down a level */
+#define SOCKET_AUDIO_LOAD_LEVEL_MAX       3
+#define SOCKET_AUDIO_LOAD_BATCH_FACTOR    2      /* Level 2: mic frames per send multiplied by this */
+#define SOCKET_AUDIO_LOAD_EVENT           "socket_audio::load"
+
+/* Recording tap (socket_audio_record / record-dir) */
+#define SOCKET_AUDIO_RECORD_BUFFER_SECONDS 4     /* Tap ring per pipe, stereo at the session rate */
+#define SOCKET_AUDIO_RECORD_INTERVAL_MS   250    /* Writer drains every tap this often */
+#define SOCKET_AUDIO_RECORD_WAV_HEADER    44
+#define SOCKET_AUDIO_RECORD_WAV_MAX       0x7FFFFFF0u  /* Audio bytes per file without segment-seconds */
+#define SOCKET_AUDIO_RECORD_PATH_MAX      1024
+
+/* Metrics exporter (statsd-server / metrics-interval) */
+#define SOCKET_AUDIO_STATSD_PORT          8125
+#define SOCKET_AUDIO_STATSD_PREFIX        "socket_audio"
+#define SOCKET_AUDIO_METRICS_INTERVAL     10     /* Seconds */
+#define SOCKET_AUDIO_STATSD_PACKET        1400   /* Keep datagrams under a typical MTU */
+
+/* Largest block handed to a resampler */
+#define SOCKET_AUDIO_RESAMPLE_MAX_IN      (SWITCH_RECOMMENDED_BUFFER_SIZE / sizeof(int16_t))
+
+/* Playback clock: timer wheel driven by the core soft timer.
+ * Slots must cover the longest ptime (wheel span = 64 * 10ms = 640ms). */
+#define SOCKET_AUDIO_CLOCK_TICK_MS        10
+#define SOCKET_AUDIO_CLOCK_TICK_US        (SOCKET_AUDIO_CLOCK_TICK_MS * 1000)
+#define SOCKET_AUDIO_WHEEL_SLOTS          64     /* Power of two */
+
+/* Event dispatcher: events are posted to a bounded ring and fired by one
+ * module thread, so switch_event_fire never runs on a media or clock thread */
+#define SOCKET_AUDIO_EVENT_SLOTS          1024   /* Power of two */
+#define SOCKET_AUDIO_EVENT_IDLE_MS        100    /* Dispatcher re-checks shutdown this often */
+
+SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_socket_audio_shutdown);
+SWITCH_MODULE_LOAD_FUNCTION(mod_socket_audio_load);
+SWITCH_MODULE_DEFINITION(mod_socket_audio, mod_socket_audio_load, mod_socket_audio_shutdown, NULL);
+
+/* Socket audio format, per direction */
+typedef struct {
+    socket_audio_encoding_t encoding;
+    uint32_t rate;
+} socket_audio_format_t;
+
+typedef enum {
+    SOCKET_AUDIO_MODE_RAW,            /* Bare PCM both ways */
+    SOCKET_AUDIO_MODE_FRAMED          /* Length-prefixed typed messages */
+} socket_audio_mode_t;
+
+/*
+ * Control message ring (framed mode).
+ *
+ * Single-producer/single-consumer like the playback queue. The reactor feeds
+ * the clock the stream's flush/mark/clear commands in arrival order, each
+ * tagged with the queue position it was received at; the clock feeds the
+ * media thread the replies to send back, so the socket keeps a single writer.
+ */
+typedef struct socket_audio_clip_s socket_audio_clip_t;
+
+typedef struct {
+    uint64_t pos;                     /* Playback queue position (bytes written when received) */
+    switch_time_t at;                 /* When the reactor received it (flush latency) */
+    uint32_t seq;
+    uint8_t type;
+    uint8_t len;
+    char payload[SOCKET_AUDIO_MARK_NAME_MAX];
+    socket_audio_clip_t *clip;        /* PLAY: the clip, one reference held */
+} socket_audio_msg_t;
+
+/*
+ * Cached clip: L16 at one rate, shared by every pipe that plays it. The cache
+ * holds a reference while the clip is listed and each PLAY holds one from the
+ * reactor's lookup until the clock has played or dropped it; the last
+ * release frees it, so replacing or deleting a clip never cuts a call off.
+ */
+struct socket_audio_clip_s {
+    socket_audio_clip_t *next;        /* Bucket chain, under globals.cache_mutex */
+    volatile uint32_t refs;
+    uint32_t rate;
+    uint32_t samples;
+    uint8_t source;                   /* As loaded; the other rates are made from it */
+    char id[SOCKET_AUDIO_MARK_NAME_MAX + 1];
+    int16_t pcm[];
+};
+
+/*
+ * A copy of a loaded clip still to be made at another session rate, for the
+ * cache thread. Holds a reference on the source.
+ */
+typedef struct socket_audio_clip_job_s {
+    struct socket_audio_clip_job_s *next;
+    socket_audio_clip_t *source;
+    uint32_t rate;
+} socket_audio_clip_job_t;
+
+/*
+ * Polyphase filters for one ratio, designed the first time a resampler needs
+ * them and shared read-only by every resampler of that ratio until unload.
+ */
+typedef struct socket_audio_bank_s {
+    struct socket_audio_bank_s *next;
+    uint32_t up;
+    uint32_t down;
+    int16_t *coefs;
+    int16_t *coefs_lite;
+} socket_audio_bank_t;
+
+/*
+ * A pipe's recording. The media thread fills the tap; the writer thread owns
+ * the files. The pipe only marks it closing at teardown, and the writer
+ * drains what is left, finishes the file and frees it, so neither the media
+ * thread nor teardown ever waits on the disk.
+ */
+typedef struct socket_audio_recorder_s {
+    struct socket_audio_recorder_s *next;  /* globals.recorders; only the writer unlinks */
+    socket_audio_tap_t tap;
+    volatile uint8_t closing;         /* Set by teardown once nothing writes the tap */
+    uint8_t failed;                   /* A file could not be written: drain and discard */
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    char *prefix;                     /* Path without -NNNN.wav */
+    uint32_t rate;
+    uint64_t segment_bytes;           /* Audio bytes per file */
+    uint32_t segment;                 /* Files started */
+    int fd;                           /* Open file, -1 between segments */
+    uint64_t file_bytes;              /* Audio bytes in the open file */
+} socket_audio_recorder_t;
+
+typedef struct {
+    volatile uint32_t head;           /* Producer */
+    uint8_t pad[SOCKET_AUDIO_CACHE_LINE - sizeof(uint32_t)];
+    volatile uint32_t tail;           /* Consumer */
+    socket_audio_msg_t slots[SOCKET_AUDIO_MSG_SLOTS];
+} socket_audio_ring_t;
+
+/*
+ * Per-call statistics
+ *
+ * Each counter has a single writer (media thread, reactor or clock, as noted)
+ * and is updated with relaxed stores, so the hot paths take no locks and the
+ * stats API reads a consistent-enough snapshot with relaxed loads. Counters
+ * marked max hold a high-water mark instead of a total.
+ */
+typedef enum {
+    SOCKET_AUDIO_VAD_OFF,
+    SOCKET_AUDIO_VAD_DETECT,              /* Events only, every frame is sent */
+    SOCKET_AUDIO_VAD_SUPPRESS             /* Silent frames are skipped (raw) or sent as SILENCE (framed) */
+} socket_audio_vad_mode_t;
+
+typedef enum {
+    SOCKET_AUDIO_STAT_MIC_FRAMES,         /* Media thread: frames staged for the sidecar */
+    SOCKET_AUDIO_STAT_MIC_BYTES,          /* Media thread: bytes the kernel accepted */
+    SOCKET_AUDIO_STAT_MIC_DROPS,          /* Media thread: frames dropped, staging buffer full */
+    SOCKET_AUDIO_STAT_MIC_SHORT_SENDS,    /* Media thread: sends the kernel took only part of */
+    SOCKET_AUDIO_STAT_SPEAKER_BYTES,      /* Reactor: bytes received from the sidecar */
+    SOCKET_AUDIO_STAT_OVERFLOW_BYTES,     /* Reactor: queued audio tossed on overflow */
+    SOCKET_AUDIO_STAT_SPEAKER_FRAMES,     /* Clock: frames written to the session */
+    SOCKET_AUDIO_STAT_UNDERRUNS,          /* Clock: ran short of a frame mid-playout (sidecar behind or turn over) */
+    SOCKET_AUDIO_STAT_FLUSHES,            /* Clock: flushes and clears applied */
+    SOCKET_AUDIO_STAT_FLUSH_US_TOTAL,     /* Clock: request-to-silence latency, summed */
+    SOCKET_AUDIO_STAT_FLUSH_US_MAX,       /* Clock: max */
+    SOCKET_AUDIO_STAT_PACE_ERROR_US_TOTAL, /* Clock: deviation of frame intervals from ptime, summed */
+    SOCKET_AUDIO_STAT_PACE_ERROR_US_MAX,  /* Clock: max */
+    SOCKET_AUDIO_STAT_QUEUE_MAX_BYTES,    /* Clock: max */
+    SOCKET_AUDIO_STAT_RECONNECTS,         /* Connector: sidecar connections re-established */
+    SOCKET_AUDIO_STAT_MIC_SILENT_FRAMES,  /* Media thread: frames the VAD kept from the sidecar */
+    SOCKET_AUDIO_STAT_SPEECH_SEGMENTS,    /* Media thread: speech_start transitions */
+    SOCKET_AUDIO_STAT_BARGE_INS,          /* Media thread: playback interrupted by caller speech */
+    SOCKET_AUDIO_STAT_CONCEALED_FRAMES,   /* Clock: underrun frames filled by concealment */
+    SOCKET_AUDIO_STAT_PREBUFFER_MAX_US,   /* Clock: max */
+    SOCKET_AUDIO_STAT_LEG_GAP_FRAMES,     /* Media thread: joined-leg frames missing from the mix */
+    SOCKET_AUDIO_STAT_AEC_DOUBLETALK_FRAMES, /* Media thread: frames the echo canceller held adaptation for */
+    SOCKET_AUDIO_STAT_AEC_SUPPRESSED_FRAMES, /* Media thread: frames with the echo residual attenuated */
+    SOCKET_AUDIO_STAT_AEC_RESETS,         /* Media thread: echo canceller divergences */
+    SOCKET_AUDIO_STAT_CLIP_PLAYS,         /* Clock: cached clips started */
+    SOCKET_AUDIO_STAT_CLIP_MISSES,        /* Reactor: PLAY of an ID not in the cache */
+    SOCKET_AUDIO_STAT_CLIP_RESAMPLED,     /* Clock: clips started with no copy at the session rate, resampled as they played */
+    SOCKET_AUDIO_STAT_MEDIA_FRAMES,       /* Media thread: mic callbacks timed (load-shedding) */
+    SOCKET_AUDIO_STAT_MEDIA_US_TOTAL,     /* Media thread: time spent in them, summed */
+    SOCKET_AUDIO_STAT_MEDIA_US_MAX,       /* Media thread: max */
+    SOCKET_AUDIO_STAT_RECORD_FRAMES,      /* Media thread: frames put in the recording tap */
+    SOCKET_AUDIO_STAT_RECORD_DROPS,       /* Media thread: frames lost, tap full (writer behind) */
+    SOCKET_AUDIO_STAT_COUNT
+} socket_audio_stat_t;
+
+/* Frame-write interval deviation from ptime: < 1, 2, 5, 10, 20 ms and more */
+#define SOCKET_AUDIO_PACE_BUCKETS         6
+
+typedef struct {
+    uint64_t count[SOCKET_AUDIO_STAT_COUNT];
+    uint64_t pace[SOCKET_AUDIO_PACE_BUCKETS];
+} socket_audio_stats_t;
+
+/*
+ * Shared-memory transport: one mapping holding this header and two byte rings,
+ * mic (module → sidecar) and speaker (sidecar → module). The layout is the
+ * wire format of shm mode; see README.md.
+ *
+ * Each ring has one writer and one reader. Cursors are free-running byte
+ * counts, each written by one side only and kept on its own cache line, and
+ * data only ever moves in whole samples. A reader about to sleep sets wait and
+ * re-checks head; the writer signals the ring's eventfd only when it finds
+ * wait set, so a busy pipe makes no syscalls at all.
+ */
+typedef struct {
+    volatile uint64_t head;           /* Writer: bytes written */
+    uint8_t pad0[SOCKET_AUDIO_CACHE_LINE - sizeof(uint64_t)];
+    volatile uint64_t tail;           /* Reader: bytes read */
+    volatile uint32_t wait;           /* Reader: set before sleeping on the eventfd */
+    uint8_t pad1[SOCKET_AUDIO_CACHE_LINE - sizeof(uint64_t) - sizeof(uint32_t)];
+} socket_audio_shm_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t mic_offset;              /* From the start of the mapping */
+    uint32_t mic_size;                /* Power of two */
+    uint32_t speaker_offset;
+    uint32_t speaker_size;
+    uint8_t pad[SOCKET_AUDIO_CACHE_LINE - 6 * sizeof(uint32_t)];
+    socket_audio_shm_ring_t mic;
+    socket_audio_shm_ring_t speaker;
+} socket_audio_shm_header_t;
+
+typedef struct socket_audio_reactor_s socket_audio_reactor_t;
+typedef struct socket_audio_clock_s socket_audio_clock_t;
+typedef struct socket_audio_ctx_s socket_audio_ctx_t;
+
+/*
+ * Joined legs (uuid_socket_audio_join)
+ *
+ * Other sessions of a bridged call or small conference share one pipe: their
+ * mic audio is mixed into (or interleaved with) the pipe's mic stream, and
+ * every frame the clock plays is written to them too. Each leg gets a slot of
+ * the pipe; its own media bug feeds the slot queue at the pipe's session rate
+ * (leg media thread → pipe media thread, SPSC), so a leg costs no socket and,
+ * at the pipe's rate, no resampler.
+ *
+ * Join fills a FREE slot under globals.mutex and publishes it ACTIVE. When the
+ * leg's bug closes (hangup, uuid_socket_audio_leave) the slot goes LEAVING;
+ * the pipe's media thread stops reading it (mix_idle), the clock releases the
+ * leg and returns the slot to FREE. socket_audio_pipe_destroy releases the rest.
+ */
+typedef enum {
+    SOCKET_AUDIO_LEGS_OFF,
+    SOCKET_AUDIO_LEGS_MIX,            /* Legs summed into the mic stream */
+    SOCKET_AUDIO_LEGS_INTERLEAVE      /* One mic channel per slot (framed mode) */
+} socket_audio_legs_mode_t;
+
+typedef enum {
+    SOCKET_AUDIO_LEG_FREE,
+    SOCKET_AUDIO_LEG_ACTIVE,
+    SOCKET_AUDIO_LEG_LEAVING
+} socket_audio_leg_state_t;
+
+typedef struct {
+    volatile uint8_t state;
+    volatile uint8_t mix_idle;        /* Pipe media thread no longer reads the queue */
+    uint8_t listen;                   /* Leg audio goes to the sidecar */
+    uint8_t speak;                    /* Playback goes to the leg */
+    socket_audio_ctx_t *ctx;
+    switch_core_session_t *session;   /* Read-locked while joined, NULL once released */
+    switch_media_bug_t *bug;
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    uint32_t rate;
+    socket_audio_queue_t queue;       /* Leg mic audio at the pipe's session rate */
+    socket_audio_resampler_t *read_resampler;   /* Leg media thread: leg → pipe session rate */
+    socket_audio_resampler_t *write_resampler;  /* Clock: pipe session → leg rate */
+    socket_audio_resampler_t *mic_resampler;    /* Pipe media thread: channel → mic rate (interleave) */
+    switch_codec_t write_codec;
+    switch_frame_t write_frame;
+    uint32_t pcm_len;                 /* Pipe media thread: samples in pcm this frame, 0 = no channel */
+    int16_t pcm[SOCKET_AUDIO_RESAMPLE_MAX_IN];
+} socket_audio_leg_t;
+
+struct socket_audio_ctx_s {
+    /* Session reference */
+    switch_core_session_t *session;
+    switch_channel_t *channel;
+    switch_media_bug_t *bug;
+    switch_memory_pool_t *pool;
+
+    /* Socket */
+    switch_socket_t *sock;
+    switch_os_socket_t sock_fd;
+    switch_memory_pool_t *sock_pool;  /* Owns a pooled connection's socket, destroyed with it */
+    uint8_t hello;                    /* Connections start with HELLO */
+
+    /* Shared-memory transport (shm mode); the socket then only carries setup and EOF */
+    socket_audio_shm_header_t *shm;   /* NULL = audio over the socket */
+    uint8_t *shm_mic;                 /* Media thread writes */
+    uint8_t *shm_speaker;             /* Clock thread reads */
+    switch_size_t shm_len;
+    int shm_mic_fd;                   /* eventfd: mic audio for a waiting sidecar */
+
+    /* Reconnect (see socket_audio_pipe_lost) */
+    char *hosts[SOCKET_AUDIO_RECONNECT_HOSTS];  /* Primary first */
+    switch_port_t ports[SOCKET_AUDIO_RECONNECT_HOSTS];
+    uint32_t host_count;
+    uint32_t reconnect_max;           /* Attempts per outage, 0 = off */
+    uint32_t reconnect_backoff_ms;
+    volatile uint8_t link_down;       /* Set by the reactor, cleared by the media thread */
+    struct socket_audio_conn_s *volatile relink;  /* Connector → media thread: replacement connection */
+    struct socket_audio_reconnect_s *reconnect;   /* Pending job, under globals.mutex */
+    socket_audio_ctx_t *repoll_next;  /* Pending reactor repoll link */
+    uint8_t *mic_ring;                /* Media thread: mic audio held while down */
+    switch_size_t mic_ring_cap;
+    switch_size_t mic_ring_start;
+    switch_size_t mic_ring_len;
+
+    /* Threading */
+    volatile uint8_t running;
+
+    /* Reactor membership (owned by the reactor thread once attached) */
+    socket_audio_reactor_t *reactor;
+    socket_audio_ctx_t *reactor_prev;
+    socket_audio_ctx_t *reactor_next;
+    socket_audio_ctx_t *op_next;      /* Pending attach/detach request link */
+    uint8_t attached;                 /* Linked into reactor->pipes */
+    uint8_t polling;                  /* Socket registered with epoll */
+
+    /* Playback clock membership (owned by the clock thread once attached) */
+    socket_audio_clock_t *clock;
+    socket_audio_ctx_t *wheel_prev;
+    socket_audio_ctx_t *wheel_next;
+    socket_audio_ctx_t *clock_op_next; /* Pending attach/detach request link */
+    uint8_t scheduled;                /* Linked into a wheel slot */
+    uint32_t wheel_slot;
+    uint64_t wheel_tick;              /* Tick at which the pipe is visited next */
+    uint64_t play_due;                /* Clock time (us) the next frame is due while playing */
+
+    /* Inbound audio queue (from sidecar, waiting to play) */
+    socket_audio_queue_t audio_queue;
+    volatile uint8_t flush_flag;      /* Set by API, cleared by the clock thread */
+    volatile uint8_t flush_barge_in;  /* Pending flush is a barge-in (set with flush_flag by the media thread) */
+    switch_time_t discard_until;  /* Discard incoming audio until this timestamp (microseconds), set by the clock */
+    uint8_t discarding;           /* Reactor is inside a discard window */
+    volatile uint8_t is_playing;  /* Track if we're currently playing audio (for events) */
+    socket_audio_clip_t *clip;        /* Clock: cached clip playing ahead of the queue, one reference held */
+    uint64_t clip_pos;                /* Queue position its PLAY arrived at */
+    uint32_t clip_off;                /* Samples played */
+    socket_audio_resampler_t *clip_resampler;  /* Clock: clip rate → session, for clips with no copy at the session rate */
+    switch_memory_pool_t *clip_pool;  /* Holds clip_resampler and clip_buf, remade when the clip rate changes */
+    uint32_t clip_rate;               /* clip_resampler's input rate, 0 = none */
+    int16_t *clip_buf;                /* Resampled clip audio not played yet */
+    uint32_t clip_buf_len;
+    uint32_t clip_buf_cap;
+
+    /* Adaptive prebuffer (socket_audio_jitter_buffer, clock thread only) */
+    uint64_t jb_max_us;               /* 0 = off: play as soon as a frame is queued */
+    uint64_t jb_target_us;            /* Audio to hold before starting */
+    uint64_t jb_head;                 /* Queue head at the last visit */
+    uint64_t jb_arrival_at;           /* Clock time of the last arrival during playback, 0 = none */
+    uint64_t jb_depth_us;             /* Queue depth right after it */
+    uint64_t jb_wait_since;           /* Prebuffering since, 0 = not waiting */
+    uint64_t jb_visit_at;
+    uint64_t plc_max_us;
+    uint64_t plc_us;                  /* Concealed so far in the current underrun */
+    uint32_t plc_seed;
+    uint8_t plc_frame[SWITCH_RECOMMENDED_BUFFER_SIZE];  /* Last frame played */
+
+    /* playback_stop debounce (clock thread only) */
+    uint64_t event_debounce_us;       /* 0 = post every stop at once */
+    uint64_t stop_pending_at;         /* Held "complete" stop is posted at this clock time, 0 = none */
+
+    /* Resamplers */
+    int16_t *decode_buf;              /* Speaker producer's G.711 decode scratch */
+    socket_audio_resampler_t *read_resampler;   /* session → mic format rate (to sidecar) */
+    socket_audio_resampler_t *write_resampler;  /* speaker format rate → session (from sidecar) */
+
+    /* Socket audio formats */
+    socket_audio_format_t mic_format;           /* To sidecar */
+    socket_audio_format_t speaker_format;       /* From sidecar */
+    uint8_t mic_buf[SWITCH_RECOMMENDED_BUFFER_SIZE];  /* Media thread: encoded mic frame */
+
+    /* Session codec info */
+    uint32_t session_rate;
+    uint32_t read_ptime;
+    uint32_t write_ptime;
+
+    /* Frame sizes in bytes (16-bit samples) */
+    uint32_t session_frame_bytes;    /* Bytes per frame at session rate */
+    uint32_t input_frame_bytes;  /* Bytes per frame in the mic format */
+    uint32_t output_frame_bytes; /* Bytes per frame in the speaker format */
+
+    /* Write codec for direct frame injection */
+    switch_codec_t write_codec;
+    switch_frame_t write_frame;
+    uint8_t write_frame_data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+
+    /* Framed protocol */
+    socket_audio_mode_t mode;
+    uint8_t rx_hdr[SOCKET_AUDIO_FRAME_HEADER_LEN];  /* Reactor: header being assembled */
+    uint32_t rx_hdr_len;
+    uint8_t rx_type;
+    uint8_t rx_flags;
+    uint32_t rx_seq;
+    uint32_t rx_remaining;            /* Payload bytes of the current message still to come */
+    uint32_t rx_payload_len;
+    uint8_t rx_payload[SOCKET_AUDIO_MARK_NAME_MAX];
+    uint8_t rx_carry;                 /* Odd byte held back until the rest of its sample arrives */
+    uint8_t rx_carry_len;
+    uint8_t rx_stale;                 /* Current AUDIO or PLAY message belongs to a flushed turn */
+    uint8_t rx_turn_valid;
+    uint32_t rx_turn;                 /* Turn of the last accepted tagged audio */
+    uint32_t rx_stale_turn;           /* Last stale turn logged */
+    volatile uint32_t min_turn;       /* Tagged audio from older turns is dropped */
+    volatile uint8_t min_turn_valid;
+    volatile uint8_t turn_flush;      /* Set by API with a turn ID, cleared by the clock thread */
+    uint8_t *rx_put;                  /* Reactor: CACHE_PUT payload being assembled */
+    switch_size_t rx_put_len;
+    switch_size_t rx_put_cap;
+    uint8_t rx_put_over;              /* Does not fit in the cache: dropped when complete */
+    socket_audio_ring_t control;      /* Reactor → clock: in-band commands */
+    socket_audio_ring_t outbox;       /* Clock → media thread: replies */
+    uint32_t mic_seq;                 /* Media thread: AUDIO messages sent */
+
+    /* Mic staging (media thread only) */
+    uint8_t *send_buf;
+    switch_size_t send_cap;
+    switch_size_t send_off;           /* Start of the bytes the kernel has not taken */
+    switch_size_t send_len;           /* End of staged bytes */
+    uint32_t send_frames;             /* Frames staged since the last send */
+    uint32_t mic_batch;               /* Frames coalesced per send */
+    uint32_t mic_batch_base;          /* mic_batch outside load level 2 */
+    uint32_t mic_dropped;             /* Frames dropped since the sidecar stopped draining */
+    uint8_t send_pending;             /* Last send was short; retry before staging more sends */
+
+    /* Load shedding (socket_audio_load_shedding): the module's load level as
+     * last applied to this pipe, media thread only */
+    uint8_t load_shed;
+    uint8_t load_level;
+
+    /* Voice activity detection (socket_audio_vad, media thread only) */
+    socket_audio_vad_mode_t vad_mode;
+    double vad_threshold_db;
+    double vad_noise_db;              /* Tracked noise floor */
+    uint32_t vad_hangover_frames;
+    uint32_t vad_hangover;            /* Frames of hangover left */
+    uint32_t vad_run;                 /* Consecutive active frames */
+    uint8_t vad_speech;               /* speech_start fired, speech_stop not yet */
+    uint32_t barge_in_frames;         /* Active frames during playback that interrupt it, 0 = off */
+    uint32_t barge_in_hangover_ms;
+
+    /* Mic diagnostics (socket_audio_debug, media thread only) */
+    uint32_t debug_interval;          /* Frames between level logs, 0 = off */
+    uint32_t debug_frames;
+    int debug_peak;
+
+    /* Joined legs (socket_audio_legs) */
+    socket_audio_legs_mode_t legs_mode;
+    socket_audio_leg_t *legs;         /* legs_max slots, NULL = joining disabled */
+    uint32_t legs_max;
+    uint32_t mic_channels;            /* Interleaved channels per mic frame */
+    uint32_t mic_frame_max;           /* Largest mic message payload */
+    int16_t *leg_mix;                 /* Media thread: caller plus legs at the session rate */
+    int16_t *mic_out;                 /* Media thread: interleaved mic frame (mic_channels > 1) */
+
+    /* Playback reference: every frame the clock wrote, handed to the mic path */
+    uint8_t stereo;                   /* Mic frames carry it as channel 1 (socket_audio_stereo) */
+    uint8_t reference;                /* Clock fills ref_queue */
+    socket_audio_queue_t ref_queue;   /* Clock → media thread, session rate */
+    socket_audio_resampler_t *ref_resampler;  /* Media thread: reference → mic rate */
+    int16_t *ref_pcm;                 /* Media thread: the reference for this mic frame */
+    socket_audio_aec_t *aec;          /* Media thread: echo canceller on the caller, NULL = off */
+    socket_audio_recorder_t *recorder;  /* Recording tap (socket_audio_record), NULL = off */
+
+    /* Statistics */
+    socket_audio_stats_t stats;
+    volatile switch_time_t flush_req_at;  /* When the pending API flush was requested */
+    switch_time_t last_write_at;      /* Clock: previous frame write while pacing, 0 = not pacing */
+    socket_audio_ctx_t *registry_prev;  /* Active pipes, under globals.mutex */
+    socket_audio_ctx_t *registry_next;
+    uint8_t registered;
+    socket_audio_ctx_t *hash_next;    /* Same UUID bucket, under globals.registry_lock */
+    const char *uuid;
+    volatile uint32_t refs;           /* The pipe's own plus one per API call using it */
+
+    /* Context pool: kept across calls, see socket_audio_ctx_get */
+    socket_audio_ctx_t *free_next;
+    socket_audio_segment_t *spare_seg;  /* Playback queue segment of the last call */
+    switch_size_t spare_seg_size;
+
+};
+
+/*
+ * Reactor
+ *
+ * One epoll loop multiplexing the sidecar sockets of many calls. It only
+ * receives and queues audio; playback is paced by the paired clock.
+ *
+ * Attach/detach requests are queued under ops_mutex and applied by the reactor
+ * thread itself, so no other thread ever waits on a reactor that may be busy
+ * writing frames into a session.
+ */
+struct socket_audio_reactor_s {
+    uint32_t id;
+    int epoll_fd;
+    int wake_fd;                      /* eventfd used to interrupt epoll_wait */
+    switch_thread_t *thread;
+
+    switch_mutex_t *ops_mutex;
+    socket_audio_ctx_t *attach_ops;   /* Pipes waiting to be attached */
+    socket_audio_ctx_t *detach_ops;   /* Pipes waiting to be released */
+    socket_audio_ctx_t *repoll_ops;   /* Reconnected pipes waiting to be polled again */
+    uint8_t stopped;                  /* Thread has exited; detach releases inline */
+
+    socket_audio_ctx_t *pipes;        /* Attached pipes (reactor thread only) */
+    volatile uint32_t pipe_count;     /* Attached + pending pipes, used for load balancing */
+
+    int16_t decode_buf[SOCKET_AUDIO_REACTOR_RECV_BUF];  /* G.711 speaker audio decoded to L16 */
+    uint8_t recv_buf[SOCKET_AUDIO_REACTOR_RECV_BUF];    /* After decode_buf, so sample aligned */
+};
+
+/*
+ * Playback clock
+ *
+ * A timer wheel stepped by the core soft timer every SOCKET_AUDIO_CLOCK_TICK_MS.
+ * Playing pipes are visited when their next frame is due, idle pipes every
+ * tick so playback starts within one tick of audio arriving. Frame emission
+ * never waits on socket reads and vice versa.
+ *
+ * Like the reactor, attach/detach requests are applied by the clock thread.
+ */
+struct socket_audio_clock_s {
+    uint32_t id;
+    switch_thread_t *thread;
+
+    switch_mutex_t *ops_mutex;
+    socket_audio_ctx_t *attach_ops;
+    socket_audio_ctx_t *detach_ops;
+    uint8_t stopped;
+
+    socket_audio_ctx_t *slots[SOCKET_AUDIO_WHEEL_SLOTS];  /* Clock thread only */
+    uint64_t tick;
+};
+
+/*
+ * Pre-connected sidecar sockets for one host:port, kept topped up by the pool
+ * thread. Each connection has its own memory pool, so handing one to a call
+ * and closing it later leaks nothing into the module pool.
+ */
+typedef struct socket_audio_conn_s {
+    switch_memory_pool_t *pool;
+    switch_socket_t *sock;
+    switch_os_socket_t fd;
+    struct socket_audio_conn_s *next;
+} socket_audio_conn_t;
+
+/*
+ * A lost pipe waiting for the connector thread. Heap-allocated so it can
+ * outlive the call: if the call ends mid-connect, ctx is cleared and the
+ * connector discards the result. Targets are copied for the same reason.
+ */
+typedef struct socket_audio_reconnect_s {
+    socket_audio_ctx_t *ctx;          /* Under globals.mutex; NULL once the call is gone */
+    char hosts[SOCKET_AUDIO_RECONNECT_HOSTS][SOCKET_AUDIO_HOST_MAX];
+    switch_port_t ports[SOCKET_AUDIO_RECONNECT_HOSTS];
+    uint32_t host_count;
+    uint32_t attempt;
+    uint32_t max_attempts;
+    uint32_t backoff_ms;
+    uint32_t timeout_ms;
+    switch_time_t retry_at;
+    uint8_t busy;                     /* Connector is connecting outside the mutex */
+    struct socket_audio_reconnect_s *next;
+} socket_audio_reconnect_t;
+
+typedef struct socket_audio_pool_s {
+    char *host;
+    switch_port_t port;
+    uint32_t size;                    /* Idle connections to keep */
+    socket_audio_conn_t *idle;        /* Under globals.mutex */
+    uint32_t idle_count;
+    switch_time_t retry_at;           /* Pool thread only */
+    struct socket_audio_pool_s *next;
+} socket_audio_pool_t;
+
+typedef enum {
+    SOCKET_AUDIO_EVENT_PLAYBACK_START,
+    SOCKET_AUDIO_EVENT_PLAYBACK_STOP,
+    SOCKET_AUDIO_EVENT_MARK,
+    SOCKET_AUDIO_EVENT_SPEECH_START,
+    SOCKET_AUDIO_EVENT_SPEECH_STOP,
+    SOCKET_AUDIO_EVENT_BARGE_IN,
+    SOCKET_AUDIO_EVENT_RECONNECT
+} socket_audio_event_kind_t;
+
+/*
+ * One posted event: everything the dispatcher needs to build it, copied so
+ * the pipe may be gone by the time it fires. seq is the slot's turn counter
+ * (bounded MPSC ring: slot i is free for position p when seq == p, holds
+ * position p when seq == p + 1).
+ */
+typedef struct {
+    volatile uint64_t seq;
+    socket_audio_event_kind_t kind;
+    const char *reason;               /* Static: stop reason or reconnect state */
+    uint32_t num;                     /* Mark seq, reconnect attempt, barge-in speech ms */
+    switch_port_t port;
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    char text[SOCKET_AUDIO_HOST_MAX]; /* Mark name or reconnect host */
+} socket_audio_event_slot_t;
+
+typedef struct {
+    volatile uint64_t head;           /* Producers: next position to claim (CAS) */
+    uint8_t pad0[SOCKET_AUDIO_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;                    /* Dispatcher: next position to fire */
+    volatile uint32_t sleeping;       /* Dispatcher is blocked, or about to block, on wake_fd */
+    uint8_t pad1[SOCKET_AUDIO_CACHE_LINE - sizeof(uint64_t) - sizeof(uint32_t)];
+    volatile uint32_t dropped;        /* Ring was full */
+    int wake_fd;
+    switch_thread_t *thread;
+    socket_audio_event_slot_t slots[SOCKET_AUDIO_EVENT_SLOTS];
+} socket_audio_events_t;
+
+static struct {
+    switch_memory_pool_t *pool;
+    switch_mutex_t *mutex;
+    volatile uint8_t running;
+
+    /* Configuration */
+    uint32_t reactor_threads;         /* 0 = one per core */
+    int queue_seconds;                /* Default playback queue limit */
+    switch_bool_t fast_resampler;     /* Polyphase kernels for integer ratios */
+    uint32_t mic_batch_frames;        /* Default mic frames per send */
+    uint32_t connect_timeout_ms;
+    socket_audio_pool_t *pools;       /* Fixed after config load */
+    socket_audio_reconnect_t *reconnects;  /* Under mutex */
+    switch_thread_t *connector_thread;
+    uint32_t reconnect_attempts;
+    uint32_t reconnect_backoff_ms;
+    uint32_t reconnect_buffer_ms;
+    char *statsd_host;                /* NULL = no StatsD export */
+    switch_port_t statsd_port;
+    char *statsd_prefix;
+    uint32_t metrics_interval;        /* Seconds between StatsD pushes */
+    socket_audio_vad_mode_t vad_mode;
+    double vad_threshold_db;
+    uint32_t vad_hangover_ms;
+    switch_bool_t jitter_buffer;
+    uint32_t jitter_buffer_max_ms;
+    uint32_t plc_max_ms;
+    switch_bool_t barge_in;
+    uint32_t barge_in_ms;
+    uint32_t barge_in_hangover_ms;
+    uint32_t event_debounce_ms;
+    socket_audio_legs_mode_t legs_mode;
+    uint32_t legs_max;
+    switch_bool_t stereo;
+    switch_bool_t aec;
+    uint32_t aec_tail_ms;
+    uint32_t aec_max_taps;            /* 0 = no cap */
+    double aec_suppress_db;
+    switch_bool_t load_shedding;
+    uint32_t load_interval_ms;
+    uint32_t load_media_us;
+    uint32_t load_pace_ms;
+    uint32_t load_recover_s;
+    char *record_dir;                 /* NULL = the FreeSWITCH recordings directory */
+    uint32_t record_segment_seconds;  /* 0 = one file per call */
+    uint32_t record_buffer_seconds;
+
+    /* Prompt cache: clips by ID, each as loaded and at the rates copied to */
+    switch_mutex_t *cache_mutex;
+    socket_audio_clip_t *cache[SOCKET_AUDIO_CACHE_BUCKETS];
+    switch_size_t cache_bytes;        /* Audio of listed clips, all rates */
+    switch_size_t cache_max_bytes;
+    uint32_t cache_clips;             /* Loaded clips (not counting other rates) */
+    uint32_t cache_rates[SOCKET_AUDIO_CACHE_RATES_MAX];  /* cache-rates */
+    uint32_t cache_rates_count;
+    socket_audio_clip_job_t *cache_jobs;  /* Copies to make, oldest first (under cache_mutex) */
+    switch_thread_t *cache_thread;
+    int cache_wake_fd;
+
+    /* Active pipes, and the totals of released ones (under mutex) */
+    socket_audio_ctx_t *registry;
+    uint32_t registry_count;
+    socket_audio_stats_t retired;
+
+    /* The same pipes by call UUID (under registry_lock) */
+    switch_thread_rwlock_t *registry_lock;
+    socket_audio_ctx_t *registry_hash[SOCKET_AUDIO_REGISTRY_BUCKETS];
+
+    /* Idle pipe contexts (under ctx_free_mutex), and the designed polyphase
+     * filters, one set per ratio (under bank_mutex) */
+    switch_mutex_t *ctx_free_mutex;
+    socket_audio_ctx_t *ctx_free;
+    uint32_t ctx_free_count;
+    uint32_t ctx_free_max;
+    switch_mutex_t *bank_mutex;
+    socket_audio_bank_t *banks;
+
+    /* StatsD exporter */
+    switch_thread_t *metrics_thread;
+
+    /* Load monitor: the level it set, read by every pipe each frame */
+    switch_thread_t *load_thread;
+    volatile uint32_t load_level;
+
+    /* Recording writer and the pipes it drains (list under record_mutex) */
+    switch_thread_t *record_thread;
+    switch_mutex_t *record_mutex;
+    socket_audio_recorder_t *recorders;
+    uint32_t recorder_count;
+    uint8_t record_running;           /* Under record_mutex: the writer takes new recorders */
+
+    /* Event dispatcher */
+    socket_audio_events_t *events;
+
+    /* Reactors, each paired with the playback clock of the same index */
+    socket_audio_reactor_t *reactors;
+    socket_audio_clock_t *clocks;
+    uint32_t reactor_count;
+} globals;
+
+/* Forward declarations */
+static void socket_audio_recorder_close(socket_audio_recorder_t *rec);
+static switch_bool_t socket_audio_media_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type);
+static void *SWITCH_THREAD_FUNC socket_audio_reactor_thread(switch_thread_t *thread, void *obj);
+static void *SWITCH_THREAD_FUNC socket_audio_clock_thread(switch_thread_t *thread, void *obj);
+static void socket_audio_reactor_detach(socket_audio_ctx_t *ctx);
+
+/*
+ * Statistics
+ */
+static const struct {
+    const char *name;
+    uint8_t is_max;
+} socket_audio_stat_info[SOCKET_AUDIO_STAT_COUNT] = {
+    [SOCKET_AUDIO_STAT_MIC_FRAMES]        = { "mic_frames", 0 },
+    [SOCKET_AUDIO_STAT_MIC_BYTES]         = { "mic_bytes", 0 },
+    [SOCKET_AUDIO_STAT_MIC_DROPS]         = { "mic_drops", 0 },
+    [SOCKET_AUDIO_STAT_MIC_SHORT_SENDS]   = { "mic_short_sends", 0 },
+    [SOCKET_AUDIO_STAT_SPEAKER_BYTES]     = { "speaker_bytes", 0 },
+    [SOCKET_AUDIO_STAT_OVERFLOW_BYTES]    = { "overflow_bytes", 0 },
+    [SOCKET_AUDIO_STAT_SPEAKER_FRAMES]    = { "speaker_frames", 0 },
+    [SOCKET_AUDIO_STAT_UNDERRUNS]         = { "underruns", 0 },
+    [SOCKET_AUDIO_STAT_FLUSHES]           = { "flushes", 0 },
+    [SOCKET_AUDIO_STAT_FLUSH_US_TOTAL]    = { "flush_latency_us_total", 0 },
+    [SOCKET_AUDIO_STAT_FLUSH_US_MAX]      = { "flush_latency_us_max", 1 },
+    [SOCKET_AUDIO_STAT_PACE_ERROR_US_TOTAL] = { "pace_error_us_total", 0 },
+    [SOCKET_AUDIO_STAT_PACE_ERROR_US_MAX] = { "pace_error_us_max", 1 },
+    [SOCKET_AUDIO_STAT_QUEUE_MAX_BYTES]   = { "queue_max_bytes", 1 },
+    [SOCKET_AUDIO_STAT_RECONNECTS]        = { "reconnects", 0 },
+    [SOCKET_AUDIO_STAT_MIC_SILENT_FRAMES] = { "mic_silent_frames", 0 },
+    [SOCKET_AUDIO_STAT_SPEECH_SEGMENTS]   = { "speech_segments", 0 },
+    [SOCKET_AUDIO_STAT_BARGE_INS]         = { "barge_ins", 0 },
+    [SOCKET_AUDIO_STAT_CONCEALED_FRAMES]  = { "concealed_frames", 0 },
+    [SOCKET_AUDIO_STAT_PREBUFFER_MAX_US]  = { "prebuffer_max_us", 1 },
+    [SOCKET_AUDIO_STAT_LEG_GAP_FRAMES]    = { "leg_gap_frames", 0 },
+    [SOCKET_AUDIO_STAT_AEC_DOUBLETALK_FRAMES] = { "aec_doubletalk_frames", 0 },
+    [SOCKET_AUDIO_STAT_AEC_SUPPRESSED_FRAMES] = { "aec_suppressed_frames", 0 },
+    [SOCKET_AUDIO_STAT_AEC_RESETS]        = { "aec_resets", 0 },
+    [SOCKET_AUDIO_STAT_CLIP_PLAYS]        = { "clip_plays", 0 },
+    [SOCKET_AUDIO_STAT_CLIP_MISSES]       = { "clip_misses", 0 },
+    [SOCKET_AUDIO_STAT_CLIP_RESAMPLED]    = { "clip_resampled", 0 },
+    [SOCKET_AUDIO_STAT_MEDIA_FRAMES]      = { "media_frames", 0 },
+    [SOCKET_AUDIO_STAT_MEDIA_US_TOTAL]    = { "media_us_total", 0 },
+    [SOCKET_AUDIO_STAT_MEDIA_US_MAX]      = { "media_us_max", 1 },
+    [SOCKET_AUDIO_STAT_RECORD_FRAMES]     = { "record_frames", 0 },
+    [SOCKET_AUDIO_STAT_RECORD_DROPS]      = { "record_drops", 0 },
+};
+
+static const uint32_t socket_audio_pace_bounds_us[SOCKET_AUDIO_PACE_BUCKETS - 1] = { 1000, 2000, 5000, 10000, 20000 };
+static const char *socket_audio_pace_names[SOCKET_AUDIO_PACE_BUCKETS] = {
+    "lt_1ms", "lt_2ms", "lt_5ms", "lt_10ms", "lt_20ms", "ge_20ms"
+};
+
+/* Single writer per counter: a relaxed load/store pair, no locked add */
+static inline void socket_audio_stat_add(socket_audio_ctx_t *ctx, socket_audio_stat_t stat, uint64_t n)
+{
+    uint64_t *c = &ctx->stats.count[stat];
+
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static inline void socket_audio_stat_max(socket_audio_ctx_t *ctx, socket_audio_stat_t stat, uint64_t v)
+{
+    uint64_t *c = &ctx->stats.count[stat];
+
+    if (v > *c) {
+        __atomic_store_n(c, v, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Record one frame-write interval against the ptime. Clock thread only.
+ */
+static void socket_audio_stat_pace(socket_audio_ctx_t *ctx, int64_t interval_us)
+{
+    int64_t expected = (int64_t)ctx->read_ptime * 1000;
+    uint64_t err = (uint64_t)(interval_us > expected ? interval_us - expected : expected - interval_us);
+    uint64_t *c;
+    int i;
+
+    for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS - 1 && err >= socket_audio_pace_bounds_us[i]; i++);
+
+    c = &ctx->stats.pace[i];
+    __atomic_store_n(c, *c + 1, __ATOMIC_RELAXED);
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_PACE_ERROR_US_TOTAL, err);
+    socket_audio_stat_max(ctx, SOCKET_AUDIO_STAT_PACE_ERROR_US_MAX, err);
+}
+
+/*
+ * A flush requested at req_at has silenced playback. Clock thread only.
+ */
+static void socket_audio_stat_flush(socket_audio_ctx_t *ctx, switch_time_t req_at)
+{
+    switch_time_t now = switch_micro_time_now();
+    uint64_t latency = req_at && now > req_at ? (uint64_t)(now - req_at) : 0;
+
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_FLUSHES, 1);
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_FLUSH_US_TOTAL, latency);
+    socket_audio_stat_max(ctx, SOCKET_AUDIO_STAT_FLUSH_US_MAX, latency);
+    ctx->last_write_at = 0;
+}
+
+/*
+ * Fold src into dst (totals added, maxima kept). Reads src with relaxed loads,
+ * so it may be a live pipe's stats.
+ */
+static void socket_audio_stats_merge(socket_audio_stats_t *dst, const socket_audio_stats_t *src)
+{
+    int i;
+
+    for (i = 0; i < SOCKET_AUDIO_STAT_COUNT; i++) {
+        uint64_t v = __atomic_load_n(&src->count[i], __ATOMIC_RELAXED);
+
+        if (!socket_audio_stat_info[i].is_max) {
+            dst->count[i] += v;
+        } else if (v > dst->count[i]) {
+            dst->count[i] = v;
+        }
+    }
+    for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS; i++) {
+        dst->pace[i] += __atomic_load_n(&src->pace[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void socket_audio_stats_json(cJSON *obj, const socket_audio_stats_t *stats)
+{
+    cJSON *pace = cJSON_CreateObject();
+    int i;
+
+    for (i = 0; i < SOCKET_AUDIO_STAT_COUNT; i++) {
+        cJSON_AddNumberToObject(obj, socket_audio_stat_info[i].name, (double)stats->count[i]);
+    }
+    for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS; i++) {
+        cJSON_AddNumberToObject(pace, socket_audio_pace_names[i], (double)stats->pace[i]);
+    }
+    cJSON_AddItemToObject(obj, "pace_error", pace);
+}
+
+/*
+ * Context pool
+ *
+ * Pipe contexts live outside the session pool, on a module free-list of up
+ * to context-pool idle ones. A context goes back when its last reference
+ * is dropped (socket_audio_ctx_release), so it never depends on the
+ * session's memory outliving the pipe. It keeps the playback queue segment
+ * of its last call, which the next call at the same session rate gets as
+ * its first: setup and the first audio cost no allocation of either.
+ */
+static socket_audio_ctx_t *socket_audio_ctx_get(void)
+{
+    socket_audio_ctx_t *ctx;
+    socket_audio_segment_t *seg = NULL;
+    switch_size_t seg_size = 0;
+
+    switch_mutex_lock(globals.ctx_free_mutex);
+    if ((ctx = globals.ctx_free)) {
+        globals.ctx_free = ctx->free_next;
+        globals.ctx_free_count--;
+    }
+    switch_mutex_unlock(globals.ctx_free_mutex);
+
+    if (!ctx) {
+        return calloc(1, sizeof(*ctx));
+    }
+
+    seg = ctx->spare_seg;
+    seg_size = ctx->spare_seg_size;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->spare_seg = seg;
+    ctx->spare_seg_size = seg_size;
+
+    return ctx;
+}
+
+static void socket_audio_ctx_put(socket_audio_ctx_t *ctx)
+{
+    switch_mutex_lock(globals.ctx_free_mutex);
+    if (globals.ctx_free_count < globals.ctx_free_max) {
+        ctx->free_next = globals.ctx_free;
+        globals.ctx_free = ctx;
+        globals.ctx_free_count++;
+        ctx = NULL;
+    }
+    switch_mutex_unlock(globals.ctx_free_mutex);
+
+    if (ctx) {
+        free(ctx->spare_seg);
+        free(ctx);
+    }
+}
+
+/* Module unload: contexts released later are freed, not pooled */
+static void socket_audio_ctx_pool_clear(void)
+{
+    socket_audio_ctx_t *ctx;
+
+    switch_mutex_lock(globals.ctx_free_mutex);
+    globals.ctx_free_max = 0;
+    while ((ctx = globals.ctx_free)) {
+        globals.ctx_free = ctx->free_next;
+        free(ctx->spare_seg);
+        free(ctx);
+    }
+    globals.ctx_free_count = 0;
+    switch_mutex_unlock(globals.ctx_free_mutex);
+}
+
+/* The playback queue is set up; give it the last call's segment if it fits */
+static void socket_audio_ctx_adopt_segment(socket_audio_ctx_t *ctx)
+{
+    if (ctx->spare_seg && ctx->spare_seg_size == ctx->audio_queue.seg_size) {
+        socket_audio_queue_adopt(&ctx->audio_queue, ctx->spare_seg);
+    } else {
+        free(ctx->spare_seg);
+    }
+    ctx->spare_seg = NULL;
+}
+
+/* Tear down the playback queue, keeping a segment for the next call */
+static void socket_audio_ctx_retire_queue(socket_audio_ctx_t *ctx)
+{
+    switch_size_t seg_size = ctx->audio_queue.seg_size;
+
+    free(ctx->spare_seg);
+    ctx->spare_seg = socket_audio_queue_retire(&ctx->audio_queue);
+    ctx->spare_seg_size = seg_size;
+}
+
+/*
+ * Registry of active pipes: a list for module-wide stats, and a hash by call
+ * UUID so the uuid_* APIs find a pipe without the core session hash.
+ *
+ * A pipe holds its session read lock from socket_audio_start on. Rather than
+ * the reactor dropping it unconditionally, the lock goes with the last
+ * reference: the pipe's own, released in socket_audio_pipe_destroy, or one an
+ * API call took in socket_audio_registry_find. So an API caller may use the
+ * ctx (and its session) until it calls socket_audio_ctx_release, even if the
+ * pipe is torn down meanwhile.
+ */
+static uint32_t socket_audio_registry_bucket(const char *uuid, switch_size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--) {
+        h = (h ^ (uint8_t)*uuid++) * 16777619u;
+    }
+
+    return h & (SOCKET_AUDIO_REGISTRY_BUCKETS - 1);
+}
+
+static void socket_audio_registry_add(socket_audio_ctx_t *ctx)
+{
+    socket_audio_ctx_t **bucket;
+
+    switch_mutex_lock(globals.mutex);
+    ctx->registry_prev = NULL;
+    ctx->registry_next = globals.registry;
+    if (globals.registry) {
+        globals.registry->registry_prev = ctx;
+    }
+    globals.registry = ctx;
+    globals.registry_count++;
+    ctx->registered = 1;
+    switch_mutex_unlock(globals.mutex);
+
+    /* At the head: a restarted pipe shadows one still being torn down */
+    ctx->uuid = switch_core_session_get_uuid(ctx->session);
+    ctx->refs = 1;
+    bucket = &globals.registry_hash[socket_audio_registry_bucket(ctx->uuid, strlen(ctx->uuid))];
+    switch_thread_rwlock_wrlock(globals.registry_lock);
+    ctx->hash_next = *bucket;
+    *bucket = ctx;
+    switch_thread_rwlock_unlock(globals.registry_lock);
+}
+
+/*
+ * The pipe of a call UUID (len bytes, need not be terminated), with a
+ * reference the caller drops with socket_audio_ctx_release; NULL if the call
+ * has no pipe.
+ */
+static socket_audio_ctx_t *socket_audio_registry_find(const char *uuid, switch_size_t len)
+{
+    socket_audio_ctx_t *ctx;
+
+    switch_thread_rwlock_rdlock(globals.registry_lock);
+    for (ctx = globals.registry_hash[socket_audio_registry_bucket(uuid, len)]; ctx; ctx = ctx->hash_next) {
+        if (!strncmp(ctx->uuid, uuid, len) && !ctx->uuid[len]) {
+            __atomic_add_fetch(&ctx->refs, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    switch_thread_rwlock_unlock(globals.registry_lock);
+
+    return ctx;
+}
+
+/* The last reference drops the session read lock and returns ctx to the
+ * pool; it must not be touched afterwards */
+static void socket_audio_ctx_release(socket_audio_ctx_t *ctx)
+{
+    if (!__atomic_sub_fetch(&ctx->refs, 1, __ATOMIC_ACQ_REL)) {
+        switch_core_session_rwunlock(ctx->session);
+        socket_audio_ctx_put(ctx);
+    }
+}
+
+/* Unlink the pipe and keep its totals. Called once nothing updates its stats. */
+static void socket_audio_registry_remove(socket_audio_ctx_t *ctx)
+{
+    socket_audio_ctx_t **link;
+
+    if (!ctx->registered) {
+        return;
+    }
+
+    switch_thread_rwlock_wrlock(globals.registry_lock);
+    for (link = &globals.registry_hash[socket_audio_registry_bucket(ctx->uuid, strlen(ctx->uuid))]; *link;
+         link = &(*link)->hash_next) {
+        if (*link == ctx) {
+            *link = ctx->hash_next;
+            break;
+        }
+    }
+    switch_thread_rwlock_unlock(globals.registry_lock);
+
+    switch_mutex_lock(globals.mutex);
+    if (ctx->registry_prev) {
+        ctx->registry_prev->registry_next = ctx->registry_next;
+    } else {
+        globals.registry = ctx->registry_next;
+    }
+    if (ctx->registry_next) {
+        ctx->registry_next->registry_prev = ctx->registry_prev;
+    }
+    globals.registry_count--;
+    ctx->registered = 0;
+    socket_audio_stats_merge(&globals.retired, &ctx->stats);
+    switch_mutex_unlock(globals.mutex);
+}
+
+/*
+ * Module-wide totals: released pipes plus a relaxed snapshot of active ones.
+ */
+static uint32_t socket_audio_stats_total(socket_audio_stats_t *stats)
+{
+    socket_audio_ctx_t *ctx;
+    uint32_t active;
+
+    switch_mutex_lock(globals.mutex);
+    *stats = globals.retired;
+    active = globals.registry_count;
+    for (ctx = globals.registry; ctx; ctx = ctx->registry_next) {
+        socket_audio_stats_merge(stats, &ctx->stats);
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    return active;
+}
+
+/*
+ * Pace error (ms) below which fraction q of the frames in the histogram fell,
+ * resolved to bucket upper bounds; the open last bucket reports max_us.
+ */
+static double socket_audio_pace_quantile(const uint64_t *pace, double q, uint64_t max_us)
+{
+    uint64_t total = 0, seen = 0;
+    int i;
+
+    for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS; i++) {
+        total += pace[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS - 1; i++) {
+        seen += pace[i];
+        if (seen >= q * total) {
+            return socket_audio_pace_bounds_us[i] / 1000.0;
+        }
+    }
+
+    return max_us / 1000.0;
+}
+
+/*
+ * Resampler
+ *
+ * The polyphase kernels live in socket_audio_core.c. Ratios they do not
+ * cover, or fast-resampler=false, use the generic switch_resample path.
+ *
+ * Point a planned resampler at the shared filters of its ratio, designing
+ * them on first use, and reset it. Only the first call per ratio since load
+ * pays for the design (a few thousand sin/cos).
+ */
+static void socket_audio_resampler_bank_get(socket_audio_resampler_t *r)
+{
+    socket_audio_bank_t *bank;
+
+    switch_mutex_lock(globals.bank_mutex);
+    for (bank = globals.banks; bank && (bank->up != r->up || bank->down != r->down); bank = bank->next);
+
+    if (!bank) {
+        bank = switch_core_alloc(globals.pool, sizeof(*bank));
+        bank->up = r->up;
+        bank->down = r->down;
+        bank->coefs = switch_core_alloc(globals.pool, sizeof(int16_t) * r->up * r->taps);
+        if (r->taps_lite) {
+            bank->coefs_lite = switch_core_alloc(globals.pool, sizeof(int16_t) * r->up * r->taps_lite);
+        }
+        r->coefs = bank->coefs;
+        r->coefs_lite = bank->coefs_lite;
+        socket_audio_resampler_design(r);
+        bank->next = globals.banks;
+        globals.banks = bank;
+    }
+    switch_mutex_unlock(globals.bank_mutex);
+
+    r->coefs = bank->coefs;
+    r->coefs_lite = bank->coefs_lite;
+    socket_audio_resampler_reset(r);
+}
+
+/*
+ * Create a resampler from one rate to another for blocks of up to max_in samples.
+ */
+static switch_status_t socket_audio_resampler_create(socket_audio_resampler_t **new_r, uint32_t from, uint32_t to,
+                                                     uint32_t max_in, switch_memory_pool_t *pool)
+{
+    socket_audio_resampler_t *r = switch_core_alloc(pool, sizeof(*r));
+
+    if (!socket_audio_resampler_plan(r, from, to, max_in) || !globals.fast_resampler) {
+        switch_audio_resampler_t *fallback = NULL;
+
+        if (switch_resample_create(&fallback, from, to, (uint32_t)(to * 0.02 * 2), /* 20ms buffer */
+                                   SWITCH_RESAMPLE_QUALITY, 1) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
+        }
+        r->fallback = fallback;
+        *new_r = r;
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    r->buf = switch_core_alloc(pool, sizeof(int16_t) * (r->taps - 1 + max_in));
+    r->out = switch_core_alloc(pool, sizeof(int16_t) * r->out_cap);
+    socket_audio_resampler_bank_get(r);
+
+    *new_r = r;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void socket_audio_resampler_destroy(socket_audio_resampler_t **r)
+{
+    if (*r && (*r)->fallback) {
+        switch_audio_resampler_t *fallback = (*r)->fallback;
+
+        switch_resample_destroy(&fallback);
+        (*r)->fallback = NULL;
+    }
+    *r = NULL;
+}
+
+static const char *socket_audio_resampler_kind(socket_audio_resampler_t *r)
+{
+    return r->fallback ? "generic" : "polyphase";
+}
+
+/*
+ * Resample one block; the result is in r->out / r->out_len until the next call.
+ * Blocks longer than max_in are truncated.
+ */
+static void socket_audio_resample(socket_audio_resampler_t *r, const int16_t *in, uint32_t n)
+{
+    if (r->fallback) {
+        switch_audio_resampler_t *fallback = r->fallback;
+
+        switch_resample_process(fallback, (int16_t *)in, n);
+        r->out = fallback->to;
+        r->out_len = fallback->to_len;
+        return;
+    }
+
+    socket_audio_resample_begin(r, in, n);
+    r->out_len = socket_audio_resample_emit(r, r->out, r->out_cap);
+}
+
+static uint32_t socket_audio_format_sample_bytes(const socket_audio_format_t *fmt)
+{
+    return fmt->encoding == SOCKET_AUDIO_ENC_L16 ? sizeof(int16_t) : 1;
+}
+
+static const char *socket_audio_format_name(const socket_audio_format_t *fmt)
+{
+    switch (fmt->encoding) {
+    case SOCKET_AUDIO_ENC_PCMU:
+        return "PCMU";
+    case SOCKET_AUDIO_ENC_PCMA:
+        return "PCMA";
+    default:
+        return "L16";
+    }
+}
+
+/*
+ * Parse a socket format: L16/<rate> (8000, 16000, 24000 or 48000), PCMU,
+ * PCMA, or "session" for the session's own codec (G.711 as is, anything
+ * else as L16 at the session rate, so neither direction resamples).
+ */
+static switch_status_t socket_audio_format_parse(switch_core_session_t *session, const char *spec,
+                                                 const socket_audio_format_t *session_fmt, socket_audio_format_t *fmt)
+{
+    const char *rate = strchr(spec, '/');
+    size_t name_len = rate ? (size_t)(rate - spec) : strlen(spec);
+
+    if (!strcasecmp(spec, "session")) {
+        *fmt = *session_fmt;
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (name_len == 4 && (!strncasecmp(spec, "PCMU", 4) || !strncasecmp(spec, "PCMA", 4))) {
+        if (rate && atoi(rate + 1) != 8000) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "Invalid socket format %s: G.711 is 8000Hz only\n", spec);
+            return SWITCH_STATUS_FALSE;
+        }
+        fmt->encoding = !strncasecmp(spec, "PCMU", 4) ? SOCKET_AUDIO_ENC_PCMU : SOCKET_AUDIO_ENC_PCMA;
+        fmt->rate = 8000;
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (name_len == 3 && !strncasecmp(spec, "L16", 3)) {
+        fmt->encoding = SOCKET_AUDIO_ENC_L16;
+        fmt->rate = rate ? (uint32_t)atoi(rate + 1) : session_fmt->rate;
+        if (fmt->rate == 8000 || fmt->rate == 16000 || fmt->rate == 24000 || fmt->rate == 48000) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                          "Invalid socket format %s: L16 rate must be 8000, 16000, 24000 or 48000\n", spec);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (name_len == 4 && !strncasecmp(spec, "opus", 4)) {
+        /* Media bugs only see decoded audio, so Opus would mean a second encoder/decoder per call */
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                          "Opus is not supported as a socket format, use L16/48000 or session\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                      "Unknown socket format: %s\n", spec);
+    return SWITCH_STATUS_FALSE;
+}
+
+/*
+ * off, detect (or true) for events only, suppress to also keep silence from
+ * the sidecar.
+ */
+static socket_audio_vad_mode_t socket_audio_vad_mode_parse(const char *value)
+{
+    if (!zstr(value) && !strcasecmp(value, "suppress")) {
+        return SOCKET_AUDIO_VAD_SUPPRESS;
+    }
+    if (!zstr(value) && (!strcasecmp(value, "detect") || switch_true(value))) {
+        return SOCKET_AUDIO_VAD_DETECT;
+    }
+    return SOCKET_AUDIO_VAD_OFF;
+}
+
+/*
+ * Joined legs: off, mix (any truthy value) or interleave.
+ */
+static socket_audio_legs_mode_t socket_audio_legs_mode_parse(const char *value)
+{
+    if (!zstr(value) && !strcasecmp(value, "interleave")) {
+        return SOCKET_AUDIO_LEGS_INTERLEAVE;
+    }
+    if (!zstr(value) && (!strcasecmp(value, "mix") || switch_true(value))) {
+        return SOCKET_AUDIO_LEGS_MIX;
+    }
+    return SOCKET_AUDIO_LEGS_OFF;
+}
+
+/*
+ * cache-rates: comma-separated session rates, up to SOCKET_AUDIO_CACHE_RATES_MAX;
+ * anything but 8000-48000 is skipped, so "none" (or empty) lists none.
+ */
+static void socket_audio_cache_rates_parse(const char *value)
+{
+    const char *p = value ? value : "";
+
+    globals.cache_rates_count = 0;
+    while (*p && globals.cache_rates_count < SOCKET_AUDIO_CACHE_RATES_MAX) {
+        char *end;
+        unsigned long rate = strtoul(p, &end, 10);
+
+        if (rate >= 8000 && rate <= 48000) {
+            globals.cache_rates[globals.cache_rates_count++] = (uint32_t)rate;
+        }
+        p = end;
+        while (*p && *p != ',') {
+            p++;
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+}
+
+/*
+ * Prompt cache
+ *
+ * Module-wide clips (greetings, fillers, hold prompts) that sidecars load once
+ * and then play on any call by ID, so the audio is neither resent nor
+ * resampled per call and never occupies a playback queue. Each clip is kept
+ * as loaded plus at each session rate in cache-rates or asked for since, all
+ * in one hash table under cache_mutex; readers only hold it for a lookup.
+ * Copies are made by the cache thread, within the same cache-max-mb budget;
+ * until one is listed, pipes at that rate resample the clip as it plays.
+ */
+static uint32_t socket_audio_cache_bucket(const char *id)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *id; id++) {
+        h = (h ^ (uint8_t)*id) * 16777619u;
+    }
+
+    return h & (SOCKET_AUDIO_CACHE_BUCKETS - 1);
+}
+
+static socket_audio_clip_t *socket_audio_clip_create(const char *id, uint32_t rate, uint32_t samples)
+{
+    socket_audio_clip_t *clip = malloc(sizeof(*clip) + (size_t)samples * sizeof(int16_t));
+
+    if (!clip) {
+        return NULL;
+    }
+    memset(clip, 0, sizeof(*clip));
+    switch_copy_string(clip->id, id, sizeof(clip->id));
+    clip->refs = 1;
+    clip->rate = rate;
+    clip->samples = samples;
+
+    return clip;
+}
+
+static void socket_audio_clip_release(socket_audio_clip_t *clip)
+{
+    if (clip && __atomic_sub_fetch(&clip->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(clip);
+    }
+}
+
+/*
+ * Unlist a clip at every rate. Returns how many entries went. Under cache_mutex.
+ */
+static uint32_t socket_audio_cache_unlink(const char *id)
+{
+    socket_audio_clip_t **link = &globals.cache[socket_audio_cache_bucket(id)];
+    uint32_t removed = 0;
+
+    while (*link) {
+        socket_audio_clip_t *clip = *link;
+
+        if (strcmp(clip->id, id)) {
+            link = &clip->next;
+            continue;
+        }
+        *link = clip->next;
+        globals.cache_bytes -= (switch_size_t)clip->samples * sizeof(int16_t);
+        if (clip->source) {
+            globals.cache_clips--;
+        }
+        socket_audio_clip_release(clip);
+        removed++;
+    }
+
+    return removed;
+}
+
+/*
+ * Queue a copy of source at rate for the cache thread, once per source and
+ * rate and only if it would fit. Returns whether one was queued (wake the
+ * thread once the lock is dropped). Under cache_mutex.
+ */
+static switch_bool_t socket_audio_cache_queue(socket_audio_clip_t *source, uint32_t rate)
+{
+    socket_audio_clip_job_t **link, *job;
+    switch_size_t bytes = (switch_size_t)((uint64_t)source->samples * rate / source->rate) * sizeof(int16_t);
+
+    if (!globals.cache_thread || rate == source->rate) {
+        return SWITCH_FALSE;
+    }
+    for (link = &globals.cache_jobs; *link && ((*link)->source != source || (*link)->rate != rate); link = &(*link)->next);
+    if (*link || globals.cache_bytes + bytes > globals.cache_max_bytes || !(job = malloc(sizeof(*job)))) {
+        return SWITCH_FALSE;
+    }
+    __atomic_add_fetch(&source->refs, 1, __ATOMIC_RELAXED);
+    job->source = source;
+    job->rate = rate;
+    job->next = NULL;
+    *link = job;
+
+    return SWITCH_TRUE;
+}
+
+static void socket_audio_cache_wake(void)
+{
+    uint64_t one = 1;
+
+    if (write(globals.cache_wake_fd, &one, sizeof(one)) < 0) {
+        /* Counter saturated: the thread is due to wake anyway */
+    }
+}
+
+/*
+ * List a loaded clip, replacing any clip with the same ID (plays already
+ * under way finish on the old one), and queue its copies at cache-rates.
+ * Takes the caller's reference; a clip the cache has no room for, even once
+ * the one it replaces is gone, is freed and SWITCH_STATUS_FALSE returned, and
+ * the old one stays.
+ */
+static switch_status_t socket_audio_cache_put(socket_audio_clip_t *clip)
+{
+    switch_size_t bytes = (switch_size_t)clip->samples * sizeof(int16_t);
+    switch_size_t freed = 0;
+    uint32_t bucket = socket_audio_cache_bucket(clip->id);
+    socket_audio_clip_t *old;
+    switch_bool_t queued = SWITCH_FALSE;
+    uint32_t i;
+
+    clip->source = 1;
+
+    switch_mutex_lock(globals.cache_mutex);
+    for (old = globals.cache[bucket]; old; old = old->next) {
+        if (!strcmp(old->id, clip->id)) {
+            freed += (switch_size_t)old->samples * sizeof(int16_t);
+        }
+    }
+    if (globals.cache_bytes - freed + bytes > globals.cache_max_bytes) {
+        switch_mutex_unlock(globals.cache_mutex);
+        socket_audio_clip_release(clip);
+        return SWITCH_STATUS_FALSE;
+    }
+    socket_audio_cache_unlink(clip->id);
+    clip->next = globals.cache[bucket];
+    globals.cache[bucket] = clip;
+    globals.cache_bytes += bytes;
+    globals.cache_clips++;
+    for (i = 0; i < globals.cache_rates_count; i++) {
+        queued |= socket_audio_cache_queue(clip, globals.cache_rates[i]);
+    }
+    switch_mutex_unlock(globals.cache_mutex);
+
+    if (queued) {
+        socket_audio_cache_wake();
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Audio bytes the cache could still take for a clip stored as id, counting
+ * what replacing a clip by that ID would free ("" for none).
+ */
+static switch_size_t socket_audio_cache_room(const char *id)
+{
+    switch_size_t room;
+    socket_audio_clip_t *clip;
+
+    switch_mutex_lock(globals.cache_mutex);
+    room = globals.cache_max_bytes > globals.cache_bytes ? globals.cache_max_bytes - globals.cache_bytes : 0;
+    for (clip = *id ? globals.cache[socket_audio_cache_bucket(id)] : NULL; clip; clip = clip->next) {
+        if (!strcmp(clip->id, id)) {
+            room += (switch_size_t)clip->samples * sizeof(int16_t);
+        }
+    }
+    switch_mutex_unlock(globals.cache_mutex);
+
+    return room;
+}
+
+/*
+ * Resample a whole clip, with the resampler the pipes would use.
+ */
+static socket_audio_clip_t *socket_audio_clip_resample(const socket_audio_clip_t *source, uint32_t rate)
+{
+    switch_memory_pool_t *pool = NULL;
+    socket_audio_resampler_t *r = NULL;
+    socket_audio_clip_t *clip = NULL;
+    uint32_t cap = (uint32_t)((uint64_t)source->samples * rate / source->rate) + SOCKET_AUDIO_RESAMPLE_MAX_IN;
+    uint32_t len = 0, i, n;
+
+    if (switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        return NULL;
+    }
+    if (socket_audio_resampler_create(&r, source->rate, rate, SOCKET_AUDIO_RESAMPLE_MAX_IN, pool) == SWITCH_STATUS_SUCCESS &&
+        (clip = socket_audio_clip_create(source->id, rate, cap))) {
+        for (i = 0; i < source->samples; i += n) {
+            n = source->samples - i < SOCKET_AUDIO_RESAMPLE_MAX_IN ? source->samples - i : SOCKET_AUDIO_RESAMPLE_MAX_IN;
+            socket_audio_resample(r, source->pcm + i, n);
+            if (r->out_len > cap - len) {
+                r->out_len = cap - len;
+            }
+            memcpy(clip->pcm + len, r->out, r->out_len * sizeof(int16_t));
+            len += r->out_len;
+        }
+        clip->samples = len;
+    }
+    socket_audio_resampler_destroy(&r);
+    switch_core_destroy_memory_pool(&pool);
+
+    return clip;
+}
+
+/*
+ * The clip for id at rate, with a reference for the caller, or NULL if there
+ * is no such ID. Without a copy at rate yet, one is queued for the cache
+ * thread (making it here would hold up every pipe on the reactor for as long
+ * as the clip takes to resample) and the clip as loaded is returned, for the
+ * clock to resample as it plays. Reactor threads.
+ */
+static socket_audio_clip_t *socket_audio_cache_get(const char *id, uint32_t rate)
+{
+    uint32_t bucket = socket_audio_cache_bucket(id);
+    socket_audio_clip_t *clip, *source = NULL;
+    switch_bool_t queued;
+
+    switch_mutex_lock(globals.cache_mutex);
+    for (clip = globals.cache[bucket]; clip; clip = clip->next) {
+        if (strcmp(clip->id, id)) {
+            continue;
+        }
+        if (clip->rate == rate) {
+            __atomic_add_fetch(&clip->refs, 1, __ATOMIC_RELAXED);
+            switch_mutex_unlock(globals.cache_mutex);
+            return clip;
+        }
+        if (clip->source) {
+            source = clip;
+        }
+    }
+    if (!source) {
+        switch_mutex_unlock(globals.cache_mutex);
+        return NULL;
+    }
+    __atomic_add_fetch(&source->refs, 1, __ATOMIC_RELAXED);
+    queued = socket_audio_cache_queue(source, rate);
+    switch_mutex_unlock(globals.cache_mutex);
+
+    if (queued) {
+        socket_audio_cache_wake();
+    }
+
+    return source;
+}
+
+/*
+ * Make a queued copy and list it, unless the clip was replaced or deleted
+ * meanwhile, a copy at that rate is listed already (queued again while this
+ * one was being made) or it does not fit in cache-max-mb. Cache thread only.
+ */
+static void socket_audio_cache_make(socket_audio_clip_job_t *job)
+{
+    socket_audio_clip_t *source = job->source, *made, *clip;
+    uint32_t bucket = socket_audio_cache_bucket(source->id);
+    const char *dropped = NULL;
+
+    switch_mutex_lock(globals.cache_mutex);
+    for (clip = globals.cache[bucket]; clip && !(clip->rate == job->rate && !strcmp(clip->id, source->id)); clip = clip->next);
+    switch_mutex_unlock(globals.cache_mutex);
+    if (clip) {
+        return;
+    }
+
+    if (!(made = socket_audio_clip_resample(source, job->rate))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                          "Clip '%s' could not be resampled to %u Hz\n", source->id, job->rate);
+        return;
+    }
+
+    switch_mutex_lock(globals.cache_mutex);
+    for (clip = globals.cache[bucket]; clip && clip != source; clip = clip->next);
+    if (clip && globals.cache_bytes + (switch_size_t)made->samples * sizeof(int16_t) <= globals.cache_max_bytes) {
+        made->next = globals.cache[bucket];
+        globals.cache[bucket] = made;
+        globals.cache_bytes += (switch_size_t)made->samples * sizeof(int16_t);
+        made = NULL;  /* The cache's reference now */
+    } else if (clip) {
+        dropped = "cache full";
+    }
+    switch_mutex_unlock(globals.cache_mutex);
+
+    if (dropped) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                          "Clip '%s' not cached at %u Hz: %s\n", source->id, job->rate, dropped);
+    }
+    socket_audio_clip_release(made);
+}
+
+static void *SWITCH_THREAD_FUNC socket_audio_cache_thread(switch_thread_t *thread, void *obj)
+{
+    for (;;) {
+        socket_audio_clip_job_t *job;
+        struct pollfd pfd;
+        uint64_t count;
+
+        switch_mutex_lock(globals.cache_mutex);
+        if ((job = globals.cache_jobs)) {
+            globals.cache_jobs = job->next;
+        }
+        switch_mutex_unlock(globals.cache_mutex);
+
+        if (job) {
+            if (globals.running) {
+                socket_audio_cache_make(job);
+            }
+            socket_audio_clip_release(job->source);
+            free(job);
+            continue;
+        }
+        if (!globals.running) {
+            break;
+        }
+
+        /* A job queued after the check above has already bumped the counter */
+        pfd.fd = globals.cache_wake_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, SOCKET_AUDIO_EVENT_IDLE_MS) > 0 && read(globals.cache_wake_fd, &count, sizeof(count)) < 0) {
+            /* Spurious wakeup; the queue is re-checked either way */
+        }
+    }
+
+    return NULL;
+}
+
+static void socket_audio_cache_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+
+    if ((globals.cache_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                          "Prompt cache: failed to create eventfd, clips play at their loaded rate only\n");
+        return;
+    }
+
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&globals.cache_thread, thd_attr, socket_audio_cache_thread, NULL, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                          "Prompt cache: failed to create resampling thread, clips play at their loaded rate only\n");
+        globals.cache_thread = NULL;
+        close(globals.cache_wake_fd);
+        globals.cache_wake_fd = -1;
+    }
+}
+
+/* Call after globals.running is cleared; queued copies are dropped */
+static void socket_audio_cache_stop(void)
+{
+    switch_status_t st;
+    uint64_t one = 1;
+
+    if (!globals.cache_thread) {
+        return;
+    }
+
+    if (write(globals.cache_wake_fd, &one, sizeof(one)) < 0) {
+        /* Counter saturated: a wakeup is pending anyway */
+    }
+    switch_thread_join(&st, globals.cache_thread);
+    globals.cache_thread = NULL;
+    close(globals.cache_wake_fd);
+    globals.cache_wake_fd = -1;
+}
+
+/*
+ * Load a clip from a raw L16 mono file at rate. Returns an error message, or
+ * NULL once listed.
+ */
+static const char *socket_audio_cache_load(const char *id, const char *path, uint32_t rate)
+{
+    socket_audio_clip_t *clip;
+    FILE *f;
+    long size;
+    size_t got;
+
+    if (strlen(id) > SOCKET_AUDIO_MARK_NAME_MAX) {
+        return "ID too long";
+    }
+    if (!(f = fopen(path, "rb"))) {
+        return "cannot open file";
+    }
+    if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < (long)sizeof(int16_t) || fseek(f, 0, SEEK_SET)) {
+        fclose(f);
+        return "empty or unreadable file";
+    }
+    if ((switch_size_t)size > globals.cache_max_bytes) {
+        fclose(f);
+        return "larger than the cache";
+    }
+    if (!(clip = socket_audio_clip_create(id, rate, (uint32_t)(size / sizeof(int16_t))))) {
+        fclose(f);
+        return "out of memory";
+    }
+    got = fread(clip->pcm, sizeof(int16_t), clip->samples, f);
+    fclose(f);
+    if (got != clip->samples) {
+        socket_audio_clip_release(clip);
+        return "short read";
+    }
+
+    return socket_audio_cache_put(clip) == SWITCH_STATUS_SUCCESS ? NULL : "cache full";
+}
+
+/*
+ * Drop every clip (module unload; no pipe is left to play one).
+ */
+static void socket_audio_cache_clear(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < SOCKET_AUDIO_CACHE_BUCKETS; i++) {
+        while (globals.cache[i]) {
+            socket_audio_clip_t *clip = globals.cache[i];
+
+            globals.cache[i] = clip->next;
+            socket_audio_clip_release(clip);
+        }
+    }
+    globals.cache_bytes = 0;
+    globals.cache_clips = 0;
+}
+
+/*
+ * Control ring (SPSC)
+ */
+static switch_bool_t socket_audio_ring_push(socket_audio_ring_t *ring, const socket_audio_msg_t *msg)
+{
+    uint32_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == SOCKET_AUDIO_MSG_SLOTS) {
+        return SWITCH_FALSE;
+    }
+
+    ring->slots[head & (SOCKET_AUDIO_MSG_SLOTS - 1)] = *msg;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return SWITCH_TRUE;
+}
+
+/*
+ * Consumer: the i-th pending message (0 = oldest), or NULL.
+ */
+static socket_audio_msg_t *socket_audio_ring_peek(socket_audio_ring_t *ring, uint32_t i)
+{
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail <= i) {
+        return NULL;
+    }
+
+    return &ring->slots[(ring->tail + i) & (SOCKET_AUDIO_MSG_SLOTS - 1)];
+}
+
+static void socket_audio_ring_pop(socket_audio_ring_t *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Turn IDs (framed mode)
+ *
+ * Audio tagged with SOCKET_AUDIO_FLAG_TURN carries a turn ID in seq. A flush
+ * with a turn ID drops queued audio of older turns and, from then on, any
+ * older-turn audio still in flight. IDs compare as serial numbers so they may
+ * wrap. Advanced by the API and the reactor, read by the reactor and clock.
+ */
+static void socket_audio_turn_advance(socket_audio_ctx_t *ctx, uint32_t turn)
+{
+    uint32_t cur = __atomic_load_n(&ctx->min_turn, __ATOMIC_ACQUIRE);
+
+    do {
+        if (__atomic_load_n(&ctx->min_turn_valid, __ATOMIC_ACQUIRE) && (int32_t)(turn - cur) <= 0) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&ctx->min_turn, &cur, turn, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    __atomic_store_n(&ctx->min_turn_valid, 1, __ATOMIC_RELEASE);
+}
+
+static switch_bool_t socket_audio_turn_stale(socket_audio_ctx_t *ctx, uint32_t turn)
+{
+    return __atomic_load_n(&ctx->min_turn_valid, __ATOMIC_ACQUIRE) &&
+           (int32_t)(turn - __atomic_load_n(&ctx->min_turn, __ATOMIC_ACQUIRE)) < 0;
+}
+
+/*
+ * Event dispatch
+ *
+ * Media, clock and connector threads post events here instead of firing
+ * them: switch_event_fire takes the core event mutexes and allocates, which
+ * is jitter the playback clock cannot afford, and a burst of marks must not
+ * delay the next frame. Any thread may post (CAS on head); only the
+ * dispatcher fires. A full ring drops the event and counts it rather than
+ * blocking the poster.
+ */
+static const char *socket_audio_event_subclass[] = {
+    "socket_audio::playback_start",
+    "socket_audio::playback_stop",
+    "socket_audio::mark",
+    "socket_audio::speech_start",
+    "socket_audio::speech_stop",
+    "socket_audio::barge_in",
+    "socket_audio::reconnect"
+};
+
+static void socket_audio_event_post(socket_audio_ctx_t *ctx, socket_audio_event_kind_t kind, const char *reason,
+                                    uint32_t num, const char *text, switch_size_t text_len, switch_port_t port)
+{
+    socket_audio_events_t *events = globals.events;
+    socket_audio_event_slot_t *slot;
+    uint64_t pos;
+
+    if (!events) {
+        return;
+    }
+
+    pos = __atomic_load_n(&events->head, __ATOMIC_RELAXED);
+    for (;;) {
+        int64_t diff;
+
+        slot = &events->slots[pos & (SOCKET_AUDIO_EVENT_SLOTS - 1)];
+        diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&events->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_add_fetch(&events->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&events->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->kind = kind;
+    slot->reason = reason;
+    slot->num = num;
+    slot->port = port;
+    switch_copy_string(slot->uuid, switch_core_session_get_uuid(ctx->session), sizeof(slot->uuid));
+    if (text_len > sizeof(slot->text) - 1) {
+        text_len = sizeof(slot->text) - 1;
+    }
+    if (text_len) {
+        memcpy(slot->text, text, text_len);
+    }
+    slot->text[text_len] = '\0';
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in the dispatcher between setting sleeping and
+     * re-checking the ring: either it sees this event or we see it asleep */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&events->sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&events->sleeping, 0, __ATOMIC_ACQ_REL)) {
+        uint64_t one = 1;
+
+        if (write(events->wake_fd, &one, sizeof(one)) < 0) {
+            /* Counter saturated: the dispatcher is already due to wake */
+        }
+    }
+}
+
+static void socket_audio_event_fire(const socket_audio_event_slot_t *slot)
+{
+    switch_event_t *event;
+    switch_core_session_t *session;
+
+    if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, socket_audio_event_subclass[slot->kind]) != SWITCH_STATUS_SUCCESS) {
+        return;
+    }
+
+    /* The call may have ended since the post; the event still goes out */
+    if ((session = switch_core_session_locate(slot->uuid))) {
+        switch_channel_event_set_data(switch_core_session_get_channel(session), event);
+        switch_core_session_rwunlock(session);
+    } else {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", slot->uuid);
+    }
+
+    switch (slot->kind) {
+    case SOCKET_AUDIO_EVENT_PLAYBACK_STOP:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Playback-Stop-Reason", slot->reason);
+        break;
+    case SOCKET_AUDIO_EVENT_MARK:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Mark-Name", slot->text);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Mark-Seq", "%u", slot->num);
+        break;
+    case SOCKET_AUDIO_EVENT_BARGE_IN:
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Barge-In-Speech-Ms", "%u", slot->num);
+        break;
+    case SOCKET_AUDIO_EVENT_RECONNECT:
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Reconnect-State", slot->reason);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Reconnect-Attempt", "%u", slot->num);
+        if (*slot->text) {
+            if (slot->port) {
+                switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Reconnect-Host", "%s:%u", slot->text, slot->port);
+            } else {
+                switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Reconnect-Host", slot->text);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    switch_event_fire(&event);
+}
+
+/*
+ * Dispatcher thread: fire events in posting order until shutdown, then
+ * drain what is left. Sleeps on wake_fd only after announcing it and finding
+ * the ring still empty.
+ */
+static void *SWITCH_THREAD_FUNC socket_audio_event_thread(switch_thread_t *thread, void *obj)
+{
+    socket_audio_events_t *events = globals.events;
+    uint32_t dropped_seen = 0;
+
+    for (;;) {
+        socket_audio_event_slot_t *slot = &events->slots[events->tail & (SOCKET_AUDIO_EVENT_SLOTS - 1)];
+        struct pollfd pfd;
+        uint64_t count;
+        uint32_t dropped;
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == events->tail + 1) {
+            socket_audio_event_fire(slot);
+            __atomic_store_n(&slot->seq, events->tail + SOCKET_AUDIO_EVENT_SLOTS, __ATOMIC_RELEASE);
+            events->tail++;
+            continue;
+        }
+
+        dropped = __atomic_load_n(&events->dropped, __ATOMIC_RELAXED);
+        if (dropped != dropped_seen) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                              "Event ring full, dropped %u events\n", dropped - dropped_seen);
+            dropped_seen = dropped;
+        }
+
+        if (!globals.running) {
+            break;
+        }
+
+        __atomic_store_n(&events->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == events->tail + 1) {
+            __atomic_store_n(&events->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        pfd.fd = events->wake_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, SOCKET_AUDIO_EVENT_IDLE_MS) > 0 && read(events->wake_fd, &count, sizeof(count)) < 0) {
+            /* Spurious wakeup; the ring is re-checked either way */
+        }
+        __atomic_store_n(&events->sleeping, 0, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+static switch_status_t socket_audio_events_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    socket_audio_events_t *events;
+    uint32_t i;
+
+    if (!(events = switch_core_alloc(globals.pool, sizeof(*events)))) {
+        return SWITCH_STATUS_MEMERR;
+    }
+    memset(events, 0, sizeof(*events));
+    for (i = 0; i < SOCKET_AUDIO_EVENT_SLOTS; i++) {
+        events->slots[i].seq = i;
+    }
+
+    if ((events->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to create event dispatcher eventfd\n");
+        return SWITCH_STATUS_GENERR;
+    }
+
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    globals.events = events;
+    if (switch_thread_create(&events->thread, thd_attr, socket_audio_event_thread, NULL, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to create event dispatcher thread\n");
+        globals.events = NULL;
+        close(events->wake_fd);
+        return SWITCH_STATUS_GENERR;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Call after globals.running is cleared and every other module thread has
+ * stopped posting; the dispatcher fires what is queued, then exits */
+static void socket_audio_events_stop(void)
+{
+    socket_audio_events_t *events = globals.events;
+    switch_status_t st;
+    uint64_t one = 1;
+
+    if (!events) {
+        return;
+    }
+
+    if (write(events->wake_fd, &one, sizeof(one)) < 0) {
+        /* Counter saturated: a wakeup is pending anyway */
+    }
+    switch_thread_join(&st, events->thread);
+    globals.events = NULL;
+    close(events->wake_fd);
+}
+
+/*
+ * Post a playback_*, speech_* event for the pipe. reason is only used by
+ * playback_stop.
+ */
+static void socket_audio_fire_playback_event(socket_audio_ctx_t *ctx, socket_audio_event_kind_t kind, const char *reason)
+{
+    socket_audio_event_post(ctx, kind, reason, 0, NULL, 0, 0);
+}
+
+static void socket_audio_fire_reconnect_event(socket_audio_ctx_t *ctx, const char *state, uint32_t attempt,
+                                              const char *host, switch_port_t port)
+{
+    socket_audio_event_post(ctx, SOCKET_AUDIO_EVENT_RECONNECT, state, attempt, host, host ? strlen(host) : 0, port);
+}
+
+static void socket_audio_conn_destroy(socket_audio_conn_t *conn)
+{
+    switch_memory_pool_t *pool = conn->pool;
+
+    switch_socket_close(conn->sock);
+    switch_core_destroy_memory_pool(&pool);
+}
+
+static void socket_audio_shm_destroy(socket_audio_ctx_t *ctx)
+{
+    if (!ctx->shm) {
+        return;
+    }
+    munmap(ctx->shm, ctx->shm_len);
+    ctx->shm = NULL;
+    ctx->shm_mic = ctx->shm_speaker = NULL;
+    if (ctx->shm_mic_fd >= 0) {
+        close(ctx->shm_mic_fd);
+        ctx->shm_mic_fd = -1;
+    }
+}
+
+/*
+ * Pop the oldest control message, dropping the clip a PLAY holds. Clock
+ * thread (the reactor at teardown).
+ */
+static void socket_audio_pipe_control_pop(socket_audio_ctx_t *ctx)
+{
+    socket_audio_msg_t *msg = socket_audio_ring_peek(&ctx->control, 0);
+
+    if (msg && msg->clip) {
+        socket_audio_clip_release(msg->clip);
+        msg->clip = NULL;
+    }
+    socket_audio_ring_pop(&ctx->control);
+}
+
+/*
+ * Stop the cached clip playing, if any. Clock thread only.
+ */
+static void socket_audio_pipe_clip_stop(socket_audio_ctx_t *ctx)
+{
+    if (ctx->clip) {
+        socket_audio_clip_release(ctx->clip);
+        ctx->clip = NULL;
+    }
+}
+
+/*
+ * Ready clip_resampler for a clip at rate, with nothing buffered. The
+ * resampler is kept for the next clip at the same rate and remade, in a fresh
+ * pool, for one at another. Returns SWITCH_FALSE if it cannot be made (the
+ * clip is then skipped). Clock thread only.
+ */
+static switch_bool_t socket_audio_pipe_clip_resampler(socket_audio_ctx_t *ctx, uint32_t rate)
+{
+    uint32_t n = ctx->session_frame_bytes / sizeof(int16_t);
+
+    ctx->clip_buf_len = 0;
+    if (ctx->clip_resampler && ctx->clip_rate == rate) {
+        if (!ctx->clip_resampler->fallback) {
+            socket_audio_resampler_reset(ctx->clip_resampler);
+        }
+        return SWITCH_TRUE;
+    }
+
+    socket_audio_resampler_destroy(&ctx->clip_resampler);
+    if (ctx->clip_pool) {
+        switch_core_destroy_memory_pool(&ctx->clip_pool);
+    }
+    ctx->clip_rate = 0;
+    if (switch_core_new_memory_pool(&ctx->clip_pool) != SWITCH_STATUS_SUCCESS ||
+        socket_audio_resampler_create(&ctx->clip_resampler, rate, ctx->session_rate,
+                                      SOCKET_AUDIO_RESAMPLE_MAX_IN, ctx->clip_pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+                          "Failed to create clip resampler %uHz->%uHz, clip skipped\n", rate, ctx->session_rate);
+        return SWITCH_FALSE;
+    }
+    /* One frame's worth of input yields about a frame; room for a generous overshoot */
+    ctx->clip_buf_cap = 3 * n;
+    ctx->clip_buf = switch_core_alloc(ctx->clip_pool, ctx->clip_buf_cap * sizeof(int16_t));
+    ctx->clip_rate = rate;
+
+    return SWITCH_TRUE;
+}
+
+/*
+ * Handle a pending flush request: clear the queue and enter timed discard mode.
+ * Called from the clock thread only.
+ */
+static void socket_audio_pipe_flush(socket_audio_ctx_t *ctx)
+{
+    socket_audio_msg_t *msg;
+    switch_size_t flushed_bytes;
+    uint8_t barge_in = __atomic_exchange_n(&ctx->flush_barge_in, 0, __ATOMIC_ACQUIRE);
+    uint32_t discard_us = barge_in ? ctx->barge_in_hangover_ms * 1000 : SOCKET_AUDIO_DISCARD_DURATION_US;
+
+    /* Start the discard window before clearing so the reactor stops queueing stale audio.
+     * After a barge-in the sidecar has not reacted yet, so the window is its hangover */
+    ctx->discard_until = switch_time_now() + discard_us;
+    __atomic_store_n(&ctx->flush_flag, 0, __ATOMIC_RELEASE);
+    flushed_bytes = socket_audio_queue_zero(&ctx->audio_queue);
+    socket_audio_pipe_clip_stop(ctx);
+    socket_audio_stat_flush(ctx, ctx->flush_req_at);
+
+    /* Marks and clips for the flushed audio will never play */
+    while ((msg = socket_audio_ring_peek(&ctx->control, 0)) &&
+           (msg->type == SOCKET_AUDIO_MSG_MARK || msg->type == SOCKET_AUDIO_MSG_TURN || msg->type == SOCKET_AUDIO_MSG_PLAY) &&
+           msg->pos <= ctx->audio_queue.tail) {
+        socket_audio_pipe_control_pop(ctx);
+    }
+
+    /* Fire playback_stop event if we were playing */
+    if (ctx->is_playing) {
+        ctx->is_playing = 0;
+        socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_STOP, barge_in ? "barge_in" : "flush");
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Socket audio playback stopped (%s)\n", barge_in ? "barge_in" : "flush");
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                      "Audio interrupted: flushed %zu bytes, discarding for %ums\n",
+                      flushed_bytes, discard_us / 1000);
+}
+
+/*
+ * Queue a control reply for the media thread to send. Clock thread only.
+ */
+static void socket_audio_pipe_reply(socket_audio_ctx_t *ctx, const socket_audio_msg_t *msg)
+{
+    if (!socket_audio_ring_push(&ctx->outbox, msg)) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                          "Control reply outbox full, dropped reply type=%u seq=%u\n", msg->type, msg->seq);
+    }
+}
+
+/*
+ * A mark has been played out (or cleared): echo it and fire socket_audio::mark.
+ */
+static void socket_audio_pipe_mark(socket_audio_ctx_t *ctx, const socket_audio_msg_t *msg)
+{
+    socket_audio_pipe_reply(ctx, msg);
+    socket_audio_event_post(ctx, SOCKET_AUDIO_EVENT_MARK, NULL, msg->seq, (const char *)msg->payload, msg->len, 0);
+}
+
+/*
+ * Apply in-band commands from the sidecar (framed mode). Clock thread only.
+ *
+ * A FLUSH or CLEAR cuts the playback queue at the position it arrived at, so
+ * audio sent before it is dropped and audio sent after it plays; no discard
+ * window is needed. When several are pending only the newest cut is applied
+ * (it covers the others) but each is acknowledged. Marks before a FLUSH are
+ * dropped, marks before a CLEAR are echoed, and clips before either (playing
+ * or not) are dropped. Any other mark is echoed once playout reaches its
+ * position; a PLAY there starts its clip, and what follows waits for the end
+ * of it.
+ */
+static void socket_audio_pipe_control(socket_audio_ctx_t *ctx)
+{
+    socket_audio_msg_t *msg, *cut = NULL;
+    uint32_t i, cut_count = 0;
+
+    for (i = 0; (msg = socket_audio_ring_peek(&ctx->control, i)); i++) {
+        if (msg->type == SOCKET_AUDIO_MSG_FLUSH || msg->type == SOCKET_AUDIO_MSG_CLEAR) {
+            cut = msg;
+            cut_count = i + 1;
+        }
+    }
+
+    if (cut) {
+        const char *reason = cut->type == SOCKET_AUDIO_MSG_CLEAR ? "clear" : "flush";
+        uint8_t cut_type = cut->type;
+        switch_size_t dropped = socket_audio_queue_skip(&ctx->audio_queue, cut->pos);
+
+        socket_audio_pipe_clip_stop(ctx);
+        socket_audio_stat_flush(ctx, cut->at);
+
+        if (ctx->is_playing) {
+            ctx->is_playing = 0;
+            socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_STOP, reason);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                              "Socket audio playback stopped (%s)\n", reason);
+        }
+
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Audio interrupted in-band (%s seq=%u): dropped %zu bytes\n",
+                          reason, cut->seq, dropped);
+
+        for (i = 0; i < cut_count; i++) {
+            msg = socket_audio_ring_peek(&ctx->control, 0);
+            if (msg->type == SOCKET_AUDIO_MSG_FLUSH || msg->type == SOCKET_AUDIO_MSG_CLEAR) {
+                socket_audio_pipe_reply(ctx, msg);
+            } else if (msg->type == SOCKET_AUDIO_MSG_MARK && cut_type == SOCKET_AUDIO_MSG_CLEAR) {
+                socket_audio_pipe_mark(ctx, msg);
+            }
+            socket_audio_pipe_control_pop(ctx);
+        }
+    }
+
+    while (!ctx->clip && (msg = socket_audio_ring_peek(&ctx->control, 0)) && msg->pos <= ctx->audio_queue.tail) {
+        if (msg->type == SOCKET_AUDIO_MSG_MARK) {
+            socket_audio_pipe_mark(ctx, msg);
+        } else if (msg->type == SOCKET_AUDIO_MSG_PLAY &&
+                   (msg->clip->rate == ctx->session_rate || socket_audio_pipe_clip_resampler(ctx, msg->clip->rate))) {
+            ctx->clip = msg->clip;
+            ctx->clip_pos = msg->pos;
+            ctx->clip_off = 0;
+            msg->clip = NULL;
+            socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_CLIP_PLAYS, 1);
+            if (ctx->clip->rate != ctx->session_rate) {
+                socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_CLIP_RESAMPLED, 1);
+            }
+        }
+        socket_audio_pipe_control_pop(ctx);
+    }
+}
+
+/*
+ * Handle a pending flush with a turn ID (framed mode). Clock thread only.
+ *
+ * Cuts the queue where the first audio of the flushed-to turn (or a later
+ * one) begins, so audio the sidecar already sent for the new turn survives,
+ * and no discard window is needed: the reactor drops older turns on arrival.
+ */
+static void socket_audio_pipe_flush_turn(socket_audio_ctx_t *ctx)
+{
+    uint32_t turn = __atomic_load_n(&ctx->min_turn, __ATOMIC_ACQUIRE);
+    socket_audio_msg_t *msg;
+    uint64_t cut_pos;
+    switch_size_t dropped;
+    uint8_t found = 0;
+
+    __atomic_store_n(&ctx->turn_flush, 0, __ATOMIC_RELEASE);
+
+    /* Snapshot head before scanning: a turn marker pushed later lies at or past it */
+    cut_pos = __atomic_load_n(&ctx->audio_queue.head, __ATOMIC_ACQUIRE);
+
+    while ((msg = socket_audio_ring_peek(&ctx->control, 0)) && msg->pos <= cut_pos) {
+        if (msg->type == SOCKET_AUDIO_MSG_TURN && (int32_t)(msg->seq - turn) >= 0) {
+            cut_pos = msg->pos;
+            found = 1;
+            socket_audio_ring_pop(&ctx->control);
+            break;
+        }
+        if (msg->type == SOCKET_AUDIO_MSG_FLUSH || msg->type == SOCKET_AUDIO_MSG_CLEAR) {
+            socket_audio_pipe_reply(ctx, msg);  /* Superseded, but still acknowledged */
+        }
+        socket_audio_pipe_control_pop(ctx);
+    }
+
+    dropped = socket_audio_queue_skip(&ctx->audio_queue, cut_pos);
+    if (ctx->clip && (!found || ctx->clip_pos < cut_pos)) {
+        socket_audio_pipe_clip_stop(ctx);  /* From an older turn; a PLAY opening the new turn sits at cut_pos */
+    }
+    socket_audio_stat_flush(ctx, ctx->flush_req_at);
+
+    if (ctx->is_playing) {
+        ctx->is_playing = 0;
+        socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_STOP, "flush");
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Socket audio playback stopped (flush)\n");
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                      "Audio interrupted for turn %u: dropped %zu bytes\n", turn, dropped);
+}
+
+static void socket_audio_pipe_overflow(socket_audio_ctx_t *ctx, switch_size_t excess)
+{
+    if (excess) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_OVERFLOW_BYTES, excess);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+            "Queue overflow, dropped %zu bytes\n", excess);
+    }
+}
+
+/*
+ * Whether received speaker audio must be dropped (flush pending or inside the
+ * discard window). Reactor thread only.
+ */
+static switch_bool_t socket_audio_pipe_dropping(socket_audio_ctx_t *ctx)
+{
+    if (ctx->flush_flag) {
+        /* Flush pending - this audio is stale; the clock clears the queue and starts the discard window */
+        return SWITCH_TRUE;
+    }
+
+    if (ctx->discard_until > 0 && switch_time_now() < ctx->discard_until) {
+        /* Discard incoming audio during discard window (clears in-flight packets) */
+        ctx->discarding = 1;
+        return SWITCH_TRUE;
+    }
+
+    if (ctx->discarding) {
+        /* Discard window expired, resume normal operation */
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Audio resumed after discard window\n");
+        ctx->discarding = 0;
+    }
+
+    return SWITCH_FALSE;
+}
+
+/*
+ * Resample the resampler's current block straight into queue space.
+ */
+static void socket_audio_pipe_enqueue_resampled(socket_audio_ctx_t *ctx)
+{
+    socket_audio_resampler_t *r = ctx->write_resampler;
+    switch_size_t excess = 0;
+    uint32_t got;
+
+    do {
+        uint8_t *region;
+        switch_size_t room = socket_audio_queue_reserve(&ctx->audio_queue, &region);
+
+        if (!room) {
+            /* Queue full: finish the block to keep the filter history, and drop it */
+            while ((got = socket_audio_resample_emit(r, r->out, r->out_cap))) {
+                excess += got * sizeof(int16_t);
+            }
+            break;
+        }
+
+        got = socket_audio_resample_emit(r, (int16_t *)region, (uint32_t)(room / sizeof(int16_t)));
+        excess += socket_audio_queue_commit(&ctx->audio_queue, got * sizeof(int16_t));
+    } while (got);
+
+    socket_audio_pipe_overflow(ctx, excess);
+}
+
+/*
+ * Decode G.711 at the session rate straight into queue space.
+ */
+static void socket_audio_pipe_enqueue_g711(socket_audio_ctx_t *ctx, const uint8_t *data, switch_size_t samples)
+{
+    switch_size_t excess = 0;
+
+    while (samples) {
+        uint8_t *region;
+        switch_size_t n = socket_audio_queue_reserve(&ctx->audio_queue, &region) / sizeof(int16_t);
+
+        if (!n) {
+            excess += samples * sizeof(int16_t);
+            break;
+        }
+        if (n > samples) {
+            n = samples;
+        }
+
+        socket_audio_g711_decode(ctx->speaker_format.encoding, data, (int16_t *)region, (uint32_t)n);
+        excess += socket_audio_queue_commit(&ctx->audio_queue, n * sizeof(int16_t));
+        data += n;
+        samples -= n;
+    }
+
+    socket_audio_pipe_overflow(ctx, excess);
+}
+
+/*
+ * Handle one chunk of speaker audio received from the sidecar.
+ * Decodes and resamples it to L16 at the session rate and pushes it to the
+ * playback queue, writing straight into queue segments where possible.
+ *
+ * L16 chunks may split a sample: an odd trailing byte is held back and
+ * rejoined with the next chunk by writing it to data[-1], which callers
+ * guarantee is writable (headroom in front of the receive buffer, or an
+ * already parsed header byte). Shared-memory rings only hold whole samples,
+ * so chunks from them never carry. Samples are read as int16_t only from an
+ * even address: raw chunks are received so they start on one, and framed
+ * payloads that do not are copied to decode_buf first.
+ */
+static void socket_audio_pipe_input(socket_audio_ctx_t *ctx, uint8_t *data, switch_size_t len)
+{
+    socket_audio_resampler_t *r = ctx->write_resampler;
+    switch_bool_t drop = socket_audio_pipe_dropping(ctx);
+    int16_t *pcm_in;
+    uint32_t samples_in;
+
+    /* Load level 1 and up: the cheaper filter; the reactor owns this resampler */
+    if (r && ctx->load_shed) {
+        r->lite = __atomic_load_n(&globals.load_level, __ATOMIC_RELAXED) >= 1;
+    }
+
+    if (ctx->speaker_format.encoding == SOCKET_AUDIO_ENC_L16) {
+        if (ctx->rx_carry_len) {
+            *--data = ctx->rx_carry;
+            len++;
+            ctx->rx_carry_len = 0;
+        }
+        if (len & 1) {
+            ctx->rx_carry = data[--len];
+            ctx->rx_carry_len = 1;
+        }
+        if ((uintptr_t)data & 1) {
+            /* A framed payload at an odd offset: samples must not be read unaligned */
+            memcpy(ctx->decode_buf, data, len);
+            data = (uint8_t *)ctx->decode_buf;
+        }
+        pcm_in = (int16_t *)data;
+        samples_in = len / sizeof(int16_t);
+    } else if (!r) {
+        if (!drop) {
+            socket_audio_pipe_enqueue_g711(ctx, data, len);
+        }
+        return;
+    } else {
+        pcm_in = ctx->decode_buf;
+        samples_in = len;
+        socket_audio_g711_decode(ctx->speaker_format.encoding, data, pcm_in, samples_in);
+    }
+
+    /* Resample in blocks the resampler accepts; dropped audio still goes
+     * through it so its history stays continuous */
+    while (samples_in) {
+        uint32_t n = samples_in > SOCKET_AUDIO_RESAMPLE_MAX_IN ? SOCKET_AUDIO_RESAMPLE_MAX_IN : samples_in;
+
+        if (!r) {
+            if (!drop) {
+                switch_size_t excess, written;
+
+                written = socket_audio_queue_write(&ctx->audio_queue, pcm_in, n * sizeof(int16_t), &excess);
+                socket_audio_pipe_overflow(ctx, excess + n * sizeof(int16_t) - written);
+            }
+        } else if (drop || r->fallback) {
+            socket_audio_resample(r, pcm_in, n);
+            if (!drop) {
+                switch_size_t excess, written, bytes = r->out_len * sizeof(int16_t);
+
+                written = socket_audio_queue_write(&ctx->audio_queue, r->out, bytes, &excess);
+                socket_audio_pipe_overflow(ctx, excess + bytes - written);
+            }
+        } else {
+            socket_audio_resample_begin(r, pcm_in, n);
+            socket_audio_pipe_enqueue_resampled(ctx);
+        }
+
+        pcm_in += n;
+        samples_in -= n;
+    }
+}
+
+/*
+ * A PLAY has been received: take the clip at the session rate and queue it
+ * behind the audio already received, like a mark. Dropped with the audio of a
+ * flushed turn or inside a discard window. Reactor thread only.
+ */
+static void socket_audio_pipe_play(socket_audio_ctx_t *ctx)
+{
+    socket_audio_msg_t msg = { 0 };
+    char id[SOCKET_AUDIO_MARK_NAME_MAX + 1];
+
+    if (ctx->rx_stale || socket_audio_pipe_dropping(ctx)) {
+        return;
+    }
+
+    memcpy(id, ctx->rx_payload, ctx->rx_payload_len);
+    id[ctx->rx_payload_len] = '\0';
+    if (!(msg.clip = socket_audio_cache_get(id, ctx->session_rate))) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_CLIP_MISSES, 1);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                          "PLAY of unknown clip '%s' (seq=%u) ignored\n", id, ctx->rx_seq);
+        return;
+    }
+
+    msg.pos = ctx->audio_queue.head;
+    msg.at = switch_micro_time_now();
+    msg.seq = ctx->rx_seq;
+    msg.type = SOCKET_AUDIO_MSG_PLAY;
+    msg.len = (uint8_t)ctx->rx_payload_len;
+    memcpy(msg.payload, ctx->rx_payload, ctx->rx_payload_len);
+
+    if (!socket_audio_ring_push(&ctx->control, &msg)) {
+        socket_audio_clip_release(msg.clip);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                          "Control queue full, dropped PLAY of '%s' seq=%u\n", id, msg.seq);
+    }
+}
+
+/*
+ * Collect a piece of a CACHE_PUT payload. Reactor thread only.
+ *
+ * Past the first message the buffer only grows while the clip could still
+ * fit in what the cache has left, counting the clip it would replace, so
+ * pipes uploading at once cannot each hold cache-max-mb.
+ */
+static void socket_audio_pipe_put_chunk(socket_audio_ctx_t *ctx, const uint8_t *data, switch_size_t len)
+{
+    if (ctx->rx_put_over) {
+        return;
+    }
+
+    if (ctx->rx_put_len + len > ctx->rx_put_cap) {
+        switch_size_t cap = ctx->rx_put_cap + SOCKET_AUDIO_CACHE_PUT_CHUNK;
+        char id[SOCKET_AUDIO_MARK_NAME_MAX + 1] = "";
+        uint8_t *buf;
+
+        if (cap < ctx->rx_put_len + len) {
+            cap = ctx->rx_put_len + len;
+        }
+        if (ctx->rx_put_len && ctx->rx_put[0] <= SOCKET_AUDIO_MARK_NAME_MAX && ctx->rx_put_len > ctx->rx_put[0]) {
+            memcpy(id, ctx->rx_put + 1, ctx->rx_put[0]);
+            id[ctx->rx_put[0]] = '\0';
+        }
+        if ((cap > SOCKET_AUDIO_CACHE_PUT_CHUNK && cap > socket_audio_cache_room(id) + 1 + SOCKET_AUDIO_MARK_NAME_MAX) ||
+            !(buf = realloc(ctx->rx_put, cap))) {
+            ctx->rx_put_over = 1;
+            return;
+        }
+        ctx->rx_put = buf;
+        ctx->rx_put_cap = cap;
+    }
+
+    memcpy(ctx->rx_put + ctx->rx_put_len, data, len);
+    ctx->rx_put_len += len;
+}
+
+/*
+ * A CACHE_PUT has been received. Unless flagged MORE it completes the clip:
+ * an ID length byte, the ID, then audio in the speaker format, which is
+ * listed as loaded at the speaker rate. Reactor thread only.
+ */
+static void socket_audio_pipe_put(socket_audio_ctx_t *ctx)
+{
+    socket_audio_clip_t *clip;
+    char id[SOCKET_AUDIO_MARK_NAME_MAX + 1];
+    const uint8_t *audio;
+    switch_size_t id_len, audio_len;
+    uint32_t samples;
+
+    if (ctx->rx_flags & SOCKET_AUDIO_FLAG_MORE) {
+        return;
+    }
+
+    id_len = ctx->rx_put_len ? ctx->rx_put[0] : 0;
+    if (ctx->rx_put_over || !id_len || id_len > SOCKET_AUDIO_MARK_NAME_MAX || 1 + id_len >= ctx->rx_put_len) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                          "CACHE_PUT seq=%u dropped: %s\n", ctx->rx_seq, ctx->rx_put_over ? "does not fit in the cache" : "malformed");
+        goto done;
+    }
+
+    memcpy(id, ctx->rx_put + 1, id_len);
+    id[id_len] = '\0';
+    audio = ctx->rx_put + 1 + id_len;
+    audio_len = ctx->rx_put_len - 1 - id_len;
+    samples = (uint32_t)(audio_len / socket_audio_format_sample_bytes(&ctx->speaker_format));
+
+    if (!samples || !(clip = socket_audio_clip_create(id, ctx->speaker_format.rate, samples))) {
+        goto done;
+    }
+    if (ctx->speaker_format.encoding == SOCKET_AUDIO_ENC_L16) {
+        memcpy(clip->pcm, audio, samples * sizeof(int16_t));
+    } else {
+        socket_audio_g711_decode(ctx->speaker_format.encoding, audio, clip->pcm, samples);
+    }
+
+    if (socket_audio_cache_put(clip) == SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Cached clip '%s': %u samples at %u Hz\n", id, samples, ctx->speaker_format.rate);
+    } else {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                          "Cache full, clip '%s' not stored\n", id);
+    }
+
+done:
+    switch_safe_free(ctx->rx_put);
+    ctx->rx_put_len = ctx->rx_put_cap = 0;
+    ctx->rx_put_over = 0;
+}
+
+/*
+ * A complete framed message has been received. Reactor thread only.
+ */
+static void socket_audio_pipe_message(socket_audio_ctx_t *ctx)
+{
+    socket_audio_msg_t msg = { 0 };
+
+    switch (ctx->rx_type) {
+    case SOCKET_AUDIO_MSG_AUDIO:
+        ctx->rx_carry_len = 0;  /* Samples never span messages */
+        break;
+
+    case SOCKET_AUDIO_MSG_FLUSH:
+    case SOCKET_AUDIO_MSG_CLEAR:
+        if (ctx->rx_flags & SOCKET_AUDIO_FLAG_TURN) {
+            socket_audio_turn_advance(ctx, ctx->rx_seq);
+        }
+        /* fall through */
+    case SOCKET_AUDIO_MSG_MARK:
+        msg.pos = ctx->audio_queue.head;
+        msg.at = switch_micro_time_now();
+        msg.seq = ctx->rx_seq;
+        msg.type = ctx->rx_type;
+        msg.len = (uint8_t)ctx->rx_payload_len;
+        memcpy(msg.payload, ctx->rx_payload, ctx->rx_payload_len);
+
+        if (!socket_audio_ring_push(&ctx->control, &msg)) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                              "Control queue full, dropped message type=%u seq=%u\n", msg.type, msg.seq);
+        }
+        break;
+
+    case SOCKET_AUDIO_MSG_PLAY:
+        socket_audio_pipe_play(ctx);
+        break;
+
+    case SOCKET_AUDIO_MSG_CACHE_PUT:
+        socket_audio_pipe_put(ctx);
+        break;
+
+    default:
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+                          "Ignoring unknown message type=%u\n", ctx->rx_type);
+        break;
+    }
+}
+
+/*
+ * A turn-tagged AUDIO message is starting. Returns SWITCH_TRUE if its turn
+ * has been flushed; otherwise records where a new turn begins in the queue,
+ * for socket_audio_pipe_flush_turn. Reactor thread only.
+ */
+static switch_bool_t socket_audio_pipe_turn(socket_audio_ctx_t *ctx, uint32_t turn)
+{
+    if (socket_audio_turn_stale(ctx, turn)) {
+        if (ctx->rx_stale_turn != turn) {
+            ctx->rx_stale_turn = turn;
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+                              "Dropping audio of flushed turn %u\n", turn);
+        }
+        return SWITCH_TRUE;
+    }
+
+    if (!ctx->rx_turn_valid || ctx->rx_turn != turn) {
+        socket_audio_msg_t msg = { 0 };
+
+        msg.pos = ctx->audio_queue.head;
+        msg.seq = turn;
+        msg.type = SOCKET_AUDIO_MSG_TURN;
+        if (!socket_audio_ring_push(&ctx->control, &msg)) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                              "Control queue full, turn %u start not recorded\n", turn);
+        }
+        ctx->rx_turn = turn;
+        ctx->rx_turn_valid = 1;
+    }
+
+    return SWITCH_FALSE;
+}
+
+/*
+ * Parse a chunk of the framed stream. Messages may span chunks in any way;
+ * AUDIO payloads are handed to socket_audio_pipe_input as they arrive.
+ */
+static void socket_audio_pipe_parse(socket_audio_ctx_t *ctx, uint8_t *data, switch_size_t len)
+{
+    while (len) {
+        switch_size_t n;
+
+        if (ctx->rx_hdr_len < SOCKET_AUDIO_FRAME_HEADER_LEN) {
+            n = SOCKET_AUDIO_FRAME_HEADER_LEN - ctx->rx_hdr_len;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(ctx->rx_hdr + ctx->rx_hdr_len, data, n);
+            ctx->rx_hdr_len += n;
+            data += n;
+            len -= n;
+
+            if (ctx->rx_hdr_len < SOCKET_AUDIO_FRAME_HEADER_LEN) {
+                break;
+            }
+
+            socket_audio_frame_parse(ctx->rx_hdr, &ctx->rx_type, &ctx->rx_flags, &ctx->rx_remaining, &ctx->rx_seq);
+            ctx->rx_payload_len = 0;
+            ctx->rx_stale = (ctx->rx_type == SOCKET_AUDIO_MSG_AUDIO || ctx->rx_type == SOCKET_AUDIO_MSG_PLAY) &&
+                            (ctx->rx_flags & SOCKET_AUDIO_FLAG_TURN) && socket_audio_pipe_turn(ctx, ctx->rx_seq);
+        } else {
+            n = ctx->rx_remaining;
+            if (n > len) {
+                n = len;
+            }
+
+            if (ctx->rx_type == SOCKET_AUDIO_MSG_AUDIO) {
+                if (!ctx->rx_stale) {
+                    socket_audio_pipe_input(ctx, data, n);
+                }
+            } else if (ctx->rx_type == SOCKET_AUDIO_MSG_CACHE_PUT) {
+                socket_audio_pipe_put_chunk(ctx, data, n);
+            } else {
+                /* Control payload; anything past SOCKET_AUDIO_MARK_NAME_MAX is dropped */
+                switch_size_t keep = sizeof(ctx->rx_payload) - ctx->rx_payload_len;
+
+                if (keep > n) {
+                    keep = n;
+                }
+                memcpy(ctx->rx_payload + ctx->rx_payload_len, data, keep);
+                ctx->rx_payload_len += keep;
+            }
+
+            ctx->rx_remaining -= n;
+            data += n;
+            len -= n;
+        }
+
+        if (!ctx->rx_remaining) {
+            socket_audio_pipe_message(ctx);
+            ctx->rx_hdr_len = 0;
+        }
+    }
+}
+
+/*
+ * Stop polling the pipe's socket (sidecar went away). The pipe stays attached
+ * until the media bug closes so teardown happens in one place.
+ */
+static void socket_audio_pipe_unpoll(socket_audio_reactor_t *reactor, socket_audio_ctx_t *ctx)
+{
+    if (ctx->polling) {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->sock_fd, NULL);
+        ctx->polling = 0;
+    }
+    ctx->running = 0;
+}
+
+/*
+ * The sidecar connection dropped. Without a reconnect policy the pipe just
+ * stops, as it always has. Otherwise it keeps running (queued speaker audio
+ * still plays, mic audio is held) while the connector thread retries; the
+ * media thread swaps the new connection in and has it polled again.
+ */
+static void socket_audio_pipe_lost(socket_audio_reactor_t *reactor, socket_audio_ctx_t *ctx)
+{
+    socket_audio_reconnect_t *job;
+    uint32_t i;
+
+    if (!ctx->reconnect_max || !globals.running || !(job = calloc(1, sizeof(*job)))) {
+        socket_audio_pipe_unpoll(reactor, ctx);
+        return;
+    }
+
+    if (ctx->polling) {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->sock_fd, NULL);
+        ctx->polling = 0;
+    }
+
+    job->ctx = ctx;
+    for (i = 0; i < ctx->host_count; i++) {
+        switch_copy_string(job->hosts[i], ctx->hosts[i], sizeof(job->hosts[i]));
+        job->ports[i] = ctx->ports[i];
+    }
+    job->host_count = ctx->host_count;
+    job->max_attempts = ctx->reconnect_max;
+    job->backoff_ms = ctx->reconnect_backoff_ms;
+    job->timeout_ms = globals.connect_timeout_ms;
+    job->retry_at = switch_micro_time_now() + (switch_time_t)job->backoff_ms * 1000;
+
+    __atomic_store_n(&ctx->link_down, 1, __ATOMIC_RELEASE);
+
+    switch_mutex_lock(globals.mutex);
+    ctx->reconnect = job;
+    job->next = globals.reconnects;
+    globals.reconnects = job;
+    switch_mutex_unlock(globals.mutex);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                      "Sidecar connection lost, reconnecting (up to %u attempts)\n", ctx->reconnect_max);
+    socket_audio_fire_reconnect_event(ctx, "lost", 0, NULL, 0);
+}
+
+/*
+ * Socket is readable: drain it without blocking.
+ */
+static void socket_audio_pipe_read(socket_audio_reactor_t *reactor, socket_audio_ctx_t *ctx)
+{
+    int reads;
+
+    for (reads = 0; reads < SOCKET_AUDIO_REACTOR_MAX_READS && ctx->running; reads++) {
+        uint8_t *region = NULL;
+        uint8_t *data = NULL;
+        switch_size_t want = 0;
+        ssize_t recv_len;
+
+        /* Raw L16 at the session rate needs no conversion: receive it straight into the queue */
+        if (ctx->mode == SOCKET_AUDIO_MODE_RAW && ctx->speaker_format.encoding == SOCKET_AUDIO_ENC_L16 &&
+            !ctx->write_resampler && !ctx->shm && !socket_audio_pipe_dropping(ctx)) {
+            want = socket_audio_queue_reserve(&ctx->audio_queue, &region);
+        }
+
+        if (want > ctx->rx_carry_len) {
+            /* The held-back odd byte goes in front, the commit covers whole samples only */
+            if (ctx->rx_carry_len) {
+                region[0] = ctx->rx_carry;
+            }
+            want -= ctx->rx_carry_len;
+            recv_len = recv(ctx->sock_fd, region + ctx->rx_carry_len, want, MSG_DONTWAIT);
+        } else {
+            /* Two bytes of headroom for socket_audio_pipe_input's sample carry.
+             * Raw audio lands where the carried byte, put in front of it, starts
+             * on a sample boundary; framed payloads fall anywhere regardless. */
+            region = NULL;
+            data = reactor->recv_buf + 2 - (ctx->mode == SOCKET_AUDIO_MODE_RAW ? ctx->rx_carry_len : 0);
+            want = sizeof(reactor->recv_buf) - 2;
+            recv_len = recv(ctx->sock_fd, data, want, MSG_DONTWAIT);
+        }
+
+        if (recv_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            break;
+        }
+
+        if (recv_len <= 0) {
+            /* Socket closed or error */
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                              "Socket closed or error (errno=%d, len=%zd)\n",
+                              recv_len < 0 ? errno : 0, recv_len);
+            socket_audio_pipe_lost(reactor, ctx);
+            break;
+        }
+
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_SPEAKER_BYTES, (uint64_t)recv_len);
+
+        if (region) {
+            switch_size_t total = ctx->rx_carry_len + (switch_size_t)recv_len;
+
+            ctx->rx_carry_len = total & 1;
+            if (ctx->rx_carry_len) {
+                ctx->rx_carry = region[total - 1];
+            }
+            socket_audio_pipe_overflow(ctx, socket_audio_queue_commit(&ctx->audio_queue, total - ctx->rx_carry_len));
+        } else if (ctx->shm) {
+            /* Audio comes through the ring, the clock is the queue's producer */
+        } else if (ctx->mode == SOCKET_AUDIO_MODE_FRAMED) {
+            socket_audio_pipe_parse(ctx, data, (switch_size_t)recv_len);
+        } else {
+            /* Received raw speaker audio from sidecar */
+            socket_audio_pipe_input(ctx, data, (switch_size_t)recv_len);
+        }
+
+        if ((size_t)recv_len < want) {
+            break;  /* Socket drained */
+        }
+    }
+}
+
+/*
+ * Move what the sidecar has written to the speaker ring into the playback
+ * queue. Clock thread: for shm pipes it is the queue's producer as well as
+ * its consumer, so draining at each visit costs no wakeup or syscall.
+ */
+static void socket_audio_shm_drain(socket_audio_ctx_t *ctx)
+{
+    socket_audio_shm_ring_t *ring = &ctx->shm->speaker;
+    uint64_t size = ctx->shm->speaker_size;
+    uint64_t tail = ring->tail;
+    uint64_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+
+    if (avail > size) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+                          "Sidecar speaker ring overrun (%" SWITCH_UINT64_T_FMT " bytes), stopping\n", avail);
+        ctx->running = 0;
+        return;
+    }
+    if (ctx->speaker_format.encoding == SOCKET_AUDIO_ENC_L16) {
+        avail &= ~(uint64_t)1;
+    }
+    if (!avail) {
+        return;
+    }
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_SPEAKER_BYTES, avail);
+
+    while (avail) {
+        uint64_t off = tail & (size - 1);
+        uint64_t n = size - off < avail ? size - off : avail;
+
+        if (n > SOCKET_AUDIO_REACTOR_RECV_BUF) {
+            n = SOCKET_AUDIO_REACTOR_RECV_BUF;  /* decode_buf bound */
+        }
+        socket_audio_pipe_input(ctx, ctx->shm_speaker + off, (switch_size_t)n);
+        tail += n;
+        avail -= n;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static uint64_t socket_audio_pipe_queue_us(socket_audio_ctx_t *ctx, switch_size_t bytes)
+{
+    return (uint64_t)bytes * 1000000 / ((uint64_t)ctx->session_rate * sizeof(int16_t));
+}
+
+/*
+ * Adapt the prebuffer to how the sidecar delivers audio. Clock thread, every
+ * visit that looks at the queue.
+ *
+ * An arrival during playback is checked against the previous one: if the gap
+ * was longer than the audio the queue then held, playback went dry (or was
+ * concealed) for the difference, and the prebuffer grows by it. With no
+ * shortfalls it shrinks back slowly, so it stays as shallow as the sidecar
+ * allows. Arrivals are seen at clock resolution (one visit per frame).
+ */
+static void socket_audio_pipe_jitter(socket_audio_ctx_t *ctx, uint64_t now_us, switch_size_t queue_bytes)
+{
+    uint64_t head = ctx->audio_queue.tail + queue_bytes;
+    uint64_t decay = ctx->jb_visit_at ? (now_us - ctx->jb_visit_at) / SOCKET_AUDIO_JB_DECAY : 0;
+
+    ctx->jb_visit_at = now_us;
+    ctx->jb_target_us = ctx->jb_target_us > decay ? ctx->jb_target_us - decay : 0;
+
+    if (head == ctx->jb_head) {
+        return;
+    }
+    ctx->jb_head = head;
+
+    if (!ctx->is_playing) {
+        ctx->jb_arrival_at = 0;
+        return;
+    }
+
+    if (ctx->jb_arrival_at && now_us - ctx->jb_arrival_at > ctx->jb_depth_us) {
+        ctx->jb_target_us += now_us - ctx->jb_arrival_at - ctx->jb_depth_us;
+        if (ctx->jb_target_us > ctx->jb_max_us) {
+            ctx->jb_target_us = ctx->jb_max_us;
+        }
+        socket_audio_stat_max(ctx, SOCKET_AUDIO_STAT_PREBUFFER_MAX_US, ctx->jb_target_us);
+    }
+    ctx->jb_arrival_at = now_us;
+    ctx->jb_depth_us = socket_audio_pipe_queue_us(ctx, queue_bytes);
+}
+
+/*
+ * Copy the next frame of the playing clip into write_frame_data (the core may
+ * alter what it is handed, and the clip is shared), padding the last one with
+ * silence, and let the clip go once it has all played. A clip at another rate
+ * goes through clip_resampler about a frame at a time. Clock thread only.
+ */
+static void socket_audio_pipe_clip_frame(socket_audio_ctx_t *ctx)
+{
+    socket_audio_clip_t *clip = ctx->clip;
+    uint32_t n = ctx->session_frame_bytes / sizeof(int16_t);
+    uint32_t left = clip->samples - ctx->clip_off;
+    uint32_t take = left < n ? left : n;
+
+    if (clip->rate != ctx->session_rate) {
+        socket_audio_resampler_t *r = ctx->clip_resampler;
+        uint32_t in = (uint32_t)((uint64_t)n * clip->rate / ctx->session_rate) + 1;
+
+        while (ctx->clip_buf_len < n && ctx->clip_off < clip->samples) {
+            uint32_t chunk = clip->samples - ctx->clip_off < in ? clip->samples - ctx->clip_off : in;
+            uint32_t room = ctx->clip_buf_cap - ctx->clip_buf_len;
+
+            socket_audio_resample(r, clip->pcm + ctx->clip_off, chunk);
+            ctx->clip_off += chunk;
+            memcpy(ctx->clip_buf + ctx->clip_buf_len, r->out, (r->out_len < room ? r->out_len : room) * sizeof(int16_t));
+            ctx->clip_buf_len += r->out_len < room ? r->out_len : room;
+        }
+        take = ctx->clip_buf_len < n ? ctx->clip_buf_len : n;
+        memcpy(ctx->write_frame_data, ctx->clip_buf, take * sizeof(int16_t));
+        ctx->clip_buf_len -= take;
+        memmove(ctx->clip_buf, ctx->clip_buf + take, ctx->clip_buf_len * sizeof(int16_t));
+    } else {
+        memcpy(ctx->write_frame_data, clip->pcm + ctx->clip_off, take * sizeof(int16_t));
+        ctx->clip_off += take;
+    }
+    if (take < n) {
+        memset(ctx->write_frame_data + take * sizeof(int16_t), 0, (n - take) * sizeof(int16_t));
+    }
+    if (ctx->clip_off >= clip->samples && !ctx->clip_buf_len) {
+        socket_audio_pipe_clip_stop(ctx);
+    }
+}
+
+/*
+ * Fill one frame of an underrun: the last frame faded out, then comfort
+ * noise, so a late burst plays on without a playback_stop/start pair or a
+ * hard cut to silence. Clock thread only.
+ */
+static void socket_audio_pipe_conceal(socket_audio_ctx_t *ctx)
+{
+    int16_t *out = (int16_t *)ctx->write_frame_data;
+    const int16_t *last = (const int16_t *)ctx->plc_frame;
+    uint32_t n = ctx->session_frame_bytes / sizeof(int16_t), i;
+
+    for (i = 0; i < n; i++) {
+        int32_t noise;
+
+        ctx->plc_seed = ctx->plc_seed * 1664525 + 1013904223;
+        noise = (int32_t)(ctx->plc_seed >> 16) % (SOCKET_AUDIO_PLC_NOISE_AMPLITUDE + 1) - SOCKET_AUDIO_PLC_NOISE_AMPLITUDE / 2;
+        out[i] = (int16_t)(ctx->plc_us ? noise : (int32_t)last[i] * (int32_t)(n - i) / (int32_t)n + noise);
+    }
+
+    if (!ctx->plc_us) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_UNDERRUNS, 1);
+    }
+    ctx->plc_us += (uint64_t)ctx->read_ptime * 1000;
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_CONCEALED_FRAMES, 1);
+}
+
+/*
+ * Media bug on a joined leg: its mic audio goes to the slot queue at the
+ * pipe's session rate. Leg media thread; the slot outlives the bug.
+ */
+static switch_bool_t socket_audio_leg_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
+{
+    socket_audio_leg_t *leg = (socket_audio_leg_t *)user_data;
+
+    switch (type) {
+
+    case SWITCH_ABC_TYPE_READ_REPLACE:
+        {
+            switch_frame_t *frame = switch_core_media_bug_get_read_replace_frame(bug);
+
+            if (leg->listen && frame && frame->data && frame->datalen > 0) {
+                const int16_t *pcm = (const int16_t *)frame->data;
+                switch_size_t len = frame->datalen;
+                switch_size_t tossed;
+
+                if (leg->read_resampler) {
+                    socket_audio_resample(leg->read_resampler, pcm, (uint32_t)(len / sizeof(int16_t)));
+                    pcm = leg->read_resampler->out;
+                    len = leg->read_resampler->out_len * sizeof(int16_t);
+                }
+                /* A full queue tosses the oldest audio, which the mix would skip anyway */
+                socket_audio_queue_write(&leg->queue, pcm, len, &tossed);
+            }
+        }
+        break;
+
+    case SWITCH_ABC_TYPE_CLOSE:
+        /* Hangup or uuid_socket_audio_leave: the pipe's clock releases the leg */
+        leg->bug = NULL;
+        __atomic_store_n(&leg->state, SOCKET_AUDIO_LEG_LEAVING, __ATOMIC_RELEASE);
+        break;
+
+    default:
+        break;
+    }
+
+    return SWITCH_TRUE;
+}
+
+/*
+ * Drop a leg's converters, write codec and session lock once its bug has
+ * closed. Clock thread, or the reactor in socket_audio_pipe_destroy.
+ */
+static void socket_audio_leg_release(socket_audio_leg_t *leg)
+{
+    socket_audio_resampler_destroy(&leg->read_resampler);
+    socket_audio_resampler_destroy(&leg->write_resampler);
+    if (switch_core_codec_ready(&leg->write_codec)) {
+        switch_core_codec_destroy(&leg->write_codec);
+    }
+    if (leg->session) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(leg->ctx->session), SWITCH_LOG_INFO,
+                          "Leg %s left the pipe\n", leg->uuid);
+        switch_core_session_rwunlock(leg->session);
+        leg->session = NULL;
+    }
+}
+
+/*
+ * Clock visit: release legs whose bug closed, and free their slots once the
+ * media thread has stopped reading them.
+ */
+static void socket_audio_pipe_legs_reap(socket_audio_ctx_t *ctx)
+{
+    uint32_t i;
+
+    for (i = 0; i < ctx->legs_max; i++) {
+        socket_audio_leg_t *leg = &ctx->legs[i];
+
+        if (__atomic_load_n(&leg->state, __ATOMIC_ACQUIRE) != SOCKET_AUDIO_LEG_LEAVING) {
+            continue;
+        }
+        if (leg->session) {
+            socket_audio_leg_release(leg);
+        }
+        if (__atomic_load_n(&leg->mix_idle, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&leg->state, SOCKET_AUDIO_LEG_FREE, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/*
+ * Fan a played frame (session rate L16) out to the legs that speak. Clock
+ * thread, like the pipe's own write.
+ */
+static void socket_audio_pipe_legs_write(socket_audio_ctx_t *ctx, const switch_frame_t *frame)
+{
+    uint32_t i;
+
+    for (i = 0; i < ctx->legs_max; i++) {
+        socket_audio_leg_t *leg = &ctx->legs[i];
+
+        if (__atomic_load_n(&leg->state, __ATOMIC_ACQUIRE) != SOCKET_AUDIO_LEG_ACTIVE || !leg->speak) {
+            continue;
+        }
+        if (leg->write_resampler) {
+            socket_audio_resample(leg->write_resampler, (const int16_t *)frame->data, frame->samples);
+            leg->write_frame.data = leg->write_resampler->out;
+            leg->write_frame.samples = leg->write_resampler->out_len;
+        } else {
+            leg->write_frame.data = frame->data;
+            leg->write_frame.samples = frame->samples;
+        }
+        leg->write_frame.datalen = leg->write_frame.samples * sizeof(int16_t);
+        leg->write_frame.buflen = leg->write_frame.datalen;
+
+        switch_core_session_write_frame(leg->session, &leg->write_frame, SWITCH_IO_FLAG_NONE, 0);
+    }
+}
+
+/*
+ * Detach every leg still joined. Reactor thread, from socket_audio_pipe_destroy:
+ * the pipe's media bug and clock are done, so only the legs' own bugs may
+ * still touch the slots, and removing them waits out a callback in progress.
+ */
+static void socket_audio_pipe_legs_destroy(socket_audio_ctx_t *ctx)
+{
+    uint32_t i;
+
+    switch_mutex_lock(globals.mutex);
+    for (i = 0; i < ctx->legs_max; i++) {
+        socket_audio_leg_t *leg = &ctx->legs[i];
+        switch_media_bug_t *bug = leg->bug;
+
+        if (leg->state == SOCKET_AUDIO_LEG_ACTIVE && bug) {
+            switch_core_media_bug_remove(leg->session, &bug);
+        }
+        socket_audio_leg_release(leg);
+        socket_audio_resampler_destroy(&leg->mic_resampler);
+        socket_audio_queue_destroy(&leg->queue);
+        leg->state = SOCKET_AUDIO_LEG_FREE;
+    }
+    switch_mutex_unlock(globals.mutex);
+}
+
+/*
+ * Clock visit: write the playback frame that is due at clock time now_us.
+ *
+ * Returns the clock time (us) at which the pipe wants its next visit. Deadlines
+ * advance by exactly one ptime per frame, so pacing follows the media clock and
+ * does not drift with the time spent writing frames.
+ */
+static uint64_t socket_audio_pipe_playout(socket_audio_ctx_t *ctx, uint64_t now_us)
+{
+    uint64_t ptime_us = (uint64_t)ctx->read_ptime * 1000;
+    uint64_t idle = now_us + SOCKET_AUDIO_CLOCK_TICK_US;
+    uint8_t *frame_data = NULL;
+    uint8_t concealed = 0;
+    switch_size_t queue_bytes;
+    switch_status_t status;
+
+    /* A held stop whose window passed without playback resuming */
+    if (ctx->stop_pending_at && now_us >= ctx->stop_pending_at) {
+        ctx->stop_pending_at = 0;
+        socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_STOP, "complete");
+    }
+
+    if (ctx->legs) {
+        socket_audio_pipe_legs_reap(ctx);
+    }
+
+    if (!ctx->running || !switch_channel_ready(ctx->channel)) {
+        return idle;
+    }
+
+    /* Check for flush flag - interrupt playback immediately */
+    if (ctx->flush_flag) {
+        socket_audio_pipe_flush(ctx);
+        return idle;
+    }
+
+    if (ctx->turn_flush) {
+        socket_audio_pipe_flush_turn(ctx);
+    }
+
+    /* In-band flush/clear/mark commands (framed mode) */
+    socket_audio_pipe_control(ctx);
+
+    if (ctx->shm) {
+        socket_audio_shm_drain(ctx);
+    }
+
+    if (ctx->is_playing && ctx->play_due > now_us) {
+        return ctx->play_due;
+    }
+
+    queue_bytes = socket_audio_queue_inuse(&ctx->audio_queue);
+    socket_audio_stat_max(ctx, SOCKET_AUDIO_STAT_QUEUE_MAX_BYTES, queue_bytes);
+
+    if (ctx->jb_max_us && !ctx->clip) {
+        socket_audio_pipe_jitter(ctx, now_us, queue_bytes);
+    }
+
+    if (ctx->clip) {
+        /* Cached clip: the audio queued behind its PLAY waits for it */
+        socket_audio_pipe_clip_frame(ctx);
+        ctx->jb_wait_since = 0;
+        ctx->plc_us = 0;
+    } else if (queue_bytes < ctx->session_frame_bytes && ctx->is_playing && ctx->plc_us < ctx->plc_max_us) {
+        /* Short underrun mid-playout: conceal it and keep the pace */
+        socket_audio_pipe_conceal(ctx);
+        concealed = 1;
+    } else if (queue_bytes < ctx->session_frame_bytes) {
+        ctx->jb_wait_since = 0;
+        if (ctx->last_write_at) {
+            if (!ctx->plc_us) {  /* Otherwise counted when concealment began */
+                socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_UNDERRUNS, 1);
+            }
+            ctx->last_write_at = 0;  /* The gap is an underrun, not pacing error */
+        }
+
+        /* Fire playback_stop event if we were playing and queue is now empty */
+        if (ctx->is_playing && queue_bytes == 0) {
+            ctx->is_playing = 0;
+            ctx->plc_us = 0;
+            if (ctx->event_debounce_us) {
+                /* Hold it: if audio resumes in the window, the stop and the
+                 * following start are both dropped */
+                ctx->stop_pending_at = now_us + ctx->event_debounce_us;
+            } else {
+                socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_STOP, "complete");
+            }
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                              "Socket audio playback stopped (complete)\n");
+        }
+
+        return idle; /* Not enough data for a full frame, wait for more */
+    } else {
+        /* Prebuffer: before starting, hold the target depth or at most that long */
+        if (!ctx->is_playing && ctx->jb_target_us) {
+            if (!ctx->jb_wait_since) {
+                ctx->jb_wait_since = now_us;
+            }
+            if (socket_audio_pipe_queue_us(ctx, queue_bytes) < ctx->jb_target_us &&
+                now_us - ctx->jb_wait_since < ctx->jb_target_us) {
+                return idle;
+            }
+        }
+        ctx->jb_wait_since = 0;
+        ctx->plc_us = 0;
+
+        /* Hand the frame to the core straight from the queue segment; copy only
+         * when it straddles two segments */
+        frame_data = socket_audio_queue_peek(&ctx->audio_queue, ctx->session_frame_bytes);
+        if (!frame_data) {
+            socket_audio_queue_read(&ctx->audio_queue, ctx->write_frame_data, ctx->session_frame_bytes);
+        }
+    }
+
+    /* Starting playback (transition from not playing to playing) */
+    if (!ctx->is_playing) {
+        ctx->is_playing = 1;
+        ctx->play_due = now_us;
+        if (ctx->stop_pending_at) {
+            ctx->stop_pending_at = 0;  /* Coalesced with the held stop */
+        } else {
+            socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_START, NULL);
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Socket audio playback started\n");
+    } else if (ctx->play_due + SOCKET_AUDIO_CLOCK_TICK_US <= now_us) {
+        /* Resuming after an underrun: restart pacing from now rather than bursting */
+        ctx->play_due = now_us;
+    }
+
+    /* Set up and write the frame */
+    ctx->write_frame.data = frame_data ? frame_data : ctx->write_frame_data;
+    ctx->write_frame.buflen = frame_data ? ctx->session_frame_bytes : sizeof(ctx->write_frame_data);
+    ctx->write_frame.datalen = ctx->session_frame_bytes;
+    ctx->write_frame.samples = ctx->session_frame_bytes / sizeof(int16_t);
+
+    if (ctx->plc_max_us && !concealed) {
+        memcpy(ctx->plc_frame, ctx->write_frame.data, ctx->session_frame_bytes);
+    }
+
+    status = switch_core_session_write_frame(ctx->session, &ctx->write_frame, SWITCH_IO_FLAG_NONE, 0);
+
+    if (ctx->legs) {
+        socket_audio_pipe_legs_write(ctx, &ctx->write_frame);
+    }
+    if (ctx->reference && status == SWITCH_STATUS_SUCCESS) {
+        switch_size_t tossed;
+
+        socket_audio_queue_write(&ctx->ref_queue, ctx->write_frame.data, ctx->session_frame_bytes, &tossed);
+    }
+
+    if (frame_data) {
+        socket_audio_queue_consume(&ctx->audio_queue, ctx->session_frame_bytes);
+    }
+
+    if (status != SWITCH_STATUS_SUCCESS) {
+        ctx->last_write_at = 0;
+        return idle;
+    }
+
+    {
+        switch_time_t now = switch_micro_time_now();
+
+        if (!concealed) {
+            socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_SPEAKER_FRAMES, 1);
+        }
+        if (ctx->last_write_at) {
+            socket_audio_stat_pace(ctx, now - ctx->last_write_at);
+        }
+        ctx->last_write_at = now;
+    }
+
+    /* Schedule the next frame one ptime after this one */
+    ctx->play_due += ptime_us;
+
+    return ctx->play_due;
+}
+
+/*
+ * Release everything the pipe owns. Runs on the reactor thread after the media
+ * bug has closed and the clock has dropped the pipe, so nothing else uses it
+ * but API calls holding a reference. Drops the pipe's own reference (and with
+ * it, unless such a call still holds one, the session read lock taken in
+ * socket_audio_start); ctx must not be touched afterwards.
+ */
+static void socket_audio_pipe_destroy(socket_audio_ctx_t *ctx)
+{
+    switch_core_session_t *session = ctx->session;
+
+    /* The clock has let go, so a still-held stop goes out here */
+    if (ctx->stop_pending_at) {
+        ctx->stop_pending_at = 0;
+        socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_PLAYBACK_STOP, "complete");
+    }
+
+    if (ctx->sock) {
+        switch_socket_close(ctx->sock);
+        ctx->sock = NULL;
+    }
+    if (ctx->sock_pool) {
+        switch_core_destroy_memory_pool(&ctx->sock_pool);
+    }
+    socket_audio_shm_destroy(ctx);
+
+    /* A reconnect still in progress is dropped, one already made is closed */
+    switch_mutex_lock(globals.mutex);
+    if (ctx->reconnect) {
+        ctx->reconnect->ctx = NULL;
+        ctx->reconnect = NULL;
+    }
+    switch_mutex_unlock(globals.mutex);
+    if (ctx->relink) {
+        socket_audio_conn_destroy(ctx->relink);
+        ctx->relink = NULL;
+    }
+
+    if (ctx->legs) {
+        socket_audio_pipe_legs_destroy(ctx);
+    }
+
+    /* Clips still referenced by the pipe */
+    socket_audio_pipe_clip_stop(ctx);
+    while (socket_audio_ring_peek(&ctx->control, 0)) {
+        socket_audio_pipe_control_pop(ctx);
+    }
+    socket_audio_resampler_destroy(&ctx->clip_resampler);
+    if (ctx->clip_pool) {
+        switch_core_destroy_memory_pool(&ctx->clip_pool);
+    }
+    switch_safe_free(ctx->rx_put);
+
+    socket_audio_resampler_destroy(&ctx->read_resampler);
+    socket_audio_resampler_destroy(&ctx->write_resampler);
+
+    if (switch_core_codec_ready(&ctx->write_codec)) {
+        switch_core_codec_destroy(&ctx->write_codec);
+    }
+
+    socket_audio_resampler_destroy(&ctx->ref_resampler);
+    socket_audio_queue_destroy(&ctx->ref_queue);
+    socket_audio_ctx_retire_queue(ctx);
+    if (ctx->recorder) {
+        socket_audio_recorder_close(ctx->recorder);
+        ctx->recorder = NULL;
+    }
+    socket_audio_registry_remove(ctx);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                      "Socket audio pipe released\n");
+
+    socket_audio_ctx_release(ctx);
+}
+
+static void socket_audio_reactor_wake(socket_audio_reactor_t *reactor)
+{
+    uint64_t one = 1;
+
+    if (write(reactor->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                          "Reactor %u: failed to signal wakeup (errno=%d)\n", reactor->id, errno);
+    }
+}
+
+/*
+ * Pick the least loaded reactor and queue the pipe for attachment.
+ */
+static void socket_audio_reactor_attach(socket_audio_ctx_t *ctx)
+{
+    socket_audio_reactor_t *reactor = &globals.reactors[0];
+    uint32_t i;
+
+    for (i = 1; i < globals.reactor_count; i++) {
+        if (globals.reactors[i].pipe_count < reactor->pipe_count) {
+            reactor = &globals.reactors[i];
+        }
+    }
+
+    ctx->reactor = reactor;
+    if (!ctx->decode_buf) {
+        ctx->decode_buf = reactor->decode_buf;
+    }
+
+    switch_mutex_lock(reactor->ops_mutex);
+    reactor->pipe_count++;
+    ctx->op_next = reactor->attach_ops;
+    reactor->attach_ops = ctx;
+    switch_mutex_unlock(reactor->ops_mutex);
+
+    socket_audio_reactor_wake(reactor);
+}
+
+/*
+ * Poll the pipe's new socket after a reconnect. Media thread.
+ */
+static void socket_audio_reactor_repoll(socket_audio_ctx_t *ctx)
+{
+    socket_audio_reactor_t *reactor = ctx->reactor;
+
+    switch_mutex_lock(reactor->ops_mutex);
+    ctx->repoll_next = reactor->repoll_ops;
+    reactor->repoll_ops = ctx;
+    switch_mutex_unlock(reactor->ops_mutex);
+
+    socket_audio_reactor_wake(reactor);
+}
+
+/*
+ * Queue the pipe for release. Never blocks: the reactor may be in the middle
+ * of writing a frame into this very session.
+ */
+static void socket_audio_reactor_detach(socket_audio_ctx_t *ctx)
+{
+    socket_audio_reactor_t *reactor = ctx->reactor;
+
+    switch_mutex_lock(reactor->ops_mutex);
+    if (reactor->stopped) {
+        reactor->pipe_count--;
+        switch_mutex_unlock(reactor->ops_mutex);
+        socket_audio_pipe_destroy(ctx);
+        return;
+    }
+    ctx->op_next = reactor->detach_ops;
+    reactor->detach_ops = ctx;
+    switch_mutex_unlock(reactor->ops_mutex);
+
+    socket_audio_reactor_wake(reactor);
+}
+
+/*
+ * Apply queued attach/detach requests. Detached pipes are unlinked right away
+ * but returned to the caller to be destroyed only after the current batch of
+ * epoll events (which may still reference them) has been processed.
+ */
+static socket_audio_ctx_t *socket_audio_reactor_apply_ops(socket_audio_reactor_t *reactor)
+{
+    socket_audio_ctx_t *attach, *detach, *repoll, *ctx, *next;
+
+    switch_mutex_lock(reactor->ops_mutex);
+    attach = reactor->attach_ops;
+    detach = reactor->detach_ops;
+    repoll = reactor->repoll_ops;
+    reactor->attach_ops = NULL;
+    reactor->detach_ops = NULL;
+    reactor->repoll_ops = NULL;
+    switch_mutex_unlock(reactor->ops_mutex);
+
+    for (ctx = attach; ctx; ctx = next) {
+        struct epoll_event ev = { 0 };
+
+        next = ctx->op_next;
+        ctx->op_next = NULL;
+
+        ctx->reactor_prev = NULL;
+        ctx->reactor_next = reactor->pipes;
+        if (reactor->pipes) {
+            reactor->pipes->reactor_prev = ctx;
+        }
+        reactor->pipes = ctx;
+        ctx->attached = 1;
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = ctx;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, ctx->sock_fd, &ev) == 0) {
+            ctx->polling = 1;
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+                              "Reactor %u: failed to poll socket (errno=%d)\n", reactor->id, errno);
+            ctx->running = 0;
+        }
+    }
+
+    /* Reconnected pipes: a new socket and a fresh stream. A detach for the same
+     * pipe can only be in this batch or a later one, and is applied after. */
+    for (ctx = repoll; ctx; ctx = next) {
+        struct epoll_event ev = { 0 };
+
+        next = ctx->repoll_next;
+        ctx->repoll_next = NULL;
+
+        ctx->rx_hdr_len = 0;
+        ctx->rx_remaining = 0;
+        ctx->rx_carry_len = 0;
+        ctx->rx_stale = 0;
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = ctx;
+        if (ctx->attached && !ctx->polling && epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, ctx->sock_fd, &ev) == 0) {
+            ctx->polling = 1;
+        }
+    }
+
+    for (ctx = detach; ctx; ctx = ctx->op_next) {
+        if (ctx->polling) {
+            epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->sock_fd, NULL);
+            ctx->polling = 0;
+        }
+
+        if (ctx->attached) {
+            if (ctx->reactor_prev) {
+                ctx->reactor_prev->reactor_next = ctx->reactor_next;
+            } else {
+                reactor->pipes = ctx->reactor_next;
+            }
+            if (ctx->reactor_next) {
+                ctx->reactor_next->reactor_prev = ctx->reactor_prev;
+            }
+            ctx->attached = 0;
+        }
+    }
+
+    return detach;
+}
+
+/*
+ * Destroy pipes returned by socket_audio_reactor_apply_ops.
+ */
+static void socket_audio_reactor_release(socket_audio_reactor_t *reactor, socket_audio_ctx_t *released)
+{
+    socket_audio_ctx_t *ctx, *next;
+
+    for (ctx = released; ctx; ctx = next) {
+        next = ctx->op_next;
+        socket_audio_pipe_destroy(ctx);
+
+        switch_mutex_lock(reactor->ops_mutex);
+        reactor->pipe_count--;
+        switch_mutex_unlock(reactor->ops_mutex);
+    }
+}
+
+/*
+ * Reactor Thread
+ *
+ * Receives and queues sidecar audio for all of its pipes.
+ */
+static void *SWITCH_THREAD_FUNC socket_audio_reactor_thread(switch_thread_t *thread, void *obj)
+{
+    socket_audio_reactor_t *reactor = (socket_audio_reactor_t *)obj;
+    struct epoll_event events[SOCKET_AUDIO_REACTOR_MAX_EVENTS];
+    socket_audio_ctx_t *ctx, *released;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Socket audio reactor %u started\n", reactor->id);
+
+    while (globals.running) {
+        int n, i;
+
+        n = epoll_wait(reactor->epoll_fd, events, SOCKET_AUDIO_REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                                  "Reactor %u: epoll_wait failed (errno=%d)\n", reactor->id, errno);
+                switch_yield(10000);
+            }
+            n = 0;
+        }
+
+        released = socket_audio_reactor_apply_ops(reactor);
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == reactor) {
+                uint64_t value;
+                if (read(reactor->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                                      "Reactor %u: failed to clear wakeup (errno=%d)\n", reactor->id, errno);
+                }
+                continue;
+            }
+
+            ctx = (socket_audio_ctx_t *)events[i].data.ptr;
+            if (!ctx->attached || !ctx->polling) {
+                continue;  /* Detached in this cycle or already closed */
+            }
+
+            socket_audio_pipe_read(reactor, ctx);
+        }
+
+        socket_audio_reactor_release(reactor, released);
+    }
+
+    /*
+     * Module is going away: apply what is pending, then stop servicing the
+     * remaining pipes. Their media bugs release them inline on close.
+     */
+    switch_mutex_lock(reactor->ops_mutex);
+    reactor->stopped = 1;
+    switch_mutex_unlock(reactor->ops_mutex);
+
+    released = socket_audio_reactor_apply_ops(reactor);
+    socket_audio_reactor_release(reactor, released);
+    for (ctx = reactor->pipes; ctx; ctx = ctx->reactor_next) {
+        socket_audio_pipe_unpoll(reactor, ctx);
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Socket audio reactor %u exiting\n", reactor->id);
+
+    return NULL;
+}
+
+/*
+ * Queue the pipe on the clock paired with its reactor.
+ */
+static void socket_audio_clock_attach(socket_audio_ctx_t *ctx)
+{
+    socket_audio_clock_t *clock = &globals.clocks[ctx->reactor->id];
+
+    ctx->clock = clock;
+
+    switch_mutex_lock(clock->ops_mutex);
+    ctx->clock_op_next = clock->attach_ops;
+    clock->attach_ops = ctx;
+    switch_mutex_unlock(clock->ops_mutex);
+}
+
+/*
+ * Queue the pipe for removal from the wheel. Once the clock has dropped it,
+ * the pipe is handed on to its reactor for release. Never blocks.
+ */
+static void socket_audio_clock_detach(socket_audio_ctx_t *ctx)
+{
+    socket_audio_clock_t *clock = ctx->clock;
+
+    switch_mutex_lock(clock->ops_mutex);
+    if (clock->stopped) {
+        switch_mutex_unlock(clock->ops_mutex);
+        socket_audio_reactor_detach(ctx);
+        return;
+    }
+    ctx->clock_op_next = clock->detach_ops;
+    clock->detach_ops = ctx;
+    switch_mutex_unlock(clock->ops_mutex);
+}
+
+static void socket_audio_clock_schedule(socket_audio_clock_t *clock, socket_audio_ctx_t *ctx, uint64_t tick)
+{
+    uint32_t slot = (uint32_t)(tick & (SOCKET_AUDIO_WHEEL_SLOTS - 1));
+
+    ctx->wheel_tick = tick;
+    ctx->wheel_slot = slot;
+    ctx->wheel_prev = NULL;
+    ctx->wheel_next = clock->slots[slot];
+    if (ctx->wheel_next) {
+        ctx->wheel_next->wheel_prev = ctx;
+    }
+    clock->slots[slot] = ctx;
+    ctx->scheduled = 1;
+}
+
+static void socket_audio_clock_unschedule(socket_audio_clock_t *clock, socket_audio_ctx_t *ctx)
+{
+    if (!ctx->scheduled) {
+        return;
+    }
+
+    if (ctx->wheel_prev) {
+        ctx->wheel_prev->wheel_next = ctx->wheel_next;
+    } else {
+        clock->slots[ctx->wheel_slot] = ctx->wheel_next;
+    }
+    if (ctx->wheel_next) {
+        ctx->wheel_next->wheel_prev = ctx->wheel_prev;
+    }
+    ctx->wheel_prev = ctx->wheel_next = NULL;
+    ctx->scheduled = 0;
+}
+
+static void socket_audio_clock_apply_ops(socket_audio_clock_t *clock)
+{
+    socket_audio_ctx_t *attach, *detach, *ctx, *next;
+
+    switch_mutex_lock(clock->ops_mutex);
+    attach = clock->attach_ops;
+    detach = clock->detach_ops;
+    clock->attach_ops = NULL;
+    clock->detach_ops = NULL;
+    switch_mutex_unlock(clock->ops_mutex);
+
+    for (ctx = attach; ctx; ctx = next) {
+        next = ctx->clock_op_next;
+        ctx->clock_op_next = NULL;
+        socket_audio_clock_schedule(clock, ctx, clock->tick + 1);
+    }
+
+    for (ctx = detach; ctx; ctx = next) {
+        next = ctx->clock_op_next;
+        ctx->clock_op_next = NULL;
+        socket_audio_clock_unschedule(clock, ctx);
+        socket_audio_reactor_detach(ctx);
+    }
+}
+
+/*
+ * Clock Thread
+ *
+ * Steps the wheel on every soft timer tick and writes the frames that are due.
+ */
+static void *SWITCH_THREAD_FUNC socket_audio_clock_thread(switch_thread_t *thread, void *obj)
+{
+    socket_audio_clock_t *clock = (socket_audio_clock_t *)obj;
+    switch_timer_t timer = { 0 };
+
+    if (switch_core_timer_init(&timer, "soft", SOCKET_AUDIO_CLOCK_TICK_MS,
+                               8000 * SOCKET_AUDIO_CLOCK_TICK_MS / 1000, NULL) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                          "Clock %u: failed to start soft timer, playback disabled\n", clock->id);
+        switch_mutex_lock(clock->ops_mutex);
+        clock->stopped = 1;
+        switch_mutex_unlock(clock->ops_mutex);
+        socket_audio_clock_apply_ops(clock);
+        return NULL;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Socket audio clock %u started\n", clock->id);
+
+    while (globals.running) {
+        socket_audio_ctx_t *ctx, *due;
+        uint32_t slot;
+        uint64_t now_us;
+
+        if (switch_core_timer_next(&timer) != SWITCH_STATUS_SUCCESS) {
+            break;
+        }
+
+        clock->tick++;
+        now_us = clock->tick * SOCKET_AUDIO_CLOCK_TICK_US;
+
+        socket_audio_clock_apply_ops(clock);
+
+        slot = (uint32_t)(clock->tick & (SOCKET_AUDIO_WHEEL_SLOTS - 1));
+        due = clock->slots[slot];
+        clock->slots[slot] = NULL;
+
+        while ((ctx = due)) {
+            uint64_t next_us, next_tick;
+
+            due = ctx->wheel_next;
+            if (due) {
+                due->wheel_prev = NULL;
+            }
+            ctx->wheel_prev = ctx->wheel_next = NULL;
+            ctx->scheduled = 0;
+
+            if (ctx->wheel_tick > clock->tick) {
+                /* Lands on this slot in a later lap of the wheel */
+                socket_audio_clock_schedule(clock, ctx, ctx->wheel_tick);
+                continue;
+            }
+
+            next_us = socket_audio_pipe_playout(ctx, now_us);
+            next_tick = (next_us + SOCKET_AUDIO_CLOCK_TICK_US - 1) / SOCKET_AUDIO_CLOCK_TICK_US;
+            if (next_tick <= clock->tick) {
+                next_tick = clock->tick + 1;
+            }
+            socket_audio_clock_schedule(clock, ctx, next_tick);
+        }
+    }
+
+    /* Stop servicing pipes; their media bugs hand them to the reactor on close */
+    switch_mutex_lock(clock->ops_mutex);
+    clock->stopped = 1;
+    switch_mutex_unlock(clock->ops_mutex);
+    socket_audio_clock_apply_ops(clock);
+
+    switch_core_timer_destroy(&timer);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Socket audio clock %u exiting\n", clock->id);
+
+    return NULL;
+}
+
+/*
+ * Create and start the module reactors and their playback clocks.
+ */
+static switch_status_t socket_audio_reactors_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+    uint32_t i;
+
+    globals.reactor_count = globals.reactor_threads ? globals.reactor_threads : switch_core_cpu_count();
+    if (globals.reactor_count == 0) {
+        globals.reactor_count = 1;
+    }
+
+    globals.reactors = switch_core_alloc(globals.pool, sizeof(socket_audio_reactor_t) * globals.reactor_count);
+    globals.clocks = switch_core_alloc(globals.pool, sizeof(socket_audio_clock_t) * globals.reactor_count);
+    memset(globals.clocks, 0, sizeof(socket_audio_clock_t) * globals.reactor_count);
+    memset(globals.reactors, 0, sizeof(socket_audio_reactor_t) * globals.reactor_count);
+    for (i = 0; i < globals.reactor_count; i++) {
+        globals.reactors[i].epoll_fd = -1;
+        globals.reactors[i].wake_fd = -1;
+    }
+
+    for (i = 0; i < globals.reactor_count; i++) {
+        socket_audio_reactor_t *reactor = &globals.reactors[i];
+        struct epoll_event ev = { 0 };
+
+        reactor->id = i;
+        switch_mutex_init(&reactor->ops_mutex, SWITCH_MUTEX_NESTED, globals.pool);
+
+        if ((reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            (reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                              "Reactor %u: failed to create epoll/eventfd (errno=%d)\n", i, errno);
+            return SWITCH_STATUS_FALSE;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = reactor;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev) < 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                              "Reactor %u: failed to poll eventfd (errno=%d)\n", i, errno);
+            return SWITCH_STATUS_FALSE;
+        }
+
+        switch_threadattr_create(&thd_attr, globals.pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        if (switch_thread_create(&reactor->thread, thd_attr, socket_audio_reactor_thread, reactor, globals.pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                              "Reactor %u: failed to create thread\n", i);
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    for (i = 0; i < globals.reactor_count; i++) {
+        socket_audio_clock_t *clock = &globals.clocks[i];
+
+        clock->id = i;
+        switch_mutex_init(&clock->ops_mutex, SWITCH_MUTEX_NESTED, globals.pool);
+
+        switch_threadattr_create(&thd_attr, globals.pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        switch_threadattr_priority_set(thd_attr, SWITCH_PRI_REALTIME);
+        if (switch_thread_create(&clock->thread, thd_attr, socket_audio_clock_thread, clock, globals.pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                              "Clock %u: failed to create thread\n", i);
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                      "Started %u socket audio reactor/clock thread pair(s)\n", globals.reactor_count);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Stop and join the module clocks and reactors. Safe to call after a partial start.
+ */
+static void socket_audio_reactors_stop(void)
+{
+    uint32_t i;
+
+    globals.running = 0;
+
+    /* Clocks first: they forward pending detaches to the reactors */
+    for (i = 0; i < globals.reactor_count && globals.clocks; i++) {
+        socket_audio_clock_t *clock = &globals.clocks[i];
+        switch_status_t st;
+
+        if (clock->thread) {
+            switch_thread_join(&st, clock->thread);
+            clock->thread = NULL;
+        }
+    }
+
+    for (i = 0; i < globals.reactor_count && globals.reactors; i++) {
+        socket_audio_reactor_t *reactor = &globals.reactors[i];
+        switch_status_t st;
+
+        if (reactor->thread) {
+            socket_audio_reactor_wake(reactor);
+            switch_thread_join(&st, reactor->thread);
+            reactor->thread = NULL;
+        }
+        if (reactor->wake_fd >= 0) {
+            close(reactor->wake_fd);
+            reactor->wake_fd = -1;
+        }
+        if (reactor->epoll_fd >= 0) {
+            close(reactor->epoll_fd);
+            reactor->epoll_fd = -1;
+        }
+    }
+}
+
+/*
+ * Connect to a co-located sidecar over a unix domain stream socket. A local
+ * connect only blocks while the listener's backlog is full; SO_SNDTIMEO bounds
+ * that wait. The descriptor is wrapped so the rest of the module handles it
+ * like a TCP socket.
+ */
+static switch_status_t socket_audio_connect_unix(const char *path, uint32_t timeout_ms,
+                                                 switch_memory_pool_t *pool, switch_socket_t **sock)
+{
+    struct sockaddr_un sun;
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    struct timeval none = { 0, 0 };
+    switch_os_socket_t fd;
+
+    if (zstr(path) || strlen(path) >= sizeof(sun.sun_path)) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    memcpy(sun.sun_path, path, strlen(path));
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        close(fd);
+        return SWITCH_STATUS_FALSE;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &none, sizeof(none));
+
+    if (switch_os_sock_put(sock, &fd, pool) != SWITCH_STATUS_SUCCESS) {
+        close(fd);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Connect to a sidecar, giving up after timeout_ms instead of the kernel's TCP
+ * timeout. The socket is left blocking with Nagle disabled, as before.
+ * A host of unix:/path selects a unix domain socket; the port is unused.
+ */
+static switch_status_t socket_audio_connect(const char *host, switch_port_t port, uint32_t timeout_ms,
+                                            switch_memory_pool_t *pool, switch_socket_t **sock)
+{
+    switch_sockaddr_t *sa = NULL;
+
+    *sock = NULL;
+
+    if (!strncasecmp(host, SOCKET_AUDIO_UNIX_PREFIX, strlen(SOCKET_AUDIO_UNIX_PREFIX))) {
+        return socket_audio_connect_unix(host + strlen(SOCKET_AUDIO_UNIX_PREFIX), timeout_ms, pool, sock);
+    }
+
+    if (switch_sockaddr_info_get(&sa, host, SWITCH_UNSPEC, port, 0, pool) != SWITCH_STATUS_SUCCESS ||
+        switch_socket_create(sock, switch_sockaddr_get_family(sa), SOCK_STREAM, SWITCH_PROTO_TCP, pool) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* A positive timeout makes the connect non-blocking with a poll for completion */
+    switch_socket_timeout_set(*sock, (switch_interval_time_t)timeout_ms * 1000);
+    if (switch_socket_connect(*sock, sa) != SWITCH_STATUS_SUCCESS) {
+        switch_socket_close(*sock);
+        *sock = NULL;
+        return SWITCH_STATUS_FALSE;
+    }
+    switch_socket_timeout_set(*sock, -1);
+
+    /* CRITICAL: Disable Nagle's algorithm for low latency */
+    switch_socket_opt_set(*sock, SWITCH_SO_TCP_NODELAY, 1);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static socket_audio_pool_t *socket_audio_pool_find(const char *host, switch_port_t port)
+{
+    socket_audio_pool_t *pool;
+
+    for (pool = globals.pools; pool; pool = pool->next) {
+        if (pool->port == port && !strcasecmp(pool->host, host)) {
+            return pool;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Take a live idle connection from the pool, or NULL. Connections the sidecar
+ * closed while idle are discarded here.
+ */
+static socket_audio_conn_t *socket_audio_pool_take(socket_audio_pool_t *pool)
+{
+    socket_audio_conn_t *conn;
+
+    for (;;) {
+        char byte;
+        ssize_t n;
+
+        switch_mutex_lock(globals.mutex);
+        if ((conn = pool->idle)) {
+            pool->idle = conn->next;
+            pool->idle_count--;
+        }
+        switch_mutex_unlock(globals.mutex);
+
+        if (!conn) {
+            return NULL;
+        }
+
+        n = recv(conn->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+            return conn;
+        }
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
+                          "Pooled connection to %s:%u closed while idle, discarding\n", pool->host, pool->port);
+        socket_audio_conn_destroy(conn);
+    }
+}
+
+/*
+ * Connector: top up one pool by a connection. Returns SWITCH_TRUE if it
+ * connected, so the caller keeps going without sleeping.
+ */
+static switch_bool_t socket_audio_pool_fill(socket_audio_pool_t *pool)
+{
+    socket_audio_conn_t *conn;
+    switch_memory_pool_t *conn_pool = NULL;
+    switch_socket_t *sock = NULL;
+    switch_time_t now = switch_micro_time_now();
+
+    if (pool->idle_count >= pool->size || now < pool->retry_at) {
+        return SWITCH_FALSE;
+    }
+
+    if (switch_core_new_memory_pool(&conn_pool) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_FALSE;
+    }
+
+    if (socket_audio_connect(pool->host, pool->port, globals.connect_timeout_ms, conn_pool, &sock) != SWITCH_STATUS_SUCCESS) {
+        if (!pool->retry_at) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                              "Connection pool: cannot connect to %s:%u, retrying\n", pool->host, pool->port);
+        }
+        pool->retry_at = now + SOCKET_AUDIO_POOL_RETRY_US;
+        switch_core_destroy_memory_pool(&conn_pool);
+        return SWITCH_FALSE;
+    }
+
+    if (pool->retry_at) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                          "Connection pool: %s:%u reachable again\n", pool->host, pool->port);
+        pool->retry_at = 0;
+    }
+
+    conn = switch_core_alloc(conn_pool, sizeof(*conn));
+    conn->pool = conn_pool;
+    conn->sock = sock;
+    switch_os_sock_get(&conn->fd, sock);
+
+    switch_mutex_lock(globals.mutex);
+    conn->next = pool->idle;
+    pool->idle = conn;
+    pool->idle_count++;
+    switch_mutex_unlock(globals.mutex);
+
+    return SWITCH_TRUE;
+}
+
+/*
+ * Connector: make one attempt for a lost pipe whose backoff has expired.
+ * Attempts cycle through the primary host and the alternates. The connect
+ * runs outside the mutex; if the call ended meanwhile the result is dropped.
+ */
+static switch_bool_t socket_audio_reconnect_step(void)
+{
+    socket_audio_reconnect_t *job, **link;
+    switch_time_t now = switch_micro_time_now();
+    switch_memory_pool_t *conn_pool = NULL;
+    switch_socket_t *sock = NULL;
+    socket_audio_conn_t *conn;
+    const char *host;
+    switch_port_t port;
+    switch_status_t status;
+
+    switch_mutex_lock(globals.mutex);
+    for (job = globals.reconnects; job && (job->ctx && now < job->retry_at); job = job->next);
+    if (job) {
+        job->busy = 1;
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    if (!job) {
+        return SWITCH_FALSE;
+    }
+
+    host = job->hosts[job->attempt % job->host_count];
+    port = job->ports[job->attempt % job->host_count];
+    job->attempt++;
+
+    status = SWITCH_STATUS_FALSE;
+    if (job->ctx && switch_core_new_memory_pool(&conn_pool) == SWITCH_STATUS_SUCCESS) {
+        status = socket_audio_connect(host, port, job->timeout_ms, conn_pool, &sock);
+    }
+
+    switch_mutex_lock(globals.mutex);
+    job->busy = 0;
+
+    if (job->ctx && status == SWITCH_STATUS_SUCCESS) {
+        conn = switch_core_alloc(conn_pool, sizeof(*conn));
+        conn->pool = conn_pool;
+        conn->sock = sock;
+        switch_os_sock_get(&conn->fd, sock);
+        conn_pool = NULL;
+
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(job->ctx->session), SWITCH_LOG_NOTICE,
+                          "Reconnected to sidecar at %s:%u (attempt %u)\n", host, port, job->attempt);
+        socket_audio_stat_add(job->ctx, SOCKET_AUDIO_STAT_RECONNECTS, 1);
+        socket_audio_fire_reconnect_event(job->ctx, "connected", job->attempt, host, port);
+
+        /* The media thread swaps it in on its next frame */
+        __atomic_store_n(&job->ctx->relink, conn, __ATOMIC_RELEASE);
+        job->ctx->reconnect = NULL;
+        job->ctx = NULL;
+    } else if (job->ctx) {
+        if (job->attempt >= job->max_attempts) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(job->ctx->session), SWITCH_LOG_ERROR,
+                              "Giving up on sidecar after %u reconnect attempts\n", job->attempt);
+            socket_audio_fire_reconnect_event(job->ctx, "failed", job->attempt, NULL, 0);
+            job->ctx->running = 0;
+            job->ctx->reconnect = NULL;
+            job->ctx = NULL;
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(job->ctx->session), SWITCH_LOG_WARNING,
+                              "Reconnect attempt %u to %s:%u failed, next in %ums\n",
+                              job->attempt, host, port, job->backoff_ms);
+            job->retry_at = switch_micro_time_now() + (switch_time_t)job->backoff_ms * 1000;
+            job->backoff_ms = job->backoff_ms * 2 < SOCKET_AUDIO_RECONNECT_BACKOFF_MAX_MS ?
+                              job->backoff_ms * 2 : SOCKET_AUDIO_RECONNECT_BACKOFF_MAX_MS;
+        }
+    }
+
+    if (!job->ctx) {
+        for (link = &globals.reconnects; *link; link = &(*link)->next) {
+            if (*link == job) {
+                *link = job->next;
+                break;
+            }
+        }
+        free(job);
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    if (conn_pool) {
+        if (sock) {
+            switch_socket_close(sock);
+        }
+        switch_core_destroy_memory_pool(&conn_pool);
+    }
+
+    return status == SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Connector thread: all outbound connects that must not run on a session,
+ * reactor or clock thread. Keeps the pools topped up, one connect at a time,
+ * and works through lost pipes waiting to reconnect.
+ */
+static void *SWITCH_THREAD_FUNC socket_audio_connector_thread(switch_thread_t *thread, void *obj)
+{
+    while (globals.running) {
+        socket_audio_pool_t *pool;
+        uint8_t busy = 0;
+
+        while (globals.running && socket_audio_reconnect_step()) {
+            busy = 1;
+        }
+
+        for (pool = globals.pools; pool && globals.running; pool = pool->next) {
+            if (socket_audio_pool_fill(pool)) {
+                busy = 1;
+            }
+        }
+
+        if (!busy) {
+            switch_yield(50000);
+        }
+    }
+
+    return NULL;
+}
+
+static void socket_audio_connector_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&globals.connector_thread, thd_attr, socket_audio_connector_thread, NULL, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Failed to create connector thread\n");
+        globals.connector_thread = NULL;
+    }
+}
+
+/* Call after globals.running is cleared */
+static void socket_audio_connector_stop(void)
+{
+    socket_audio_pool_t *pool;
+    switch_status_t st;
+
+    if (globals.connector_thread) {
+        switch_thread_join(&st, globals.connector_thread);
+        globals.connector_thread = NULL;
+    }
+
+    for (pool = globals.pools; pool; pool = pool->next) {
+        while (pool->idle) {
+            socket_audio_conn_t *conn = pool->idle;
+
+            pool->idle = conn->next;
+            socket_audio_conn_destroy(conn);
+        }
+        pool->idle_count = 0;
+    }
+
+    /* Pipes still waiting give up; their calls keep going without the sidecar */
+    switch_mutex_lock(globals.mutex);
+    while (globals.reconnects) {
+        socket_audio_reconnect_t *job = globals.reconnects;
+
+        globals.reconnects = job->next;
+        if (job->ctx) {
+            job->ctx->reconnect = NULL;
+            job->ctx->running = 0;
+        }
+        free(job);
+    }
+    switch_mutex_unlock(globals.mutex);
+}
+
+/*
+ * StatsD exporter
+ *
+ * Pushes the module-wide totals every metrics-interval seconds as one or more
+ * UDP datagrams: counters as deltas since the last push (|c, so the StatsD
+ * server derives rates), active pipes, flush latency and frame pacing error
+ * percentiles over the interval as gauges. It only reads the stats, so the
+ * media paths never wait on it.
+ */
+typedef struct {
+    switch_socket_t *sock;
+    switch_sockaddr_t *addr;
+    char buf[SOCKET_AUDIO_STATSD_PACKET];
+    switch_size_t len;
+} socket_audio_statsd_t;
+
+static void socket_audio_statsd_flush(socket_audio_statsd_t *sd)
+{
+    switch_size_t len = sd->len;
+
+    if (len && switch_socket_sendto(sd->sock, sd->addr, 0, sd->buf, &len) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "StatsD send failed\n");
+    }
+    sd->len = 0;
+}
+
+static void socket_audio_statsd_metric(socket_audio_statsd_t *sd, const char *name, double value, const char *type)
+{
+    char line[256];
+    int n = switch_snprintf(line, sizeof(line), "%s.%s:%.3f|%s\n", globals.statsd_prefix, name, value, type);
+
+    if (n <= 0 || (switch_size_t)n >= sizeof(line)) {
+        return;
+    }
+    if (sd->len + n > sizeof(sd->buf)) {
+        socket_audio_statsd_flush(sd);
+    }
+    memcpy(sd->buf + sd->len, line, n);
+    sd->len += n;
+}
+
+static void *SWITCH_THREAD_FUNC socket_audio_metrics_thread(switch_thread_t *thread, void *obj)
+{
+    socket_audio_statsd_t *sd = obj;
+    socket_audio_stats_t last, now, delta;
+    uint32_t waited_ms = 0;
+    int i;
+
+    socket_audio_stats_total(&last);
+
+    while (globals.running) {
+        uint32_t active;
+        uint64_t flushes;
+
+        /* Short sleeps so module unload is not held up by the interval */
+        switch_yield(100000);
+        if ((waited_ms += 100) < globals.metrics_interval * 1000) {
+            continue;
+        }
+        waited_ms = 0;
+
+        active = socket_audio_stats_total(&now);
+        for (i = 0; i < SOCKET_AUDIO_STAT_COUNT; i++) {
+            delta.count[i] = socket_audio_stat_info[i].is_max ? now.count[i] : now.count[i] - last.count[i];
+        }
+        for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS; i++) {
+            delta.pace[i] = now.pace[i] - last.pace[i];
+        }
+        last = now;
+
+        socket_audio_statsd_metric(sd, "active_pipes", active, "g");
+        socket_audio_statsd_metric(sd, "load_level", globals.load_level, "g");
+        for (i = 0; i < SOCKET_AUDIO_STAT_COUNT; i++) {
+            if (!socket_audio_stat_info[i].is_max) {
+                socket_audio_statsd_metric(sd, socket_audio_stat_info[i].name, (double)delta.count[i], "c");
+            }
+        }
+
+        flushes = delta.count[SOCKET_AUDIO_STAT_FLUSHES];
+        if (flushes) {
+            socket_audio_statsd_metric(sd, "flush_latency_ms_avg",
+                                       delta.count[SOCKET_AUDIO_STAT_FLUSH_US_TOTAL] / 1000.0 / flushes, "g");
+        }
+        socket_audio_statsd_metric(sd, "pace_error_ms_p50",
+                                   socket_audio_pace_quantile(delta.pace, 0.50, delta.count[SOCKET_AUDIO_STAT_PACE_ERROR_US_MAX]), "g");
+        socket_audio_statsd_metric(sd, "pace_error_ms_p99",
+                                   socket_audio_pace_quantile(delta.pace, 0.99, delta.count[SOCKET_AUDIO_STAT_PACE_ERROR_US_MAX]), "g");
+
+        socket_audio_statsd_flush(sd);
+    }
+
+    return NULL;
+}
+
+static void socket_audio_metrics_start(void)
+{
+    socket_audio_statsd_t *sd;
+    switch_threadattr_t *thd_attr = NULL;
+
+    if (!globals.statsd_host) {
+        return;
+    }
+
+    sd = switch_core_alloc(globals.pool, sizeof(*sd));
+    memset(sd, 0, sizeof(*sd));
+
+    if (switch_sockaddr_info_get(&sd->addr, globals.statsd_host, SWITCH_UNSPEC, globals.statsd_port, 0, globals.pool) != SWITCH_STATUS_SUCCESS ||
+        switch_socket_create(&sd->sock, switch_sockaddr_get_family(sd->addr), SOCK_DGRAM, SWITCH_PROTO_UDP, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                          "StatsD: cannot reach %s:%u, metrics export disabled\n", globals.statsd_host, globals.statsd_port);
+        return;
+    }
+
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&globals.metrics_thread, thd_attr, socket_audio_metrics_thread, sd, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "StatsD: failed to create thread\n");
+        globals.metrics_thread = NULL;
+        return;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                      "StatsD: pushing %s.* to %s:%u every %us\n",
+                      globals.statsd_prefix, globals.statsd_host, globals.statsd_port, globals.metrics_interval);
+}
+
+/* Call after globals.running is cleared */
+static void socket_audio_metrics_stop(void)
+{
+    switch_status_t st;
+
+    if (globals.metrics_thread) {
+        switch_thread_join(&st, globals.metrics_thread);
+        globals.metrics_thread = NULL;
+    }
+}
+
+/*
+ * Load shedding
+ *
+ * A module-level monitor samples two signs of CPU pressure: the mean time a
+ * mic callback takes (it runs on the session's media thread, which contends
+ * with everything else on the box) and the p99 pacing error of the playback
+ * clocks. While either is past its threshold it steps the load level up by
+ * one per interval; after load-recover-s of both being under half of theirs
+ * it steps back down one. Each pipe applies the level on its own threads:
+ *
+ *   1  cheaper resampler filters, no per-frame debug logging
+ *   2  also mic frames batched LOAD_BATCH_FACTOR times larger per send, and
+ *      the echo canceller on suppression only (its filter is frozen)
+ *   3  also VAD-gated sending: frames the VAD thinks are silence are held back
+ *
+ * Every change fires socket_audio::load.
+ */
+static const char *socket_audio_load_policy[SOCKET_AUDIO_LOAD_LEVEL_MAX + 1] = {
+    "none",
+    "lite-resampler",
+    "lite-resampler,mic-batch,aec-suppress-only",
+    "lite-resampler,mic-batch,aec-suppress-only,vad-gate"
+};
+
+static void socket_audio_load_fire(uint32_t level, uint32_t previous, double media_us, double pace_ms)
+{
+    switch_event_t *event;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, level > previous ? SWITCH_LOG_WARNING : SWITCH_LOG_NOTICE,
+                      "Load level %u -> %u (mic callback %.0fus/frame, pacing p99 %.1fms): %s\n",
+                      previous, level, media_us, pace_ms, socket_audio_load_policy[level]);
+
+    if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, SOCKET_AUDIO_LOAD_EVENT) != SWITCH_STATUS_SUCCESS) {
+        return;
+    }
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Load-Level", "%u", level);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Load-Previous-Level", "%u", previous);
+    switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Load-Policy", socket_audio_load_policy[level]);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Load-Media-Us", "%.0f", media_us);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Load-Pace-Ms-P99", "%.1f", pace_ms);
+    switch_event_fire(&event);
+}
+
+static void *SWITCH_THREAD_FUNC socket_audio_load_thread(switch_thread_t *thread, void *obj)
+{
+    socket_audio_stats_t last, now;
+    uint64_t pace[SOCKET_AUDIO_PACE_BUCKETS];
+    uint32_t waited_ms = 0, calm_ms = 0;
+    int i;
+
+    socket_audio_stats_total(&last);
+
+    while (globals.running) {
+        uint32_t level = globals.load_level;
+        uint64_t frames, media_us;
+        double media_avg, pace_p99;
+
+        /* Short sleeps so module unload is not held up by the interval */
+        switch_yield(100000);
+        if ((waited_ms += 100) < globals.load_interval_ms) {
+            continue;
+        }
+        waited_ms = 0;
+
+        socket_audio_stats_total(&now);
+        frames = now.count[SOCKET_AUDIO_STAT_MEDIA_FRAMES] - last.count[SOCKET_AUDIO_STAT_MEDIA_FRAMES];
+        media_us = now.count[SOCKET_AUDIO_STAT_MEDIA_US_TOTAL] - last.count[SOCKET_AUDIO_STAT_MEDIA_US_TOTAL];
+        for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS; i++) {
+            pace[i] = now.pace[i] - last.pace[i];
+        }
+        last = now;
+
+        media_avg = frames ? (double)media_us / frames : 0;
+        pace_p99 = socket_audio_pace_quantile(pace, 0.99, now.count[SOCKET_AUDIO_STAT_PACE_ERROR_US_MAX]);
+
+        if (media_avg >= globals.load_media_us || pace_p99 > globals.load_pace_ms) {
+            calm_ms = 0;
+            if (level < SOCKET_AUDIO_LOAD_LEVEL_MAX) {
+                __atomic_store_n(&globals.load_level, level + 1, __ATOMIC_RELAXED);
+                socket_audio_load_fire(level + 1, level, media_avg, pace_p99);
+            }
+        } else if (media_avg < globals.load_media_us / 2.0 && pace_p99 <= globals.load_pace_ms / 2.0) {
+            calm_ms += globals.load_interval_ms;
+            if (level && calm_ms >= globals.load_recover_s * 1000) {
+                calm_ms = 0;
+                __atomic_store_n(&globals.load_level, level - 1, __ATOMIC_RELAXED);
+                socket_audio_load_fire(level - 1, level, media_avg, pace_p99);
+            }
+        } else {
+            calm_ms = 0;
+        }
+    }
+
+    return NULL;
+}
+
+static void socket_audio_load_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+
+    globals.load_level = 0;
+    if (!globals.load_shedding) {
+        return;
+    }
+
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&globals.load_thread, thd_attr, socket_audio_load_thread, NULL, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Load shedding: failed to create monitor thread\n");
+        globals.load_thread = NULL;
+        return;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                      "Load shedding: every %ums, pressure at %uus/frame or %ums pacing p99\n",
+                      globals.load_interval_ms, globals.load_media_us, globals.load_pace_ms);
+}
+
+/* Call after globals.running is cleared */
+static void socket_audio_load_stop(void)
+{
+    switch_status_t st;
+
+    if (globals.load_thread) {
+        switch_thread_join(&st, globals.load_thread);
+        globals.load_thread = NULL;
+    }
+    globals.load_level = 0;
+}
+
+/*
+ * Recording writer
+ *
+ * One thread drains every pipe's tap SOCKET_AUDIO_RECORD_INTERVAL_MS apart,
+ * each in one or two large sequential writes, into stereo WAV files: the
+ * caller on the left, what the module played on the right. A file is
+ * finished (its header sizes filled in) when its segment is full or the pipe
+ * is gone, and the next one starts with the next audio.
+ */
+static uint8_t *socket_audio_put_le(uint8_t *p, uint32_t v, uint32_t bytes)
+{
+    uint32_t i;
+
+    for (i = 0; i < bytes; i++) {
+        *p++ = (uint8_t)(v >> (8 * i));
+    }
+
+    return p;
+}
+
+/* Canonical 44-byte header: PCM, 2 channels, 16 bits */
+static void socket_audio_wav_header(uint8_t *h, uint32_t rate, uint32_t data_bytes)
+{
+    uint8_t *p = h;
+
+    memcpy(p, "RIFF", 4);
+    p = socket_audio_put_le(p + 4, 36 + data_bytes, 4);
+    memcpy(p, "WAVEfmt ", 8);
+    p = socket_audio_put_le(p + 8, 16, 4);
+    p = socket_audio_put_le(p, 1, 2);
+    p = socket_audio_put_le(p, 2, 2);
+    p = socket_audio_put_le(p, rate, 4);
+    p = socket_audio_put_le(p, rate * 2 * sizeof(int16_t), 4);
+    p = socket_audio_put_le(p, 2 * sizeof(int16_t), 2);
+    p = socket_audio_put_le(p, 16, 2);
+    memcpy(p, "data", 4);
+    socket_audio_put_le(p + 4, data_bytes, 4);
+}
+
+/* Writer thread, or teardown once the writer has stopped */
+static switch_status_t socket_audio_record_file_open(socket_audio_recorder_t *rec)
+{
+    uint8_t header[SOCKET_AUDIO_RECORD_WAV_HEADER];
+    char path[SOCKET_AUDIO_RECORD_PATH_MAX];
+
+    switch_snprintf(path, sizeof(path), "%s-%04u.wav", rec->prefix, rec->segment + 1);
+    if ((rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_UUID_LOG(rec->uuid), SWITCH_LOG_ERROR,
+                          "Recording: cannot create %s (errno=%d), recording stopped\n", path, errno);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* Sizes are filled in when the file is finished */
+    socket_audio_wav_header(header, rec->rate, 0);
+    if (write(rec->fd, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        switch_log_printf(SWITCH_CHANNEL_UUID_LOG(rec->uuid), SWITCH_LOG_ERROR,
+                          "Recording: cannot write %s (errno=%d), recording stopped\n", path, errno);
+        close(rec->fd);
+        rec->fd = -1;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    rec->segment++;
+    rec->file_bytes = 0;
+    switch_log_printf(SWITCH_CHANNEL_UUID_LOG(rec->uuid), SWITCH_LOG_DEBUG, "Recording to %s\n", path);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void socket_audio_record_file_close(socket_audio_recorder_t *rec)
+{
+    uint8_t header[SOCKET_AUDIO_RECORD_WAV_HEADER];
+
+    if (rec->fd < 0) {
+        return;
+    }
+
+    socket_audio_wav_header(header, rec->rate, (uint32_t)rec->file_bytes);
+    if (pwrite(rec->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        switch_log_printf(SWITCH_CHANNEL_UUID_LOG(rec->uuid), SWITCH_LOG_WARNING,
+                          "Recording: cannot finish segment %u header (errno=%d)\n", rec->segment, errno);
+    }
+    close(rec->fd);
+    rec->fd = -1;
+
+    switch_log_printf(SWITCH_CHANNEL_UUID_LOG(rec->uuid), SWITCH_LOG_INFO,
+                      "Recording: %s-%04u.wav done (%.1fs)\n", rec->prefix, rec->segment,
+                      (double)rec->file_bytes / (rec->rate * 2 * sizeof(int16_t)));
+}
+
+/* Write out everything in the tap, rotating at segment boundaries */
+static void socket_audio_record_drain(socket_audio_recorder_t *rec)
+{
+    const uint8_t *p;
+    size_t len;
+
+    while ((len = socket_audio_tap_peek(&rec->tap, &p))) {
+        ssize_t n;
+
+        if (rec->failed || (rec->fd < 0 && socket_audio_record_file_open(rec) != SWITCH_STATUS_SUCCESS)) {
+            rec->failed = 1;
+            socket_audio_tap_consume(&rec->tap, len);
+            continue;
+        }
+
+        if (len > rec->segment_bytes - rec->file_bytes) {
+            len = (size_t)(rec->segment_bytes - rec->file_bytes);
+        }
+        if ((n = write(rec->fd, p, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            switch_log_printf(SWITCH_CHANNEL_UUID_LOG(rec->uuid), SWITCH_LOG_ERROR,
+                              "Recording: write failed (errno=%d), recording stopped\n", errno);
+            socket_audio_record_file_close(rec);
+            rec->failed = 1;
+            continue;
+        }
+
+        socket_audio_tap_consume(&rec->tap, (size_t)n);
+        rec->file_bytes += (uint64_t)n;
+        if (rec->file_bytes >= rec->segment_bytes) {
+            socket_audio_record_file_close(rec);
+        }
+    }
+}
+
+static void socket_audio_recorder_free(socket_audio_recorder_t *rec)
+{
+    socket_audio_recorder_t **pp;
+
+    switch_mutex_lock(globals.record_mutex);
+    for (pp = &globals.recorders; *pp && *pp != rec; pp = &(*pp)->next);
+    if (*pp) {
+        *pp = rec->next;
+        globals.recorder_count--;
+    }
+    switch_mutex_unlock(globals.record_mutex);
+
+    socket_audio_tap_destroy(&rec->tap);
+    free(rec->prefix);
+    free(rec);
+}
+
+/*
+ * One pass over the recorders. The list is walked without the lock: new
+ * recorders only go in at the head and only this thread unlinks. The final
+ * pass (unload) finishes every file and holds the lock throughout, so
+ * teardown after it does its own draining.
+ */
+static void socket_audio_record_pass(uint8_t final)
+{
+    socket_audio_recorder_t *rec, *next;
+
+    switch_mutex_lock(globals.record_mutex);
+    rec = globals.recorders;
+    if (final) {
+        globals.record_running = 0;
+    } else {
+        switch_mutex_unlock(globals.record_mutex);
+    }
+
+    for (; rec; rec = next) {
+        uint8_t closing = __atomic_load_n(&rec->closing, __ATOMIC_ACQUIRE);
+
+        next = rec->next;
+        socket_audio_record_drain(rec);
+        if (closing || final) {
+            socket_audio_record_file_close(rec);
+        }
+        if (closing) {
+            socket_audio_recorder_free(rec);
+        }
+    }
+
+    if (final) {
+        switch_mutex_unlock(globals.record_mutex);
+    }
+}
+
+static void *SWITCH_THREAD_FUNC socket_audio_record_thread(switch_thread_t *thread, void *obj)
+{
+    while (globals.running) {
+        switch_yield(SOCKET_AUDIO_RECORD_INTERVAL_MS * 1000);
+        socket_audio_record_pass(0);
+    }
+    socket_audio_record_pass(1);
+
+    return NULL;
+}
+
+static void socket_audio_record_start(void)
+{
+    switch_threadattr_t *thd_attr = NULL;
+
+    globals.record_running = 1;
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&globals.record_thread, thd_attr, socket_audio_record_thread, NULL, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Recording: failed to create writer thread\n");
+        globals.record_thread = NULL;
+        globals.record_running = 0;
+    }
+}
+
+/* Call after globals.running is cleared */
+static void socket_audio_record_stop(void)
+{
+    switch_status_t st;
+
+    if (globals.record_thread) {
+        switch_thread_join(&st, globals.record_thread);
+        globals.record_thread = NULL;
+    }
+}
+
+/*
+ * A recorder for a pipe about to start: var is socket_audio_record, true for
+ * <record-dir>/<uuid>, else the path prefix (relative ones under record-dir).
+ * NULL if recording cannot start; the call goes on without it.
+ */
+static socket_audio_recorder_t *socket_audio_recorder_create(socket_audio_ctx_t *ctx, const char *var)
+{
+    socket_audio_recorder_t *rec;
+    const char *uuid = switch_core_session_get_uuid(ctx->session);
+    const char *dir = globals.record_dir ? globals.record_dir : SWITCH_GLOBAL_dirs.recordings_dir;
+    uint32_t bytes_per_second = ctx->session_rate * 2 * sizeof(int16_t);
+
+    if (!(rec = calloc(1, sizeof(*rec))) ||
+        socket_audio_tap_init(&rec->tap, (size_t)bytes_per_second * globals.record_buffer_seconds)) {
+        free(rec);
+        return NULL;
+    }
+
+    if (switch_true(var)) {
+        rec->prefix = switch_mprintf("%s%s%s", dir, SWITCH_PATH_SEPARATOR, uuid);
+    } else if (!switch_is_file_path(var)) {
+        rec->prefix = switch_mprintf("%s%s%s", dir, SWITCH_PATH_SEPARATOR, var);
+    } else {
+        rec->prefix = strdup(var);
+    }
+    switch_copy_string(rec->uuid, uuid, sizeof(rec->uuid));
+    rec->rate = ctx->session_rate;
+    rec->fd = -1;
+    rec->segment_bytes = globals.record_segment_seconds ? (uint64_t)bytes_per_second * globals.record_segment_seconds
+                                                        : SOCKET_AUDIO_RECORD_WAV_MAX;
+
+    switch_mutex_lock(globals.record_mutex);
+    if (globals.record_running && rec->prefix) {
+        rec->next = globals.recorders;
+        globals.recorders = rec;
+        globals.recorder_count++;
+    } else {
+        socket_audio_tap_destroy(&rec->tap);
+        switch_safe_free(rec->prefix);
+        free(rec);
+        rec = NULL;
+    }
+    switch_mutex_unlock(globals.record_mutex);
+
+    if (rec) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Recording: %s-NNNN.wav, stereo %u Hz (caller left, played right)\n", rec->prefix, rec->rate);
+    }
+
+    return rec;
+}
+
+/*
+ * Teardown: nothing writes the tap any more. The writer finishes the
+ * recording; after it has stopped (unload), it is finished here.
+ */
+static void socket_audio_recorder_close(socket_audio_recorder_t *rec)
+{
+    switch_mutex_lock(globals.record_mutex);
+    if (globals.record_running) {
+        __atomic_store_n(&rec->closing, 1, __ATOMIC_RELEASE);
+        rec = NULL;
+    }
+    switch_mutex_unlock(globals.record_mutex);
+
+    if (rec) {
+        socket_audio_record_drain(rec);
+        socket_audio_record_file_close(rec);
+        socket_audio_recorder_free(rec);
+    }
+}
+
+/*
+ * Load socket_audio.conf
+ */
+static void socket_audio_load_config(void)
+{
+    switch_xml_t cfg, xml, settings, param;
+
+    globals.reactor_threads = 0;
+    globals.queue_seconds = SOCKET_AUDIO_QUEUE_SECONDS;
+    globals.fast_resampler = SWITCH_TRUE;
+    globals.mic_batch_frames = SOCKET_AUDIO_MIC_BATCH_FRAMES;
+    globals.connect_timeout_ms = SOCKET_AUDIO_CONNECT_TIMEOUT_MS;
+    globals.pools = NULL;
+    globals.reconnect_attempts = SOCKET_AUDIO_RECONNECT_ATTEMPTS;
+    globals.reconnect_backoff_ms = SOCKET_AUDIO_RECONNECT_BACKOFF_MS;
+    globals.reconnect_buffer_ms = SOCKET_AUDIO_RECONNECT_BUFFER_MS;
+    globals.statsd_host = NULL;
+    globals.statsd_port = SOCKET_AUDIO_STATSD_PORT;
+    globals.statsd_prefix = SOCKET_AUDIO_STATSD_PREFIX;
+    globals.metrics_interval = SOCKET_AUDIO_METRICS_INTERVAL;
+    globals.vad_mode = SOCKET_AUDIO_VAD_OFF;
+    globals.vad_threshold_db = SOCKET_AUDIO_VAD_THRESHOLD_DB;
+    globals.vad_hangover_ms = SOCKET_AUDIO_VAD_HANGOVER_MS;
+    globals.jitter_buffer = SWITCH_FALSE;
+    globals.jitter_buffer_max_ms = SOCKET_AUDIO_JB_MAX_MS;
+    globals.plc_max_ms = SOCKET_AUDIO_PLC_MAX_MS;
+    globals.barge_in = SWITCH_FALSE;
+    globals.barge_in_ms = SOCKET_AUDIO_BARGE_IN_MS;
+    globals.barge_in_hangover_ms = SOCKET_AUDIO_BARGE_IN_HANGOVER_MS;
+    globals.event_debounce_ms = 0;
+    globals.legs_mode = SOCKET_AUDIO_LEGS_OFF;
+    globals.legs_max = SOCKET_AUDIO_LEGS_MAX;
+    globals.stereo = SWITCH_FALSE;
+    globals.aec = SWITCH_FALSE;
+    globals.aec_tail_ms = SOCKET_AUDIO_AEC_TAIL_MS;
+    globals.aec_max_taps = SOCKET_AUDIO_AEC_MAX_TAPS;
+    globals.aec_suppress_db = SOCKET_AUDIO_AEC_SUPPRESS_DB;
+    globals.cache_max_bytes = (switch_size_t)SOCKET_AUDIO_CACHE_MAX_MB << 20;
+    socket_audio_cache_rates_parse(SOCKET_AUDIO_CACHE_RATES);
+    globals.load_shedding = SWITCH_FALSE;
+    globals.load_interval_ms = SOCKET_AUDIO_LOAD_INTERVAL_MS;
+    globals.load_media_us = SOCKET_AUDIO_LOAD_MEDIA_US;
+    globals.load_pace_ms = SOCKET_AUDIO_LOAD_PACE_MS;
+    globals.load_recover_s = SOCKET_AUDIO_LOAD_RECOVER_S;
+    globals.ctx_free_max = SOCKET_AUDIO_CONTEXT_POOL;
+    globals.record_dir = NULL;
+    globals.record_segment_seconds = 0;
+    globals.record_buffer_seconds = SOCKET_AUDIO_RECORD_BUFFER_SECONDS;
+
+    if (!(xml = switch_xml_open_cfg(SOCKET_AUDIO_CONFIG, &cfg, NULL))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                          "%s not found, using defaults\n", SOCKET_AUDIO_CONFIG);
+        return;
+    }
+
+    if ((settings = switch_xml_child(cfg, "settings"))) {
+        for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+            const char *name = switch_xml_attr_soft(param, "name");
+            const char *value = switch_xml_attr_soft(param, "value");
+
+            if (!strcasecmp(name, "reactor-threads")) {
+                int n = atoi(value);
+                globals.reactor_threads = n > 0 ? (uint32_t)n : 0;
+            } else if (!strcasecmp(name, "queue-seconds")) {
+                int n = atoi(value);
+                globals.queue_seconds = n > 0 ? n : SOCKET_AUDIO_QUEUE_SECONDS;
+            } else if (!strcasecmp(name, "fast-resampler")) {
+                globals.fast_resampler = switch_true(value);
+            } else if (!strcasecmp(name, "mic-batch-frames")) {
+                int n = atoi(value);
+                globals.mic_batch_frames = n > 0 ? (uint32_t)(n < SOCKET_AUDIO_MIC_BATCH_MAX ? n : SOCKET_AUDIO_MIC_BATCH_MAX)
+                                                 : SOCKET_AUDIO_MIC_BATCH_FRAMES;
+            } else if (!strcasecmp(name, "connect-timeout-ms")) {
+                int n = atoi(value);
+                globals.connect_timeout_ms = n > 0 ? (uint32_t)n : SOCKET_AUDIO_CONNECT_TIMEOUT_MS;
+            } else if (!strcasecmp(name, "reconnect-attempts")) {
+                int n = atoi(value);
+                globals.reconnect_attempts = n > 0 ? (uint32_t)n : 0;
+            } else if (!strcasecmp(name, "reconnect-backoff-ms")) {
+                int n = atoi(value);
+                globals.reconnect_backoff_ms = n > 0 ? (uint32_t)n : SOCKET_AUDIO_RECONNECT_BACKOFF_MS;
+            } else if (!strcasecmp(name, "reconnect-buffer-ms")) {
+                int n = atoi(value);
+                globals.reconnect_buffer_ms = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_RECONNECT_BUFFER_MS;
+            } else if (!strcasecmp(name, "connection-pool")) {
+                /* host:port[/size]; repeat the param for more sidecars */
+                socket_audio_pool_t *pool = switch_core_alloc(globals.pool, sizeof(*pool));
+                char *host = switch_core_strdup(globals.pool, value);
+                char *size = strchr(host, '/');
+                char *port;
+                int n;
+
+                memset(pool, 0, sizeof(*pool));
+                pool->size = SOCKET_AUDIO_POOL_SIZE;
+                if (size) {
+                    *size++ = '\0';
+                    n = atoi(size);
+                    pool->size = n > 0 ? (uint32_t)(n < SOCKET_AUDIO_POOL_SIZE_MAX ? n : SOCKET_AUDIO_POOL_SIZE_MAX) : SOCKET_AUDIO_POOL_SIZE;
+                }
+                if (!(port = strrchr(host, ':')) || (n = atoi(port + 1)) <= 0 || n > 65535) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                      "Invalid connection-pool %s (expected host:port[/size])\n", value);
+                    continue;
+                }
+                *port = '\0';
+                pool->host = host;
+                pool->port = (switch_port_t)n;
+                pool->next = globals.pools;
+                globals.pools = pool;
+            } else if (!strcasecmp(name, "statsd-server")) {
+                char *host = switch_core_strdup(globals.pool, value);
+                char *port = strrchr(host, ':');
+
+                if (port && !strchr(port + 1, ']')) {
+                    *port++ = '\0';
+                    globals.statsd_port = (switch_port_t)atoi(port);
+                }
+                if (*host == '[' && host[strlen(host) - 1] == ']') {  /* [v6]:port */
+                    host[strlen(host) - 1] = '\0';
+                    host++;
+                }
+                globals.statsd_host = zstr(host) ? NULL : host;
+            } else if (!strcasecmp(name, "statsd-prefix")) {
+                globals.statsd_prefix = switch_core_strdup(globals.pool, value);
+            } else if (!strcasecmp(name, "metrics-interval")) {
+                int n = atoi(value);
+                globals.metrics_interval = n > 0 ? (uint32_t)n : SOCKET_AUDIO_METRICS_INTERVAL;
+            } else if (!strcasecmp(name, "vad")) {
+                globals.vad_mode = socket_audio_vad_mode_parse(value);
+            } else if (!strcasecmp(name, "vad-threshold-db")) {
+                globals.vad_threshold_db = atof(value) < 0 ? atof(value) : SOCKET_AUDIO_VAD_THRESHOLD_DB;
+            } else if (!strcasecmp(name, "vad-hangover-ms")) {
+                int n = atoi(value);
+                globals.vad_hangover_ms = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_VAD_HANGOVER_MS;
+            } else if (!strcasecmp(name, "jitter-buffer")) {
+                globals.jitter_buffer = switch_true(value);
+            } else if (!strcasecmp(name, "jitter-buffer-max-ms")) {
+                int n = atoi(value);
+                globals.jitter_buffer_max_ms = n > 0 ? (uint32_t)n : SOCKET_AUDIO_JB_MAX_MS;
+            } else if (!strcasecmp(name, "plc-max-ms")) {
+                int n = atoi(value);
+                globals.plc_max_ms = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_PLC_MAX_MS;
+            } else if (!strcasecmp(name, "barge-in")) {
+                globals.barge_in = switch_true(value);
+            } else if (!strcasecmp(name, "barge-in-ms")) {
+                int n = atoi(value);
+                globals.barge_in_ms = n > 0 ? (uint32_t)n : SOCKET_AUDIO_BARGE_IN_MS;
+            } else if (!strcasecmp(name, "barge-in-hangover-ms")) {
+                int n = atoi(value);
+                globals.barge_in_hangover_ms = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_BARGE_IN_HANGOVER_MS;
+            } else if (!strcasecmp(name, "event-debounce-ms")) {
+                int n = atoi(value);
+                globals.event_debounce_ms = n > 0 ? (uint32_t)n : 0;
+            } else if (!strcasecmp(name, "legs")) {
+                globals.legs_mode = socket_audio_legs_mode_parse(value);
+            } else if (!strcasecmp(name, "legs-max")) {
+                int n = atoi(value);
+                globals.legs_max = n > 0 ? (n < SOCKET_AUDIO_LEGS_LIMIT ? (uint32_t)n : SOCKET_AUDIO_LEGS_LIMIT) : SOCKET_AUDIO_LEGS_MAX;
+            } else if (!strcasecmp(name, "stereo")) {
+                globals.stereo = switch_true(value);
+            } else if (!strcasecmp(name, "aec")) {
+                globals.aec = switch_true(value);
+            } else if (!strcasecmp(name, "aec-tail-ms")) {
+                int n = atoi(value);
+                globals.aec_tail_ms = n > 0 ? (n < SOCKET_AUDIO_AEC_TAIL_MAX_MS ? (uint32_t)n : SOCKET_AUDIO_AEC_TAIL_MAX_MS) : SOCKET_AUDIO_AEC_TAIL_MS;
+            } else if (!strcasecmp(name, "aec-max-taps")) {
+                int n = atoi(value);
+                globals.aec_max_taps = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_AEC_MAX_TAPS;
+            } else if (!strcasecmp(name, "aec-suppress-db")) {
+                globals.aec_suppress_db = atof(value) >= 0 ? atof(value) : SOCKET_AUDIO_AEC_SUPPRESS_DB;
+            } else if (!strcasecmp(name, "cache-max-mb")) {
+                int n = atoi(value);
+                globals.cache_max_bytes = (switch_size_t)(n >= 0 ? n : SOCKET_AUDIO_CACHE_MAX_MB) << 20;
+            } else if (!strcasecmp(name, "cache-rates")) {
+                socket_audio_cache_rates_parse(value);
+            } else if (!strcasecmp(name, "load-shedding")) {
+                globals.load_shedding = switch_true(value);
+            } else if (!strcasecmp(name, "load-interval-ms")) {
+                int n = atoi(value);
+                globals.load_interval_ms = n >= 100 ? (uint32_t)n : SOCKET_AUDIO_LOAD_INTERVAL_MS;  /* Monitor sleeps 100ms at a time */
+            } else if (!strcasecmp(name, "load-media-us")) {
+                int n = atoi(value);
+                globals.load_media_us = n > 0 ? (uint32_t)n : SOCKET_AUDIO_LOAD_MEDIA_US;
+            } else if (!strcasecmp(name, "load-pace-ms")) {
+                int n = atoi(value);
+                globals.load_pace_ms = n > 0 ? (uint32_t)n : SOCKET_AUDIO_LOAD_PACE_MS;
+            } else if (!strcasecmp(name, "load-recover-s")) {
+                int n = atoi(value);
+                globals.load_recover_s = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_LOAD_RECOVER_S;
+            } else if (!strcasecmp(name, "context-pool")) {
+                int n = atoi(value);
+                globals.ctx_free_max = n >= 0 ? (uint32_t)n : SOCKET_AUDIO_CONTEXT_POOL;
+            } else if (!strcasecmp(name, "record-dir")) {
+                globals.record_dir = !zstr(value) ? switch_core_strdup(globals.pool, value) : NULL;
+            } else if (!strcasecmp(name, "record-segment-seconds")) {
+                int n = atoi(value);
+                globals.record_segment_seconds = n >= 0 ? (uint32_t)n : 0;
+            } else if (!strcasecmp(name, "record-buffer-seconds")) {
+                int n = atoi(value);
+                globals.record_buffer_seconds = n > 0 ? (uint32_t)n : SOCKET_AUDIO_RECORD_BUFFER_SECONDS;
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                  "Unknown %s param: %s\n", SOCKET_AUDIO_CONFIG, name);
+            }
+        }
+    }
+
+    switch_xml_free(xml);
+}
+
+/*
+ * Hand staged mic bytes to the kernel. A short write leaves the rest staged
+ * and is retried on the next frame, so the stream is never torn mid-sample
+ * or mid-message.
+ */
+static void socket_audio_pipe_xmit(socket_audio_ctx_t *ctx)
+{
+    switch_size_t n = ctx->send_len - ctx->send_off;
+
+    if (switch_socket_send_nonblock(ctx->sock, (const char *)ctx->send_buf + ctx->send_off, &n) != SWITCH_STATUS_SUCCESS) {
+        n = 0;
+    }
+    ctx->send_off += n;
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_BYTES, n);
+
+    if (ctx->send_off < ctx->send_len) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_SHORT_SENDS, 1);
+        ctx->send_pending = 1;
+        return;
+    }
+
+    ctx->send_off = ctx->send_len = 0;
+    ctx->send_frames = 0;
+    ctx->send_pending = 0;
+
+    if (ctx->mic_dropped) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Sidecar draining mic audio again (%u frames dropped)\n", ctx->mic_dropped);
+        ctx->mic_dropped = 0;
+    }
+}
+
+/*
+ * Send one mic frame to the sidecar. Media thread only: this is the socket's
+ * single writer. type is the framed message type (AUDIO, or SILENCE with no
+ * payload); raw mode sends the bytes alone.
+ *
+ * Frames are staged and sent mic_batch at a time. In framed mode the control
+ * replies queued by the clock are staged ahead of the audio and sent at once.
+ * While the kernel is not taking data the backlog stays staged; once the
+ * buffer is full new frames are dropped whole and replies wait in the outbox.
+ */
+static void socket_audio_pipe_send(socket_audio_ctx_t *ctx, uint8_t type, const void *pcm, switch_size_t len)
+{
+    socket_audio_msg_t *msg;
+    switch_size_t need;
+    uint8_t backlogged = 0;
+    uint8_t urgent = 0;
+    uint32_t i;
+
+    if (ctx->send_pending) {
+        socket_audio_pipe_xmit(ctx);
+        backlogged = ctx->send_pending;
+    }
+
+    if (ctx->send_off) {
+        memmove(ctx->send_buf, ctx->send_buf + ctx->send_off, ctx->send_len - ctx->send_off);
+        ctx->send_len -= ctx->send_off;
+        ctx->send_off = 0;
+    }
+
+    need = len;
+    if (ctx->mode == SOCKET_AUDIO_MODE_FRAMED) {
+        for (i = 0; i < SOCKET_AUDIO_MSG_SLOTS && (msg = socket_audio_ring_peek(&ctx->outbox, 0)); i++) {
+            if (ctx->send_len + SOCKET_AUDIO_FRAME_HEADER_LEN + msg->len > ctx->send_cap) {
+                break;
+            }
+            socket_audio_frame_header(ctx->send_buf + ctx->send_len, msg->type, msg->len, msg->seq);
+            memcpy(ctx->send_buf + ctx->send_len + SOCKET_AUDIO_FRAME_HEADER_LEN, msg->payload, msg->len);
+            ctx->send_len += SOCKET_AUDIO_FRAME_HEADER_LEN + msg->len;
+            socket_audio_ring_pop(&ctx->outbox);
+            urgent = 1;  /* Acks and marks are not held for the batch */
+        }
+
+        if (len > ctx->mic_frame_max) {
+            len = ctx->mic_frame_max;
+        }
+        need = SOCKET_AUDIO_FRAME_HEADER_LEN + len;
+    }
+
+    if (ctx->send_len + need <= ctx->send_cap) {
+        uint8_t *p = ctx->send_buf + ctx->send_len;
+
+        if (ctx->mode == SOCKET_AUDIO_MODE_FRAMED) {
+            p = socket_audio_frame_header(p, type, (uint16_t)len, ctx->mic_seq++);
+        }
+        if (len) {
+            memcpy(p, pcm, len);
+        }
+        ctx->send_len += need;
+        ctx->send_frames++;
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_FRAMES, 1);
+    } else {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_DROPS, 1);
+        if (!ctx->mic_dropped++) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                              "Sidecar not draining mic audio, dropping frames\n");
+        }
+    }
+
+    /* The kernel just refused the backlog; the rest waits for the next frame */
+    if (!backlogged && ctx->send_len && (urgent || ctx->send_frames >= ctx->mic_batch)) {
+        socket_audio_pipe_xmit(ctx);
+    }
+}
+
+/*
+ * Identify the call to the sidecar: a HELLO message carrying the UUID, the
+ * first bytes on the connection in either mode. Session or media thread,
+ * before the socket is polled, while it is still blocking.
+ */
+static switch_status_t socket_audio_pipe_hello(socket_audio_ctx_t *ctx)
+{
+    const char *uuid = switch_core_session_get_uuid(ctx->session);
+    uint8_t msg[SOCKET_AUDIO_FRAME_HEADER_LEN + SOCKET_AUDIO_MARK_NAME_MAX];
+    switch_size_t uuid_len = strlen(uuid);
+    switch_size_t len;
+
+    if (uuid_len > SOCKET_AUDIO_MARK_NAME_MAX) {
+        uuid_len = SOCKET_AUDIO_MARK_NAME_MAX;
+    }
+    socket_audio_frame_header(msg, SOCKET_AUDIO_MSG_HELLO, (uint16_t)uuid_len, 0);
+    memcpy(msg + SOCKET_AUDIO_FRAME_HEADER_LEN, uuid, uuid_len);
+    len = SOCKET_AUDIO_FRAME_HEADER_LEN + uuid_len;
+
+    return switch_socket_send(ctx->sock, (const char *)msg, &len);
+}
+
+static uint32_t socket_audio_shm_ring_size(const socket_audio_format_t *fmt, uint32_t channels)
+{
+    uint32_t want = (uint32_t)((uint64_t)fmt->rate * socket_audio_format_sample_bytes(fmt) * channels * SOCKET_AUDIO_SHM_RING_MS / 1000);
+    uint32_t size = 4096;
+
+    while (size < want) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/*
+ * Set up shm mode: map the ring pair and hand it to the sidecar as an SHM
+ * message whose payload is the mapping length (32-bit big endian), with the
+ * memfd and the mic eventfd attached as SCM_RIGHTS. The header fields are in
+ * host byte order: both ends share the machine. Session thread, before the
+ * socket is polled.
+ */
+static switch_status_t socket_audio_shm_create(socket_audio_ctx_t *ctx)
+{
+    uint32_t mic_size = socket_audio_shm_ring_size(&ctx->mic_format, ctx->mic_channels);
+    uint32_t speaker_size = socket_audio_shm_ring_size(&ctx->speaker_format, 1);
+    uint32_t data_offset = 4096;  /* Rings start page aligned */
+    uint8_t msg[SOCKET_AUDIO_FRAME_HEADER_LEN + sizeof(uint32_t)];
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov = { msg, sizeof(msg) };
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    uint8_t *p;
+    int fds[2];
+    int memfd;
+    void *map;
+
+    ctx->shm_len = (switch_size_t)data_offset + mic_size + speaker_size;
+    ctx->shm_mic_fd = -1;
+
+    if ((memfd = memfd_create("socket_audio", MFD_CLOEXEC)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if (ftruncate(memfd, (off_t)ctx->shm_len) < 0 ||
+        (map = mmap(NULL, ctx->shm_len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+        close(memfd);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    ctx->shm = map;
+    ctx->shm->magic = SOCKET_AUDIO_SHM_MAGIC;
+    ctx->shm->version = SOCKET_AUDIO_SHM_VERSION;
+    ctx->shm->mic_offset = data_offset;
+    ctx->shm->mic_size = mic_size;
+    ctx->shm->speaker_offset = data_offset + mic_size;
+    ctx->shm->speaker_size = speaker_size;
+    ctx->shm_mic = (uint8_t *)map + data_offset;
+    ctx->shm_speaker = (uint8_t *)map + data_offset + mic_size;
+
+    if ((ctx->shm_mic_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        close(memfd);
+        socket_audio_shm_destroy(ctx);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    p = socket_audio_frame_header(msg, SOCKET_AUDIO_MSG_SHM, sizeof(uint32_t), 0);
+    p[0] = (uint8_t)(ctx->shm_len >> 24);
+    p[1] = (uint8_t)(ctx->shm_len >> 16);
+    p[2] = (uint8_t)(ctx->shm_len >> 8);
+    p[3] = (uint8_t)ctx->shm_len;
+
+    memset(&mh, 0, sizeof(mh));
+    memset(&control, 0, sizeof(control));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    fds[0] = memfd;
+    fds[1] = ctx->shm_mic_fd;
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(ctx->sock_fd, &mh, MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+        close(memfd);
+        socket_audio_shm_destroy(ctx);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* The mapping and the sidecar's copy keep the memory alive */
+    close(memfd);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Write one mic frame to the mic ring. Media thread only: the ring's single
+ * writer. A frame that does not fit is dropped whole, like a full staging
+ * buffer on the socket path.
+ */
+static void socket_audio_shm_send(socket_audio_ctx_t *ctx, const void *data, switch_size_t len)
+{
+    socket_audio_shm_ring_t *ring = &ctx->shm->mic;
+    uint64_t size = ctx->shm->mic_size;
+    uint64_t head = ring->head;
+    uint64_t off = head & (size - 1);
+    uint64_t first = size - off < len ? size - off : len;
+    uint64_t one = 1;
+
+    if (len > size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_DROPS, 1);
+        if (!ctx->mic_dropped++) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                              "Sidecar not draining mic audio, dropping frames\n");
+        }
+        return;
+    }
+
+    memcpy(ctx->shm_mic + off, data, first);
+    memcpy(ctx->shm_mic, (const uint8_t *)data + first, len - first);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_FRAMES, 1);
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_BYTES, len);
+
+    if (ctx->mic_dropped) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                          "Sidecar draining mic audio again (%u frames dropped)\n", ctx->mic_dropped);
+        ctx->mic_dropped = 0;
+    }
+
+    /* Pairs with the sidecar's fence between setting wait and re-reading head */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->wait, __ATOMIC_RELAXED) && __atomic_exchange_n(&ring->wait, 0, __ATOMIC_ACQ_REL)) {
+        if (write(ctx->shm_mic_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+                              "Failed to signal mic ring (errno=%d)\n", errno);
+        }
+    }
+}
+
+/*
+ * Swap in the connection the connector made after the sidecar dropped.
+ * Media thread: as the socket's only writer it is the one thread that may
+ * close the old socket. Whatever was staged for the old connection is lost
+ * with it; the new one starts on a message boundary.
+ */
+static void socket_audio_pipe_relink(socket_audio_ctx_t *ctx)
+{
+    socket_audio_conn_t *conn = __atomic_exchange_n(&ctx->relink, NULL, __ATOMIC_ACQUIRE);
+
+    if (!conn) {
+        return;
+    }
+
+    switch_socket_close(ctx->sock);
+    if (ctx->sock_pool) {
+        switch_core_destroy_memory_pool(&ctx->sock_pool);
+    }
+    ctx->sock = conn->sock;
+    ctx->sock_fd = conn->fd;
+    ctx->sock_pool = conn->pool;
+
+    ctx->send_off = ctx->send_len = 0;
+    ctx->send_frames = 0;
+    ctx->send_pending = 0;
+
+    if (ctx->hello && socket_audio_pipe_hello(ctx) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                          "Failed to send HELLO after reconnect\n");
+    }
+
+    __atomic_store_n(&ctx->link_down, 0, __ATOMIC_RELEASE);
+    socket_audio_reactor_repoll(ctx);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                      "Resuming on new sidecar connection, replaying %zu bytes of mic audio\n", ctx->mic_ring_len);
+}
+
+/*
+ * Hold mic audio while the sidecar is away, keeping the newest
+ * reconnect-buffer-ms of it. Media thread only.
+ */
+static void socket_audio_pipe_hold(socket_audio_ctx_t *ctx, const uint8_t *data, switch_size_t len)
+{
+    switch_size_t cap = ctx->mic_ring_cap;
+    switch_size_t end, n;
+
+    if (ctx->mic_ring_len + len > cap) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_DROPS, 1);
+        if (len > cap) {
+            data += len - cap;
+            len = cap;
+        }
+        n = ctx->mic_ring_len + len - cap;
+        ctx->mic_ring_start = (ctx->mic_ring_start + n) % cap;
+        ctx->mic_ring_len -= n;
+    }
+
+    end = (ctx->mic_ring_start + ctx->mic_ring_len) % cap;
+    n = len < cap - end ? len : cap - end;
+    memcpy(ctx->mic_ring + end, data, n);
+    memcpy(ctx->mic_ring, data + n, len - n);
+    ctx->mic_ring_len += len;
+}
+
+/*
+ * Feed held mic audio to the new connection a frame at a time, as far as the
+ * staging buffer takes it; the rest goes on the next frames. Room for a full
+ * outbox is kept so pipe_send never has to drop a replayed frame.
+ */
+static void socket_audio_pipe_replay(socket_audio_ctx_t *ctx)
+{
+    switch_size_t header = ctx->mode == SOCKET_AUDIO_MODE_FRAMED ? SOCKET_AUDIO_FRAME_HEADER_LEN : 0;
+
+    while (ctx->mic_ring_len && !ctx->send_pending) {
+        switch_size_t n = ctx->input_frame_bytes;
+
+        if (n > ctx->mic_ring_len) {
+            n = ctx->mic_ring_len;
+        }
+        if (n > ctx->mic_ring_cap - ctx->mic_ring_start) {
+            n = ctx->mic_ring_cap - ctx->mic_ring_start;
+        }
+        if (ctx->send_len - ctx->send_off + header + n + SOCKET_AUDIO_OUTBOX_BYTES > ctx->send_cap) {
+            break;
+        }
+
+        socket_audio_pipe_send(ctx, SOCKET_AUDIO_MSG_AUDIO, ctx->mic_ring + ctx->mic_ring_start, n);
+        ctx->mic_ring_start = (ctx->mic_ring_start + n) % ctx->mic_ring_cap;
+        ctx->mic_ring_len -= n;
+    }
+}
+
+/*
+ * Send one mic frame, or hold it while the pipe is reconnecting or still
+ * replaying what it held. Media thread only.
+ */
+static void socket_audio_pipe_mic(socket_audio_ctx_t *ctx, const void *data, switch_size_t len)
+{
+    if (ctx->shm) {
+        socket_audio_shm_send(ctx, data, len);
+        return;
+    }
+
+    if (ctx->reconnect_max) {
+        if (__atomic_load_n(&ctx->link_down, __ATOMIC_ACQUIRE)) {
+            socket_audio_pipe_relink(ctx);
+        }
+        if (ctx->link_down || ctx->mic_ring_len) {
+            if (ctx->mic_ring_cap) {
+                socket_audio_pipe_hold(ctx, data, len);
+            }
+            if (!ctx->link_down) {
+                socket_audio_pipe_replay(ctx);
+            }
+            return;
+        }
+    }
+
+    socket_audio_pipe_send(ctx, SOCKET_AUDIO_MSG_AUDIO, data, len);
+}
+
+/*
+ * Caller speech during playback: flush it, as uuid_socket_audio_flush would,
+ * and tell the sidecar. Media thread only.
+ */
+static void socket_audio_pipe_barge_in(socket_audio_ctx_t *ctx)
+{
+    ctx->flush_req_at = switch_micro_time_now();
+    __atomic_store_n(&ctx->flush_barge_in, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->flush_flag, 1, __ATOMIC_RELEASE);
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_BARGE_INS, 1);
+
+    socket_audio_event_post(ctx, SOCKET_AUDIO_EVENT_BARGE_IN, NULL, ctx->vad_run * ctx->read_ptime, NULL, 0, 0);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                      "Barge-in: caller speech during playback, flushing\n");
+}
+
+/*
+ * Classify one mic frame (session rate L16). Media thread only.
+ *
+ * A frame is active when its energy clears both the absolute threshold and
+ * the tracked noise floor by a margin, and its zero-crossing rate is speech
+ * like (or it is loud enough that it does not matter). Speech starts after a
+ * short run of active frames and ends after the hangover, which also keeps
+ * word endings and short pauses on the wire. Returns whether to send it.
+ */
+static switch_bool_t socket_audio_pipe_vad(socket_audio_ctx_t *ctx, const int16_t *pcm, uint32_t samples)
+{
+    uint32_t crossings;
+    uint64_t energy = socket_audio_vad_measure(pcm, samples, &crossings);
+    double db = 10.0 * log10(((double)energy / (samples ? samples : 1) + 1.0) / (32768.0 * 32768.0));
+    double threshold = ctx->vad_noise_db + SOCKET_AUDIO_VAD_NOISE_MARGIN_DB;
+    double zcr = samples > 1 ? (double)crossings / (samples - 1) : 0;
+    switch_bool_t active;
+
+    if (threshold < ctx->vad_threshold_db) {
+        threshold = ctx->vad_threshold_db;
+    }
+    active = db >= threshold && (zcr <= SOCKET_AUDIO_VAD_MAX_ZCR || db >= threshold + SOCKET_AUDIO_VAD_LOUD_DB);
+
+    /* The floor follows quieter frames quickly and louder ones slowly, so a
+     * steady background eventually stops counting as speech */
+    ctx->vad_noise_db += (db - ctx->vad_noise_db) * (db < ctx->vad_noise_db ? 0.1 : active ? 0.002 : 0.02);
+
+    if (active) {
+        ctx->vad_hangover = ctx->vad_hangover_frames;
+        ++ctx->vad_run;
+
+        /* Barge-in: interrupt playback here instead of waiting for the sidecar
+         * to notice and flush over ESL; the clock applies it on its next visit */
+        if (ctx->barge_in_frames && ctx->vad_run >= ctx->barge_in_frames && ctx->is_playing &&
+            !__atomic_load_n(&ctx->flush_flag, __ATOMIC_ACQUIRE)) {
+            socket_audio_pipe_barge_in(ctx);
+        }
+
+        if (ctx->vad_run >= SOCKET_AUDIO_VAD_ONSET_FRAMES && !ctx->vad_speech) {
+            ctx->vad_speech = 1;
+            socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_SPEECH_SEGMENTS, 1);
+            socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_SPEECH_START, NULL);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+                              "Speech started (%.1f dBFS, noise floor %.1f dBFS)\n", db, ctx->vad_noise_db);
+        }
+    } else {
+        ctx->vad_run = 0;
+        if (ctx->vad_hangover) {
+            ctx->vad_hangover--;
+        }
+        if (!ctx->vad_hangover && ctx->vad_speech) {
+            ctx->vad_speech = 0;
+            socket_audio_fire_playback_event(ctx, SOCKET_AUDIO_EVENT_SPEECH_STOP, NULL);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+                              "Speech stopped\n");
+        }
+    }
+
+    return active || ctx->vad_hangover;
+}
+
+/*
+ * A mic frame the VAD suppressed. Framed mode sends an 8-byte SILENCE message
+ * in its place so the sidecar keeps the stream's timing (seq still counts
+ * frames); raw mode sends nothing. Silence is not held across a reconnect.
  */
+static void socket_audio_pipe_silence(socket_audio_ctx_t *ctx)
+{
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MIC_SILENT_FRAMES, 1);
 
-#include <switch.h>
+    if (ctx->mode != SOCKET_AUDIO_MODE_FRAMED || ctx->shm) {
+        return;
+    }
+    if (ctx->reconnect_max) {
+        if (__atomic_load_n(&ctx->link_down, __ATOMIC_ACQUIRE)) {
+            socket_audio_pipe_relink(ctx);
+        }
+        if (ctx->link_down || ctx->mic_ring_len) {
+            if (!ctx->link_down) {
+                socket_audio_pipe_replay(ctx);
+            }
+            return;
+        }
+    }
 
-#define SOCKET_AUDIO_INPUT_RATE   16000   /* Input sample rate (to sidecar) */
-#define SOCKET_AUDIO_OUTPUT_RATE  24000   /* Output sample rate (from sidecar) */
-#define SOCKET_AUDIO_BUG_NAME     "socket_audio"
-#define SOCKET_AUDIO_PRIVATE      "_socket_audio_"
+    socket_audio_pipe_send(ctx, SOCKET_AUDIO_MSG_SILENCE, NULL, 0);
+}
 
-/* Maximum audio queue size: 90 seconds at 48kHz (worst case session rate)
- * Sidecar may generate audio faster than real-time, so queue must hold entire turn.
- * Memory: ~8.6MB at 48kHz, ~2.9MB at 16kHz, ~1.4MB at 8kHz per call */
-#define SOCKET_AUDIO_QUEUE_MAX_SIZE  (48000 * 2 * 90)
+/*
+ * Add the joined legs' audio for this frame to the caller's (session rate),
+ * leaving each leg's share in leg->pcm for interleaving. A leg whose media
+ * clock runs ahead builds a backlog, trimmed here to a couple of frames; one
+ * that is behind contributes silence. Media thread only.
+ */
+static int16_t *socket_audio_pipe_legs_mix(socket_audio_ctx_t *ctx, const int16_t *pcm, uint32_t samples)
+{
+    switch_size_t bytes = samples * sizeof(int16_t);
+    uint32_t i, j;
 
-/* Duration to discard incoming audio after flush (microseconds)
- * This allows in-flight packets to clear before resuming playback */
-#define SOCKET_AUDIO_DISCARD_DURATION_US  50000  /* 50ms */
+    memcpy(ctx->leg_mix, pcm, bytes);
 
-SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_socket_audio_shutdown);
-SWITCH_MODULE_LOAD_FUNCTION(mod_socket_audio_load);
-SWITCH_MODULE_DEFINITION(mod_socket_audio, mod_socket_audio_load, mod_socket_audio_shutdown, NULL);
+    for (i = 0; i < ctx->legs_max; i++) {
+        socket_audio_leg_t *leg = &ctx->legs[i];
+        uint8_t state = __atomic_load_n(&leg->state, __ATOMIC_ACQUIRE);
 
-typedef struct {
-    /* Session reference */
-    switch_core_session_t *session;
-    switch_channel_t *channel;
-    switch_media_bug_t *bug;
-    switch_memory_pool_t *pool;
+        leg->pcm_len = 0;
+        if (state != SOCKET_AUDIO_LEG_ACTIVE) {
+            if (state == SOCKET_AUDIO_LEG_LEAVING && !leg->mix_idle) {
+                __atomic_store_n(&leg->mix_idle, 1, __ATOMIC_RELEASE);
+            }
+            continue;
+        }
+        if (!leg->listen) {
+            continue;
+        }
 
-    /* Socket */
-    switch_socket_t *sock;
+        leg->pcm_len = samples;
+        while (socket_audio_queue_inuse(&leg->queue) > bytes * SOCKET_AUDIO_LEG_LAG_FRAMES) {
+            socket_audio_queue_read(&leg->queue, leg->pcm, bytes);
+        }
+        if (socket_audio_queue_read(&leg->queue, leg->pcm, bytes) < bytes) {
+            memset(leg->pcm, 0, bytes);
+            socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_LEG_GAP_FRAMES, 1);
+            continue;
+        }
 
-    /* Threading */
-    switch_thread_t *thread;
-    switch_mutex_t *mutex;
-    volatile uint8_t running;
+        for (j = 0; j < samples; j++) {
+            int32_t v = (int32_t)ctx->leg_mix[j] + leg->pcm[j];
 
-    /* Inbound audio queue (from sidecar, waiting to play) */
-    switch_buffer_t *audio_queue;
-    volatile uint8_t flush_flag;
-    switch_time_t discard_until;  /* Discard incoming audio until this timestamp (microseconds) */
-    volatile uint8_t is_playing;  /* Track if we're currently playing audio (for events) */
+            ctx->leg_mix[j] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+        }
+    }
 
-    /* Resamplers */
-    switch_audio_resampler_t *read_resampler;   /* session → 16kHz (to sidecar) */
-    switch_audio_resampler_t *write_resampler;  /* 24kHz → session (from sidecar) */
+    return ctx->leg_mix;
+}
 
-    /* Session codec info */
-    uint32_t session_rate;
-    uint32_t read_ptime;
-    uint32_t write_ptime;
+/*
+ * The frame the clock played during this mic frame, or silence while nothing
+ * plays. Taken for every mic frame, sent or not, so a backlog only builds
+ * from clock phase: anything past a couple of frames is dropped. Media thread
+ * only.
+ */
+static int16_t *socket_audio_pipe_reference(socket_audio_ctx_t *ctx, uint32_t samples)
+{
+    switch_size_t bytes = samples * sizeof(int16_t);
 
-    /* Frame sizes in bytes (16-bit samples) */
-    uint32_t session_frame_bytes;    /* Bytes per frame at session rate */
-    uint32_t input_frame_bytes;  /* Bytes per frame at 16kHz */
-    uint32_t output_frame_bytes; /* Bytes per frame at 24kHz */
+    while (socket_audio_queue_inuse(&ctx->ref_queue) > bytes * SOCKET_AUDIO_REF_LAG_FRAMES) {
+        socket_audio_queue_read(&ctx->ref_queue, ctx->ref_pcm, bytes);
+    }
+    if (socket_audio_queue_read(&ctx->ref_queue, ctx->ref_pcm, bytes) < bytes) {
+        memset(ctx->ref_pcm, 0, bytes);
+    }
 
-    /* Write codec for direct frame injection */
-    switch_codec_t write_codec;
-    switch_frame_t write_frame;
-    uint8_t write_frame_data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+    return ctx->ref_pcm;
+}
+
+/*
+ * Copy the caller's frame and the one played during it into the recording
+ * tap. A full tap (writer behind) loses the frame rather than waiting. Media
+ * thread only, after socket_audio_pipe_reference.
+ */
+static void socket_audio_pipe_record(socket_audio_ctx_t *ctx, const int16_t *caller, uint32_t samples)
+{
+    if (socket_audio_tap_write_stereo(&ctx->recorder->tap, caller, ctx->ref_pcm, samples)) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_RECORD_FRAMES, 1);
+    } else {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_RECORD_DROPS, 1);
+    }
+}
+
+/*
+ * Cancel the echo of the reference from the caller's frame, which is left
+ * untouched (it is the live read frame). Media thread only, after
+ * socket_audio_pipe_reference.
+ */
+static int16_t *socket_audio_pipe_aec(socket_audio_ctx_t *ctx, const int16_t *pcm, uint32_t samples)
+{
+    socket_audio_aec_t *aec = ctx->aec;
+
+    socket_audio_aec_process(aec, pcm, ctx->ref_pcm, samples);
+    if (aec->doubletalk) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_AEC_DOUBLETALK_FRAMES, 1);
+    }
+    if (aec->suppressed) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_AEC_SUPPRESSED_FRAMES, 1);
+    }
+    if (aec->reset) {
+        socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_AEC_RESETS, 1);
+    }
 
-} socket_audio_ctx_t;
+    return aec->out;
+}
 
-/* Forward declarations */
-static switch_bool_t socket_audio_media_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type);
-static void *SWITCH_THREAD_FUNC socket_audio_thread(switch_thread_t *thread, void *obj);
+static void socket_audio_interleave_channel(int16_t *out, uint32_t channels, uint32_t c,
+                                            const int16_t *src, uint32_t len, uint32_t n)
+{
+    uint32_t j;
+
+    for (j = 0; j < n; j++) {
+        out[j * channels + c] = j < len ? src[j] : 0;
+    }
+}
 
 /*
- * Socket Reader Thread
- *
- * Runs in background, receives raw PCM from sidecar, pushes to queue.
- * Exits when socket closes or channel hangs up.
+ * Build one interleaved L16 mic frame at the mic rate and return its length:
+ * the caller on channel 0, then the playback reference (stereo), then one
+ * channel per leg slot (interleave), silent while empty. Each channel has its
+ * own resampler. Media thread only, after socket_audio_pipe_legs_mix and
+ * socket_audio_pipe_reference.
  */
-static void *SWITCH_THREAD_FUNC socket_audio_thread(switch_thread_t *thread, void *obj)
+static switch_size_t socket_audio_pipe_interleave(socket_audio_ctx_t *ctx, const int16_t *pcm, uint32_t samples)
 {
-    socket_audio_ctx_t *ctx = (socket_audio_ctx_t *)obj;
-    uint8_t recv_buf[8192];
-    switch_size_t recv_len;
-    switch_status_t status;
+    uint32_t channels = ctx->mic_channels;
+    uint32_t n = samples;
+    uint32_t c = 1;
+    uint32_t i;
 
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                      "Socket audio thread started\n");
+    if (ctx->read_resampler) {
+        socket_audio_resample(ctx->read_resampler, pcm, samples);
+        pcm = ctx->read_resampler->out;
+        n = ctx->read_resampler->out_len;
+    }
+    socket_audio_interleave_channel(ctx->mic_out, channels, 0, pcm, n, n);
 
-    while (ctx->running && switch_channel_ready(ctx->channel)) {
-        recv_len = sizeof(recv_buf);
-        status = switch_socket_recv(ctx->sock, (char *)recv_buf, &recv_len);
+    if (ctx->stereo) {
+        const int16_t *ref = ctx->ref_pcm;
+        uint32_t len = samples;
 
-        if (status != SWITCH_STATUS_SUCCESS || recv_len == 0) {
-            /* Socket closed or error */
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                              "Socket closed or error (status=%d, len=%zu)\n",
-                              status, recv_len);
-            break;
+        if (ctx->ref_resampler) {
+            socket_audio_resample(ctx->ref_resampler, ref, len);
+            ref = ctx->ref_resampler->out;
+            len = ctx->ref_resampler->out_len;
         }
+        socket_audio_interleave_channel(ctx->mic_out, channels, c++, ref, len, n);
+    }
 
-        /* Received raw 24kHz PCM from sidecar */
-        if (recv_len > 0) {
-            int16_t *pcm_in = (int16_t *)recv_buf;
-            uint32_t samples_in = recv_len / sizeof(int16_t);
-            void *pcm_out = recv_buf;
-            uint32_t bytes_out = recv_len;
-
-            /* Resample 24kHz → session rate if needed */
-            if (ctx->write_resampler) {
-                switch_resample_process(ctx->write_resampler, pcm_in, samples_in);
-                pcm_out = ctx->write_resampler->to;
-                bytes_out = ctx->write_resampler->to_len * sizeof(int16_t);
-            }
-
-            /* Check for flush flag - clear queue and enter timed discard mode */
-            if (ctx->flush_flag) {
-                switch_size_t flushed_bytes;
-                switch_mutex_lock(ctx->mutex);
-                flushed_bytes = switch_buffer_inuse(ctx->audio_queue);
-                switch_buffer_zero(ctx->audio_queue);
-                ctx->flush_flag = 0;
-                ctx->discard_until = switch_time_now() + SOCKET_AUDIO_DISCARD_DURATION_US;
-                switch_mutex_unlock(ctx->mutex);
-
-                /* Fire playback_stop event if we were playing */
-                if (ctx->is_playing) {
-                    switch_event_t *event;
-                    ctx->is_playing = 0;
-                    if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, "socket_audio::playback_stop") == SWITCH_STATUS_SUCCESS) {
-                        switch_channel_event_set_data(ctx->channel, event);
-                        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Playback-Stop-Reason", "flush");
-                        switch_event_fire(&event);
-                    }
-                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                      "Socket audio playback stopped (flush)\n");
-                }
-
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                  "Audio interrupted: flushed %zu bytes, discarding for %dms\n",
-                                  flushed_bytes, SOCKET_AUDIO_DISCARD_DURATION_US / 1000);
-                continue;
-            }
+    for (i = 0; c < channels; i++, c++) {
+        socket_audio_leg_t *leg = &ctx->legs[i];
+        const int16_t *src = leg->pcm;
+        uint32_t len = leg->pcm_len;
 
-            /* Discard incoming audio during discard window (clears in-flight packets) */
-            if (ctx->discard_until > 0 && switch_time_now() < ctx->discard_until) {
-                continue;  /* Silently discard */
-            } else if (ctx->discard_until > 0) {
-                /* Discard window expired, resume normal operation */
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                  "Audio resumed after discard window\n");
-                ctx->discard_until = 0;
-            }
-
-            /* Push resampled audio to queue */
-            switch_mutex_lock(ctx->mutex);
-            if (switch_buffer_inuse(ctx->audio_queue) + bytes_out > SOCKET_AUDIO_QUEUE_MAX_SIZE) {
-                switch_size_t excess = (switch_buffer_inuse(ctx->audio_queue) + bytes_out) - SOCKET_AUDIO_QUEUE_MAX_SIZE;
-                switch_buffer_toss(ctx->audio_queue, excess);
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
-                    "Queue overflow, dropped %zu bytes\n", excess);
-            }
-            switch_buffer_write(ctx->audio_queue, pcm_out, bytes_out);
-            switch_mutex_unlock(ctx->mutex);
-
-            /* Write frames with proper 20ms pacing */
-            while (switch_channel_ready(ctx->channel) && ctx->running) {
-                switch_size_t queue_bytes;
-
-                /* Check if we're starting playback (transition from not playing to playing) */
-                if (!ctx->is_playing) {
-                    switch_mutex_lock(ctx->mutex);
-                    queue_bytes = switch_buffer_inuse(ctx->audio_queue);
-                    switch_mutex_unlock(ctx->mutex);
-
-                    if (queue_bytes >= ctx->session_frame_bytes) {
-                        switch_event_t *event;
-                        ctx->is_playing = 1;
-                        if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, "socket_audio::playback_start") == SWITCH_STATUS_SUCCESS) {
-                            switch_channel_event_set_data(ctx->channel, event);
-                            switch_event_fire(&event);
-                        }
-                        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                          "Socket audio playback started\n");
-                    }
-                }
+        if (len && leg->mic_resampler) {
+            socket_audio_resample(leg->mic_resampler, src, len);
+            src = leg->mic_resampler->out;
+            len = leg->mic_resampler->out_len;
+        }
+        socket_audio_interleave_channel(ctx->mic_out, channels, c, src, len, n);
+    }
 
-                /* Check for flush flag - interrupt playback immediately */
-                if (ctx->flush_flag) {
-                    switch_size_t flushed_bytes;
-                    switch_mutex_lock(ctx->mutex);
-                    flushed_bytes = switch_buffer_inuse(ctx->audio_queue);
-                    switch_buffer_zero(ctx->audio_queue);
-                    ctx->flush_flag = 0;
-                    ctx->discard_until = switch_time_now() + SOCKET_AUDIO_DISCARD_DURATION_US;
-                    switch_mutex_unlock(ctx->mutex);
-
-                    /* Fire playback_stop event if we were playing */
-                    if (ctx->is_playing) {
-                        switch_event_t *event;
-                        ctx->is_playing = 0;
-                        if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, "socket_audio::playback_stop") == SWITCH_STATUS_SUCCESS) {
-                            switch_channel_event_set_data(ctx->channel, event);
-                            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Playback-Stop-Reason", "flush");
-                            switch_event_fire(&event);
-                        }
-                        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                          "Socket audio playback stopped (flush)\n");
-                    }
+    return (switch_size_t)n * channels * sizeof(int16_t);
+}
 
-                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                      "Audio interrupted: flushed %zu bytes, discarding for %dms\n",
-                                      flushed_bytes, SOCKET_AUDIO_DISCARD_DURATION_US / 1000);
-                    break;
-                }
+/*
+ * Mic frame diagnostics, enabled per call with socket_audio_debug. Media
+ * thread only, so the counters need no synchronization.
+ *
+ * The first frames are logged in detail (the raw bytes identify the
+ * encoding), then the peak level every debug_interval frames when it changed.
+ */
+static void socket_audio_pipe_debug_frame(socket_audio_ctx_t *ctx, const switch_frame_t *frame)
+{
+    const int16_t *samples = (const int16_t *)frame->data;
+    const uint8_t *raw = (const uint8_t *)frame->data;
+    uint32_t count = frame->datalen / sizeof(int16_t);
+    int peak;
 
-                switch_mutex_lock(ctx->mutex);
-                queue_bytes = switch_buffer_inuse(ctx->audio_queue);
-
-                if (queue_bytes < ctx->session_frame_bytes) {
-                    switch_mutex_unlock(ctx->mutex);
-
-                    /* Fire playback_stop event if we were playing and queue is now empty */
-                    if (ctx->is_playing && queue_bytes == 0) {
-                        switch_event_t *event;
-                        ctx->is_playing = 0;
-                        if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, "socket_audio::playback_stop") == SWITCH_STATUS_SUCCESS) {
-                            switch_channel_event_set_data(ctx->channel, event);
-                            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Playback-Stop-Reason", "complete");
-                            switch_event_fire(&event);
-                        }
-                        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                                          "Socket audio playback stopped (complete)\n");
-                    }
+    ctx->debug_frames++;
 
-                    break; /* Not enough data for a full frame, wait for more */
-                }
+    if (ctx->debug_frames > SOCKET_AUDIO_DEBUG_DETAIL_FRAMES && ctx->debug_frames % ctx->debug_interval) {
+        return;
+    }
 
-                /* Read one frame worth of data */
-                switch_buffer_read(ctx->audio_queue, ctx->write_frame_data, ctx->session_frame_bytes);
-                switch_mutex_unlock(ctx->mutex);
+    peak = socket_audio_peak(samples, count);
 
-                /* Set up and write the frame */
-                ctx->write_frame.data = ctx->write_frame_data;
-                ctx->write_frame.datalen = ctx->session_frame_bytes;
-                ctx->write_frame.samples = ctx->session_frame_bytes / sizeof(int16_t);
+    if (ctx->debug_frames <= SOCKET_AUDIO_DEBUG_DETAIL_FRAMES && frame->datalen >= 8) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+                          "Mic frame #%u: datalen=%u, rate=%u, codec=%s, samples=%u, peak_amp=%d, "
+                          "first8bytes=[%02x %02x %02x %02x %02x %02x %02x %02x]\n",
+                          ctx->debug_frames, (unsigned)frame->datalen, frame->rate,
+                          frame->codec ? frame->codec->implementation->iananame : "NULL",
+                          frame->samples, peak,
+                          raw[0], raw[1], raw[2], raw[3], raw[4], raw[5], raw[6], raw[7]);
+    } else if (peak != ctx->debug_peak) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+                          "Mic frame #%u: peak_amp=%d (%.1f%%)\n",
+                          ctx->debug_frames, peak, peak * 100.0 / 32768);
+    }
+    ctx->debug_peak = peak;
+}
 
-                status = switch_core_session_write_frame(ctx->session, &ctx->write_frame, SWITCH_IO_FLAG_NONE, 0);
+/*
+ * Apply a new load level to the media thread's side of the pipe (see
+ * socket_audio_load_thread). Debug logging and VAD gating check
+ * ctx->load_level per frame.
+ */
+static void socket_audio_pipe_load(socket_audio_ctx_t *ctx, uint32_t level)
+{
+    ctx->load_level = (uint8_t)level;
 
-                if (status != SWITCH_STATUS_SUCCESS) {
-                    break;
-                }
+    if (ctx->read_resampler) {
+        ctx->read_resampler->lite = level >= 1;
+    }
+    if (ctx->ref_resampler) {
+        ctx->ref_resampler->lite = level >= 1;
+    }
+    if (ctx->aec) {
+        ctx->aec->lite = level >= 2;
+    }
 
-                /* Sleep for frame duration to maintain proper 20ms pacing */
-                switch_yield(ctx->read_ptime * 1000); /* Convert ms to microseconds */
-            }
+    ctx->mic_batch = ctx->mic_batch_base;
+    if (level >= 2) {
+        ctx->mic_batch = ctx->mic_batch_base * SOCKET_AUDIO_LOAD_BATCH_FACTOR;
+        if (ctx->mic_batch > SOCKET_AUDIO_MIC_BATCH_MAX) {
+            ctx->mic_batch = SOCKET_AUDIO_MIC_BATCH_MAX;
         }
     }
+}
 
-    ctx->running = 0;
-
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
-                      "Socket audio thread exiting\n");
+/*
+ * Time one mic callback for the load monitor.
+ */
+static void socket_audio_pipe_media_time(socket_audio_ctx_t *ctx, switch_time_t started)
+{
+    switch_time_t now = switch_micro_time_now();
+    uint64_t us = now > started ? (uint64_t)(now - started) : 0;
 
-    return NULL;
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MEDIA_FRAMES, 1);
+    socket_audio_stat_add(ctx, SOCKET_AUDIO_STAT_MEDIA_US_TOTAL, us);
+    socket_audio_stat_max(ctx, SOCKET_AUDIO_STAT_MEDIA_US_MAX, us);
 }
 
 /*
@@ -299,87 +5994,94 @@ static switch_bool_t socket_audio_media_callback(switch_media_bug_t *bug, void *
         /* MIC AUDIO: FreeSWITCH → sidecar */
         {
             switch_frame_t *frame = switch_core_media_bug_get_read_replace_frame(bug);
-            static int read_frame_log_count = 0;
 
             if (frame && frame->data && frame->datalen > 0 && ctx->sock && ctx->running) {
-                /* Debug: Log frame details for first few frames */
-                if (read_frame_log_count < 5) {
-                    /* Calculate audio level (peak amplitude) */
-                    int16_t *samples = (int16_t *)frame->data;
-                    uint8_t *raw_bytes = (uint8_t *)frame->data;
-                    int max_amp = 0;
-                    uint32_t i;
-                    for (i = 0; i < frame->datalen / 2 && i < 160; i++) {
-                        int amp = samples[i] < 0 ? -samples[i] : samples[i];
-                        if (amp > max_amp) max_amp = amp;
-                    }
-                    /* Show first 8 raw bytes to identify encoding */
-                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
-                        "READ_REPLACE frame: datalen=%u, rate=%u, codec=%s, samples=%u, peak_amp=%d, "
-                        "first8bytes=[%02x %02x %02x %02x %02x %02x %02x %02x]\n",
-                        (unsigned)frame->datalen, frame->rate,
-                        frame->codec ? frame->codec->implementation->iananame : "NULL",
-                        frame->samples, max_amp,
-                        raw_bytes[0], raw_bytes[1], raw_bytes[2], raw_bytes[3],
-                        raw_bytes[4], raw_bytes[5], raw_bytes[6], raw_bytes[7]);
-                    read_frame_log_count++;
-                }
                 int16_t *pcm_in = (int16_t *)frame->data;
+                const int16_t *caller;
                 uint32_t samples_in = frame->datalen / sizeof(int16_t);
-                void *pcm_out = frame->data;
+                void *pcm_out;
                 switch_size_t send_len = frame->datalen;
-                static int frame_count = 0;
-                static int last_logged_peak = 0;
-                frame_count++;
-
-                /* Log periodically if audio level changes significantly */
-                if (frame_count % 250 == 0) { /* Every 5 seconds */
-                    int16_t *samples = (int16_t *)frame->data;
-                    int max_amp = 0;
-                    uint32_t j;
-                    for (j = 0; j < frame->datalen / 2 && j < 160; j++) {
-                        int amp = samples[j] < 0 ? -samples[j] : samples[j];
-                        if (amp > max_amp) max_amp = amp;
+                switch_time_t started = globals.load_shedding ? switch_micro_time_now() : 0;
+                socket_audio_vad_mode_t vad_mode;
+
+                if (ctx->load_shed) {
+                    uint32_t level = __atomic_load_n(&globals.load_level, __ATOMIC_RELAXED);
+
+                    if (level != ctx->load_level) {
+                        socket_audio_pipe_load(ctx, level);
                     }
-                    if (max_amp != last_logged_peak || frame_count <= 500) {
-                        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
-                            "READ frame #%d: peak_amp=%d (%.1f%%)\n",
-                            frame_count, max_amp, max_amp * 100.0 / 32768);
-                        last_logged_peak = max_amp;
+                }
+
+                if (ctx->debug_interval && !ctx->load_level) {
+                    socket_audio_pipe_debug_frame(ctx, frame);
+                }
+
+                if (ctx->reference) {
+                    socket_audio_pipe_reference(ctx, samples_in);
+                }
+
+                /* The caller's echo of what we played goes before anyone hears it */
+                if (ctx->aec) {
+                    pcm_in = socket_audio_pipe_aec(ctx, pcm_in, samples_in);
+                }
+                caller = pcm_in;
+
+                /* What the sidecar hears and what it said, VAD-suppressed frames included */
+                if (ctx->recorder) {
+                    socket_audio_pipe_record(ctx, caller, samples_in);
+                }
+
+                /* Joined legs: the VAD and mix mode see everyone */
+                if (ctx->legs) {
+                    pcm_in = socket_audio_pipe_legs_mix(ctx, pcm_in, samples_in);
+                }
+                pcm_out = pcm_in;
+
+                /* Before resampling, so suppressed frames cost no resampler work;
+                 * its history simply resumes with the next sent frame. Load
+                 * level 3 gates sending on the VAD whatever its mode. */
+                vad_mode = ctx->load_level >= 3 ? SOCKET_AUDIO_VAD_SUPPRESS : ctx->vad_mode;
+                if (vad_mode && !socket_audio_pipe_vad(ctx, pcm_in, samples_in) &&
+                    vad_mode == SOCKET_AUDIO_VAD_SUPPRESS) {
+                    socket_audio_pipe_silence(ctx);
+                    if (started) {
+                        socket_audio_pipe_media_time(ctx, started);
                     }
+                    break;
                 }
 
-                /* Resample session rate → 16kHz if needed */
-                if (ctx->read_resampler) {
-                    switch_resample_process(ctx->read_resampler, pcm_in, samples_in);
-                    pcm_out = ctx->read_resampler->to;
-                    send_len = ctx->read_resampler->to_len * sizeof(int16_t);
+                /* Resample session rate → mic format rate if needed */
+                if (ctx->mic_out) {
+                    send_len = socket_audio_pipe_interleave(ctx, ctx->legs_mode == SOCKET_AUDIO_LEGS_INTERLEAVE ? caller : pcm_in,
+                                                            samples_in);
+                    pcm_out = ctx->mic_out;
+                } else if (ctx->read_resampler) {
+                    socket_audio_resample(ctx->read_resampler, pcm_in, samples_in);
+                    pcm_out = ctx->read_resampler->out;
+                    send_len = ctx->read_resampler->out_len * sizeof(int16_t);
                 }
 
-                /* Non-blocking send to socket */
-                /* If send fails (buffer full), drop the packet - better than blocking */
-                switch_socket_send_nonblock(ctx->sock, pcm_out, &send_len);
-            }
-        }
-        break;
+                if (ctx->mic_format.encoding != SOCKET_AUDIO_ENC_L16 && pcm_out == ctx->mic_out) {
+                    /* In place is safe here: each byte written lies behind the sample read */
+                    send_len /= sizeof(int16_t);
+                    socket_audio_g711_encode(ctx->mic_format.encoding, ctx->mic_out, (uint8_t *)ctx->mic_out, (uint32_t)send_len);
+                } else if (ctx->mic_format.encoding != SOCKET_AUDIO_ENC_L16) {
+                    /* Encode G.711 (never in place: frame->data is the live read frame) */
+                    uint32_t samples = (uint32_t)(send_len / sizeof(int16_t));
 
-    case SWITCH_ABC_TYPE_WRITE_REPLACE:
-        /*
-         * SPEAKER AUDIO: sidecar → FreeSWITCH
-         * NOTE: We're NOT using WRITE_REPLACE for playback anymore.
-         * The socket thread handles direct frame writing with proper pacing.
-         * We keep this callback to handle flush requests only.
-         */
-        {
-            switch_mutex_lock(ctx->mutex);
-            /* Check flush flag (set by uuid_socket_audio_flush API) */
-            if (ctx->flush_flag) {
-                switch_buffer_zero(ctx->audio_queue);
-                ctx->flush_flag = 0;
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
-                                  "Audio queue flushed\n");
+                    if (samples > sizeof(ctx->mic_buf)) {
+                        samples = sizeof(ctx->mic_buf);
+                    }
+                    socket_audio_g711_encode(ctx->mic_format.encoding, pcm_out, ctx->mic_buf, samples);
+                    pcm_out = ctx->mic_buf;
+                    send_len = samples;
+                }
+
+                socket_audio_pipe_mic(ctx, pcm_out, send_len);
+                if (started) {
+                    socket_audio_pipe_media_time(ctx, started);
+                }
             }
-            switch_mutex_unlock(ctx->mutex);
         }
         break;
 
@@ -387,30 +6089,17 @@ static switch_bool_t socket_audio_media_callback(switch_media_bug_t *bug, void *
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
                           "Socket audio closing\n");
 
-        /* Signal thread to stop */
+        /* Stop sending mic audio */
         ctx->running = 0;
 
-        /* Close socket to unblock recv() in thread */
+        /* Tell the sidecar we're done; the reactor sees EOF if it is mid-read */
         if (ctx->sock) {
             switch_socket_shutdown(ctx->sock, SWITCH_SHUTDOWN_READWRITE);
-            switch_socket_close(ctx->sock);
-            ctx->sock = NULL;
-        }
-
-        /* Clean up resamplers */
-        if (ctx->read_resampler) {
-            switch_resample_destroy(&ctx->read_resampler);
-        }
-        if (ctx->write_resampler) {
-            switch_resample_destroy(&ctx->write_resampler);
-        }
-
-        /* Clean up write codec */
-        if (switch_core_codec_ready(&ctx->write_codec)) {
-            switch_core_codec_destroy(&ctx->write_codec);
         }
 
-        /* Buffer will be freed when session pool is destroyed */
+        /* Clock drops the pipe, then the reactor closes the socket, frees
+         * resamplers/codec/queue and drops our session lock */
+        socket_audio_clock_detach(ctx);
         break;
 
     default:
@@ -423,7 +6112,8 @@ static switch_bool_t socket_audio_media_callback(switch_media_bug_t *bug, void *
 /*
  * Application Entry Point
  *
- * Called when ESL executes: execute socket_audio <host> <port>
+ * Called when ESL executes: execute socket_audio <host> <port> [raw|framed]
+ * or, for a sidecar on the same host: socket_audio unix:<path> [raw|framed|shm]
  * Sets up socket, resamplers, thread, and media bug, then returns immediately.
  */
 SWITCH_STANDARD_APP(socket_audio_start)
@@ -431,40 +6121,68 @@ SWITCH_STANDARD_APP(socket_audio_start)
     switch_channel_t *channel = switch_core_session_get_channel(session);
     switch_memory_pool_t *pool = switch_core_session_get_pool(session);
     switch_codec_implementation_t read_impl = { 0 };
-    switch_sockaddr_t *sa = NULL;
-    switch_threadattr_t *thd_attr = NULL;
+    socket_audio_pool_t *conn_pool = NULL;
+    socket_audio_conn_t *conn = NULL;
+    uint8_t hello = 0;
     socket_audio_ctx_t *ctx = NULL;
     char *host = NULL;
     char *port_str = NULL;
+    char *mode_str = NULL;
+    const char *peer = NULL;
     int port = 0;
-    char *argv[2] = { 0 };
+    socket_audio_mode_t mode = SOCKET_AUDIO_MODE_RAW;
+    uint8_t use_shm = 0;
+    uint8_t use_aec;
+    uint8_t use_record = 0;
+    uint8_t is_unix;
+    char *argv[3] = { 0 };
     int argc;
     char *mycmd = NULL;
 
-    /* Parse arguments: <host> <port> */
+    /* Parse arguments: <host> <port> [raw|framed] or unix:<path> [raw|framed|shm] */
     if (zstr(data)) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Usage: socket_audio <host> <port>\n");
+                          "Usage: socket_audio <host> <port> [raw|framed] | unix:<path> [raw|framed|shm]\n");
         return;
     }
 
     mycmd = switch_core_session_strdup(session, data);
     argc = switch_split(mycmd, ' ', argv);
+    is_unix = argc >= 1 && !strncasecmp(argv[0], SOCKET_AUDIO_UNIX_PREFIX, strlen(SOCKET_AUDIO_UNIX_PREFIX));
 
-    if (argc != 2) {
+    if (is_unix ? (argc < 1 || argc > 2) : (argc < 2 || argc > 3)) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Usage: socket_audio <host> <port>\n");
+                          "Usage: socket_audio <host> <port> [raw|framed] | unix:<path> [raw|framed|shm]\n");
         return;
     }
 
     host = argv[0];
-    port_str = argv[1];
-    port = atoi(port_str);
+    mode_str = is_unix ? argv[1] : argv[2];
 
-    if (port <= 0 || port > 65535) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Invalid port: %s\n", port_str);
-        return;
+    if (mode_str) {
+        if (!strcasecmp(mode_str, "framed")) {
+            mode = SOCKET_AUDIO_MODE_FRAMED;
+        } else if (is_unix && !strcasecmp(mode_str, "shm")) {
+            use_shm = 1;  /* Raw PCM through shared memory */
+        } else if (strcasecmp(mode_str, "raw")) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "Invalid mode: %s (expected raw or framed%s)\n", mode_str, is_unix ? " or shm" : "");
+            return;
+        }
+    }
+
+    if (is_unix) {
+        peer = host;
+    } else {
+        port_str = argv[1];
+        port = atoi(port_str);
+
+        if (port <= 0 || port > 65535) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "Invalid port: %s\n", port_str);
+            return;
+        }
+        peer = switch_core_session_sprintf(session, "%s:%d", host, port);
     }
 
     /* Get session codec info */
@@ -474,106 +6192,429 @@ SWITCH_STANDARD_APP(socket_audio_start)
         return;
     }
 
-    /* Allocate context from session pool (auto-freed on hangup) */
-    ctx = switch_core_session_alloc(session, sizeof(*ctx));
-    memset(ctx, 0, sizeof(*ctx));
+    /* A pooled context, returned once the pipe and any API call using it are done */
+    if (!(ctx = socket_audio_ctx_get())) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                          "Failed to allocate pipe context\n");
+        return;
+    }
 
     ctx->session = session;
     ctx->channel = channel;
     ctx->pool = pool;
+    ctx->mode = mode;
     ctx->session_rate = read_impl.actual_samples_per_second;
     ctx->read_ptime = read_impl.microseconds_per_packet / 1000;
 
+    /* Socket formats: defaults, then socket_audio_format, then per direction */
+    {
+        socket_audio_format_t session_fmt = { SOCKET_AUDIO_ENC_L16, ctx->session_rate };
+        const char *both = switch_channel_get_variable(channel, "socket_audio_format");
+        const char *mic = switch_channel_get_variable(channel, "socket_audio_mic_format");
+        const char *speaker = switch_channel_get_variable(channel, "socket_audio_speaker_format");
+
+        if (ctx->session_rate == 8000 && !zstr(read_impl.iananame)) {
+            if (!strcasecmp(read_impl.iananame, "PCMU")) {
+                session_fmt.encoding = SOCKET_AUDIO_ENC_PCMU;
+            } else if (!strcasecmp(read_impl.iananame, "PCMA")) {
+                session_fmt.encoding = SOCKET_AUDIO_ENC_PCMA;
+            }
+        }
+
+        ctx->mic_format.encoding = SOCKET_AUDIO_ENC_L16;
+        ctx->mic_format.rate = SOCKET_AUDIO_INPUT_RATE;
+        ctx->speaker_format.encoding = SOCKET_AUDIO_ENC_L16;
+        ctx->speaker_format.rate = SOCKET_AUDIO_OUTPUT_RATE;
+
+        if ((!zstr(both) && (socket_audio_format_parse(session, both, &session_fmt, &ctx->mic_format) != SWITCH_STATUS_SUCCESS ||
+                             socket_audio_format_parse(session, both, &session_fmt, &ctx->speaker_format) != SWITCH_STATUS_SUCCESS)) ||
+            (!zstr(mic) && socket_audio_format_parse(session, mic, &session_fmt, &ctx->mic_format) != SWITCH_STATUS_SUCCESS) ||
+            (!zstr(speaker) && socket_audio_format_parse(session, speaker, &session_fmt, &ctx->speaker_format) != SWITCH_STATUS_SUCCESS)) {
+            goto error;
+        }
+    }
+
+    /* Mic channels: the caller (mixed with any joined legs), then the playback
+     * reference (stereo), then a channel per leg slot (interleaved legs). The
+     * echo canceller needs the reference too, without sending it. */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_legs");
+        const char *max = switch_channel_get_variable(channel, "socket_audio_legs_max");
+        const char *stereo = switch_channel_get_variable(channel, "socket_audio_stereo");
+        const char *aec = switch_channel_get_variable(channel, "socket_audio_aec");
+        const char *record = switch_channel_get_variable(channel, "socket_audio_record");
+
+        ctx->legs_mode = !zstr(var) ? socket_audio_legs_mode_parse(var) : globals.legs_mode;
+        ctx->legs_max = globals.legs_max;
+        if (!zstr(max) && atoi(max) > 0) {
+            ctx->legs_max = atoi(max) < SOCKET_AUDIO_LEGS_LIMIT ? (uint32_t)atoi(max) : SOCKET_AUDIO_LEGS_LIMIT;
+        }
+        if (ctx->legs_mode == SOCKET_AUDIO_LEGS_INTERLEAVE && mode != SOCKET_AUDIO_MODE_FRAMED) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "Interleaved legs need framed mode, mixing them instead\n");
+            ctx->legs_mode = SOCKET_AUDIO_LEGS_MIX;
+        }
+        ctx->stereo = !zstr(stereo) ? switch_true(stereo) : globals.stereo;
+        use_aec = !zstr(aec) ? switch_true(aec) : globals.aec;
+        use_record = !zstr(record) && !switch_false(record);
+        ctx->reference = ctx->stereo || use_aec || use_record;
+        ctx->mic_channels = 1 + ctx->stereo + (ctx->legs_mode == SOCKET_AUDIO_LEGS_INTERLEAVE ? ctx->legs_max : 0);
+        ctx->mic_frame_max = SWITCH_RECOMMENDED_BUFFER_SIZE * ctx->mic_channels - SOCKET_AUDIO_FRAME_HEADER_LEN;
+        if (ctx->mic_frame_max > 0xFFFF) {
+            ctx->mic_frame_max = 0xFFFF;  /* Framed length field */
+        }
+    }
+
     /* Calculate frame sizes for 20ms ptime */
     ctx->session_frame_bytes = (ctx->session_rate / 1000) * ctx->read_ptime * sizeof(int16_t);
-    ctx->input_frame_bytes = (SOCKET_AUDIO_INPUT_RATE / 1000) * ctx->read_ptime * sizeof(int16_t);
-    ctx->output_frame_bytes = (SOCKET_AUDIO_OUTPUT_RATE / 1000) * ctx->read_ptime * sizeof(int16_t);
+    ctx->input_frame_bytes = (ctx->mic_format.rate / 1000) * ctx->read_ptime * socket_audio_format_sample_bytes(&ctx->mic_format) *
+                             ctx->mic_channels;
+    ctx->output_frame_bytes = (ctx->speaker_format.rate / 1000) * ctx->read_ptime * socket_audio_format_sample_bytes(&ctx->speaker_format);
 
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-                      "Socket audio: session_rate=%u, ptime=%ums, frame_bytes=%u\n",
-                      ctx->session_rate, ctx->read_ptime, ctx->session_frame_bytes);
+                      "Socket audio: session_rate=%u, ptime=%ums, frame_bytes=%u, mic=%s/%u x%u (%u bytes), speaker=%s/%u (%u bytes)\n",
+                      ctx->session_rate, ctx->read_ptime, ctx->session_frame_bytes,
+                      socket_audio_format_name(&ctx->mic_format), ctx->mic_format.rate, ctx->mic_channels, ctx->input_frame_bytes,
+                      socket_audio_format_name(&ctx->speaker_format), ctx->speaker_format.rate, ctx->output_frame_bytes);
+
+    /* Opt-in mic diagnostics: true, or the level log interval in frames */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_debug");
+
+        if (!zstr(var)) {
+            ctx->debug_interval = atoi(var) > 0 ? (uint32_t)atoi(var) : switch_true(var) ? SOCKET_AUDIO_DEBUG_INTERVAL : 0;
+        }
+    }
+
+    /* Voice activity detection: mode, then tuning */
+    {
+        const char *mode_var = switch_channel_get_variable(channel, "socket_audio_vad");
+        const char *threshold = switch_channel_get_variable(channel, "socket_audio_vad_threshold_db");
+        const char *hangover = switch_channel_get_variable(channel, "socket_audio_vad_hangover_ms");
+        uint32_t hangover_ms = globals.vad_hangover_ms;
+
+        ctx->vad_mode = !zstr(mode_var) ? socket_audio_vad_mode_parse(mode_var) : globals.vad_mode;
+        ctx->vad_threshold_db = !zstr(threshold) && atof(threshold) < 0 ? atof(threshold) : globals.vad_threshold_db;
+        if (!zstr(hangover) && atoi(hangover) >= 0) {
+            hangover_ms = (uint32_t)atoi(hangover);
+        }
+        ctx->vad_hangover_frames = ctx->read_ptime ? (hangover_ms + ctx->read_ptime - 1) / ctx->read_ptime : 0;
+        ctx->vad_noise_db = ctx->vad_threshold_db - SOCKET_AUDIO_VAD_NOISE_MARGIN_DB;
+    }
+
+    /* Adaptive prebuffer and underrun concealment */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_jitter_buffer");
+        const char *max = switch_channel_get_variable(channel, "socket_audio_jitter_buffer_max_ms");
+        const char *plc = switch_channel_get_variable(channel, "socket_audio_plc_max_ms");
+
+        if (!zstr(var) ? switch_true(var) : globals.jitter_buffer) {
+            ctx->jb_max_us = (uint64_t)(!zstr(max) && atoi(max) > 0 ? (uint32_t)atoi(max) : globals.jitter_buffer_max_ms) * 1000;
+            ctx->plc_max_us = (uint64_t)(!zstr(plc) && atoi(plc) >= 0 ? (uint32_t)atoi(plc) : globals.plc_max_ms) * 1000;
+            ctx->plc_seed = (uint32_t)switch_micro_time_now();
+        }
+    }
+
+    /* Local barge-in, driven by the VAD (which it turns on if needed) */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_barge_in");
+        const char *ms = switch_channel_get_variable(channel, "socket_audio_barge_in_ms");
+        const char *hangover = switch_channel_get_variable(channel, "socket_audio_barge_in_hangover_ms");
+        uint32_t barge_in_ms = !zstr(ms) && atoi(ms) > 0 ? (uint32_t)atoi(ms) : globals.barge_in_ms;
+
+        if (!zstr(var) ? switch_true(var) : globals.barge_in) {
+            ctx->barge_in_frames = ctx->read_ptime ? (barge_in_ms + ctx->read_ptime - 1) / ctx->read_ptime : 1;
+            if (!ctx->barge_in_frames) {
+                ctx->barge_in_frames = 1;
+            }
+            if (!ctx->vad_mode) {
+                ctx->vad_mode = SOCKET_AUDIO_VAD_DETECT;
+            }
+        }
+        ctx->barge_in_hangover_ms = !zstr(hangover) && atoi(hangover) >= 0 ? (uint32_t)atoi(hangover) : globals.barge_in_hangover_ms;
+    }
+
+    /* Coalesce playback_stop/playback_start pairs across short gaps */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_event_debounce_ms");
+
+        ctx->event_debounce_us = (uint64_t)(!zstr(var) && atoi(var) >= 0 ? (uint32_t)atoi(var) : globals.event_debounce_ms) * 1000;
+    }
+
+    /* Load shedding applies to this call unless it opts out */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_load_shedding");
+
+        ctx->load_shed = globals.load_shedding && (zstr(var) || switch_true(var));
+    }
+
+    /* Mic staging buffer: two batches of frames (with margin for resampler
+     * jitter) plus a full outbox of replies. Batches are sized for the
+     * largest level 2 of load shedding can make them. */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_mic_batch_frames");
+        switch_size_t slot = SOCKET_AUDIO_FRAME_HEADER_LEN + (switch_size_t)ctx->input_frame_bytes * 2;
+        uint32_t batch_max;
+
+        ctx->mic_batch = globals.mic_batch_frames;
+        if (!zstr(var) && atoi(var) > 0) {
+            ctx->mic_batch = atoi(var) < SOCKET_AUDIO_MIC_BATCH_MAX ? (uint32_t)atoi(var) : SOCKET_AUDIO_MIC_BATCH_MAX;
+        }
+        ctx->mic_batch_base = ctx->mic_batch;
+        batch_max = ctx->mic_batch;
+        if (ctx->load_shed) {
+            batch_max = ctx->mic_batch * SOCKET_AUDIO_LOAD_BATCH_FACTOR;
+            if (batch_max > SOCKET_AUDIO_MIC_BATCH_MAX) {
+                batch_max = SOCKET_AUDIO_MIC_BATCH_MAX;
+            }
+        }
+        if (slot > SOCKET_AUDIO_FRAME_HEADER_LEN + ctx->mic_frame_max) {
+            slot = SOCKET_AUDIO_FRAME_HEADER_LEN + ctx->mic_frame_max;
+        }
+        ctx->send_cap = 2 * batch_max * slot + SOCKET_AUDIO_OUTBOX_BYTES;
+        ctx->send_buf = switch_core_session_alloc(session, ctx->send_cap);
+    }
+
+    /* Reconnect policy: the sidecar we connect to first, then any alternates */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_reconnect_attempts");
+        const char *alts = switch_channel_get_variable(channel, "socket_audio_reconnect_hosts");
+        const char *backoff = switch_channel_get_variable(channel, "socket_audio_reconnect_backoff_ms");
+        const char *buffer = switch_channel_get_variable(channel, "socket_audio_reconnect_buffer_ms");
+        uint32_t buffer_ms = globals.reconnect_buffer_ms;
+
+        ctx->hosts[0] = host;
+        ctx->ports[0] = (switch_port_t)port;
+        ctx->host_count = 1;
+        ctx->reconnect_max = !zstr(var) ? (uint32_t)(atoi(var) > 0 ? atoi(var) : 0) : globals.reconnect_attempts;
+        ctx->reconnect_backoff_ms = !zstr(backoff) && atoi(backoff) > 0 ? (uint32_t)atoi(backoff) : globals.reconnect_backoff_ms;
+        if (!zstr(buffer) && atoi(buffer) >= 0) {
+            buffer_ms = (uint32_t)atoi(buffer);
+        }
+
+        if (!zstr(alts)) {
+            char *list = switch_core_session_strdup(session, alts);
+            char *alt[SOCKET_AUDIO_RECONNECT_HOSTS - 1] = { 0 };
+            int i, n = switch_split(list, ',', alt);
+
+            for (i = 0; i < n; i++) {
+                char *colon = strrchr(alt[i], ':');
+                int alt_port = colon ? atoi(colon + 1) : 0;
+
+                if (!strncasecmp(alt[i], SOCKET_AUDIO_UNIX_PREFIX, strlen(SOCKET_AUDIO_UNIX_PREFIX)) &&
+                    strlen(alt[i]) < SOCKET_AUDIO_HOST_MAX) {
+                    ctx->hosts[ctx->host_count] = alt[i];
+                    ctx->ports[ctx->host_count] = 0;
+                    ctx->host_count++;
+                    continue;
+                }
+                if (!colon || alt_port <= 0 || alt_port > 65535 || strlen(alt[i]) >= SOCKET_AUDIO_HOST_MAX) {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                                      "Ignoring reconnect host %s (expected host:port or unix:path)\n", alt[i]);
+                    continue;
+                }
+                *colon = '\0';
+                ctx->hosts[ctx->host_count] = alt[i];
+                ctx->ports[ctx->host_count] = (switch_port_t)alt_port;
+                ctx->host_count++;
+            }
+        }
+
+        if (use_shm && ctx->reconnect_max) {
+            /* A new connection would need a new ring handshake mid-call */
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "Reconnect is not supported in shm mode, disabled\n");
+            ctx->reconnect_max = 0;
+        }
+
+        if (ctx->reconnect_max && ctx->input_frame_bytes) {
+            /* Whole mic frames, so replay stays sample aligned */
+            ctx->mic_ring_cap = (switch_size_t)((buffer_ms + ctx->read_ptime - 1) / ctx->read_ptime) * ctx->input_frame_bytes;
+            if (ctx->mic_ring_cap) {
+                ctx->mic_ring = switch_core_session_alloc(session, ctx->mic_ring_cap);
+            }
+        }
+    }
+
+    /* Create audio queue, sized in seconds of audio at the session rate */
+    {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_queue_seconds");
+        uint32_t bytes_per_second = ctx->session_rate * sizeof(int16_t);
+        int seconds = globals.queue_seconds;
+
+        if (!zstr(var) && atoi(var) > 0) {
+            seconds = atoi(var);
+        }
 
-    /* Create mutex */
-    if (switch_mutex_init(&ctx->mutex, SWITCH_MUTEX_NESTED, pool) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Failed to create mutex\n");
-        return;
-    }
+        socket_audio_queue_init(&ctx->audio_queue,
+                                (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_SEGMENT_FRAMES,
+                                (switch_size_t)bytes_per_second * seconds,
+                                (switch_size_t)bytes_per_second * SOCKET_AUDIO_QUEUE_SLACK_SECONDS);
+        socket_audio_ctx_adopt_segment(ctx);
 
-    /* Create audio queue */
-    if (switch_buffer_create_dynamic(&ctx->audio_queue, 4096, 8192, SOCKET_AUDIO_QUEUE_MAX_SIZE) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Failed to create audio queue\n");
-        return;
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                          "Audio queue limit: %ds (%u bytes)\n", seconds, bytes_per_second * seconds);
     }
 
     /* Create resamplers if needed */
-    if (ctx->session_rate != SOCKET_AUDIO_INPUT_RATE) {
-        /* Session → 16kHz for sending to sidecar */
-        if (switch_resample_create(&ctx->read_resampler,
-                                   ctx->session_rate,
-                                   SOCKET_AUDIO_INPUT_RATE,
-                                   (uint32_t)(SOCKET_AUDIO_INPUT_RATE * 0.02 * 2), /* 20ms buffer */
-                                   SWITCH_RESAMPLE_QUALITY,
-                                   1) != SWITCH_STATUS_SUCCESS) {
+    if (ctx->session_rate != ctx->mic_format.rate) {
+        /* Session → mic rate for sending to sidecar */
+        if (socket_audio_resampler_create(&ctx->read_resampler,
+                                          ctx->session_rate,
+                                          ctx->mic_format.rate,
+                                          SOCKET_AUDIO_RESAMPLE_MAX_IN,
+                                          pool) != SWITCH_STATUS_SUCCESS) {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
                               "Failed to create read resampler (%u → %u)\n",
-                              ctx->session_rate, SOCKET_AUDIO_INPUT_RATE);
-            return;
+                              ctx->session_rate, ctx->mic_format.rate);
+            goto error;
         }
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-                          "Created read resampler: %u → %u Hz\n",
-                          ctx->session_rate, SOCKET_AUDIO_INPUT_RATE);
-    }
-
-    if (ctx->session_rate != SOCKET_AUDIO_OUTPUT_RATE) {
-        /* 24kHz → Session for receiving from sidecar */
-        if (switch_resample_create(&ctx->write_resampler,
-                                   SOCKET_AUDIO_OUTPUT_RATE,
-                                   ctx->session_rate,
-                                   (uint32_t)(ctx->session_rate * 0.02 * 2), /* 20ms buffer */
-                                   SWITCH_RESAMPLE_QUALITY,
-                                   1) != SWITCH_STATUS_SUCCESS) {
+                          "Created read resampler: %u → %u Hz (%s)\n",
+                          ctx->session_rate, ctx->mic_format.rate,
+                          socket_audio_resampler_kind(ctx->read_resampler));
+    }
+
+    if (ctx->session_rate != ctx->speaker_format.rate) {
+        /* Speaker rate → Session for receiving from sidecar */
+        if (socket_audio_resampler_create(&ctx->write_resampler,
+                                          ctx->speaker_format.rate,
+                                          ctx->session_rate,
+                                          SOCKET_AUDIO_RESAMPLE_MAX_IN,
+                                          pool) != SWITCH_STATUS_SUCCESS) {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
                               "Failed to create write resampler (%u → %u)\n",
-                              SOCKET_AUDIO_OUTPUT_RATE, ctx->session_rate);
-            if (ctx->read_resampler) {
-                switch_resample_destroy(&ctx->read_resampler);
-            }
-            return;
+                              ctx->speaker_format.rate, ctx->session_rate);
+            goto error;
         }
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-                          "Created write resampler: %u → %u Hz\n",
-                          SOCKET_AUDIO_OUTPUT_RATE, ctx->session_rate);
+                          "Created write resampler: %u → %u Hz (%s)\n",
+                          ctx->speaker_format.rate, ctx->session_rate,
+                          socket_audio_resampler_kind(ctx->write_resampler));
     }
 
-    /* Resolve host address */
-    if (switch_sockaddr_info_get(&sa, host, SWITCH_UNSPEC, port, 0, pool) != SWITCH_STATUS_SUCCESS) {
+    /* Interleaved mic frames, and the played frames the reference channel is made of */
+    if (ctx->mic_channels > 1) {
+        ctx->mic_out = switch_core_session_alloc(session, SOCKET_AUDIO_RESAMPLE_MAX_IN * sizeof(int16_t) * ctx->mic_channels);
+    }
+    if (ctx->reference) {
+        ctx->ref_pcm = switch_core_session_alloc(session, SOCKET_AUDIO_RESAMPLE_MAX_IN * sizeof(int16_t));
+        socket_audio_queue_init(&ctx->ref_queue,
+                                (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_REF_QUEUE_FRAMES,
+                                (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_REF_QUEUE_FRAMES,
+                                (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_REF_QUEUE_FRAMES);
+    }
+    if (use_aec) {
+        const char *tail = switch_channel_get_variable(channel, "socket_audio_aec_tail_ms");
+        const char *suppress = switch_channel_get_variable(channel, "socket_audio_aec_suppress_db");
+        double suppress_db = !zstr(suppress) && atof(suppress) >= 0 ? atof(suppress) : globals.aec_suppress_db;
+        uint32_t tail_ms = !zstr(tail) && atoi(tail) > 0 ? (uint32_t)atoi(tail) : globals.aec_tail_ms;
+
+        /* Cost grows with taps (rate × tail): cap it, leaving longer echo to the suppressor */
+        if (globals.aec_max_taps && (uint64_t)ctx->session_rate * tail_ms / 1000 > globals.aec_max_taps) {
+            tail_ms = (uint32_t)((uint64_t)globals.aec_max_taps * 1000 / ctx->session_rate);
+            if (!tail_ms) {
+                tail_ms = 1;
+            }
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_NOTICE,
+                              "Echo canceller tail capped to %ums at %u Hz (aec-max-taps %u)\n",
+                              tail_ms, ctx->session_rate, globals.aec_max_taps);
+        }
+        ctx->aec = switch_core_session_alloc(session, sizeof(socket_audio_aec_t));
+        socket_audio_aec_plan(ctx->aec, ctx->session_rate, tail_ms, SOCKET_AUDIO_RESAMPLE_MAX_IN);
+        ctx->aec->w = switch_core_session_alloc(session, ctx->aec->taps * sizeof(float));
+        ctx->aec->buf = switch_core_session_alloc(session, (ctx->aec->taps + ctx->aec->max_in) * sizeof(float));
+        ctx->aec->out = switch_core_session_alloc(session, ctx->aec->max_in * sizeof(int16_t));
+        socket_audio_aec_reset(ctx->aec, suppress_db);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                          "Echo canceller: %u taps at %u Hz, %.1f dB suppression\n",
+                          ctx->aec->taps, ctx->session_rate, suppress_db);
+    }
+    if (ctx->stereo && ctx->read_resampler &&
+        socket_audio_resampler_create(&ctx->ref_resampler, ctx->session_rate, ctx->mic_format.rate,
+                                      SOCKET_AUDIO_RESAMPLE_MAX_IN, pool) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Failed to resolve address: %s:%d\n", host, port);
+                          "Failed to create reference resampler (%u → %u)\n",
+                          ctx->session_rate, ctx->mic_format.rate);
         goto error;
     }
 
-    /* Create socket */
-    if (switch_socket_create(&ctx->sock, switch_sockaddr_get_family(sa),
-                             SOCK_STREAM, SWITCH_PROTO_TCP, pool) != SWITCH_STATUS_SUCCESS) {
+    /* Slots for joined legs; interleave gives each a mic resampler of its own */
+    if (ctx->legs_mode) {
+        uint32_t i;
+
+        ctx->legs = switch_core_session_alloc(session, sizeof(socket_audio_leg_t) * ctx->legs_max);
+        memset(ctx->legs, 0, sizeof(socket_audio_leg_t) * ctx->legs_max);
+        ctx->leg_mix = switch_core_session_alloc(session, SOCKET_AUDIO_RESAMPLE_MAX_IN * sizeof(int16_t));
+
+        for (i = 0; i < ctx->legs_max; i++) {
+            ctx->legs[i].ctx = ctx;
+            if (ctx->legs_mode == SOCKET_AUDIO_LEGS_INTERLEAVE && ctx->read_resampler &&
+                socket_audio_resampler_create(&ctx->legs[i].mic_resampler, ctx->session_rate, ctx->mic_format.rate,
+                                              SOCKET_AUDIO_RESAMPLE_MAX_IN, pool) != SWITCH_STATUS_SUCCESS) {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                                  "Failed to create leg resampler (%u → %u)\n",
+                                  ctx->session_rate, ctx->mic_format.rate);
+                goto error;
+            }
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                          "Legs: up to %u, %s\n", ctx->legs_max,
+                          ctx->legs_mode == SOCKET_AUDIO_LEGS_INTERLEAVE ? "interleaved" : "mixed");
+    }
+
+    /* Resolve host address */
+    /* Prefer a pre-connected socket: no DNS or TCP handshake on the answer path */
+    if (!is_unix && (conn_pool = socket_audio_pool_find(host, (switch_port_t)port)) && (conn = socket_audio_pool_take(conn_pool))) {
+        ctx->sock = conn->sock;
+        ctx->sock_pool = conn->pool;
+        hello = 1;  /* The sidecar cannot otherwise tell which call it now serves */
+    } else {
+        const char *var = switch_channel_get_variable(channel, "socket_audio_connect_timeout_ms");
+        uint32_t timeout_ms = globals.connect_timeout_ms;
+
+        if (!zstr(var) && atoi(var) > 0) {
+            timeout_ms = (uint32_t)atoi(var);
+        }
+        if (conn_pool) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "Connection pool for %s is empty, connecting directly\n", peer);
+        }
+
+        if (socket_audio_connect(host, (switch_port_t)port, timeout_ms, pool, &ctx->sock) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "Failed to connect to %s (timeout %ums)\n", peer, timeout_ms);
+            goto error;
+        }
+        hello = switch_true(switch_channel_get_variable(channel, "socket_audio_hello"));
+    }
+
+    if (switch_os_sock_get(&ctx->sock_fd, ctx->sock) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Failed to create socket\n");
+                          "Failed to get socket descriptor\n");
         goto error;
     }
 
-    /* Connect to sidecar */
-    if (switch_socket_connect(ctx->sock, sa) != SWITCH_STATUS_SUCCESS) {
+    ctx->hello = hello;
+    if (hello && socket_audio_pipe_hello(ctx) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Failed to connect to %s:%d\n", host, port);
+                          "Failed to send HELLO to %s\n", peer);
         goto error;
     }
 
-    /* CRITICAL: Disable Nagle's algorithm for low latency */
-    switch_socket_opt_set(ctx->sock, SWITCH_SO_TCP_NODELAY, 1);
+    if (use_shm) {
+        if (socket_audio_shm_create(ctx) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "Failed to set up shared memory with %s (errno=%d)\n", peer, errno);
+            goto error;
+        }
+        /* The clock produces into the queue, so it needs its own decode scratch */
+        ctx->decode_buf = switch_core_session_alloc(session, SOCKET_AUDIO_REACTOR_RECV_BUF * sizeof(int16_t));
+    }
 
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-                      "Connected to sidecar at %s:%d\n", host, port);
+                      "Connected to sidecar at %s (%s mode%s)\n", peer,
+                      use_shm ? "shm" : mode == SOCKET_AUDIO_MODE_FRAMED ? "framed" : "raw", conn ? ", pooled" : "");
 
     /* Initialize write codec for direct frame injection (L16 at session rate) */
     if (switch_core_codec_init(&ctx->write_codec,
@@ -599,33 +6640,43 @@ SWITCH_STANDARD_APP(socket_audio_start)
     ctx->write_frame.data = ctx->write_frame_data;
     ctx->write_frame.buflen = sizeof(ctx->write_frame_data);
 
-    /* Start socket reader thread */
-    ctx->running = 1;
-    switch_threadattr_create(&thd_attr, pool);
-    switch_threadattr_detach_set(thd_attr, 1);
-    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (!globals.running) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                          "Module is shutting down\n");
+        goto error;
+    }
 
-    if (switch_thread_create(&ctx->thread, thd_attr, socket_audio_thread, ctx, pool) != SWITCH_STATUS_SUCCESS) {
+    /* Keep the session alive until the reactor has released the pipe */
+    if (switch_core_session_read_lock(session) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "Failed to create socket thread\n");
-        ctx->running = 0;
+                          "Failed to lock session\n");
         goto error;
     }
 
+    /* Last, as nothing after it can fail; the reactor closes it at teardown */
+    if (use_record) {
+        ctx->recorder = socket_audio_recorder_create(ctx, switch_channel_get_variable(channel, "socket_audio_record"));
+    }
+
+    /* Hand the socket to a reactor and playback to its clock; from here on
+     * they own the pipe's resources */
+    ctx->running = 1;
+    socket_audio_registry_add(ctx);
+    socket_audio_reactor_attach(ctx);
+    socket_audio_clock_attach(ctx);
+
     /* Attach media bug */
     if (switch_core_media_bug_add(session, SOCKET_AUDIO_BUG_NAME, NULL,
                                   socket_audio_media_callback, ctx, 0,
-                                  SMBF_READ_REPLACE | SMBF_WRITE_REPLACE | SMBF_NO_PAUSE,
+                                  SMBF_READ_REPLACE | SMBF_NO_PAUSE,
                                   &ctx->bug) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
                           "Failed to attach media bug\n");
         ctx->running = 0;
-        goto error;
+        socket_audio_clock_detach(ctx);
+        return;
     }
 
-    /* Store context in channel for API access */
-    switch_channel_set_private(channel, SOCKET_AUDIO_PRIVATE, ctx);
-
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
                       "Socket audio pipe established\n");
 
@@ -636,18 +6687,70 @@ error:
         switch_socket_close(ctx->sock);
         ctx->sock = NULL;
     }
-    if (ctx->read_resampler) {
-        switch_resample_destroy(&ctx->read_resampler);
+    if (ctx->sock_pool) {
+        switch_core_destroy_memory_pool(&ctx->sock_pool);
     }
-    if (ctx->write_resampler) {
-        switch_resample_destroy(&ctx->write_resampler);
+    socket_audio_shm_destroy(ctx);
+    socket_audio_resampler_destroy(&ctx->read_resampler);
+    socket_audio_resampler_destroy(&ctx->write_resampler);
+    socket_audio_resampler_destroy(&ctx->ref_resampler);
+    socket_audio_queue_destroy(&ctx->ref_queue);
+    if (ctx->legs) {
+        uint32_t i;
+
+        for (i = 0; i < ctx->legs_max; i++) {
+            socket_audio_resampler_destroy(&ctx->legs[i].mic_resampler);
+        }
     }
     if (switch_core_codec_ready(&ctx->write_codec)) {
         switch_core_codec_destroy(&ctx->write_codec);
     }
-    if (ctx->audio_queue) {
-        switch_buffer_destroy(&ctx->audio_queue);
+    socket_audio_ctx_retire_queue(ctx);
+    socket_audio_ctx_put(ctx);
+}
+
+/*
+ * Next space-separated argument of an API command, read in place: its start
+ * (len bytes, not terminated), or NULL when there are no more.
+ */
+static const char *socket_audio_api_arg(const char **cmd, switch_size_t *len)
+{
+    const char *p = *cmd, *start;
+
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+    start = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    *cmd = p;
+    *len = (switch_size_t)(p - start);
+
+    return *len ? start : NULL;
+}
+
+/* A turn ID argument: 1 to 10 digits, at most UINT32_MAX */
+static switch_bool_t socket_audio_api_turn(const char *arg, switch_size_t len, uint32_t *turn)
+{
+    uint64_t n = 0;
+    switch_size_t i;
+
+    if (!len || len > 10) {
+        return SWITCH_FALSE;
+    }
+    for (i = 0; i < len; i++) {
+        if (arg[i] < '0' || arg[i] > '9') {
+            return SWITCH_FALSE;
+        }
+        n = n * 10 + (uint64_t)(arg[i] - '0');
+    }
+    if (n > UINT32_MAX) {
+        return SWITCH_FALSE;
     }
+    *turn = (uint32_t)n;
+
+    return SWITCH_TRUE;
 }
 
 /*
@@ -656,67 +6759,320 @@ error:
  * Flushes the audio queue for a session. Called by sidecar via ESL when
  * signaling end-of-turn or interruption.
  *
- * Usage: uuid_socket_audio_flush <uuid>
+ * With a turn ID (framed mode), only audio of older turns is dropped, now and
+ * as it arrives; otherwise the queue is cleared and a short discard window
+ * absorbs in-flight audio.
+ *
+ * Several UUIDs flush several calls in one command (barge-in bursts): each
+ * is found in the module's registry, so no core session lock is taken. The
+ * calls that have a pipe are flushed even if others do not.
+ *
+ * Usage: uuid_socket_audio_flush <uuid> [turn] | <uuid> <uuid> ...
  */
 SWITCH_STANDARD_API(uuid_socket_audio_flush_function)
 {
-    switch_core_session_t *target_session = NULL;
-    switch_channel_t *channel = NULL;
-    socket_audio_ctx_t *ctx = NULL;
-    char *uuid = NULL;
-    char *mycmd = NULL;
+    const char *args = cmd ? cmd : "";
+    const char *uuid, *second;
+    switch_size_t uuid_len, second_len;
+    switch_bool_t has_turn;
+    uint32_t turn = 0;
+    uint32_t missing = 0;
 
-    if (zstr(cmd)) {
-        stream->write_function(stream, "-ERR Usage: uuid_socket_audio_flush <uuid>\n");
+    if (!(uuid = socket_audio_api_arg(&args, &uuid_len))) {
+        stream->write_function(stream, "-ERR Usage: uuid_socket_audio_flush <uuid> [turn] | <uuid> <uuid> ...\n");
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Duplicate command string since we may modify it */
-    mycmd = strdup(cmd);
-    if (!mycmd) {
-        stream->write_function(stream, "-ERR Memory allocation failed\n");
+    /* A second argument of digits alone is a turn ID, not a UUID */
+    second = socket_audio_api_arg(&args, &second_len);
+    has_turn = second && socket_audio_api_turn(second, second_len, &turn);
+    if (has_turn && socket_audio_api_arg(&args, &second_len)) {
+        stream->write_function(stream, "-ERR Usage: uuid_socket_audio_flush <uuid> [turn] | <uuid> <uuid> ...\n");
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Trim whitespace */
-    uuid = mycmd;
-    while (*uuid == ' ' || *uuid == '\t') uuid++;
-    {
-        char *end = uuid + strlen(uuid) - 1;
-        while (end > uuid && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) {
-            *end-- = '\0';
+    for (;;) {
+        socket_audio_ctx_t *ctx = socket_audio_registry_find(uuid, uuid_len);
+
+        if (!ctx) {
+            stream->write_function(stream, missing++ ? " %.*s" : "-ERR Socket audio not active on session: %.*s",
+                                   (int)uuid_len, uuid);
+        } else if (has_turn && ctx->mode != SOCKET_AUDIO_MODE_FRAMED) {
+            socket_audio_ctx_release(ctx);
+            stream->write_function(stream, "-ERR Turn IDs require framed mode\n");
+            return SWITCH_STATUS_SUCCESS;
+        } else if (has_turn) {
+            /* Reactor drops older turns from now on; the clock cuts the queue on its next tick */
+            socket_audio_turn_advance(ctx, turn);
+            ctx->flush_req_at = switch_micro_time_now();
+            __atomic_store_n(&ctx->turn_flush, 1, __ATOMIC_RELEASE);
+
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                              "Flush requested (turn %u)\n", turn);
+            socket_audio_ctx_release(ctx);
+        } else {
+            /* Set flush flag - the playback clock clears the queue on its next tick */
+            ctx->flush_req_at = switch_micro_time_now();
+            __atomic_store_n(&ctx->flush_flag, 1, __ATOMIC_RELEASE);
+
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                              "Flush requested\n");
+            socket_audio_ctx_release(ctx);
+        }
+
+        if (has_turn || !second) {
+            break;
         }
+        uuid = second;
+        uuid_len = second_len;
+        second = socket_audio_api_arg(&args, &second_len);
     }
 
-    target_session = switch_core_session_locate(uuid);
-    if (!target_session) {
-        stream->write_function(stream, "-ERR Session not found: %s\n", uuid);
-        free(mycmd);
+    stream->write_function(stream, missing ? "\n" : "+OK\n");
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * API: uuid_socket_audio_stats
+ *
+ * Reports the per-call counters of a session's pipe as JSON.
+ *
+ * Usage: uuid_socket_audio_stats <uuid>
+ */
+SWITCH_STANDARD_API(uuid_socket_audio_stats_function)
+{
+    const char *args = cmd ? cmd : "";
+    const char *uuid;
+    switch_size_t uuid_len;
+    socket_audio_ctx_t *ctx;
+    socket_audio_stats_t stats;
+    cJSON *json;
+    char *out;
+
+    if (!(uuid = socket_audio_api_arg(&args, &uuid_len))) {
+        stream->write_function(stream, "-ERR Usage: uuid_socket_audio_stats <uuid>\n");
         return SWITCH_STATUS_SUCCESS;
     }
 
-    channel = switch_core_session_get_channel(target_session);
-    ctx = switch_channel_get_private(channel, SOCKET_AUDIO_PRIVATE);
-
-    if (!ctx) {
-        stream->write_function(stream, "-ERR Socket audio not active on session: %s\n", uuid);
-        switch_core_session_rwunlock(target_session);
-        free(mycmd);
+    if (!(ctx = socket_audio_registry_find(uuid, uuid_len))) {
+        stream->write_function(stream, "-ERR Socket audio not active on session: %.*s\n", (int)uuid_len, uuid);
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Set flush flag - media callback will clear the queue */
-    switch_mutex_lock(ctx->mutex);
-    ctx->flush_flag = 1;
-    switch_mutex_unlock(ctx->mutex);
+    memset(&stats, 0, sizeof(stats));
+    socket_audio_stats_merge(&stats, &ctx->stats);
 
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(target_session), SWITCH_LOG_INFO,
-                      "Flush requested\n");
+    json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "uuid", ctx->uuid);
+    cJSON_AddStringToObject(json, "mode", ctx->mode == SOCKET_AUDIO_MODE_FRAMED ? "framed" : "raw");
+    cJSON_AddNumberToObject(json, "session_rate", ctx->session_rate);
+    cJSON_AddNumberToObject(json, "ptime", ctx->read_ptime);
+    cJSON_AddStringToObject(json, "mic_format", socket_audio_format_name(&ctx->mic_format));
+    cJSON_AddNumberToObject(json, "mic_rate", ctx->mic_format.rate);
+    cJSON_AddStringToObject(json, "speaker_format", socket_audio_format_name(&ctx->speaker_format));
+    cJSON_AddNumberToObject(json, "speaker_rate", ctx->speaker_format.rate);
+    cJSON_AddNumberToObject(json, "mic_channels", ctx->mic_channels);
+    cJSON_AddBoolToObject(json, "stereo", ctx->stereo);
+    if (ctx->aec) {
+        cJSON_AddNumberToObject(json, "aec_taps", ctx->aec->taps);
+    }
+    if (ctx->load_shed) {
+        cJSON_AddNumberToObject(json, "load_level", ctx->load_level);
+    }
+    cJSON_AddBoolToObject(json, "recording", ctx->recorder != NULL);
+    cJSON_AddBoolToObject(json, "playing", ctx->is_playing);
+    cJSON_AddNumberToObject(json, "queue_bytes",
+                            (double)(__atomic_load_n(&ctx->audio_queue.head, __ATOMIC_ACQUIRE) -
+                                     __atomic_load_n(&ctx->audio_queue.tail, __ATOMIC_ACQUIRE)));
+    if (ctx->legs) {
+        cJSON *legs = cJSON_CreateArray();
+        uint32_t i;
 
-    stream->write_function(stream, "+OK\n");
+        cJSON_AddStringToObject(json, "legs_mode", ctx->legs_mode == SOCKET_AUDIO_LEGS_INTERLEAVE ? "interleave" : "mix");
+        switch_mutex_lock(globals.mutex);
+        for (i = 0; i < ctx->legs_max; i++) {
+            if (__atomic_load_n(&ctx->legs[i].state, __ATOMIC_ACQUIRE) == SOCKET_AUDIO_LEG_ACTIVE) {
+                cJSON *leg = cJSON_CreateObject();
 
-    switch_core_session_rwunlock(target_session);
-    free(mycmd);
+                cJSON_AddStringToObject(leg, "uuid", ctx->legs[i].uuid);
+                cJSON_AddNumberToObject(leg, "channel", i + 1 + ctx->stereo);
+                cJSON_AddNumberToObject(leg, "rate", ctx->legs[i].rate);
+                cJSON_AddBoolToObject(leg, "listen", ctx->legs[i].listen);
+                cJSON_AddBoolToObject(leg, "speak", ctx->legs[i].speak);
+                cJSON_AddItemToArray(legs, leg);
+            }
+        }
+        switch_mutex_unlock(globals.mutex);
+        cJSON_AddItemToObject(json, "legs", legs);
+    }
+    socket_audio_stats_json(json, &stats);
+    socket_audio_ctx_release(ctx);
+
+    out = cJSON_PrintUnformatted(json);
+    stream->write_function(stream, "%s\n", out ? out : "{}");
+    switch_safe_free(out);
+    cJSON_Delete(json);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * API: socket_audio_stats
+ *
+ * Module-wide totals as JSON: active pipes plus every pipe released since
+ * load. Maxima are over all of them.
+ *
+ * Usage: socket_audio_stats
+ */
+SWITCH_STANDARD_API(socket_audio_stats_function)
+{
+    socket_audio_stats_t stats;
+    uint32_t active = socket_audio_stats_total(&stats);
+    cJSON *json;
+    char *out;
+
+    json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "active_pipes", active);
+    cJSON_AddNumberToObject(json, "reactors", globals.reactor_count);
+    cJSON_AddNumberToObject(json, "events_dropped", globals.events ? __atomic_load_n(&globals.events->dropped, __ATOMIC_RELAXED) : 0);
+    cJSON_AddNumberToObject(json, "load_level", globals.load_level);
+    cJSON_AddNumberToObject(json, "contexts_idle", __atomic_load_n(&globals.ctx_free_count, __ATOMIC_RELAXED));
+    cJSON_AddNumberToObject(json, "recordings", __atomic_load_n(&globals.recorder_count, __ATOMIC_RELAXED));
+    socket_audio_stats_json(json, &stats);
+
+    out = cJSON_PrintUnformatted(json);
+    stream->write_function(stream, "%s\n", out ? out : "{}");
+    switch_safe_free(out);
+    cJSON_Delete(json);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * API: socket_audio_metrics
+ *
+ * Module-wide totals in the Prometheus text exposition format, for scraping
+ * through mod_xml_rpc (/txtapi/socket_audio_metrics).
+ *
+ * Usage: socket_audio_metrics
+ */
+SWITCH_STANDARD_API(socket_audio_metrics_function)
+{
+    socket_audio_stats_t stats;
+    uint32_t active = socket_audio_stats_total(&stats);
+    uint64_t cumulative = 0;
+    int i;
+
+    stream->write_function(stream, "# TYPE socket_audio_active_pipes gauge\nsocket_audio_active_pipes %u\n", active);
+    stream->write_function(stream, "# TYPE socket_audio_events_dropped counter\nsocket_audio_events_dropped %u\n",
+                           globals.events ? __atomic_load_n(&globals.events->dropped, __ATOMIC_RELAXED) : 0);
+    stream->write_function(stream, "# TYPE socket_audio_load_level gauge\nsocket_audio_load_level %u\n", globals.load_level);
+
+    for (i = 0; i < SOCKET_AUDIO_STAT_COUNT; i++) {
+        const char *name = socket_audio_stat_info[i].name;
+
+        if (i == SOCKET_AUDIO_STAT_PACE_ERROR_US_TOTAL) {
+            continue;  /* Reported as the histogram sum */
+        }
+        if (socket_audio_stat_info[i].is_max) {
+            stream->write_function(stream, "# TYPE socket_audio_%s gauge\nsocket_audio_%s %" SWITCH_UINT64_T_FMT "\n",
+                                   name, name, stats.count[i]);
+        } else {
+            stream->write_function(stream, "# TYPE socket_audio_%s counter\nsocket_audio_%s %" SWITCH_UINT64_T_FMT "\n",
+                                   name, name, stats.count[i]);
+        }
+    }
+
+    stream->write_function(stream, "# TYPE socket_audio_pace_error_seconds histogram\n");
+    for (i = 0; i < SOCKET_AUDIO_PACE_BUCKETS; i++) {
+        cumulative += stats.pace[i];
+        if (i < SOCKET_AUDIO_PACE_BUCKETS - 1) {
+            stream->write_function(stream, "socket_audio_pace_error_seconds_bucket{le=\"%.3f\"} %" SWITCH_UINT64_T_FMT "\n",
+                                   socket_audio_pace_bounds_us[i] / 1e6, cumulative);
+        } else {
+            stream->write_function(stream, "socket_audio_pace_error_seconds_bucket{le=\"+Inf\"} %" SWITCH_UINT64_T_FMT "\n",
+                                   cumulative);
+        }
+    }
+    stream->write_function(stream, "socket_audio_pace_error_seconds_sum %.6f\n",
+                           stats.count[SOCKET_AUDIO_STAT_PACE_ERROR_US_TOTAL] / 1e6);
+    stream->write_function(stream, "socket_audio_pace_error_seconds_count %" SWITCH_UINT64_T_FMT "\n", cumulative);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * API: socket_audio_cache
+ *
+ * Manages the prompt cache. put loads a raw L16 mono file (default 24000 Hz,
+ * the default speaker rate) under an ID, replacing any clip with it; del
+ * removes one; list reports every entry as JSON.
+ *
+ * Usage: socket_audio_cache put <id> <path> [rate] | del <id> | list
+ */
+SWITCH_STANDARD_API(socket_audio_cache_function)
+{
+    char *mycmd = NULL;
+    char *argv[4] = { 0 };
+    int argc = 0;
+
+    if (!zstr(cmd) && (mycmd = strdup(cmd))) {
+        argc = switch_split(mycmd, ' ', argv);
+    }
+
+    if (argc >= 3 && !strcasecmp(argv[0], "put")) {
+        int rate = argc > 3 ? atoi(argv[3]) : 24000;
+        const char *err = rate >= 8000 && rate <= 48000 ? socket_audio_cache_load(argv[1], argv[2], (uint32_t)rate) : "bad rate";
+
+        if (err) {
+            stream->write_function(stream, "-ERR %s\n", err);
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Cached clip '%s' from %s (%d Hz)\n", argv[1], argv[2], rate);
+            stream->write_function(stream, "+OK\n");
+        }
+    } else if (argc >= 2 && !strcasecmp(argv[0], "del")) {
+        uint32_t removed;
+
+        switch_mutex_lock(globals.cache_mutex);
+        removed = socket_audio_cache_unlink(argv[1]);
+        switch_mutex_unlock(globals.cache_mutex);
+        stream->write_function(stream, removed ? "+OK\n" : "-ERR No such clip\n");
+    } else if (argc >= 1 && !strcasecmp(argv[0], "list")) {
+        cJSON *json = cJSON_CreateObject();
+        cJSON *clips = cJSON_CreateArray();
+        char *out;
+        uint32_t i;
+
+        switch_mutex_lock(globals.cache_mutex);
+        cJSON_AddNumberToObject(json, "clips", globals.cache_clips);
+        cJSON_AddNumberToObject(json, "bytes", (double)globals.cache_bytes);
+        cJSON_AddNumberToObject(json, "max_bytes", (double)globals.cache_max_bytes);
+        for (i = 0; i < SOCKET_AUDIO_CACHE_BUCKETS; i++) {
+            socket_audio_clip_t *clip;
+
+            for (clip = globals.cache[i]; clip; clip = clip->next) {
+                cJSON *entry = cJSON_CreateObject();
+
+                cJSON_AddStringToObject(entry, "id", clip->id);
+                cJSON_AddNumberToObject(entry, "rate", clip->rate);
+                cJSON_AddNumberToObject(entry, "samples", clip->samples);
+                cJSON_AddBoolToObject(entry, "loaded", clip->source);
+                cJSON_AddNumberToObject(entry, "playing", __atomic_load_n(&clip->refs, __ATOMIC_RELAXED) - 1);
+                cJSON_AddItemToArray(clips, entry);
+            }
+        }
+        switch_mutex_unlock(globals.cache_mutex);
+        cJSON_AddItemToObject(json, "entries", clips);
+
+        out = cJSON_PrintUnformatted(json);
+        stream->write_function(stream, "%s\n", out ? out : "{}");
+        switch_safe_free(out);
+        cJSON_Delete(json);
+    } else {
+        stream->write_function(stream, "-ERR Usage: socket_audio_cache put <id> <path> [rate] | del <id> | list\n");
+    }
+
+    switch_safe_free(mycmd);
     return SWITCH_STATUS_SUCCESS;
 }
 
@@ -729,64 +7085,241 @@ SWITCH_STANDARD_API(uuid_socket_audio_flush_function)
  */
 SWITCH_STANDARD_API(uuid_socket_audio_stop_function)
 {
-    switch_core_session_t *target_session = NULL;
-    switch_channel_t *channel = NULL;
-    socket_audio_ctx_t *ctx = NULL;
-    char *uuid = NULL;
-    char *mycmd = NULL;
+    const char *args = cmd ? cmd : "";
+    const char *uuid;
+    switch_size_t uuid_len;
+    socket_audio_ctx_t *ctx;
+    switch_media_bug_t *bug;
 
-    if (zstr(cmd)) {
+    if (!(uuid = socket_audio_api_arg(&args, &uuid_len))) {
         stream->write_function(stream, "-ERR Usage: uuid_socket_audio_stop <uuid>\n");
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Duplicate command string since we may modify it */
-    mycmd = strdup(cmd);
-    if (!mycmd) {
-        stream->write_function(stream, "-ERR Memory allocation failed\n");
+    /* One stop takes the bug; a concurrent or repeated one finds it gone */
+    if (!(ctx = socket_audio_registry_find(uuid, uuid_len)) ||
+        !(bug = __atomic_exchange_n(&ctx->bug, NULL, __ATOMIC_ACQ_REL))) {
+        if (ctx) {
+            socket_audio_ctx_release(ctx);
+        }
+        stream->write_function(stream, "-ERR Socket audio not active on session: %.*s\n", (int)uuid_len, uuid);
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Trim whitespace */
-    uuid = mycmd;
-    while (*uuid == ' ' || *uuid == '\t') uuid++;
-    {
-        char *end = uuid + strlen(uuid) - 1;
-        while (end > uuid && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) {
-            *end-- = '\0';
+    /* Remove media bug (triggers SWITCH_ABC_TYPE_CLOSE) */
+    switch_core_media_bug_remove(ctx->session, &bug);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                      "Socket audio stopped\n");
+    socket_audio_ctx_release(ctx);
+
+    stream->write_function(stream, "+OK\n");
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * API: uuid_socket_audio_join
+ *
+ * Joins another session (a bridged leg, a conference member) to a pipe
+ * started with socket_audio_legs: listen sends its audio to the sidecar,
+ * speak plays the sidecar's audio to it, both (the default) does both. Replies
+ * with the leg's channel in interleave mode (1 + slot).
+ *
+ * Usage: uuid_socket_audio_join <uuid> <leg_uuid> [listen|speak|both]
+ */
+SWITCH_STANDARD_API(uuid_socket_audio_join_function)
+{
+    switch_core_session_t *leg_session = NULL;
+    switch_codec_implementation_t leg_impl = { 0 };
+    socket_audio_ctx_t *ctx = NULL;
+    socket_audio_leg_t *leg = NULL;
+    switch_memory_pool_t *leg_pool;
+    char *argv[3] = { 0 };
+    char *mycmd = NULL;
+    uint8_t listen = 1, speak = 1;
+    uint32_t i;
+    int argc;
+
+    if (zstr(cmd) || !(mycmd = strdup(cmd)) || (argc = switch_split(mycmd, ' ', argv)) < 2) {
+        stream->write_function(stream, "-ERR Usage: uuid_socket_audio_join <uuid> <leg_uuid> [listen|speak|both]\n");
+        switch_safe_free(mycmd);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (argc > 2) {
+        if (!strcasecmp(argv[2], "listen")) {
+            speak = 0;
+        } else if (!strcasecmp(argv[2], "speak")) {
+            listen = 0;
+        } else if (strcasecmp(argv[2], "both")) {
+            stream->write_function(stream, "-ERR Invalid direction: %s\n", argv[2]);
+            free(mycmd);
+            return SWITCH_STATUS_SUCCESS;
         }
     }
 
-    target_session = switch_core_session_locate(uuid);
-    if (!target_session) {
-        stream->write_function(stream, "-ERR Session not found: %s\n", uuid);
+    if (!strcmp(argv[0], argv[1])) {
+        stream->write_function(stream, "-ERR A session cannot join its own pipe\n");
         free(mycmd);
         return SWITCH_STATUS_SUCCESS;
     }
 
-    channel = switch_core_session_get_channel(target_session);
-    ctx = switch_channel_get_private(channel, SOCKET_AUDIO_PRIVATE);
-
-    if (!ctx) {
-        stream->write_function(stream, "-ERR Socket audio not active on session: %s\n", uuid);
-        switch_core_session_rwunlock(target_session);
+    if (!(ctx = socket_audio_registry_find(argv[0], strlen(argv[0])))) {
+        stream->write_function(stream, "-ERR Socket audio not active on session: %s\n", argv[0]);
         free(mycmd);
         return SWITCH_STATUS_SUCCESS;
     }
 
-    /* Remove media bug (triggers SWITCH_ABC_TYPE_CLOSE) */
-    if (ctx->bug) {
-        switch_core_media_bug_remove(target_session, &ctx->bug);
+    /* Slots change only under the mutex, which socket_audio_pipe_destroy takes too */
+    switch_mutex_lock(globals.mutex);
+
+    if (!ctx->running) {
+        stream->write_function(stream, "-ERR Socket audio not active on session: %s\n", argv[0]);
+        goto done;
+    }
+    if (!ctx->legs) {
+        stream->write_function(stream, "-ERR Pipe does not take legs (set socket_audio_legs)\n");
+        goto done;
     }
 
-    switch_channel_set_private(channel, SOCKET_AUDIO_PRIVATE, NULL);
+    for (i = 0; i < ctx->legs_max; i++) {
+        if (ctx->legs[i].state != SOCKET_AUDIO_LEG_FREE && !strcmp(ctx->legs[i].uuid, argv[1])) {
+            stream->write_function(stream, "-ERR Already joined: %s\n", argv[1]);
+            goto done;
+        }
+        if (!leg && __atomic_load_n(&ctx->legs[i].state, __ATOMIC_ACQUIRE) == SOCKET_AUDIO_LEG_FREE) {
+            leg = &ctx->legs[i];
+        }
+    }
+    if (!leg) {
+        stream->write_function(stream, "-ERR All %u leg slots in use\n", ctx->legs_max);
+        goto done;
+    }
 
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(target_session), SWITCH_LOG_INFO,
-                      "Socket audio stopped\n");
+    if (!(leg_session = switch_core_session_locate(argv[1]))) {
+        stream->write_function(stream, "-ERR Session not found: %s\n", argv[1]);
+        goto done;
+    }
+    if (switch_core_session_get_read_impl(leg_session, &leg_impl) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR No media on session: %s\n", argv[1]);
+        goto done;
+    }
 
-    stream->write_function(stream, "+OK\n");
+    /* The leg's converters and codec come from its own pool: they are
+     * released before its session lock is */
+    leg_pool = switch_core_session_get_pool(leg_session);
+    leg->rate = leg_impl.actual_samples_per_second;
+    leg->listen = listen;
+    leg->speak = speak;
+    leg->mix_idle = 0;
+    switch_copy_string(leg->uuid, argv[1], sizeof(leg->uuid));
+    socket_audio_queue_destroy(&leg->queue);
+    socket_audio_queue_init(&leg->queue,
+                            (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_LEG_QUEUE_FRAMES,
+                            (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_LEG_QUEUE_FRAMES,
+                            (switch_size_t)ctx->session_frame_bytes * SOCKET_AUDIO_LEG_QUEUE_FRAMES);
+
+    if ((leg->rate != ctx->session_rate &&
+         (socket_audio_resampler_create(&leg->read_resampler, leg->rate, ctx->session_rate,
+                                        SOCKET_AUDIO_RESAMPLE_MAX_IN, leg_pool) != SWITCH_STATUS_SUCCESS ||
+          socket_audio_resampler_create(&leg->write_resampler, ctx->session_rate, leg->rate,
+                                        SOCKET_AUDIO_RESAMPLE_MAX_IN, leg_pool) != SWITCH_STATUS_SUCCESS)) ||
+        switch_core_codec_init(&leg->write_codec, "L16", NULL, NULL, leg->rate, ctx->read_ptime, 1,
+                               SWITCH_CODEC_FLAG_ENCODE | SWITCH_CODEC_FLAG_DECODE, NULL, leg_pool) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failed to set up audio for %s (%u Hz)\n", argv[1], leg->rate);
+        socket_audio_leg_release(leg);
+        goto done;
+    }
+    memset(&leg->write_frame, 0, sizeof(leg->write_frame));
+    leg->write_frame.codec = &leg->write_codec;
+
+    /* Live before the bug is added, so a close right away still finds it;
+     * from here on the slot owns the leg's session lock */
+    leg->session = leg_session;
+    leg_session = NULL;
+    __atomic_store_n(&leg->state, SOCKET_AUDIO_LEG_ACTIVE, __ATOMIC_RELEASE);
+
+    if (switch_core_media_bug_add(leg->session, SOCKET_AUDIO_LEG_BUG_NAME, NULL,
+                                  socket_audio_leg_callback, leg, 0,
+                                  SMBF_READ_REPLACE | SMBF_NO_PAUSE,
+                                  &leg->bug) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failed to attach media bug to %s\n", argv[1]);
+        leg->bug = NULL;
+        __atomic_store_n(&leg->state, SOCKET_AUDIO_LEG_LEAVING, __ATOMIC_RELEASE);
+        goto done;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+                      "Leg %s joined the pipe (channel %u, %u Hz, %s)\n", leg->uuid, (uint32_t)(leg - ctx->legs) + 1 + ctx->stereo,
+                      leg->rate, listen && speak ? "both" : listen ? "listen" : "speak");
+    stream->write_function(stream, "+OK %u\n", (uint32_t)(leg - ctx->legs) + 1 + ctx->stereo);
+
+done:
+    switch_mutex_unlock(globals.mutex);
+    if (leg_session) {
+        switch_core_session_rwunlock(leg_session);
+    }
+    socket_audio_ctx_release(ctx);
+    free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * API: uuid_socket_audio_leave
+ *
+ * Detaches a joined leg from a pipe; the slot is free again once the pipe's
+ * clock has let go of it.
+ *
+ * Usage: uuid_socket_audio_leave <uuid> <leg_uuid>
+ */
+SWITCH_STANDARD_API(uuid_socket_audio_leave_function)
+{
+    socket_audio_ctx_t *ctx = NULL;
+    char *argv[2] = { 0 };
+    char *mycmd = NULL;
+    uint32_t i;
+
+    if (zstr(cmd) || !(mycmd = strdup(cmd)) || switch_split(mycmd, ' ', argv) != 2) {
+        stream->write_function(stream, "-ERR Usage: uuid_socket_audio_leave <uuid> <leg_uuid>\n");
+        switch_safe_free(mycmd);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (!(ctx = socket_audio_registry_find(argv[0], strlen(argv[0])))) {
+        stream->write_function(stream, "-ERR Socket audio not active on session: %s\n", argv[0]);
+        free(mycmd);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    switch_mutex_lock(globals.mutex);
+
+    for (i = 0; ctx->legs && i < ctx->legs_max; i++) {
+        socket_audio_leg_t *leg = &ctx->legs[i];
+
+        if (__atomic_load_n(&leg->state, __ATOMIC_ACQUIRE) == SOCKET_AUDIO_LEG_ACTIVE && !strcmp(leg->uuid, argv[1])) {
+            switch_core_session_t *leg_session = switch_core_session_locate(argv[1]);
+            switch_media_bug_t *bug = leg->bug;
+
+            /* Our own lock: the clock may release the slot's as soon as the bug closes */
+            if (leg_session && bug) {
+                switch_core_media_bug_remove(leg_session, &bug);
+            }
+            __atomic_store_n(&leg->state, SOCKET_AUDIO_LEG_LEAVING, __ATOMIC_RELEASE);
+            if (leg_session) {
+                switch_core_session_rwunlock(leg_session);
+            }
+            break;
+        }
+    }
+
+    if (!ctx->legs || i == ctx->legs_max) {
+        stream->write_function(stream, "-ERR Leg not joined: %s\n", argv[1]);
+    } else {
+        stream->write_function(stream, "+OK\n");
+    }
 
-    switch_core_session_rwunlock(target_session);
+    switch_mutex_unlock(globals.mutex);
+    socket_audio_ctx_release(ctx);
     free(mycmd);
     return SWITCH_STATUS_SUCCESS;
 }
@@ -799,6 +7332,32 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_socket_audio_load)
     switch_application_interface_t *app_interface;
     switch_api_interface_t *api_interface;
 
+    memset(&globals, 0, sizeof(globals));
+    globals.pool = pool;
+    switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_mutex_init(&globals.cache_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_mutex_init(&globals.ctx_free_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_mutex_init(&globals.bank_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_mutex_init(&globals.record_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_thread_rwlock_create(&globals.registry_lock, pool);
+
+    socket_audio_load_config();
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Resampler: %s\n",
+                      globals.fast_resampler ? socket_audio_resample_init() : "generic");
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Echo canceller: %s\n", socket_audio_aec_init());
+    socket_audio_g711_init();
+
+    globals.running = 1;
+    if (socket_audio_events_start() != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_GENERR;
+    }
+    if (socket_audio_reactors_start() != SWITCH_STATUS_SUCCESS) {
+        socket_audio_reactors_stop();
+        socket_audio_events_stop();
+        return SWITCH_STATUS_GENERR;
+    }
+
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
     /* Register application */
@@ -806,20 +7365,57 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_socket_audio_load)
                    "Socket Audio Pipe",
                    "Ultra-low-latency bidirectional audio streaming via TCP socket",
                    socket_audio_start,
-                   "<host> <port>",
+                   "<host> <port> [raw|framed] | unix:<path> [raw|framed|shm]",
                    SAF_MEDIA_TAP);
 
     /* Register API commands */
     SWITCH_ADD_API(api_interface, "uuid_socket_audio_flush",
-                   "Flush socket audio queue (auto-resumes after 50ms)",
+                   "Flush socket audio queue (by turn ID in framed mode, else auto-resumes after 50ms); "
+                   "several UUIDs flush those calls in one batch",
                    uuid_socket_audio_flush_function,
-                   "<uuid>");
+                   "<uuid> [turn] | <uuid> <uuid> ...");
 
     SWITCH_ADD_API(api_interface, "uuid_socket_audio_stop",
                    "Stop socket audio pipe",
                    uuid_socket_audio_stop_function,
                    "<uuid>");
 
+    SWITCH_ADD_API(api_interface, "uuid_socket_audio_join",
+                   "Join another session to a socket audio pipe (socket_audio_legs)",
+                   uuid_socket_audio_join_function,
+                   "<uuid> <leg_uuid> [listen|speak|both]");
+
+    SWITCH_ADD_API(api_interface, "uuid_socket_audio_leave",
+                   "Detach a joined leg from a socket audio pipe",
+                   uuid_socket_audio_leave_function,
+                   "<uuid> <leg_uuid>");
+
+    SWITCH_ADD_API(api_interface, "uuid_socket_audio_stats",
+                   "Socket audio pipe statistics (JSON)",
+                   uuid_socket_audio_stats_function,
+                   "<uuid>");
+
+    SWITCH_ADD_API(api_interface, "socket_audio_stats",
+                   "Module-wide socket audio statistics (JSON)",
+                   socket_audio_stats_function,
+                   "");
+
+    SWITCH_ADD_API(api_interface, "socket_audio_metrics",
+                   "Module-wide socket audio metrics (Prometheus text format)",
+                   socket_audio_metrics_function,
+                   "");
+
+    SWITCH_ADD_API(api_interface, "socket_audio_cache",
+                   "Prompt cache: clips sidecars play by ID (framed PLAY)",
+                   socket_audio_cache_function,
+                   "put <id> <path> [rate] | del <id> | list");
+
+    socket_audio_connector_start();
+    socket_audio_cache_start();
+    socket_audio_metrics_start();
+    socket_audio_load_start();
+    socket_audio_record_start();
+
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
                       "mod_socket_audio loaded\n");
 
@@ -831,6 +7427,16 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_socket_audio_load)
  */
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_socket_audio_shutdown)
 {
+    socket_audio_reactors_stop();
+    socket_audio_connector_stop();
+    socket_audio_metrics_stop();
+    socket_audio_load_stop();
+    socket_audio_record_stop();
+    socket_audio_events_stop();
+    socket_audio_cache_stop();
+    socket_audio_cache_clear();
+    socket_audio_ctx_pool_clear();
+
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
                       "mod_socket_audio unloaded\n");
 
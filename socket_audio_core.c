@@ -0,0 +1,1113 @@
+/*
+ * socket_audio_core.c -- Media-path kernels of mod_socket_audio
+ *
+ * No FreeSWITCH dependency: see socket_audio_core.h.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "socket_audio_core.h"
+
+static socket_audio_dot_func_t socket_audio_resample_dot;  /* Chosen by socket_audio_resample_init */
+
+/* G.711 decode tables, built by socket_audio_g711_init */
+static int16_t socket_audio_ulaw_table[256];
+static int16_t socket_audio_alaw_table[256];
+
+/*
+ * Playback queue (SPSC segments)
+ */
+void socket_audio_queue_init(socket_audio_queue_t *queue, size_t seg_size, size_t limit, size_t slack)
+{
+    memset(queue, 0, sizeof(*queue));
+
+    queue->seg_size = seg_size;
+    queue->limit = limit;
+    queue->slack = slack;
+}
+
+void socket_audio_queue_destroy(socket_audio_queue_t *queue)
+{
+    socket_audio_segment_t *seg = queue->read_seg ? queue->read_seg : queue->first;
+
+    while (seg) {
+        socket_audio_segment_t *next = seg->next;
+        free(seg);
+        seg = next;
+    }
+    free(queue->spare);
+    queue->spare = NULL;
+
+    queue->first = queue->read_seg = queue->write_seg = NULL;
+}
+
+/*
+ * Destroy a queue neither side uses any more, but keep one of its segments
+ * (the spare if there is one) and return it, or NULL if it had none. Another
+ * queue with the same seg_size can adopt it, saving its first allocation.
+ */
+socket_audio_segment_t *socket_audio_queue_retire(socket_audio_queue_t *queue)
+{
+    socket_audio_segment_t *seg = queue->spare;
+
+    queue->spare = NULL;
+    if (!seg && (seg = queue->read_seg)) {
+        queue->read_seg = seg->next;
+        queue->first = NULL;  /* The chain now starts at read_seg, if anywhere */
+    } else if (!seg && (seg = queue->first)) {
+        queue->first = seg->next;
+    }
+    socket_audio_queue_destroy(queue);
+
+    return seg;
+}
+
+/*
+ * Give a freshly initialised queue a segment from socket_audio_queue_retire,
+ * of its seg_size, as its spare. Before either side uses the queue.
+ */
+void socket_audio_queue_adopt(socket_audio_queue_t *queue, socket_audio_segment_t *seg)
+{
+    if (seg) {
+        seg->next = NULL;
+    }
+    queue->spare = seg;
+}
+
+/*
+ * Producer: take the spare segment or allocate a new one.
+ */
+static socket_audio_segment_t *socket_audio_queue_segment_get(socket_audio_queue_t *queue)
+{
+    socket_audio_segment_t *seg = __atomic_exchange_n(&queue->spare, NULL, __ATOMIC_ACQUIRE);
+
+    if (!seg) {
+        seg = malloc(sizeof(*seg) + queue->seg_size);
+    }
+    if (seg) {
+        seg->next = NULL;
+    }
+
+    return seg;
+}
+
+/*
+ * Consumer: keep a drained segment as the spare, or free it.
+ */
+static void socket_audio_queue_segment_put(socket_audio_queue_t *queue, socket_audio_segment_t *seg)
+{
+    socket_audio_segment_t *expected = NULL;
+
+    if (!__atomic_compare_exchange_n(&queue->spare, &expected, seg, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        free(seg);
+    }
+}
+
+/*
+ * Producer: contiguous free space at the write position, allocating a segment
+ * if the current one is full. Returns its size in bytes (always even, to keep
+ * sample alignment) and sets *ptr; 0 if the queue is more than the slack past
+ * its limit or memory ran out. Nothing is queued until socket_audio_queue_commit.
+ */
+size_t socket_audio_queue_reserve(socket_audio_queue_t *queue, uint8_t **ptr)
+{
+    uint64_t used = queue->head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    uint64_t cap = queue->limit + queue->slack;
+    size_t room;
+
+    if (used >= cap) {
+        return 0;
+    }
+
+    if (!queue->write_seg || queue->write_off == queue->seg_size) {
+        socket_audio_segment_t *seg = socket_audio_queue_segment_get(queue);
+
+        if (!seg) {
+            return 0;
+        }
+        /* Link before head covers any byte in it, so the consumer can always follow */
+        if (queue->write_seg) {
+            __atomic_store_n(&queue->write_seg->next, seg, __ATOMIC_RELEASE);
+        } else {
+            __atomic_store_n(&queue->first, seg, __ATOMIC_RELEASE);
+        }
+        queue->write_seg = seg;
+        queue->write_off = 0;
+    }
+
+    room = queue->seg_size - queue->write_off;
+    if (room > cap - used) {
+        room = (size_t)(cap - used);
+    }
+
+    *ptr = queue->write_seg->data + queue->write_off;
+    return room & ~(size_t)1;
+}
+
+/*
+ * Producer: publish len bytes written into reserved space. If the limit is
+ * now exceeded, the oldest audio is tossed; returns the bytes tossed.
+ */
+size_t socket_audio_queue_commit(socket_audio_queue_t *queue, size_t len)
+{
+    uint64_t head = queue->head;
+    uint64_t used = head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    uint64_t pending = queue->toss_req - __atomic_load_n(&queue->toss_done, __ATOMIC_ACQUIRE);
+    uint64_t live = used > pending ? used - pending : 0;
+    size_t tossed = 0;
+
+    if (!len) {
+        return 0;
+    }
+
+    if (live + len > queue->limit) {
+        tossed = (size_t)(live + len - queue->limit);
+        if (tossed > live) {
+            tossed = (size_t)live;
+        }
+        __atomic_store_n(&queue->toss_req, queue->toss_req + tossed, __ATOMIC_RELEASE);
+    }
+
+    queue->write_off += len;
+    __atomic_store_n(&queue->head, head + len, __ATOMIC_RELEASE);
+
+    return tossed;
+}
+
+/*
+ * Producer: append len bytes. If the limit would be exceeded, the oldest
+ * audio is tossed (reported in *tossed). Returns the bytes actually written,
+ * which is less than len only if the consumer has fallen more than the slack
+ * behind on applying tosses or memory ran out.
+ */
+size_t socket_audio_queue_write(socket_audio_queue_t *queue, const void *data, size_t len, size_t *tossed)
+{
+    const uint8_t *src = data;
+    size_t written = 0;
+
+    *tossed = 0;
+
+    while (written < len) {
+        uint8_t *region;
+        size_t n = socket_audio_queue_reserve(queue, &region);
+
+        if (!n) {
+            break;
+        }
+        if (n > len - written) {
+            n = (len - written) & ~(size_t)1;
+            if (!n) {
+                break;
+            }
+        }
+        memcpy(region, src + written, n);
+        *tossed += socket_audio_queue_commit(queue, n);
+        written += n;
+    }
+
+    return written;
+}
+
+/*
+ * Consumer: move to the next segment once the current one is used up,
+ * releasing the drained one. Returns 0 if there is none yet.
+ */
+static int socket_audio_queue_advance(socket_audio_queue_t *queue)
+{
+    socket_audio_segment_t *next;
+
+    if (!queue->read_seg) {
+        if (!(queue->read_seg = __atomic_load_n(&queue->first, __ATOMIC_ACQUIRE))) {
+            return 0;
+        }
+        queue->read_off = 0;
+    }
+
+    if (queue->read_off < queue->seg_size) {
+        return 1;
+    }
+
+    if (!(next = __atomic_load_n(&queue->read_seg->next, __ATOMIC_ACQUIRE))) {
+        return 0;
+    }
+
+    socket_audio_queue_segment_put(queue, queue->read_seg);
+    queue->read_seg = next;
+    queue->read_off = 0;
+
+    return 1;
+}
+
+/*
+ * Consumer: copy (or, with out == NULL, skip) len bytes that are known to be queued.
+ */
+static void socket_audio_queue_take(socket_audio_queue_t *queue, uint8_t *out, size_t len)
+{
+    while (len && socket_audio_queue_advance(queue)) {
+        size_t n = queue->seg_size - queue->read_off;
+
+        if (n > len) {
+            n = len;
+        }
+        if (out) {
+            memcpy(out, queue->read_seg->data + queue->read_off, n);
+            out += n;
+        }
+        queue->read_off += n;
+        len -= n;
+    }
+
+    /* Give the drained segment back right away rather than on the next read */
+    socket_audio_queue_advance(queue);
+}
+
+/*
+ * Consumer: apply outstanding toss requests (drop oldest audio).
+ */
+static void socket_audio_queue_sync(socket_audio_queue_t *queue)
+{
+    uint64_t req = __atomic_load_n(&queue->toss_req, __ATOMIC_ACQUIRE);
+    uint64_t head, toss;
+
+    if (req == queue->toss_done) {
+        return;
+    }
+
+    head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    toss = req - queue->toss_done;
+    if (toss > head - queue->tail) {
+        toss = head - queue->tail;
+    }
+
+    socket_audio_queue_take(queue, NULL, (size_t)toss);
+    __atomic_store_n(&queue->tail, queue->tail + toss, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->toss_done, req, __ATOMIC_RELEASE);
+}
+
+/*
+ * Consumer: bytes available to read.
+ */
+size_t socket_audio_queue_inuse(socket_audio_queue_t *queue)
+{
+    socket_audio_queue_sync(queue);
+    return (size_t)(__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - queue->tail);
+}
+
+/*
+ * Consumer: read up to len bytes.
+ */
+size_t socket_audio_queue_read(socket_audio_queue_t *queue, void *out, size_t len)
+{
+    size_t avail = socket_audio_queue_inuse(queue);
+
+    if (len > avail) {
+        len = avail;
+    }
+    if (!len) {
+        return 0;
+    }
+
+    socket_audio_queue_take(queue, out, len);
+    __atomic_store_n(&queue->tail, queue->tail + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+/*
+ * Consumer: pointer to the next len bytes if they are queued and contiguous
+ * in one segment, else NULL. They stay queued until socket_audio_queue_consume,
+ * and the producer never touches them in the meantime.
+ */
+uint8_t *socket_audio_queue_peek(socket_audio_queue_t *queue, size_t len)
+{
+    if (socket_audio_queue_inuse(queue) < len || !socket_audio_queue_advance(queue) ||
+        queue->seg_size - queue->read_off < len) {
+        return NULL;
+    }
+
+    return queue->read_seg->data + queue->read_off;
+}
+
+/*
+ * Consumer: release bytes returned by socket_audio_queue_peek.
+ */
+void socket_audio_queue_consume(socket_audio_queue_t *queue, size_t len)
+{
+    socket_audio_queue_take(queue, NULL, len);
+    __atomic_store_n(&queue->tail, queue->tail + len, __ATOMIC_RELEASE);
+}
+
+/*
+ * Consumer: drop everything queued. Returns the bytes dropped.
+ */
+size_t socket_audio_queue_zero(socket_audio_queue_t *queue)
+{
+    uint64_t req = __atomic_load_n(&queue->toss_req, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    size_t dropped = (size_t)(head - queue->tail);
+
+    socket_audio_queue_take(queue, NULL, dropped);
+    __atomic_store_n(&queue->tail, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->toss_done, req, __ATOMIC_RELEASE);
+
+    return dropped;
+}
+
+/*
+ * Consumer: drop queued audio up to absolute position pos. Returns the bytes dropped.
+ */
+size_t socket_audio_queue_skip(socket_audio_queue_t *queue, uint64_t pos)
+{
+    size_t dropped;
+
+    socket_audio_queue_sync(queue);
+    if (pos <= queue->tail) {
+        return 0;
+    }
+
+    dropped = (size_t)(pos - queue->tail);
+    socket_audio_queue_take(queue, NULL, dropped);
+    __atomic_store_n(&queue->tail, pos, __ATOMIC_RELEASE);
+
+    return dropped;
+}
+
+/*
+ * Recording tap (SPSC ring)
+ *
+ * Returns 0 on success, -1 if the ring could not be allocated. The size is
+ * min_size rounded up to a power of two, so a stereo sample pair (4 bytes)
+ * never straddles the wrap.
+ */
+int socket_audio_tap_init(socket_audio_tap_t *tap, size_t min_size)
+{
+    size_t size = 4;
+
+    memset(tap, 0, sizeof(*tap));
+    while (size < min_size) {
+        size <<= 1;
+    }
+    if (!(tap->data = malloc(size))) {
+        return -1;
+    }
+    tap->size = size;
+
+    return 0;
+}
+
+void socket_audio_tap_destroy(socket_audio_tap_t *tap)
+{
+    free(tap->data);
+    tap->data = NULL;
+    tap->size = 0;
+}
+
+/*
+ * Producer: interleave n samples of left and right into the ring. Returns the
+ * bytes written, or 0 (nothing written) if they do not fit.
+ */
+size_t socket_audio_tap_write_stereo(socket_audio_tap_t *tap, const int16_t *left, const int16_t *right, uint32_t n)
+{
+    uint64_t head = tap->head;
+    size_t bytes = (size_t)n * 2 * sizeof(int16_t);
+    size_t mask = tap->size - 1;
+    uint32_t i;
+
+    if (bytes > tap->size - (size_t)(head - __atomic_load_n(&tap->tail, __ATOMIC_ACQUIRE))) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        int16_t *pair = (int16_t *)(tap->data + ((head + (uint64_t)i * 4) & mask));
+
+        pair[0] = left[i];
+        pair[1] = right[i];
+    }
+    __atomic_store_n(&tap->head, head + bytes, __ATOMIC_RELEASE);
+
+    return bytes;
+}
+
+/*
+ * Consumer: the longest contiguous run of unread bytes, 0 if none. The run
+ * stays valid until it is consumed.
+ */
+size_t socket_audio_tap_peek(socket_audio_tap_t *tap, const uint8_t **ptr)
+{
+    uint64_t tail = tap->tail;
+    size_t avail = (size_t)(__atomic_load_n(&tap->head, __ATOMIC_ACQUIRE) - tail);
+    size_t off = (size_t)(tail & (tap->size - 1));
+
+    if (avail > tap->size - off) {
+        avail = tap->size - off;
+    }
+    *ptr = tap->data + off;
+
+    return avail;
+}
+
+void socket_audio_tap_consume(socket_audio_tap_t *tap, size_t len)
+{
+    __atomic_store_n(&tap->tail, tap->tail + len, __ATOMIC_RELEASE);
+}
+
+/*
+ * Resampler
+ *
+ * The socket and session rates are related by small integer ratios
+ * (8k→16k, 48k→16k, 24k→8k, 24k→16k, 24k→48k, ...). Those go through an int16
+ * polyphase FIR: coefficients are laid out per phase so every output sample
+ * is one contiguous dot product, computed by the widest kernel the CPU
+ * supports (chosen at load). Coefficients are Q15 with unity DC gain per
+ * phase, so the int32 accumulators cannot overflow. Other ratios, or
+ * fast-resampler=false, use the generic switch_resample path.
+ */
+#if defined(__x86_64__)
+static int32_t socket_audio_dot_sse2(const int16_t *x, const int16_t *h, uint32_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    uint32_t i;
+
+    for (i = 0; i < n; i += 8) {
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + i)),
+                                                _mm_loadu_si128((const __m128i *)(h + i))));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("avx2")))
+static int32_t socket_audio_dot_avx2(const int16_t *x, const int16_t *h, uint32_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m128i sum;
+    uint32_t i;
+
+    for (i = 0; i < n; i += 16) {
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(x + i)),
+                                                      _mm256_loadu_si256((const __m256i *)(h + i))));
+    }
+    sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(sum);
+}
+#elif defined(__aarch64__)
+static int32_t socket_audio_dot_neon(const int16_t *x, const int16_t *h, uint32_t n)
+{
+    int32x4_t acc0 = vdupq_n_s32(0), acc1 = vdupq_n_s32(0);
+    uint32_t i;
+
+    for (i = 0; i < n; i += 8) {
+        int16x8_t xv = vld1q_s16(x + i), hv = vld1q_s16(h + i);
+
+        acc0 = vmlal_s16(acc0, vget_low_s16(xv), vget_low_s16(hv));
+        acc1 = vmlal_s16(acc1, vget_high_s16(xv), vget_high_s16(hv));
+    }
+
+    return vaddvq_s32(vaddq_s32(acc0, acc1));
+}
+#else
+static int32_t socket_audio_dot_scalar(const int16_t *x, const int16_t *h, uint32_t n)
+{
+    int32_t acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        acc += (int32_t)x[i] * h[i];
+    }
+
+    return acc;
+}
+#endif
+
+/*
+ * Pick the dot product kernel for this CPU. Called once at load.
+ */
+const char *socket_audio_resample_init(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        socket_audio_resample_dot = socket_audio_dot_avx2;
+        return "avx2";
+    }
+    socket_audio_resample_dot = socket_audio_dot_sse2;
+    return "sse2";
+#elif defined(__aarch64__)
+    socket_audio_resample_dot = socket_audio_dot_neon;
+    return "neon";
+#else
+    socket_audio_resample_dot = socket_audio_dot_scalar;
+    return "scalar";
+#endif
+}
+
+static uint32_t socket_audio_gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Size a polyphase resampler from one rate to another for blocks of up to
+ * max_in samples: fills in the ratio, taps, taps_lite and out_cap. Returns 0
+ * if the ratio is beyond the polyphase limits (use a generic resampler
+ * instead). The caller then provides coefs (up × taps), coefs_lite
+ * (up × taps_lite, if any), buf (taps - 1 + max_in) and out (out_cap) and
+ * calls socket_audio_resampler_design.
+ */
+int socket_audio_resampler_plan(socket_audio_resampler_t *r, uint32_t from, uint32_t to, uint32_t max_in)
+{
+    uint32_t g = socket_audio_gcd(from, to);
+
+    memset(r, 0, sizeof(*r));
+    r->up = to / g;
+    r->down = from / g;
+    r->max_in = max_in;
+
+    /* Enough taps for SOCKET_AUDIO_RESAMPLE_ZERO_CROSSINGS each side at the cutoff */
+    r->taps = 2 * SOCKET_AUDIO_RESAMPLE_ZERO_CROSSINGS * (r->down > r->up ? r->down : r->up) / r->up;
+    r->taps = (r->taps + SOCKET_AUDIO_RESAMPLE_TAP_ALIGN - 1) & ~(SOCKET_AUDIO_RESAMPLE_TAP_ALIGN - 1);
+    r->taps_lite = 2 * SOCKET_AUDIO_RESAMPLE_LITE_CROSSINGS * (r->down > r->up ? r->down : r->up) / r->up;
+    r->taps_lite = (r->taps_lite + SOCKET_AUDIO_RESAMPLE_TAP_ALIGN - 1) & ~(SOCKET_AUDIO_RESAMPLE_TAP_ALIGN - 1);
+    if (r->taps_lite >= r->taps) {
+        r->taps_lite = 0;
+    }
+    r->out_cap = max_in * r->up / r->down + 2;
+
+    return r->up <= SOCKET_AUDIO_RESAMPLE_MAX_RATIO && r->down <= SOCKET_AUDIO_RESAMPLE_MAX_RATIO &&
+        r->taps <= SOCKET_AUDIO_RESAMPLE_MAX_TAPS;
+}
+
+/*
+ * Fill one filter bank of taps per phase: a Blackman-windowed sinc at L × the
+ * input rate, cut off just below the lower of the two Nyquist rates, split
+ * into L phases each normalised to unity DC gain.
+ */
+static void socket_audio_resampler_bank(const socket_audio_resampler_t *r, int16_t *coefs, uint32_t taps)
+{
+    uint32_t n = r->up * taps, p, k;
+    double fc = SOCKET_AUDIO_RESAMPLE_CUTOFF / (double)(r->up > r->down ? r->up : r->down);
+    double center = (n - 1) / 2.0;
+
+    for (p = 0; p < r->up; p++) {
+        double h[SOCKET_AUDIO_RESAMPLE_MAX_TAPS], sum = 0;
+
+        for (k = 0; k < taps; k++) {
+            double m = p + (double)k * r->up, t = m - center;
+            double w = 0.42 - 0.5 * cos(2 * M_PI * m / (n - 1)) + 0.08 * cos(4 * M_PI * m / (n - 1));
+
+            h[k] = (fabs(t) < 1e-9 ? fc : sin(M_PI * fc * t) / (M_PI * t)) * w;
+            sum += h[k];
+        }
+
+        /* Reverse so the window over the input is read forwards */
+        for (k = 0; k < taps; k++) {
+            double q = h[k] / sum * 32768.0;
+
+            q = q > 32767 ? 32767 : q < -32767 ? -32767 : q;
+            coefs[p * taps + (taps - 1 - k)] = (int16_t)lrint(q);
+        }
+    }
+}
+
+/*
+ * Build the polyphase filters (the cheaper one too when coefs_lite is set)
+ * and clear the input history.
+ */
+void socket_audio_resampler_design(socket_audio_resampler_t *r)
+{
+    socket_audio_resampler_bank(r, r->coefs, r->taps);
+    if (r->taps_lite && r->coefs_lite) {
+        socket_audio_resampler_bank(r, r->coefs_lite, r->taps_lite);
+    }
+
+    socket_audio_resampler_reset(r);
+}
+
+/*
+ * Start a new stream: clear the input history and position, full filter.
+ * The filters only depend on the ratio, so resamplers of the same ratio may
+ * share one designed set of coefs, each calling this instead of designing.
+ */
+void socket_audio_resampler_reset(socket_audio_resampler_t *r)
+{
+    r->pos = 0;
+    r->block = 0;
+    r->lite = 0;
+
+    memset(r->buf, 0, sizeof(int16_t) * (r->taps - 1));
+}
+
+/*
+ * Polyphase only: load a block of input (truncated to max_in samples). Its
+ * output is then produced by socket_audio_resample_emit, straight into the
+ * caller's buffer.
+ */
+void socket_audio_resample_begin(socket_audio_resampler_t *r, const int16_t *in, uint32_t n)
+{
+    if (n > r->max_in) {
+        n = r->max_in;
+    }
+    memcpy(r->buf + r->taps - 1, in, n * sizeof(int16_t));
+    r->block = n;
+}
+
+/*
+ * Polyphase only: write up to cap output samples of the current block to out.
+ * Returns the number written; 0 once the block is finished.
+ *
+ * With lite set, the cheaper filter reads the middle taps_lite samples of the
+ * full window. Both filters are centred on the same input sample, so
+ * switching between them mid-stream shifts nothing in time.
+ */
+uint32_t socket_audio_resample_emit(socket_audio_resampler_t *r, int16_t *out, uint32_t cap)
+{
+    socket_audio_dot_func_t dot = socket_audio_resample_dot;
+    const int16_t *buf = r->buf, *coefs = r->coefs;
+    uint32_t taps = r->taps;
+    uint32_t len = 0;
+
+    if (r->lite && r->coefs_lite) {
+        buf += (r->taps - r->taps_lite) / 2;
+        coefs = r->coefs_lite;
+        taps = r->taps_lite;
+    }
+
+    /* Output k uses input samples up to pos / L with phase pos % L */
+    while (len < cap && r->pos / r->up < r->block) {
+        uint32_t i = r->pos / r->up;
+        int32_t acc = dot(buf + i, coefs + (r->pos % r->up) * taps, taps);
+
+        acc = (acc + (1 << 14)) >> 15;
+        out[len++] = (int16_t)(acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc);
+        r->pos += r->down;
+    }
+
+    if (r->block && r->pos / r->up >= r->block) {
+        /* Block done: keep its tail as history for the next one */
+        r->pos -= r->block * r->up;
+        memmove(r->buf, r->buf + r->block, (r->taps - 1) * sizeof(int16_t));
+        r->block = 0;
+    }
+
+    return len;
+}
+
+/*
+ * Echo canceller
+ *
+ * One kernel does both halves of a delayed-update NLMS step over the filter:
+ * w += g·x (the previous sample's window), then returns w·x' where x' is the
+ * window one sample later. Lengths are multiples of SOCKET_AUDIO_AEC_TAP_ALIGN.
+ */
+#if defined(__x86_64__)
+static float socket_audio_aec_step_sse2(float *w, const float *x, float g, uint32_t n)
+{
+    __m128 gv = _mm_set1_ps(g), acc = _mm_setzero_ps();
+    uint32_t i;
+
+    for (i = 0; i < n; i += 4) {
+        __m128 wv = _mm_add_ps(_mm_loadu_ps(w + i), _mm_mul_ps(gv, _mm_loadu_ps(x + i)));
+
+        _mm_storeu_ps(w + i, wv);
+        acc = _mm_add_ps(acc, _mm_mul_ps(wv, _mm_loadu_ps(x + i + 1)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    return _mm_cvtss_f32(acc);
+}
+
+__attribute__((target("avx2,fma")))
+static float socket_audio_aec_step_avx2(float *w, const float *x, float g, uint32_t n)
+{
+    __m256 gv = _mm256_set1_ps(g), acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m128 sum;
+    uint32_t i;
+
+    for (i = 0; i < n; i += 16) {
+        __m256 w0 = _mm256_fmadd_ps(gv, _mm256_loadu_ps(x + i), _mm256_loadu_ps(w + i));
+        __m256 w1 = _mm256_fmadd_ps(gv, _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(w + i + 8));
+
+        _mm256_storeu_ps(w + i, w0);
+        _mm256_storeu_ps(w + i + 8, w1);
+        acc0 = _mm256_fmadd_ps(w0, _mm256_loadu_ps(x + i + 1), acc0);
+        acc1 = _mm256_fmadd_ps(w1, _mm256_loadu_ps(x + i + 9), acc1);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    return _mm_cvtss_f32(sum);
+}
+#elif defined(__aarch64__)
+static float socket_audio_aec_step_neon(float *w, const float *x, float g, uint32_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    uint32_t i;
+
+    for (i = 0; i < n; i += 8) {
+        float32x4_t w0 = vfmaq_n_f32(vld1q_f32(w + i), vld1q_f32(x + i), g);
+        float32x4_t w1 = vfmaq_n_f32(vld1q_f32(w + i + 4), vld1q_f32(x + i + 4), g);
+
+        vst1q_f32(w + i, w0);
+        vst1q_f32(w + i + 4, w1);
+        acc0 = vfmaq_f32(acc0, w0, vld1q_f32(x + i + 1));
+        acc1 = vfmaq_f32(acc1, w1, vld1q_f32(x + i + 5));
+    }
+
+    return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+#else
+static float socket_audio_aec_step_scalar(float *w, const float *x, float g, uint32_t n)
+{
+    float acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        w[i] += g * x[i];
+        acc += w[i] * x[i + 1];
+    }
+
+    return acc;
+}
+#endif
+
+static socket_audio_aec_step_func_t socket_audio_aec_step;  /* Chosen by socket_audio_aec_init */
+
+/*
+ * Pick the echo canceller kernel for this CPU. Called once at load.
+ */
+const char *socket_audio_aec_init(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        socket_audio_aec_step = socket_audio_aec_step_avx2;
+        return "avx2";
+    }
+    socket_audio_aec_step = socket_audio_aec_step_sse2;
+    return "sse2";
+#elif defined(__aarch64__)
+    socket_audio_aec_step = socket_audio_aec_step_neon;
+    return "neon";
+#else
+    socket_audio_aec_step = socket_audio_aec_step_scalar;
+    return "scalar";
+#endif
+}
+
+/*
+ * Size an echo canceller for tail_ms of echo at rate, in blocks of up to
+ * max_in samples. The caller then provides w, buf and out (see
+ * socket_audio_aec_t) and calls socket_audio_aec_reset.
+ */
+void socket_audio_aec_plan(socket_audio_aec_t *aec, uint32_t rate, uint32_t tail_ms, uint32_t max_in)
+{
+    uint32_t taps;
+
+    if (tail_ms > SOCKET_AUDIO_AEC_TAIL_MAX_MS) {
+        tail_ms = SOCKET_AUDIO_AEC_TAIL_MAX_MS;
+    }
+    taps = (uint32_t)((uint64_t)rate * tail_ms / 1000);
+    taps = (taps + SOCKET_AUDIO_AEC_TAP_ALIGN - 1) / SOCKET_AUDIO_AEC_TAP_ALIGN * SOCKET_AUDIO_AEC_TAP_ALIGN;
+
+    memset(aec, 0, sizeof(*aec));
+    aec->taps = taps ? taps : SOCKET_AUDIO_AEC_TAP_ALIGN;
+    aec->max_in = max_in;
+}
+
+/*
+ * Forget the echo path and history. suppress_db is the residual attenuation
+ * while only the far end talks (0 = cancellation only).
+ */
+void socket_audio_aec_reset(socket_audio_aec_t *aec, double suppress_db)
+{
+    memset(aec->w, 0, aec->taps * sizeof(float));
+    memset(aec->buf, 0, (aec->taps + aec->max_in) * sizeof(float));
+    aec->suppress = (float)pow(10.0, -suppress_db / 20.0);
+    aec->gain = 1.0f;
+    aec->pending = 0;
+    aec->hangover = 0;
+}
+
+/*
+ * Cancel the echo of ref (the block played alongside this one, same rate) from
+ * n mic samples, n <= max_in. Returns aec->out, valid until the next call.
+ *
+ * With lite set only the suppressor runs: the filter keeps its coefficients
+ * and the history keeps moving, so clearing lite resumes cancellation with
+ * the echo path as last learned.
+ */
+const int16_t *socket_audio_aec_process(socket_audio_aec_t *aec, const int16_t *mic, const int16_t *ref, uint32_t n)
+{
+    float *x = aec->buf;
+    uint32_t taps = aec->taps, j;
+    float eps = (float)taps * SOCKET_AUDIO_AEC_FAR_FLOOR;  /* Regularization, well under a floor-level window */
+    float energy = 0, peak = 0, mic_energy = 0, err_energy = 0;
+    float target, from = aec->gain;
+    uint8_t far, adapt;
+
+    for (j = 0; j < n; j++) {
+        x[taps + j] = ref[j];
+    }
+    /* The window ending just before this block, and the reference peak over tail and block */
+    for (j = 0; j < taps; j++) {
+        energy += x[j] * x[j];
+    }
+    for (j = 0; j < taps + n; j++) {
+        float a = fabsf(x[j]);
+        if (a > peak) peak = a;
+    }
+
+    far = peak > SOCKET_AUDIO_AEC_FAR_FLOOR;
+    if (far && socket_audio_peak(mic, n) > SOCKET_AUDIO_AEC_GEIGEL * peak) {
+        aec->hangover = SOCKET_AUDIO_AEC_HANGOVER;
+    } else if (aec->hangover) {
+        aec->hangover--;
+    }
+    aec->doubletalk = aec->hangover > 0;
+    aec->suppressed = far && !aec->doubletalk && aec->suppress < 1.0f;
+    adapt = far && !aec->doubletalk && !aec->lite;
+    if (!adapt) {
+        aec->pending = 0;
+    }
+    target = aec->suppressed ? aec->suppress : 1.0f;
+
+    for (j = 0; j < n; j++) {
+        float d = mic[j];
+        float e = aec->lite ? d : d - socket_audio_aec_step(aec->w, x + j, aec->pending, taps);
+        float v = e * (from + (target - from) * (float)(j + 1) / (float)n);
+
+        energy += x[j + taps] * x[j + taps] - x[j] * x[j];
+        if (energy < 0) energy = 0;
+        aec->pending = adapt ? SOCKET_AUDIO_AEC_STEP * e / (energy + eps) : 0;
+
+        mic_energy += d * d;
+        err_energy += e * e;
+        aec->out[j] = (int16_t)(v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : lrintf(v));
+    }
+    aec->gain = target;
+
+    /* A filter that adds more than it removes has diverged: start over */
+    aec->reset = err_energy > 4.0f * mic_energy + (float)n * SOCKET_AUDIO_AEC_FAR_FLOOR * SOCKET_AUDIO_AEC_FAR_FLOOR;
+    if (aec->reset) {
+        memset(aec->w, 0, taps * sizeof(float));
+        aec->pending = 0;
+    }
+
+    /* Keep the last taps samples as history for the next block */
+    memmove(x, x + n, taps * sizeof(float));
+
+    return aec->out;
+}
+
+/*
+ * G.711
+ *
+ * Encoding is computed (a few bit operations per sample), decoding uses
+ * tables built at load.
+ */
+static uint8_t socket_audio_ulaw_encode(int16_t sample)
+{
+    int pcm = sample, sign = 0, exponent;
+
+    if (pcm < 0) {
+        pcm = -pcm;
+        sign = 0x80;
+    }
+    if (pcm > 32635) {
+        pcm = 32635;
+    }
+    pcm += 0x84;
+    exponent = 31 - __builtin_clz((unsigned)pcm) - 7;
+
+    return (uint8_t)~(sign | (exponent << 4) | ((pcm >> (exponent + 3)) & 0x0F));
+}
+
+static uint8_t socket_audio_alaw_encode(int16_t sample)
+{
+    int pcm = sample >> 3, mask = 0xD5, seg;
+
+    if (pcm < 0) {
+        pcm = -pcm - 1;
+        mask = 0x55;
+    }
+    seg = pcm < 0x20 ? 0 : 31 - __builtin_clz((unsigned)pcm) - 4;
+
+    return (uint8_t)(((seg << 4) | ((seg < 2 ? pcm >> 1 : pcm >> seg) & 0x0F)) ^ mask);
+}
+
+void socket_audio_g711_init(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        int u = ~i & 0xFF, a = i ^ 0x55, t, seg;
+
+        t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+        socket_audio_ulaw_table[i] = (int16_t)((u & 0x80) ? 0x84 - t : t - 0x84);
+
+        t = (a & 0x0F) << 4;
+        seg = (a & 0x70) >> 4;
+        t += seg ? 0x108 : 8;
+        if (seg > 1) {
+            t <<= seg - 1;
+        }
+        socket_audio_alaw_table[i] = (int16_t)((a & 0x80) ? t : -t);
+    }
+}
+
+void socket_audio_g711_encode(socket_audio_encoding_t encoding, const int16_t *in, uint8_t *out, uint32_t n)
+{
+    uint32_t i;
+
+    if (encoding == SOCKET_AUDIO_ENC_PCMU) {
+        for (i = 0; i < n; i++) {
+            out[i] = socket_audio_ulaw_encode(in[i]);
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            out[i] = socket_audio_alaw_encode(in[i]);
+        }
+    }
+}
+
+void socket_audio_g711_decode(socket_audio_encoding_t encoding, const uint8_t *in, int16_t *out, uint32_t n)
+{
+    const int16_t *table = encoding == SOCKET_AUDIO_ENC_PCMU ? socket_audio_ulaw_table : socket_audio_alaw_table;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        out[i] = table[in[i]];
+    }
+}
+
+/*
+ * Voice activity detection
+ *
+ * An energy detector gated by zero-crossing rate, run on each mic frame at
+ * the session rate before it is resampled. One pass computes the sum of
+ * squares and the number of sign changes with the widest vectors the build
+ * targets; x86-64 always has SSE2, so no runtime dispatch is needed.
+ */
+uint64_t socket_audio_vad_measure(const int16_t *x, uint32_t n, uint32_t *crossings)
+{
+    uint64_t energy = 0;
+    uint32_t zc = 0, i = 0;
+
+#if defined(__x86_64__)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero, zacc = zero;
+        uint64_t sums[2];
+        uint16_t lanes[8];
+        uint32_t k;
+
+        /* x[i + 8] is read as the neighbour of the last lane */
+        for (; i + 8 < n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+            __m128i next = _mm_loadu_si128((const __m128i *)(x + i + 1));
+            __m128i sq = _mm_madd_epi16(v, v);  /* Pairs of squares, at most 2^31: read as unsigned */
+
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+            zacc = _mm_sub_epi16(zacc, _mm_srai_epi16(_mm_xor_si128(v, next), 15));
+        }
+        _mm_storeu_si128((__m128i *)sums, acc);
+        _mm_storeu_si128((__m128i *)lanes, zacc);
+        energy = sums[0] + sums[1];
+        for (k = 0; k < 8; k++) {
+            zc += lanes[k];
+        }
+    }
+#elif defined(__aarch64__)
+    {
+        uint64x2_t acc = vdupq_n_u64(0);
+        uint16x8_t zacc = vdupq_n_u16(0);
+
+        for (; i + 8 < n; i += 8) {
+            int16x8_t v = vld1q_s16(x + i), next = vld1q_s16(x + i + 1);
+
+            acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_low_s16(v), vget_low_s16(v))));
+            acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_high_s16(v), vget_high_s16(v))));
+            zacc = vsubq_u16(zacc, vreinterpretq_u16_s16(vshrq_n_s16(veorq_s16(v, next), 15)));
+        }
+        energy = vaddvq_u64(acc);
+        zc = vaddlvq_u16(zacc);
+    }
+#endif
+
+    for (; i < n; i++) {
+        energy += (uint64_t)((int32_t)x[i] * x[i]);
+        if (i + 1 < n && (x[i] ^ x[i + 1]) < 0) {
+            zc++;
+        }
+    }
+
+    *crossings = zc;
+    return energy;
+}
+
+/*
+ * Peak absolute sample value.
+ */
+int socket_audio_peak(const int16_t *x, uint32_t n)
+{
+    int peak = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        int amp = x[i] < 0 ? -x[i] : x[i];
+        if (amp > peak) peak = amp;
+    }
+
+    return peak;
+}
+
+/*
+ * Framed protocol
+ *
+ * Write a header; returns the position just past it.
+ */
+uint8_t *socket_audio_frame_header(uint8_t *p, uint8_t type, uint16_t len, uint32_t seq)
+{
+    p[0] = type;
+    p[1] = 0;                         /* Flags, reserved */
+    p[2] = (uint8_t)(len >> 8);
+    p[3] = (uint8_t)len;
+    p[4] = (uint8_t)(seq >> 24);
+    p[5] = (uint8_t)(seq >> 16);
+    p[6] = (uint8_t)(seq >> 8);
+    p[7] = (uint8_t)seq;
+
+    return p + SOCKET_AUDIO_FRAME_HEADER_LEN;
+}
+
+/*
+ * Decode a header.
+ */
+void socket_audio_frame_parse(const uint8_t *p, uint8_t *type, uint8_t *flags, uint32_t *len, uint32_t *seq)
+{
+    *type = p[0];
+    *flags = p[1];
+    *len = ((uint32_t)p[2] << 8) | p[3];
+    *seq = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+}
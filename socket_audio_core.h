@@ -0,0 +1,224 @@
+/*
+ * socket_audio_core.h -- Media-path kernels of mod_socket_audio
+ *
+ * Everything here is plain C with no FreeSWITCH dependency, so the per-frame
+ * work (playback queue, recording tap, polyphase resampling, G.711, VAD
+ * measurement, peak scans, echo cancellation, framed protocol headers) can be
+ * built and benchmarked on its own
+ * (bench/socket_audio_kernels.c, make bench-kernels).
+ *
+ * Threading rules are the callers': see each function.
+ */
+
+#ifndef SOCKET_AUDIO_CORE_H
+#define SOCKET_AUDIO_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOCKET_AUDIO_CACHE_LINE      64
+
+/* Framed protocol: 8-byte header (type, flags, length, seq; network order) + payload */
+#define SOCKET_AUDIO_FRAME_HEADER_LEN     8
+#define SOCKET_AUDIO_MSG_AUDIO            0x01
+#define SOCKET_AUDIO_MSG_FLUSH            0x02
+#define SOCKET_AUDIO_MSG_MARK             0x03
+#define SOCKET_AUDIO_MSG_CLEAR            0x04
+#define SOCKET_AUDIO_MSG_HELLO            0x05   /* Module → sidecar: call UUID, first on the connection */
+#define SOCKET_AUDIO_MSG_SHM              0x06   /* Module → sidecar: shared-memory rings, fds attached */
+#define SOCKET_AUDIO_MSG_SILENCE          0x07   /* Module → sidecar: a mic frame the VAD suppressed */
+#define SOCKET_AUDIO_MSG_CACHE_PUT        0x08   /* Sidecar → module: store a clip (ID length, ID, audio) */
+#define SOCKET_AUDIO_MSG_PLAY             0x09   /* Sidecar → module: play a cached clip by ID */
+#define SOCKET_AUDIO_MSG_TURN             0x80   /* Internal only: first audio of a turn */
+#define SOCKET_AUDIO_FLAG_TURN            0x01   /* seq carries a turn ID */
+#define SOCKET_AUDIO_FLAG_MORE            0x02   /* CACHE_PUT: the clip continues in the next one */
+
+/* Polyphase resampler (ratios with L, M <= MAX_RATIO after reduction) */
+#define SOCKET_AUDIO_RESAMPLE_ZERO_CROSSINGS  16    /* Sinc zero crossings each side of the filter center */
+#define SOCKET_AUDIO_RESAMPLE_LITE_CROSSINGS  4     /* The same for the cheaper filter used under load */
+#define SOCKET_AUDIO_RESAMPLE_CUTOFF      0.90   /* Fraction of the lower Nyquist rate */
+#define SOCKET_AUDIO_RESAMPLE_TAP_ALIGN   16     /* Taps per phase are padded to the widest kernel */
+#define SOCKET_AUDIO_RESAMPLE_MAX_RATIO   8
+#define SOCKET_AUDIO_RESAMPLE_MAX_TAPS    256
+
+/* Echo canceller */
+#define SOCKET_AUDIO_AEC_TAP_ALIGN        16     /* Filter length is padded to the widest kernel */
+#define SOCKET_AUDIO_AEC_TAIL_MAX_MS      512
+#define SOCKET_AUDIO_AEC_STEP             0.5f   /* NLMS step size */
+#define SOCKET_AUDIO_AEC_GEIGEL           0.5f   /* Double talk: mic peak above this fraction of the reference peak */
+#define SOCKET_AUDIO_AEC_HANGOVER         4      /* Blocks double talk is held after it was last detected */
+#define SOCKET_AUDIO_AEC_FAR_FLOOR        100.0f /* Reference peak (about -50 dBFS) below which the far end is silent */
+
+/*
+ * Playback queue: single-producer/single-consumer segmented byte queue.
+ *
+ * The reactor thread is the only producer, the clock thread the only consumer,
+ * so the hot path takes no locks. Audio lives in a chain of fixed-size
+ * segments allocated as audio arrives; the consumer frees segments as it
+ * drains them (keeping one spare for reuse), so memory follows the audio
+ * actually queued instead of the worst-case limit.
+ *
+ * Byte counters are free-running, each written by one side only and kept on
+ * its own cache line. Overflow keeps the switch_buffer_toss semantics (oldest
+ * audio is dropped): the producer publishes a toss request and the consumer
+ * applies it before its next inuse/read/zero.
+ */
+typedef struct socket_audio_segment_s {
+    struct socket_audio_segment_s *volatile next;  /* Published by the producer */
+    uint8_t data[];
+} socket_audio_segment_t;
+
+typedef struct {
+    uint8_t pad0[SOCKET_AUDIO_CACHE_LINE];
+
+    /* Producer side */
+    volatile uint64_t head;           /* Total bytes written */
+    volatile uint64_t toss_req;       /* Total bytes the producer asked to drop */
+    socket_audio_segment_t *write_seg;
+    size_t write_off;
+    uint8_t pad1[SOCKET_AUDIO_CACHE_LINE - 2 * sizeof(uint64_t) - sizeof(void *) - sizeof(size_t)];
+
+    /* Consumer side */
+    volatile uint64_t tail;           /* Total bytes consumed or dropped */
+    volatile uint64_t toss_done;      /* Total toss requests applied */
+    socket_audio_segment_t *read_seg;
+    size_t read_off;
+    uint8_t pad2[SOCKET_AUDIO_CACHE_LINE - 2 * sizeof(uint64_t) - sizeof(void *) - sizeof(size_t)];
+
+    /* Shared */
+    socket_audio_segment_t *volatile first;  /* First segment, published once by the producer */
+    socket_audio_segment_t *volatile spare;  /* Drained segment kept for reuse */
+
+    /* Immutable after init */
+    size_t seg_size;           /* Payload bytes per segment */
+    size_t limit;              /* Overflow threshold */
+    size_t slack;              /* Extra room while a toss is pending */
+} socket_audio_queue_t;
+
+/*
+ * Recording tap: single-producer/single-consumer byte ring of fixed size.
+ *
+ * The media thread writes each frame as interleaved stereo L16, whole or not
+ * at all, so a slow disk costs recorded frames rather than media time. The
+ * writer thread drains it in contiguous spans written straight to the file.
+ * The size is a power of two and the counters are free-running, each written
+ * by one side only.
+ */
+typedef struct {
+    uint8_t pad0[SOCKET_AUDIO_CACHE_LINE];
+    volatile uint64_t head;           /* Producer: total bytes written */
+    uint8_t pad1[SOCKET_AUDIO_CACHE_LINE - sizeof(uint64_t)];
+    volatile uint64_t tail;           /* Consumer: total bytes drained */
+    uint8_t pad2[SOCKET_AUDIO_CACHE_LINE - sizeof(uint64_t)];
+    uint8_t *data;
+    size_t size;
+} socket_audio_tap_t;
+
+typedef int32_t (*socket_audio_dot_func_t)(const int16_t *x, const int16_t *h, uint32_t n);
+
+typedef struct {
+    void *fallback;                   /* Module's generic switch_resample path, NULL when polyphase */
+    uint32_t up;                      /* Interpolation factor L */
+    uint32_t down;                    /* Decimation factor M */
+    uint32_t taps;                    /* Taps per phase, multiple of SOCKET_AUDIO_RESAMPLE_TAP_ALIGN */
+    uint32_t pos;                     /* Next output position, in input samples × L past the block start */
+    uint32_t block;                   /* Input samples of the block being emitted */
+    uint32_t max_in;
+    uint32_t taps_lite;               /* Taps per phase of the cheaper filter, 0 if it saves nothing */
+    uint8_t lite;                     /* Emit with the cheaper filter (set by the owning thread) */
+    int16_t *coefs;                   /* up × taps, Q15, reversed per phase; may be shared */
+    int16_t *coefs_lite;              /* up × taps_lite, same layout */
+    int16_t *buf;                     /* taps - 1 history samples + current block */
+    int16_t *out;
+    uint32_t out_cap;
+    uint32_t out_len;
+} socket_audio_resampler_t;
+
+typedef float (*socket_audio_aec_step_func_t)(float *w, const float *x, float g, uint32_t n);
+
+/*
+ * Echo canceller: NLMS adaptive filter plus a residual echo suppressor.
+ *
+ * The filter models the echo path from the reference (what was played) to the
+ * mic over taps samples of tail and subtracts its estimate. Each sample runs
+ * one fused kernel pass: the coefficient update for the previous sample
+ * (delayed-update NLMS) and the filter output for this one, so the filter is
+ * read and written once per sample. Adaptation stops during double talk
+ * (Geigel detector with hangover), which keeps the caller's speech from
+ * training the filter away. While only the far end talks, the residual is
+ * attenuated by the suppression gain, ramped per block. With lite set the
+ * filter is skipped and frozen, leaving the suppressor alone.
+ */
+typedef struct {
+    uint32_t taps;                    /* Multiple of SOCKET_AUDIO_AEC_TAP_ALIGN */
+    uint32_t max_in;
+    float suppress;                   /* Residual gain while only the far end talks */
+    float gain;                       /* Residual gain at the end of the last block */
+    float pending;                    /* Normalized update of the last sample, applied with the next */
+    uint32_t hangover;                /* Blocks of double talk still held */
+    float *w;                         /* taps, reversed: w[taps - 1] weighs the newest reference sample */
+    float *buf;                       /* taps history samples + current block of reference */
+    int16_t *out;                     /* max_in */
+    uint8_t lite;                     /* Suppression only, under load (set by the owning thread) */
+    uint8_t doubletalk;               /* Last block: adaptation held for near-end speech */
+    uint8_t suppressed;               /* Last block: residual attenuated */
+    uint8_t reset;                    /* Last block: filter diverged and was cleared */
+} socket_audio_aec_t;
+
+/* Socket audio encodings */
+typedef enum {
+    SOCKET_AUDIO_ENC_L16,             /* 16-bit signed little-endian PCM */
+    SOCKET_AUDIO_ENC_PCMU,            /* G.711 mu-law, 8kHz */
+    SOCKET_AUDIO_ENC_PCMA             /* G.711 A-law, 8kHz */
+} socket_audio_encoding_t;
+
+/* Playback queue */
+void socket_audio_queue_init(socket_audio_queue_t *queue, size_t seg_size, size_t limit, size_t slack);
+void socket_audio_queue_destroy(socket_audio_queue_t *queue);
+size_t socket_audio_queue_reserve(socket_audio_queue_t *queue, uint8_t **ptr);
+size_t socket_audio_queue_commit(socket_audio_queue_t *queue, size_t len);
+size_t socket_audio_queue_write(socket_audio_queue_t *queue, const void *data, size_t len, size_t *tossed);
+size_t socket_audio_queue_inuse(socket_audio_queue_t *queue);
+size_t socket_audio_queue_read(socket_audio_queue_t *queue, void *out, size_t len);
+uint8_t *socket_audio_queue_peek(socket_audio_queue_t *queue, size_t len);
+void socket_audio_queue_consume(socket_audio_queue_t *queue, size_t len);
+size_t socket_audio_queue_zero(socket_audio_queue_t *queue);
+size_t socket_audio_queue_skip(socket_audio_queue_t *queue, uint64_t pos);
+socket_audio_segment_t *socket_audio_queue_retire(socket_audio_queue_t *queue);
+void socket_audio_queue_adopt(socket_audio_queue_t *queue, socket_audio_segment_t *seg);
+
+/* Recording tap */
+int socket_audio_tap_init(socket_audio_tap_t *tap, size_t min_size);
+void socket_audio_tap_destroy(socket_audio_tap_t *tap);
+size_t socket_audio_tap_write_stereo(socket_audio_tap_t *tap, const int16_t *left, const int16_t *right, uint32_t n);
+size_t socket_audio_tap_peek(socket_audio_tap_t *tap, const uint8_t **ptr);
+void socket_audio_tap_consume(socket_audio_tap_t *tap, size_t len);
+
+/* Resampler (polyphase path; the caller owns the memory and the fallback) */
+const char *socket_audio_resample_init(void);
+int socket_audio_resampler_plan(socket_audio_resampler_t *r, uint32_t from, uint32_t to, uint32_t max_in);
+void socket_audio_resampler_design(socket_audio_resampler_t *r);
+void socket_audio_resampler_reset(socket_audio_resampler_t *r);
+void socket_audio_resample_begin(socket_audio_resampler_t *r, const int16_t *in, uint32_t n);
+uint32_t socket_audio_resample_emit(socket_audio_resampler_t *r, int16_t *out, uint32_t cap);
+
+/* Echo canceller (the caller owns the memory: w taps, buf taps + max_in, out max_in) */
+const char *socket_audio_aec_init(void);
+void socket_audio_aec_plan(socket_audio_aec_t *aec, uint32_t rate, uint32_t tail_ms, uint32_t max_in);
+void socket_audio_aec_reset(socket_audio_aec_t *aec, double suppress_db);
+const int16_t *socket_audio_aec_process(socket_audio_aec_t *aec, const int16_t *mic, const int16_t *ref, uint32_t n);
+
+/* G.711 */
+void socket_audio_g711_init(void);
+void socket_audio_g711_encode(socket_audio_encoding_t encoding, const int16_t *in, uint8_t *out, uint32_t n);
+void socket_audio_g711_decode(socket_audio_encoding_t encoding, const uint8_t *in, int16_t *out, uint32_t n);
+
+/* Level measurement */
+uint64_t socket_audio_vad_measure(const int16_t *x, uint32_t n, uint32_t *crossings);
+int socket_audio_peak(const int16_t *x, uint32_t n);
+
+/* Framed protocol */
+uint8_t *socket_audio_frame_header(uint8_t *p, uint8_t type, uint16_t len, uint32_t seq);
+void socket_audio_frame_parse(const uint8_t *p, uint8_t *type, uint8_t *flags, uint32_t *len, uint32_t *seq);
+
+#endif